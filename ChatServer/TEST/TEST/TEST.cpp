@@ -9,32 +9,7 @@
 #include <unistd.h>
 #include <algorithm>
 #include <mutex>
-
-struct MSG_header
-{
-    char sender_name[64];
-    int Type;
-    size_t length;
-};
-
-enum MSG_type
-{
-    REGISTER,
-    REGISTER_success,
-    REGISTER_failed,
-    LOGIN,
-    LOGIN_success,
-    LOGIN_failed,
-    INITIAL,
-    JOIN,
-    EXIT,
-    GROUP_MSG,
-    FILE_MSG,
-    FILE_DATA,
-    FILE_END,
-    TEST,
-    TEST_success
-};
+#include "../../protocol/MessageSchema.hpp"
 
 std::atomic<long long> total_sent(0);
 std::atomic<long long> send_failed(0);
@@ -94,19 +69,13 @@ void worker_thread(const char *ip, int port, int conn_per_thread, int duration_s
             std::string uname = "user_" + std::to_string(thread_idx) + "_" + std::to_string(i);
             std::string msg = "this is a test";
 
-            MSG_header header{};
-            strncpy(header.sender_name, uname.c_str(), sizeof(header.sender_name) - 1);
-            header.Type = TEST;
-            header.length = msg.size();
-
-            size_t total_size = sizeof(header) + msg.size();
-            std::vector<char> send_buf(total_size);
-            memcpy(send_buf.data(), &header, sizeof(header));
-            memcpy(send_buf.data() + sizeof(header), msg.data(), msg.size());
+            // 消息帧直接编码到栈上的缓冲区
+            char send_buf[sizeof(MSG_header) + 64];
+            size_t send_size = schema::encodeText(send_buf, TEST, uname.c_str(), msg.data(), msg.size());
 
             auto send_start = std::chrono::steady_clock::now();
-            ssize_t sent_bytes = send(sock, send_buf.data(), send_buf.size(), 0);
-            if (sent_bytes != (ssize_t)send_buf.size())
+            ssize_t sent_bytes = send(sock, send_buf, send_size, 0);
+            if (sent_bytes != (ssize_t)send_size)
             {
                 send_failed++;
                 continue;
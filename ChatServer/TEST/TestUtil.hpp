@@ -0,0 +1,66 @@
+#pragma once
+
+// 测试共用的最小断言工具:不依赖第三方测试框架,每个测试文件编译为一个可执行文件,由ctest运行
+// 用法:TEST_CASE(名称) { CHECK(条件); },文件末尾写TEST_MAIN()
+#include <cstdio>
+#include <vector>
+
+namespace test
+{
+    struct Case
+    {
+        const char *name;
+        void (*run)();
+    };
+
+    inline std::vector<Case> &cases()
+    {
+        static std::vector<Case> list;
+        return list;
+    }
+
+    inline int &failures()
+    {
+        static int count = 0;
+        return count;
+    }
+
+    struct Registrar
+    {
+        Registrar(const char *name, void (*run)()) { cases().push_back(Case{name, run}); }
+    };
+
+    // 依次运行所有用例,任一CHECK失败时返回非0
+    inline int runAll()
+    {
+        for (const Case &c : cases())
+        {
+            int before = failures();
+            c.run();
+            std::printf("[%s] %s\n", failures() == before ? "PASS" : "FAIL", c.name);
+        }
+        return failures() == 0 ? 0 : 1;
+    }
+}
+
+#define TEST_CASE(name)                                        \
+    static void name();                                        \
+    static const test::Registrar name##_registrar(#name, name); \
+    static void name()
+
+// 失败时记录并继续,同一用例中的其余检查照常执行
+#define CHECK(cond)                                                                 \
+    do                                                                              \
+    {                                                                               \
+        if (!(cond))                                                                \
+        {                                                                           \
+            ++test::failures();                                                     \
+            std::fprintf(stderr, "%s:%d: 检查失败: %s\n", __FILE__, __LINE__, #cond); \
+        }                                                                           \
+    } while (0)
+
+#define TEST_MAIN()             \
+    int main()                  \
+    {                           \
+        return test::runAll();  \
+    }
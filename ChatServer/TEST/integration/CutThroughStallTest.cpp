@@ -0,0 +1,77 @@
+// 集成测试:边收边转发(cut-through)的FILE_DATA只到达一部分后发送方停止发送,
+// 该帧不能一直挡住接收方写队列中其后的消息;服务器中止该文件流后聊天消息照常送达,
+// 发送方迟到的剩余字节被丢弃,其后续消息仍能正确解析
+// 用法: CutThroughStallTest <chatserver可执行文件>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../TestUtil.hpp"
+#include "ServerProcess.hpp"
+
+using test::Client;
+
+TEST_CASE(stalled_cut_through_does_not_block_chat)
+{
+    // 不持久化消息、不保存离线私聊
+    pid_t server = test::startServer({"2", "pool", "0", "0", "256", "off", "off"});
+    CHECK(server > 0);
+    if (server <= 0)
+        return;
+
+    Client alice, bob, carol;
+    bool connected = alice.connectToServer() && bob.connectToServer() && carol.connectToServer();
+    CHECK(connected);
+    if (connected)
+    {
+        alice.sendText(JOIN, "alice", "");
+        bob.sendText(JOIN, "bob", "");
+        carol.sendText(JOIN, "carol", "");
+        CHECK(bob.waitFor(INITIAL, std::chrono::seconds(2)));
+
+        // 带内容哈希的文件流才会边收边转发,服务器回复FILE_ACCEPT后开始发送数据
+        constexpr uint32_t stream_id = 7;
+        constexpr size_t chunk_size = 1024 * 1024;
+        FileInfo info{};
+        strncpy(info.filename, "stall.bin", MAX_FILENAME - 1);
+        info.file_size = chunk_size;
+        info.content_hash = 0x1234;
+        info.stream_id = stream_id;
+        std::vector<char> start(schema::frameSize<FILE_MSG>());
+        schema::encode<FILE_MSG>(start.data(), "alice", info);
+        alice.sendRaw(start.data(), start.size());
+        CHECK(alice.waitFor(FILE_ACCEPT, std::chrono::seconds(2)));
+        CHECK(bob.waitFor(FILE_MSG, std::chrono::seconds(2)));
+
+        // 声明1MB的数据块,只发送超过边收边转发阈值的一部分,然后停止
+        std::vector<char> data(sizeof(MSG_header) + sizeof(FileStreamHeader) + chunk_size, 'x');
+        schema::encodeHeader(data.data(), FILE_DATA, "alice", sizeof(FileStreamHeader) + chunk_size);
+        FileStreamHeader stream_header{stream_id};
+        memcpy(data.data() + sizeof(MSG_header), &stream_header, sizeof(stream_header));
+        size_t partial = sizeof(MSG_header) + sizeof(FileStreamHeader) + 300 * 1024;
+        alice.sendRaw(data.data(), partial);
+        std::this_thread::sleep_for(std::chrono::milliseconds(300));
+
+        // 停滞的数据块之后排队的聊天消息在中止后送达(心跳周期加停滞超时之内)
+        carol.sendText(GROUP_MSG, "carol", "still alive");
+        std::string text;
+        CHECK(bob.waitFor(GROUP_MSG, std::chrono::seconds(25), &text));
+        CHECK(text == "still alive");
+
+        // 发送方补发的剩余字节被丢弃,之后的消息仍按帧边界解析
+        alice.sendRaw(data.data() + partial, data.size() - partial);
+        alice.sendText(GROUP_MSG, "alice", "after stall");
+        CHECK(bob.waitFor(GROUP_MSG, std::chrono::seconds(5), &text));
+        CHECK(text == "after stall");
+    }
+
+    test::stopServer(server);
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test::parseServerArgs(argc, argv))
+        return 1;
+    return test::runAll();
+}
@@ -0,0 +1,166 @@
+// 集成测试:ring扇出模式下的投递顺序
+// 进入/退出通知与聊天消息同样经过广播环,接收方看到的顺序与发送方的发送顺序一致;
+// 文件帧不经过广播环,可能先于更早发出的聊天消息到达,但文件流内部和聊天消息内部各自保持顺序
+// 用法: RingOrderingTest <chatserver可执行文件>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../TestUtil.hpp"
+#include "ServerProcess.hpp"
+
+using test::Client;
+
+namespace
+{
+    constexpr int BURST = 300;
+
+    // 收集timeout内的消息,直到收到stop_type类型的消息(含)
+    std::vector<std::pair<MSG_type, std::string>> collectUntil(Client &client, MSG_type stop_type,
+                                                               std::chrono::milliseconds timeout)
+    {
+        std::vector<std::pair<MSG_type, std::string>> messages;
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+        MSG_header header;
+        std::string body;
+        while (client.receive(header, body, std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                deadline - std::chrono::steady_clock::now())))
+        {
+            messages.emplace_back(header.Type, body);
+            if (header.Type == stop_type)
+                break;
+        }
+        return messages;
+    }
+
+    std::vector<char> fileStreamFrame(MSG_type type, uint32_t stream_id, const std::string &data)
+    {
+        std::vector<char> frame(sizeof(MSG_header) + sizeof(FileStreamHeader) + data.size());
+        schema::encodeHeader(frame.data(), type, "alice", sizeof(FileStreamHeader) + data.size());
+        FileStreamHeader stream_header{stream_id};
+        memcpy(frame.data() + sizeof(MSG_header), &stream_header, sizeof(stream_header));
+        memcpy(frame.data() + sizeof(MSG_header) + sizeof(FileStreamHeader), data.data(), data.size());
+        return frame;
+    }
+}
+
+TEST_CASE(presence_follows_chat_order)
+{
+    pid_t server = test::startServer({"4", "ring", "0", "0", "256", "off", "off"});
+    CHECK(server > 0);
+    if (server <= 0)
+        return;
+
+    Client bob, carol;
+    bool connected = bob.connectToServer() && carol.connectToServer();
+    CHECK(connected);
+    if (connected)
+    {
+        bob.sendText(JOIN, "bob", "");
+        CHECK(bob.waitFor(INITIAL, std::chrono::seconds(2)));
+
+        // 进入后立即发言:接收方先看到JOIN
+        carol.sendText(JOIN, "carol", "");
+        for (int i = 0; i < BURST; ++i)
+        {
+            carol.sendText(GROUP_MSG, "carol", "m" + std::to_string(i));
+        }
+        // 连续发言后立即退出:EXIT排在全部聊天消息之后
+        carol.sendText(EXIT, "carol", "");
+
+        auto messages = collectUntil(bob, EXIT, std::chrono::seconds(10));
+        std::vector<std::string> chat;
+        bool joined_first = false;
+        for (const auto &message : messages)
+        {
+            if (message.first == JOIN)
+                joined_first = chat.empty();
+            else if (message.first == GROUP_MSG)
+                chat.push_back(message.second);
+        }
+        CHECK(joined_first);
+        CHECK(!messages.empty() && messages.back().first == EXIT);
+        CHECK(chat.size() == static_cast<size_t>(BURST));
+        for (size_t i = 0; i < chat.size(); ++i)
+        {
+            CHECK(chat[i] == "m" + std::to_string(i));
+        }
+    }
+
+    test::stopServer(server);
+}
+
+TEST_CASE(file_frames_keep_stream_order)
+{
+    pid_t server = test::startServer({"4", "ring", "0", "0", "256", "off", "off"});
+    CHECK(server > 0);
+    if (server <= 0)
+        return;
+
+    Client alice, bob;
+    bool connected = alice.connectToServer() && bob.connectToServer();
+    CHECK(connected);
+    if (connected)
+    {
+        alice.sendText(JOIN, "alice", "");
+        bob.sendText(JOIN, "bob", "");
+        CHECK(bob.waitFor(INITIAL, std::chrono::seconds(2)));
+
+        for (int i = 0; i < BURST; ++i)
+        {
+            alice.sendText(GROUP_MSG, "alice", "m" + std::to_string(i));
+        }
+        // 不带内容哈希的文件流直接转发,不等待FILE_ACCEPT
+        constexpr uint32_t stream_id = 3;
+        FileInfo info{};
+        strncpy(info.filename, "order.bin", MAX_FILENAME - 1);
+        info.file_size = 3;
+        info.stream_id = stream_id;
+        std::vector<char> start(schema::frameSize<FILE_MSG>());
+        schema::encode<FILE_MSG>(start.data(), "alice", info);
+        alice.sendRaw(start.data(), start.size());
+        for (const char *part : {"a", "b", "c"})
+        {
+            std::vector<char> data = fileStreamFrame(FILE_DATA, stream_id, part);
+            alice.sendRaw(data.data(), data.size());
+        }
+        std::vector<char> end = fileStreamFrame(FILE_END, stream_id, "");
+        alice.sendRaw(end.data(), end.size());
+        alice.sendText(GROUP_MSG, "alice", "last");
+
+        // 文件帧与聊天消息之间的先后不作要求,各自内部按发送顺序
+        std::vector<std::string> chat;
+        std::string file;
+        MSG_header header;
+        std::string body;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+        while ((chat.size() <= static_cast<size_t>(BURST) || file.size() < 5) &&
+               bob.receive(header, body, std::chrono::duration_cast<std::chrono::milliseconds>(
+                                             deadline - std::chrono::steady_clock::now())))
+        {
+            if (header.Type == GROUP_MSG)
+                chat.push_back(body);
+            else if (header.Type == FILE_MSG)
+                file += 'S';
+            else if (header.Type == FILE_DATA)
+                file += body.substr(sizeof(FileStreamHeader));
+            else if (header.Type == FILE_END)
+                file += 'E';
+        }
+        CHECK(file == "SabcE");
+        CHECK(chat.size() == static_cast<size_t>(BURST) + 1);
+        for (size_t i = 0; i < chat.size(); ++i)
+        {
+            CHECK(chat[i] == (i < static_cast<size_t>(BURST) ? "m" + std::to_string(i) : std::string("last")));
+        }
+    }
+
+    test::stopServer(server);
+}
+
+int main(int argc, char *argv[])
+{
+    if (!test::parseServerArgs(argc, argv))
+        return 1;
+    return test::runAll();
+}
@@ -0,0 +1,182 @@
+#pragma once
+
+// 集成测试共用:在临时目录中启动chatserver子进程,以及使用旧版80字节帧头的最小客户端
+#include <arpa/inet.h>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "../../protocol/MessageSchema.hpp"
+
+namespace test
+{
+    inline const char *&serverPath()
+    {
+        static const char *path = nullptr;
+        return path;
+    }
+
+    inline int &serverPort()
+    {
+        static int port = 0;
+        return port;
+    }
+
+    // 端口之后的启动参数,如{"2", "pool", "0", "0", "256", "off", "off"}
+    inline pid_t startServer(std::initializer_list<const char *> args)
+    {
+        char dir[] = "/tmp/chatserver_test_XXXXXX";
+        if (!mkdtemp(dir))
+            return -1;
+        std::string port = std::to_string(serverPort());
+        std::vector<char *> argv;
+        argv.push_back(const_cast<char *>(serverPath()));
+        argv.push_back(const_cast<char *>(port.c_str()));
+        for (const char *arg : args)
+            argv.push_back(const_cast<char *>(arg));
+        argv.push_back(nullptr);
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            if (chdir(dir) != 0)
+                _exit(127);
+            execv(serverPath(), argv.data());
+            _exit(127);
+        }
+        return pid;
+    }
+
+    inline void stopServer(pid_t pid)
+    {
+        kill(pid, SIGTERM);
+        for (int i = 0; i < 50; ++i)
+        {
+            if (waitpid(pid, nullptr, WNOHANG) == pid)
+                return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+    }
+
+    // 命令行参数:<chatserver可执行文件> [端口],未指定端口时按进程号选取
+    inline bool parseServerArgs(int argc, char *argv[])
+    {
+        if (argc < 2)
+        {
+            std::fprintf(stderr, "用法: %s <chatserver可执行文件> [端口]\n", argv[0]);
+            return false;
+        }
+        serverPath() = argv[1];
+        serverPort() = argc > 2 ? std::atoi(argv[2]) : 20000 + getpid() % 20000;
+        return true;
+    }
+
+    // 旧版80字节帧头的最小客户端
+    class Client
+    {
+    public:
+        bool connectToServer()
+        {
+            // 服务器启动需要一点时间,重试连接
+            for (int i = 0; i < 50; ++i)
+            {
+                fd_ = socket(AF_INET, SOCK_STREAM, 0);
+                sockaddr_in addr{};
+                addr.sin_family = AF_INET;
+                addr.sin_port = htons(static_cast<uint16_t>(serverPort()));
+                inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+                if (connect(fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0)
+                    return true;
+                close(fd_);
+                fd_ = -1;
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            return false;
+        }
+
+        ~Client()
+        {
+            disconnect();
+        }
+
+        void disconnect()
+        {
+            if (fd_ >= 0)
+                close(fd_);
+            fd_ = -1;
+        }
+
+        bool sendRaw(const void *data, size_t size)
+        {
+            return send(fd_, data, size, MSG_NOSIGNAL) == static_cast<ssize_t>(size);
+        }
+
+        bool sendText(MSG_type type, const std::string &sender, const std::string &text)
+        {
+            std::vector<char> frame(sizeof(MSG_header) + text.size());
+            schema::encodeText(frame.data(), type, sender.c_str(), text.data(), text.size());
+            return sendRaw(frame.data(), frame.size());
+        }
+
+        // 在timeout内接收下一条消息;超时或连接关闭时返回false
+        bool receive(MSG_header &header, std::string &body, std::chrono::milliseconds timeout)
+        {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            while (true)
+            {
+                if (buffer_.size() >= sizeof(MSG_header))
+                {
+                    schema::decodeHeader(buffer_.data(), header);
+                    if (buffer_.size() >= sizeof(MSG_header) + header.length)
+                    {
+                        body.assign(buffer_.data() + sizeof(MSG_header), header.length);
+                        buffer_.erase(0, sizeof(MSG_header) + header.length);
+                        return true;
+                    }
+                }
+                if (std::chrono::steady_clock::now() >= deadline)
+                    return false;
+                timeval tv{0, 100 * 1000};
+                setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                char chunk[64 * 1024];
+                ssize_t n = recv(fd_, chunk, sizeof(chunk), 0);
+                if (n == 0)
+                    return false;
+                if (n > 0)
+                    buffer_.append(chunk, static_cast<size_t>(n));
+            }
+        }
+
+        // 在timeout内等待一条type类型的消息,其余消息丢弃
+        bool waitFor(MSG_type type, std::chrono::milliseconds timeout, std::string *body = nullptr)
+        {
+            auto deadline = std::chrono::steady_clock::now() + timeout;
+            MSG_header header;
+            std::string message;
+            while (receive(header, message, std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                deadline - std::chrono::steady_clock::now())))
+            {
+                if (header.Type == type)
+                {
+                    if (body)
+                        *body = std::move(message);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        int fd_ = -1;
+        std::string buffer_;
+    };
+}
@@ -0,0 +1,139 @@
+// 单元测试:KeywordFilter的词表解析、多词匹配、动作优先级和热加载
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <unistd.h>
+#include "../TestUtil.hpp"
+#include "filter/KeywordFilter.hpp"
+
+namespace
+{
+    using Action = KeywordFilter::Action;
+
+    // 临时目录中的词表文件
+    class WordList
+    {
+    public:
+        WordList()
+        {
+            char dir[] = "/tmp/keyword_filter_test_XXXXXX";
+            if (mkdtemp(dir))
+                dir_ = dir;
+            path_ = dir_ + "/banned_words.txt";
+        }
+
+        ~WordList()
+        {
+            std::remove(path_.c_str());
+            rmdir(dir_.c_str());
+        }
+
+        void write(const std::string &content) const
+        {
+            std::ofstream(path_, std::ios::trunc) << content;
+        }
+
+        const std::string &path() const { return path_; }
+
+    private:
+        std::string dir_;
+        std::string path_;
+    };
+
+    Action check(const KeywordFilter &filter, const std::string &text, std::string *masked = nullptr,
+                 std::string *term = nullptr)
+    {
+        std::string masked_text, hit;
+        Action action = filter.check(text.data(), text.size(), masked_text, hit);
+        if (masked)
+            *masked = masked_text;
+        if (term)
+            *term = hit;
+        return action;
+    }
+}
+
+TEST_CASE(parses_actions_and_comments)
+{
+    WordList words;
+    words.write("# 注释\n\nreject spam\nmask  darn\nflag   maybe\nheck\n");
+    KeywordFilter filter(words.path());
+    CHECK(filter.reloadIfChanged());
+    CHECK(filter.termCount() == 4);
+
+    std::string masked, term;
+    CHECK(check(filter, "buy spam now", nullptr, &term) == Action::REJECT);
+    CHECK(term == "spam");
+    CHECK(check(filter, "oh darn it", &masked) == Action::MASK);
+    CHECK(masked == "oh **** it");
+    // 不写动作时默认为mask
+    CHECK(check(filter, "heck", &masked) == Action::MASK);
+    CHECK(masked == "****");
+    CHECK(check(filter, "maybe later") == Action::FLAG);
+    CHECK(check(filter, "nothing here") == Action::NONE);
+}
+
+TEST_CASE(matches_overlapping_terms)
+{
+    WordList words;
+    words.write("he\nshe\nhers\n");
+    KeywordFilter filter(words.path());
+    filter.reloadIfChanged();
+
+    // 一次扫描命中所有重叠的词,被任一词覆盖的字节都打码
+    std::string masked;
+    CHECK(check(filter, "ushers", &masked) == Action::MASK);
+    CHECK(masked == "u*****");
+}
+
+TEST_CASE(ascii_case_insensitive_and_utf8_masked_per_character)
+{
+    WordList words;
+    words.write("mask BadWord\nmask \xE5\x9D\x8F\xE8\xAF\x9D\n"); // 坏话
+    KeywordFilter filter(words.path());
+    filter.reloadIfChanged();
+
+    std::string masked;
+    CHECK(check(filter, "a BADword b", &masked) == Action::MASK);
+    CHECK(masked == "a ******* b");
+    // 每个UTF-8字符替换为一个*
+    CHECK(check(filter, "\xE8\xAF\xB4\xE5\x9D\x8F\xE8\xAF\x9D", &masked) == Action::MASK);
+    CHECK(masked == "\xE8\xAF\xB4**");
+}
+
+TEST_CASE(most_severe_action_wins)
+{
+    WordList words;
+    words.write("flag alpha\nmask beta\nreject gamma\n");
+    KeywordFilter filter(words.path());
+    filter.reloadIfChanged();
+
+    std::string term;
+    CHECK(check(filter, "alpha beta") == Action::MASK);
+    CHECK(check(filter, "alpha beta gamma", nullptr, &term) == Action::REJECT);
+    CHECK(term == "gamma");
+}
+
+TEST_CASE(reloads_when_file_changes)
+{
+    WordList words;
+    words.write("reject one\n");
+    KeywordFilter filter(words.path());
+    CHECK(filter.reloadIfChanged());
+    CHECK(!filter.reloadIfChanged());
+    CHECK(check(filter, "one") == Action::REJECT);
+
+    words.write("reject two\nreject three\n");
+    CHECK(filter.reloadIfChanged());
+    CHECK(check(filter, "one") == Action::NONE);
+    CHECK(check(filter, "two") == Action::REJECT);
+
+    // 词表文件被删除后不再过滤
+    std::remove(words.path().c_str());
+    CHECK(filter.reloadIfChanged());
+    CHECK(filter.termCount() == 0);
+    CHECK(check(filter, "two") == Action::NONE);
+}
+
+TEST_MAIN()
@@ -0,0 +1,178 @@
+// 单元测试:MessageLog的写入、重启恢复、分段读取和保留策略
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../TestUtil.hpp"
+#include "storage/MessageLog.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // 每个用例使用独立的临时目录
+    class TempDir
+    {
+    public:
+        TempDir()
+        {
+            char dir[] = "/tmp/message_log_test_XXXXXX";
+            if (mkdtemp(dir))
+                path_ = dir;
+        }
+
+        ~TempDir()
+        {
+            std::error_code ec;
+            fs::remove_all(path_, ec);
+        }
+
+        const std::string &path() const { return path_; }
+
+        size_t count(const std::string &extension) const
+        {
+            size_t n = 0;
+            for (const auto &item : fs::directory_iterator(path_))
+                n += item.path().extension() == extension;
+            return n;
+        }
+
+    private:
+        std::string path_;
+    };
+
+    MessageLog::Options optionsFor(const TempDir &dir, size_t segment_bytes = MessageLog::SEGMENT_BYTES)
+    {
+        MessageLog::Options options;
+        options.dir = dir.path();
+        options.sync_interval = std::chrono::milliseconds(0);
+        options.segment_bytes = segment_bytes;
+        return options;
+    }
+
+    SharedFrame frameOf(const std::string &text)
+    {
+        return std::make_shared<const std::vector<char>>(text.begin(), text.end());
+    }
+
+    // 写入count条消息,内容为"m<序号>"加填充;stop()写完队列后返回
+    void fill(const MessageLog::Options &options, size_t count, size_t padding = 0)
+    {
+        MessageLog log(options);
+        for (size_t i = 0; i < count; ++i)
+        {
+            CHECK(log.append("lobby", frameOf("m" + std::to_string(i) + std::string(padding, '.'))));
+        }
+        log.stop();
+    }
+
+    std::vector<MessageLog::Record> readAll(const MessageLog &log)
+    {
+        std::vector<MessageLog::Record> records;
+        log.read(log.firstOffset(), SIZE_MAX, [&](const MessageLog::Record &record)
+                 { records.push_back(record); });
+        return records;
+    }
+}
+
+TEST_CASE(records_survive_restart)
+{
+    TempDir dir;
+    {
+        MessageLog log(optionsFor(dir));
+        CHECK(log.isEnabled());
+        log.append("lobby", frameOf("hello"));
+        log.append("team", frameOf("world"));
+        log.stop();
+        CHECK(log.nextOffset() == 2);
+    }
+
+    MessageLog log(optionsFor(dir));
+    CHECK(log.nextOffset() == 2);
+    auto records = readAll(log);
+    CHECK(records.size() == 2);
+    if (records.size() == 2)
+    {
+        CHECK(records[0].offset == 0 && records[0].room == "lobby");
+        CHECK(std::string(records[0].frame.begin(), records[0].frame.end()) == "hello");
+        CHECK(records[1].offset == 1 && records[1].room == "team");
+    }
+}
+
+TEST_CASE(reads_across_segments)
+{
+    TempDir dir;
+    fill(optionsFor(dir, 4096), 200, 100);
+    CHECK(dir.count(".log") > 1);
+
+    MessageLog log(optionsFor(dir, 4096));
+    auto records = readAll(log);
+    CHECK(records.size() == 200);
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        CHECK(records[i].offset == i);
+    }
+    // 从中间的偏移开始读取,经索引定位到所在的段
+    std::vector<uint64_t> offsets;
+    log.read(150, 10, [&](const MessageLog::Record &record)
+             { offsets.push_back(record.offset); });
+    CHECK(offsets.size() == 10 && offsets.front() == 150 && offsets.back() == 159);
+}
+
+TEST_CASE(truncated_tail_recovered)
+{
+    TempDir dir;
+    fill(optionsFor(dir), 3);
+    // 模拟崩溃时写了一半的记录
+    for (const auto &item : fs::directory_iterator(dir.path()))
+    {
+        if (item.path().extension() == ".log")
+            std::ofstream(item.path(), std::ios::app) << "garbage";
+    }
+
+    MessageLog log(optionsFor(dir));
+    CHECK(log.nextOffset() == 3);
+    log.append("lobby", frameOf("after"));
+    log.stop();
+    auto records = readAll(log);
+    CHECK(records.size() == 4);
+    CHECK(!records.empty() && std::string(records.back().frame.begin(), records.back().frame.end()) == "after");
+}
+
+TEST_CASE(retention_by_total_size)
+{
+    TempDir dir;
+    fill(optionsFor(dir, 4096), 200, 100);
+    size_t segments = dir.count(".log");
+
+    // 启动时按总大小删除最早的段,剩余记录仍连续可读,活动段始终保留
+    MessageLog::Options options = optionsFor(dir, 4096);
+    options.retention_bytes = 3 * 4096;
+    MessageLog log(options);
+    CHECK(dir.count(".log") < segments);
+    CHECK(dir.count(".log") >= 1);
+    CHECK(log.firstOffset() > 0);
+    CHECK(log.nextOffset() == 200);
+    auto records = readAll(log);
+    CHECK(!records.empty() && records.front().offset == log.firstOffset() && records.back().offset == 199);
+    CHECK(records.size() == 200 - log.firstOffset());
+}
+
+TEST_CASE(retention_by_age)
+{
+    TempDir dir;
+    fill(optionsFor(dir, 4096), 100, 100);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    // 保留时间为0:除活动段外全部过期
+    MessageLog::Options options = optionsFor(dir, 4096);
+    options.retention_age = std::chrono::hours(0);
+    MessageLog log(options);
+    CHECK(dir.count(".log") == 1);
+    CHECK(log.nextOffset() == 100);
+}
+
+TEST_MAIN()
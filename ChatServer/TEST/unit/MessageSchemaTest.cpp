@@ -0,0 +1,215 @@
+// 单元测试:MessageSchema中消息帧的编解码与长度检查
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../TestUtil.hpp"
+#include "protocol/MessageSchema.hpp"
+
+TEST_CASE(header_round_trip_truncates_sender)
+{
+    std::string sender(MAX_NAMEBUFFER + 10, 'a');
+    char out[sizeof(MSG_header)];
+    schema::encodeHeader(out, GROUP_MSG, sender.c_str(), 42);
+    MSG_header header;
+    schema::decodeHeader(out, header);
+    CHECK(header.Type == GROUP_MSG);
+    CHECK(header.length == 42);
+    // 超长的发送者名称截断后仍以0结尾
+    CHECK(strnlen(header.sender_name, MAX_NAMEBUFFER) == MAX_NAMEBUFFER - 1);
+}
+
+TEST_CASE(fixed_body_rejects_wrong_size)
+{
+    std::vector<char> frame(schema::frameSize<FILE_END>());
+    schema::encode<FILE_END>(frame.data(), "alice", FileStreamHeader{9});
+    const char *body = frame.data() + sizeof(MSG_header);
+    size_t size = frame.size() - sizeof(MSG_header);
+
+    FileStreamHeader decoded{};
+    CHECK(schema::decode<FILE_END>(body, size, decoded));
+    CHECK(decoded.stream_id == 9);
+    // 没有变长部分的消息:短于定长部分或多出字节都是格式错误
+    CHECK(!schema::decode<FILE_END>(body, size - 1, decoded));
+    std::vector<char> longer(body, body + size);
+    longer.push_back(0);
+    CHECK(!schema::decode<FILE_END>(longer.data(), longer.size(), decoded));
+}
+
+TEST_CASE(legacy_file_info_zero_fills_new_fields)
+{
+    FileInfo info{};
+    strncpy(info.filename, "a.txt", MAX_FILENAME - 1);
+    info.file_size = 123;
+    info.content_hash = 0xdeadbeef;
+    info.stream_id = 5;
+
+    // 旧版FileInfo只到file_size为止,缺少的字段补0
+    FileInfo decoded;
+    CHECK(schema::decode<FILE_MSG>(reinterpret_cast<const char *>(&info), LEGACY_FILEINFO_SIZE, decoded));
+    CHECK(std::string(decoded.filename) == "a.txt");
+    CHECK(decoded.file_size == 123);
+    CHECK(decoded.content_hash == 0);
+    CHECK(decoded.stream_id == 0);
+    CHECK(!schema::decode<FILE_MSG>(reinterpret_cast<const char *>(&info), LEGACY_FILEINFO_SIZE - 1, decoded));
+}
+
+TEST_CASE(payload_follows_fixed_body)
+{
+    DirectInfo info{};
+    info.target_id = 7;
+    strncpy(info.target_name, "bob", MAX_NAMEBUFFER - 1);
+    std::string text = "hello";
+    std::vector<char> frame(schema::frameSize<DIRECT_MSG>(text.size()));
+    CHECK(schema::encode<DIRECT_MSG>(frame.data(), "alice", info, text.data(), text.size()) == frame.size());
+
+    DirectInfo decoded;
+    const char *payload = nullptr;
+    size_t payload_size = 0;
+    CHECK(schema::decode<DIRECT_MSG>(frame.data() + sizeof(MSG_header), frame.size() - sizeof(MSG_header), decoded,
+                                     &payload, &payload_size));
+    CHECK(decoded.target_id == 7);
+    CHECK(std::string(payload, payload_size) == text);
+    // 定长部分不完整
+    CHECK(!schema::decode<DIRECT_MSG>(frame.data() + sizeof(MSG_header), sizeof(DirectInfo) - 1, decoded));
+}
+
+TEST_CASE(body_limits_by_type)
+{
+    size_t limit = 0;
+    CHECK(schema::maxBodySize(GROUP_MSG, limit) && limit == MAX_TEXT_BODY_SIZE);
+    CHECK(schema::maxBodySize(FILE_END, limit) && limit == sizeof(FileStreamHeader));
+    // 只由服务器发出的类型不接受客户端发来的消息体
+    CHECK(schema::maxBodySize(INITIAL, limit) && limit == 0);
+    CHECK(schema::maxBodySize(DIRECT_FAILED, limit) && limit == 0);
+    CHECK(!schema::maxBodySize(static_cast<MSG_type>(1000), limit));
+}
+
+namespace
+{
+    std::vector<char> batchOf(const std::vector<std::string> &texts)
+    {
+        std::vector<char> body;
+        for (const std::string &text : texts)
+        {
+            size_t offset = body.size();
+            body.resize(offset + schema::batchItemSize(text.size()));
+            schema::encodeBatchItem(body.data() + offset, GROUP_MSG, text.data(), text.size());
+        }
+        return body;
+    }
+}
+
+TEST_CASE(batch_items_visited_in_order)
+{
+    std::vector<char> body = batchOf({"one", "", "three"});
+    std::vector<std::string> seen;
+    bool ok = schema::forEachBatchItem(body.data(), body.size(), [&](MSG_type type, const char *data, size_t size)
+                                       {
+                                           CHECK(type == GROUP_MSG);
+                                           seen.emplace_back(data, size);
+                                           return true; });
+    CHECK(ok);
+    CHECK((seen == std::vector<std::string>{"one", "", "three"}));
+    CHECK(schema::forEachBatchItem(body.data(), 0, [](MSG_type, const char *, size_t)
+                                   { return true; }));
+}
+
+TEST_CASE(batch_rejects_truncated_items)
+{
+    std::vector<char> body = batchOf({"hello"});
+    auto accept = [](MSG_type, const char *, size_t)
+    { return true; };
+    // 子消息长度超出消息体,或剩余字节不足一个子消息头
+    CHECK(!schema::forEachBatchItem(body.data(), body.size() - 1, accept));
+    CHECK(!schema::forEachBatchItem(body.data(), sizeof(BatchItemHeader) - 1, accept));
+    std::vector<char> trailing = body;
+    trailing.push_back(0);
+    CHECK(!schema::forEachBatchItem(trailing.data(), trailing.size(), accept));
+}
+
+TEST_CASE(batch_item_count_limited)
+{
+    std::vector<char> body(schema::batchItemSize(0) * (MAX_BATCH_ITEMS + 1));
+    for (size_t i = 0; i <= MAX_BATCH_ITEMS; ++i)
+    {
+        schema::encodeBatchItem(body.data() + i * schema::batchItemSize(0), GROUP_MSG, nullptr, 0);
+    }
+    size_t visited = 0;
+    auto count = [&](MSG_type, const char *, size_t)
+    {
+        ++visited;
+        return true;
+    };
+    CHECK(schema::forEachBatchItem(body.data(), body.size() - schema::batchItemSize(0), count));
+    CHECK(visited == MAX_BATCH_ITEMS);
+    CHECK(!schema::forEachBatchItem(body.data(), body.size(), count));
+}
+
+TEST_CASE(batch_visitor_can_stop)
+{
+    std::vector<char> body = batchOf({"a", "b", "c"});
+    size_t visited = 0;
+    CHECK(!schema::forEachBatchItem(body.data(), body.size(), [&](MSG_type, const char *, size_t)
+                                    { return ++visited < 2; }));
+    CHECK(visited == 2);
+}
+
+namespace
+{
+    struct RosterEntry
+    {
+        uint32_t user_id;
+        uint8_t op;
+        std::string name;
+    };
+
+    std::vector<char> rosterOf(uint64_t epoch, const std::vector<RosterEntry> &entries)
+    {
+        std::vector<char> body(sizeof(RosterHeader));
+        RosterHeader header{epoch, ROSTER_FLAG_RESET, static_cast<uint32_t>(entries.size())};
+        memcpy(body.data(), &header, sizeof(header));
+        for (const RosterEntry &entry : entries)
+        {
+            size_t offset = body.size();
+            body.resize(offset + schema::rosterEntrySize(entry.name.size()));
+            schema::encodeRosterEntry(body.data() + offset, entry.user_id, entry.op, entry.name.data(),
+                                      entry.name.size());
+        }
+        return body;
+    }
+}
+
+TEST_CASE(roster_entries_round_trip)
+{
+    std::vector<char> body = rosterOf(77, {{1, ROSTER_OP_JOIN, "alice"}, {2, ROSTER_OP_LEAVE, ""}});
+    RosterHeader header{};
+    std::vector<std::string> seen;
+    CHECK(schema::forEachRosterEntry(body.data(), body.size(), header,
+                                     [&](uint32_t user_id, uint8_t op, const char *name, size_t length)
+                                     { seen.push_back(std::to_string(user_id) + ":" + std::to_string(op) + ":" +
+                                                      std::string(name, length)); }));
+    CHECK(header.epoch == 77);
+    CHECK(header.flags == ROSTER_FLAG_RESET);
+    CHECK((seen == std::vector<std::string>{"1:1:alice", "2:0:"}));
+}
+
+TEST_CASE(roster_rejects_count_mismatch)
+{
+    std::vector<char> body = rosterOf(1, {{1, ROSTER_OP_JOIN, "alice"}});
+    RosterHeader header{};
+    auto ignore = [](uint32_t, uint8_t, const char *, size_t) {};
+    // 消息头短于RosterHeader
+    CHECK(!schema::forEachRosterEntry(body.data(), sizeof(RosterHeader) - 1, header, ignore));
+    // 用户名越界
+    CHECK(!schema::forEachRosterEntry(body.data(), body.size() - 1, header, ignore));
+    // 条目数之后还有多余的字节
+    std::vector<char> trailing = body;
+    trailing.push_back(0);
+    CHECK(!schema::forEachRosterEntry(trailing.data(), trailing.size(), header, ignore));
+    // 声明的条目数多于实际条目
+    RosterHeader inflated{1, 0, 2};
+    memcpy(body.data(), &inflated, sizeof(inflated));
+    CHECK(!schema::forEachRosterEntry(body.data(), body.size(), header, ignore));
+}
+
+TEST_MAIN()
@@ -0,0 +1,179 @@
+// 单元测试:OfflineInbox的存取、用户登记、容量上限和过期清理
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <sys/time.h>
+#include <thread>
+#include <vector>
+#include "../TestUtil.hpp"
+#include "storage/OfflineInbox.hpp"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    class TempDir
+    {
+    public:
+        TempDir()
+        {
+            char dir[] = "/tmp/offline_inbox_test_XXXXXX";
+            if (mkdtemp(dir))
+                path_ = dir;
+        }
+
+        ~TempDir()
+        {
+            std::error_code ec;
+            fs::remove_all(path_, ec);
+        }
+
+        const std::string &path() const { return path_; }
+
+        size_t inboxCount() const
+        {
+            size_t n = 0;
+            for (const auto &item : fs::directory_iterator(path_))
+                n += item.path().extension() == ".inbox";
+            return n;
+        }
+
+    private:
+        std::string path_;
+    };
+
+    OfflineInbox::Options optionsFor(const TempDir &dir)
+    {
+        OfflineInbox::Options options;
+        options.dir = dir.path();
+        return options;
+    }
+
+    std::vector<char> frameOf(const std::string &text)
+    {
+        std::vector<char> frame(sizeof(MSG_header) + text.size());
+        schema::encodeText(frame.data(), DIRECT_MSG, "alice", text.data(), text.size());
+        return frame;
+    }
+
+    std::string textOf(const SharedFrame &frame)
+    {
+        return std::string(frame->begin() + sizeof(MSG_header), frame->end());
+    }
+}
+
+TEST_CASE(only_known_users_get_inboxes)
+{
+    TempDir dir;
+    {
+        OfflineInbox inbox(optionsFor(dir));
+        CHECK(inbox.isEnabled());
+        // 从未登录过的用户名不创建收件箱
+        CHECK(!inbox.store("ghost", frameOf("x")));
+        CHECK(dir.inboxCount() == 0);
+        inbox.addKnownUser("bob");
+        CHECK(inbox.store("bob", frameOf("hi")));
+    }
+    // 登记表重启后仍然有效
+    OfflineInbox inbox(optionsFor(dir));
+    CHECK(inbox.isKnownUser("bob"));
+    CHECK(!inbox.isKnownUser("ghost"));
+    CHECK(inbox.hasPending("bob"));
+}
+
+TEST_CASE(known_user_limit)
+{
+    TempDir dir;
+    OfflineInbox::Options options = optionsFor(dir);
+    options.max_known_users = 2;
+    OfflineInbox inbox(options);
+    inbox.addKnownUser("a");
+    inbox.addKnownUser("b");
+    inbox.addKnownUser("a");
+    inbox.addKnownUser("c");
+    CHECK(inbox.isKnownUser("a") && inbox.isKnownUser("b"));
+    CHECK(!inbox.isKnownUser("c"));
+}
+
+TEST_CASE(read_and_commit_in_order)
+{
+    TempDir dir;
+    OfflineInbox inbox(optionsFor(dir));
+    inbox.addKnownUser("bob");
+    for (int i = 0; i < 3; ++i)
+    {
+        CHECK(inbox.store("bob", frameOf("m" + std::to_string(i))));
+    }
+
+    OfflineInbox::Batch batch;
+    inbox.read("bob", 0, batch);
+    CHECK(batch.frames.size() == 3);
+    CHECK(!batch.frames.empty() && textOf(batch.frames.front()) == "m0" && textOf(batch.frames.back()) == "m2");
+    // 全部投递完后删除收件箱
+    CHECK(!inbox.commit("bob", batch.end_position));
+    CHECK(!inbox.hasPending("bob"));
+    CHECK(dir.inboxCount() == 0);
+}
+
+TEST_CASE(per_user_limit)
+{
+    TempDir dir;
+    OfflineInbox::Options options = optionsFor(dir);
+    options.max_user_bytes = 1024;
+    OfflineInbox inbox(options);
+    inbox.addKnownUser("bob");
+    size_t stored = 0;
+    while (stored < 100 && inbox.store("bob", frameOf(std::string(200, 'x'))))
+    {
+        ++stored;
+    }
+    CHECK(stored > 0 && stored < 100);
+}
+
+TEST_CASE(expired_messages_skipped)
+{
+    TempDir dir;
+    OfflineInbox::Options options = optionsFor(dir);
+    options.ttl = std::chrono::hours(0);
+    OfflineInbox inbox(options);
+    inbox.addKnownUser("bob");
+    CHECK(inbox.store("bob", frameOf("old")));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+    // 超过保留时间的消息读取时跳过,计入expired
+    OfflineInbox::Batch batch;
+    inbox.read("bob", 0, batch);
+    CHECK(batch.frames.empty());
+    CHECK(batch.expired == 1);
+}
+
+TEST_CASE(stale_inboxes_purged_on_startup)
+{
+    TempDir dir;
+    {
+        OfflineInbox inbox(optionsFor(dir));
+        inbox.addKnownUser("bob");
+        inbox.addKnownUser("carol");
+        inbox.store("bob", frameOf("stale"));
+        inbox.store("carol", frameOf("fresh"));
+    }
+    // 把bob的收件箱改为保留时间之前最后写入
+    for (const auto &item : fs::directory_iterator(dir.path()))
+    {
+        if (item.path().stem() == "626f62") // "bob"的十六进制编码
+        {
+            time_t old = time(nullptr) - std::chrono::duration_cast<std::chrono::seconds>(
+                                             OfflineInbox::DEFAULT_TTL + std::chrono::hours(1))
+                                             .count();
+            timeval times[2] = {{old, 0}, {old, 0}};
+            CHECK(utimes(item.path().c_str(), times) == 0);
+        }
+    }
+
+    OfflineInbox inbox(optionsFor(dir));
+    CHECK(!inbox.hasPending("bob"));
+    CHECK(inbox.hasPending("carol"));
+    CHECK(dir.inboxCount() == 1);
+}
+
+TEST_MAIN()
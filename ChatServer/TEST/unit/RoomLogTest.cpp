@@ -0,0 +1,119 @@
+// 单元测试:RoomLog的序号分配、补发范围和保留上限
+#include <memory>
+#include <string>
+#include <vector>
+#include "../TestUtil.hpp"
+#include "reactor/RoomLog.hpp"
+
+namespace
+{
+    SharedFrame frameOf(size_t size)
+    {
+        return std::make_shared<const std::vector<char>>(size, 'x');
+    }
+
+    using Replay = std::vector<std::pair<uint64_t, SharedFrame>>;
+}
+
+TEST_CASE(sequences_are_consecutive)
+{
+    RoomLog log;
+    uint64_t first = log.append(frameOf(10));
+    CHECK(log.append(frameOf(10)) == first + 1);
+    CHECK(log.append(frameOf(10)) == first + 2);
+    CHECK(log.lastSequence() == first + 2);
+
+    // 从第一条之前开始补发得到全部消息;已经是最新序号时没有消息
+    Replay messages;
+    CHECK(log.replaySince(first - 1, messages) == first - 1);
+    CHECK(messages.size() == 3);
+    CHECK(messages.front().first == first);
+    messages.clear();
+    CHECK(log.replaySince(first + 2, messages) == first + 2);
+    CHECK(messages.empty());
+}
+
+TEST_CASE(foreign_sequence_not_replayed)
+{
+    RoomLog log;
+    uint64_t first = log.append(frameOf(10));
+    log.append(frameOf(10));
+    // 0和其它聊天室(或上一次运行)的序号不补发,返回最新序号
+    Replay messages;
+    CHECK(log.replaySince(0, messages) == log.lastSequence());
+    CHECK(log.replaySince(first - 100, messages) == log.lastSequence());
+    CHECK(messages.empty());
+}
+
+TEST_CASE(message_count_retention)
+{
+    RoomLog log;
+    uint64_t first = log.append(frameOf(1));
+    for (size_t i = 1; i < RoomLog::MAX_MESSAGES + 5; ++i)
+    {
+        log.append(frameOf(1));
+    }
+    // 最早的5条已被丢弃:返回的起点大于请求的序号,二者之间的消息无法补发
+    Replay messages;
+    CHECK(log.replaySince(first - 1, messages) == first + 4);
+    CHECK(messages.size() == RoomLog::MAX_MESSAGES);
+    CHECK(messages.front().first == first + 5);
+    CHECK(messages.back().first == log.lastSequence());
+}
+
+TEST_CASE(byte_retention_keeps_latest_message)
+{
+    RoomLog log;
+    uint64_t first = log.append(frameOf(RoomLog::MAX_BYTES / 2));
+    log.append(frameOf(RoomLog::MAX_BYTES / 2));
+    log.append(frameOf(RoomLog::MAX_BYTES / 2));
+    Replay messages;
+    log.replaySince(first - 1, messages);
+    CHECK(messages.size() == 2);
+
+    // 单条超过上限的消息仍然保留
+    log.append(frameOf(RoomLog::MAX_BYTES + 1));
+    messages.clear();
+    log.replaySince(first - 1, messages);
+    CHECK(messages.size() == 1);
+    CHECK(messages.front().first == log.lastSequence());
+}
+
+TEST_CASE(total_budget_shared_by_rooms)
+{
+    size_t base = RoomLog::totalBytes();
+    RoomLog::setTotalBudget(base + 1000);
+    {
+        RoomLog a, b;
+        uint64_t first = a.append(frameOf(600));
+        a.append(frameOf(300));
+        // 超出所有聊天室共用的上限时,追加消息的聊天室丢弃自己最早的消息
+        b.append(frameOf(200));
+        CHECK(RoomLog::totalBytes() == base + 1100);
+        a.append(frameOf(100));
+        CHECK(RoomLog::totalBytes() == base + 600);
+        Replay messages;
+        CHECK(a.replaySince(first - 1, messages) == first);
+        CHECK(messages.size() == 2);
+    }
+    // 聊天室销毁时归还其保留的字节数
+    CHECK(RoomLog::totalBytes() == base);
+    RoomLog::setTotalBudget(RoomLog::DEFAULT_TOTAL_BUDGET);
+}
+
+TEST_CASE(recent_start_limits)
+{
+    RoomLog log;
+    for (int i = 0; i < 10; ++i)
+    {
+        log.append(frameOf(100));
+    }
+    uint64_t last = log.lastSequence();
+    CHECK(log.recentStart(3, 1000000) == last - 3);
+    CHECK(log.recentStart(100, 250) == last - 2);
+    // 至少一条,即使它超过字节上限
+    CHECK(log.recentStart(100, 10) == last - 1);
+    CHECK(log.recentStart(0, 1000000) == last);
+}
+
+TEST_MAIN()
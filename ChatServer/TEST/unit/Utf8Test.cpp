@@ -0,0 +1,81 @@
+// 单元测试:UTF-8校验(含AVX2路径与标量路径一致)和非法序列的替换
+#include <string>
+#include <vector>
+#include "../TestUtil.hpp"
+#include "protocol/Utf8.hpp"
+
+namespace
+{
+    const std::string REPLACEMENT = "\xEF\xBF\xBD"; // U+FFFD
+
+    bool valid(const std::string &text)
+    {
+        bool result = utf8::validate(text.data(), text.size());
+        // 向量化实现与标量实现的结论必须一致
+        CHECK(result == utf8::validateScalar(text.data(), text.size()));
+        return result;
+    }
+
+    std::string repaired(const std::string &text)
+    {
+        return utf8::repair(text.data(), text.size());
+    }
+}
+
+TEST_CASE(accepts_valid_text)
+{
+    CHECK(valid(""));
+    CHECK(valid("hello"));
+    CHECK(valid("\xE4\xBD\xA0\xE5\xA5\xBD"));     // 你好
+    CHECK(valid("\xF0\x9F\x98\x80"));             // U+1F600
+    CHECK(valid("\xF4\x8F\xBF\xBF"));             // U+10FFFF
+    CHECK(valid(std::string(1000, 'a') + "\xC3\xA9"));
+}
+
+TEST_CASE(rejects_invalid_sequences)
+{
+    CHECK(!valid("\x80"));             // 孤立的后续字节
+    CHECK(!valid("\xC0\x80"));         // 过长编码
+    CHECK(!valid("\xE0\x80\x80"));     // 过长编码
+    CHECK(!valid("\xED\xA0\x80"));     // 代理区码点
+    CHECK(!valid("\xF4\x90\x80\x80")); // 大于U+10FFFF
+    CHECK(!valid("\xE4\xBD"));         // 在结尾处截断
+    CHECK(!valid("\xFF"));
+}
+
+TEST_CASE(detects_error_at_every_offset)
+{
+    // 错误出现在32字节分块的任意位置(含跨块的多字节字符和末尾不足一块的部分)
+    const std::string two_byte = "\xC3\xA9";
+    for (size_t offset = 0; offset < 100; ++offset)
+    {
+        std::string text(100, 'a');
+        text[offset] = '\x80';
+        CHECK(!valid(text));
+
+        std::string split(100, 'a');
+        split.replace(offset, 2, two_byte);
+        CHECK(valid(split));
+        split.resize(offset + 1); // 截断多字节字符
+        CHECK(!valid(split));
+    }
+}
+
+TEST_CASE(repair_replaces_maximal_invalid_prefixes)
+{
+    CHECK(repaired("plain") == "plain");
+    CHECK(repaired("a\x80" "b") == "a" + REPLACEMENT + "b");
+    // 截断的多字节字符整体替换为一个U+FFFD
+    CHECK(repaired("\xE4\xBD" "x") == REPLACEMENT + "x");
+    // 不可能开始合法序列的字节逐个替换
+    CHECK(repaired("\xC0\x80") == REPLACEMENT + REPLACEMENT);
+    CHECK(repaired("\xED\xA0\x80") == REPLACEMENT + REPLACEMENT + REPLACEMENT);
+    CHECK(repaired("\xF4\x90\x80\x80") == REPLACEMENT + REPLACEMENT + REPLACEMENT + REPLACEMENT);
+    // 合法部分原样保留,修复结果一定合法
+    std::string mixed = "\xE4\xBD\xA0\xFF\xE5\xA5\xBD";
+    std::string result = repaired(mixed);
+    CHECK(result == "\xE4\xBD\xA0" + REPLACEMENT + "\xE5\xA5\xBD");
+    CHECK(valid(result));
+}
+
+TEST_MAIN()
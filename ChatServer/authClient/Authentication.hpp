@@ -19,8 +19,8 @@ public:
     explicit AuthClient(std::shared_ptr<grpc::Channel> channel)
         : stub_(auth::AuthService::NewStub(channel)) {}
 
-    // 处理客户端请求接口
-    void processAuthRequest(int client_fd, const MSG_header &header, const std::string &payload);
+    // 处理客户端请求接口,返回应答的消息类型,由调用方按连接的线格式发送
+    MSG_type processAuthRequest(const MSG_header &header, const std::string &payload);
 
 private:
     std::unique_ptr<auth::AuthService::Stub> stub_;
@@ -0,0 +1,423 @@
+#include "KeywordFilter.hpp"
+#include "logger/log_macros.hpp"
+#include <fstream>
+#include <vector>
+#include <queue>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <sys/stat.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define KEYWORD_FILTER_HAVE_AVX2 1
+#endif
+
+namespace
+{
+    inline unsigned char foldCase(unsigned char c)
+    {
+        return (c >= 'A' && c <= 'Z') ? static_cast<unsigned char>(c + ('a' - 'A')) : c;
+    }
+
+    // 解析词表中的一行:[动作 空白] 词;不是词的行返回false
+    bool parseLine(std::string line, KeywordFilter::Action &action, std::string &term)
+    {
+        // 去掉首尾空白(兼容Windows换行)
+        const char *spaces = " \t\r\n";
+        size_t begin = line.find_first_not_of(spaces);
+        if (begin == std::string::npos || line[begin] == '#')
+            return false;
+        line = line.substr(begin, line.find_last_not_of(spaces) - begin + 1);
+
+        action = KeywordFilter::Action::MASK;
+        size_t space = line.find_first_of(" \t");
+        if (space != std::string::npos)
+        {
+            std::string keyword = line.substr(0, space);
+            bool known = true;
+            if (keyword == "reject")
+                action = KeywordFilter::Action::REJECT;
+            else if (keyword == "mask")
+                action = KeywordFilter::Action::MASK;
+            else if (keyword == "flag")
+                action = KeywordFilter::Action::FLAG;
+            else
+                known = false;
+            if (known)
+                line = line.substr(line.find_first_not_of(" \t", space));
+        }
+        term = line;
+        return true;
+    }
+} // namespace
+
+// 编译好的自动机,创建后只读,可被多个线程同时使用
+class KeywordFilter::Automaton
+{
+public:
+    // 每个状态的输出,汇总沿失败链可达(即在此结束)的所有词
+    struct Output
+    {
+        Action action = Action::NONE; // 最严重的动作
+        uint16_t length = 0;          // 该动作的词中最长的长度
+        uint16_t mask_length = 0;     // 需要打码(MASK/REJECT)的词中最长的长度
+    };
+
+    // 把另一组输出合并进来
+    static void merge(Output &out, Action action, uint16_t length, uint16_t mask_length)
+    {
+        if (action > out.action)
+        {
+            out.action = action;
+            out.length = length;
+        }
+        else if (action == out.action)
+        {
+            out.length = std::max(out.length, length);
+        }
+        out.mask_length = std::max(out.mask_length, mask_length);
+    }
+
+    Automaton(const std::vector<std::pair<std::string, Action>> &terms)
+        : terms_(terms.size())
+    {
+        // 字节等价类:词中出现过的每个字节(折叠大小写后)一类,其余字节共用类0,压缩转移表的宽度
+        uint16_t byte_class[256] = {};
+        classes_ = 1;
+        for (const auto &term : terms)
+        {
+            for (unsigned char c : term.first)
+            {
+                if (byte_class[c] == 0)
+                    byte_class[c] = static_cast<uint16_t>(classes_++);
+            }
+        }
+        for (int c = 0; c < 256; ++c)
+        {
+            class_of_[c] = byte_class[foldCase(static_cast<unsigned char>(c))];
+        }
+
+        // 构建字典树:转移表中的0表示没有边(根状态不会是任何边的目标)
+        delta_.assign(classes_, 0);
+        outputs_.emplace_back();
+        for (const auto &term : terms)
+        {
+            uint32_t state = 0;
+            for (unsigned char c : term.first)
+            {
+                uint32_t &next = delta_[state * classes_ + byte_class[c]];
+                if (next == 0)
+                {
+                    next = static_cast<uint32_t>(outputs_.size());
+                    outputs_.emplace_back();
+                    delta_.resize(delta_.size() + classes_, 0);
+                }
+                state = delta_[state * classes_ + byte_class[c]]; // resize后引用失效,重新读取
+            }
+            uint16_t length = static_cast<uint16_t>(term.first.size());
+            merge(outputs_[state], term.second, length, term.second >= Action::MASK ? length : 0);
+        }
+
+        // 按深度广度优先计算失败链接,同时把缺失的边补成失败状态的转移,得到完整的DFA
+        std::vector<uint32_t> fail(outputs_.size(), 0);
+        std::vector<uint32_t> order(1, 0); // 广度优先的访问顺序
+        std::queue<uint32_t> pending;
+        for (size_t c = 0; c < classes_; ++c)
+        {
+            if (delta_[c] != 0)
+                pending.push(delta_[c]);
+        }
+        while (!pending.empty())
+        {
+            uint32_t state = pending.front();
+            pending.pop();
+            order.push_back(state);
+            const Output inherited = outputs_[fail[state]];
+            merge(outputs_[state], inherited.action, inherited.length, inherited.mask_length);
+
+            for (size_t c = 0; c < classes_; ++c)
+            {
+                uint32_t &next = delta_[state * classes_ + c];
+                uint32_t fallback = delta_[fail[state] * classes_ + c];
+                if (next != 0)
+                {
+                    fail[next] = fallback;
+                    pending.push(next);
+                }
+                else
+                {
+                    next = fallback;
+                }
+            }
+        }
+
+        // 预过滤:根状态下只有这些字节会离开根状态
+        for (int c = 0; c < 256; ++c)
+        {
+            first_[c] = delta_[class_of_[c]] != 0;
+        }
+
+        // 按广度优先顺序重新编号,扫描时最常停留的浅层状态集中在表的开头,留在缓存中
+        // 转移表改存目标状态的行偏移,最高位标记目标状态有输出:扫描时每字节只有一次依赖的表访问,不做乘法也不读outputs_
+        std::vector<uint32_t> rank(order.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            rank[order[i]] = static_cast<uint32_t>(i);
+        }
+        std::vector<uint32_t> table(delta_.size());
+        std::vector<Output> outputs(outputs_.size());
+        for (size_t state = 0; state < order.size(); ++state)
+        {
+            outputs[rank[state]] = outputs_[state];
+            for (size_t c = 0; c < classes_; ++c)
+            {
+                uint32_t target = delta_[state * classes_ + c];
+                uint32_t next = static_cast<uint32_t>(rank[target] * classes_);
+                if (outputs_[target].action != Action::NONE)
+                    next |= HAS_OUTPUT;
+                table[rank[state] * classes_ + c] = next;
+            }
+        }
+        delta_ = std::move(table);
+        outputs_ = std::move(outputs);
+#ifdef KEYWORD_FILTER_HAVE_AVX2
+        // 按低4位查表得到高4位的位图:low_rows_[l]的第h位表示字节(h<<4)|l是首字节,h为0~7;high_rows_对应h为8~15
+        for (int c = 0; c < 256; ++c)
+        {
+            if (!first_[c])
+                continue;
+            int low = c & 0x0F, high = c >> 4;
+            uint8_t *rows = high < 8 ? low_rows_ : high_rows_;
+            rows[low] |= static_cast<uint8_t>(1u << (high & 7));
+            rows[low + 16] = rows[low];
+        }
+        use_avx2_ = __builtin_cpu_supports("avx2");
+#endif
+    }
+
+    size_t termCount() const { return terms_; }
+    size_t stateCount() const { return outputs_.size(); }
+    size_t tableBytes() const { return delta_.size() * sizeof(uint32_t); }
+
+    // 扫描data,返回最严重的动作;spans非空时记录每个命中的 [起点, 终点)
+    Action scan(const unsigned char *data, size_t size, std::vector<std::pair<size_t, size_t>> *spans,
+                std::pair<size_t, size_t> &decisive) const
+    {
+        Action worst = Action::NONE;
+        uint32_t row = 0; // 当前状态在转移表中的行偏移,根状态为0
+        size_t i = 0;
+        while (i < size)
+        {
+            if (row == 0)
+            {
+                i = nextCandidate(data, i, size);
+                if (i == size)
+                    break;
+            }
+            uint32_t next = delta_[row + class_of_[data[i]]];
+            row = next & ~HAS_OUTPUT;
+            ++i;
+
+            if (next & HAS_OUTPUT)
+            {
+                const Output &out = outputs_[row / classes_];
+                if (out.action > worst)
+                {
+                    worst = out.action;
+                    decisive = {i - out.length, i};
+                    if (worst == Action::REJECT)
+                        break; // 不会更严重了
+                }
+                if (spans && out.mask_length > 0)
+                    spans->emplace_back(i - out.mask_length, i);
+            }
+        }
+        return worst;
+    }
+
+private:
+    // 从i开始找第一个可能作为词首字节的位置,没有时返回size
+    size_t nextCandidate(const unsigned char *data, size_t i, size_t size) const
+    {
+        // 词首字节密集的文本(词表覆盖了大部分字母)中下一个字节往往就是候选,不必进入SIMD循环
+        if (i < size && first_[data[i]])
+            return i;
+#ifdef KEYWORD_FILTER_HAVE_AVX2
+        if (use_avx2_)
+            i = nextCandidateAvx2(data, i, size);
+#endif
+        while (i < size && !first_[data[i]])
+            ++i;
+        return i;
+    }
+
+#ifdef KEYWORD_FILTER_HAVE_AVX2
+    // 每次检查32字节,返回第一个候选位置;不足32字节的尾部返回给标量循环处理
+    __attribute__((target("avx2"))) size_t nextCandidateAvx2(const unsigned char *data, size_t i, size_t size) const
+    {
+        const __m256i low_rows = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(low_rows_));
+        const __m256i high_rows = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(high_rows_));
+        const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+                                              1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+        const __m256i nibble = _mm256_set1_epi8(0x0F);
+        const __m256i seven = _mm256_set1_epi8(7);
+        for (; i + 32 <= size; i += 32)
+        {
+            __m256i input = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+            __m256i low = _mm256_and_si256(input, nibble);
+            __m256i high = _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble);
+            __m256i row = _mm256_blendv_epi8(_mm256_shuffle_epi8(low_rows, low), _mm256_shuffle_epi8(high_rows, low),
+                                             _mm256_cmpgt_epi8(high, seven));
+            __m256i bit = _mm256_shuffle_epi8(bits, high);
+            __m256i miss = _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), _mm256_setzero_si256());
+            uint32_t hits = ~static_cast<uint32_t>(_mm256_movemask_epi8(miss));
+            if (hits != 0)
+                return i + static_cast<size_t>(__builtin_ctz(hits));
+        }
+        return i;
+    }
+#endif
+
+    static constexpr uint32_t HAS_OUTPUT = 0x80000000u;
+
+    size_t terms_;
+    size_t classes_;
+    uint16_t class_of_[256];
+    std::vector<uint32_t> delta_; // delta_[状态 * classes_ + 字节类] = 下一状态 * classes_ | HAS_OUTPUT
+    std::vector<Output> outputs_;
+    bool first_[256];
+#ifdef KEYWORD_FILTER_HAVE_AVX2
+    uint8_t low_rows_[32] = {};
+    uint8_t high_rows_[32] = {};
+    bool use_avx2_ = false;
+#endif
+};
+
+KeywordFilter::KeywordFilter(const std::string &path)
+    : path_(path), file_exists_(false), file_mtime_(0), file_mtime_nsec_(0), file_size_(0)
+{
+}
+
+KeywordFilter::~KeywordFilter() = default;
+
+bool KeywordFilter::reloadIfChanged()
+{
+    struct stat st;
+    bool exists = stat(path_.c_str(), &st) == 0;
+    if (exists == file_exists_ &&
+        (!exists || (st.st_mtim.tv_sec == file_mtime_ && st.st_mtim.tv_nsec == file_mtime_nsec_ &&
+                     st.st_size == file_size_)))
+    {
+        return false;
+    }
+    file_exists_ = exists;
+    file_mtime_ = exists ? st.st_mtim.tv_sec : 0;
+    file_mtime_nsec_ = exists ? st.st_mtim.tv_nsec : 0;
+    file_size_ = exists ? st.st_size : 0;
+
+    if (!exists)
+    {
+        if (std::atomic_load(&automaton_))
+            LOG_INFO("敏感词表 {} 已删除,停止过滤", path_);
+        std::atomic_store(&automaton_, std::shared_ptr<const Automaton>());
+        return true;
+    }
+
+    std::ifstream in(path_);
+    if (!in)
+    {
+        LOG_ERROR("打开敏感词表 {} 失败,继续使用当前词表", path_);
+        return false;
+    }
+
+    std::vector<std::pair<std::string, Action>> terms;
+    std::string line, term;
+    Action action;
+    size_t skipped = 0;
+    while (std::getline(in, line))
+    {
+        if (!parseLine(line, action, term))
+            continue;
+        if (term.size() > MAX_TERM_SIZE)
+        {
+            ++skipped;
+            continue;
+        }
+        for (char &c : term)
+            c = static_cast<char>(foldCase(static_cast<unsigned char>(c)));
+        terms.emplace_back(term, action);
+    }
+
+    // 状态数不超过词的总字节数,据此在编译前估算转移表的上限
+    size_t total_bytes = 0;
+    bool used[256] = {};
+    size_t classes = 1;
+    for (const auto &entry : terms)
+    {
+        total_bytes += entry.first.size();
+        for (unsigned char c : entry.first)
+        {
+            if (!used[c])
+            {
+                used[c] = true;
+                ++classes;
+            }
+        }
+    }
+    if ((total_bytes + 1) * classes * sizeof(uint32_t) > MAX_TABLE_BYTES)
+    {
+        LOG_ERROR("敏感词表 {} 过大({} 个词, {} 字节),继续使用当前词表", path_, terms.size(), total_bytes);
+        return false;
+    }
+
+    // 在锁外编译,完成后原子替换;旧自动机在最后一个使用者结束扫描后释放
+    auto automaton = std::make_shared<const Automaton>(terms);
+    std::atomic_store(&automaton_, automaton);
+    LOG_INFO("加载敏感词表 {}: {} 个词, {} 个状态, 转移表 {} KB{}", path_, automaton->termCount(),
+             automaton->stateCount(), automaton->tableBytes() / 1024,
+             skipped > 0 ? ", 忽略 " + std::to_string(skipped) + " 个过长的词" : std::string());
+    return true;
+}
+
+KeywordFilter::Action KeywordFilter::check(const char *data, size_t size, std::string &masked,
+                                           std::string &term) const
+{
+    std::shared_ptr<const Automaton> automaton = std::atomic_load(&automaton_);
+    if (!automaton || automaton->termCount() == 0)
+        return Action::NONE;
+
+    const unsigned char *text = reinterpret_cast<const unsigned char *>(data);
+    std::vector<std::pair<size_t, size_t>> spans;
+    std::pair<size_t, size_t> decisive{0, 0};
+    Action action = automaton->scan(text, size, &spans, decisive);
+    if (action == Action::NONE)
+        return action;
+    term.assign(data + decisive.first, decisive.second - decisive.first);
+    if (action != Action::MASK)
+        return action;
+
+    // 命中区间按终点有序,起点可能回退(较长的词),标记后统一替换;UTF-8的后续字节不单独产生*
+    std::vector<bool> covered(size, false);
+    for (const auto &span : spans)
+    {
+        std::fill(covered.begin() + static_cast<std::ptrdiff_t>(span.first),
+                  covered.begin() + static_cast<std::ptrdiff_t>(span.second), true);
+    }
+    masked.clear();
+    masked.reserve(size);
+    for (size_t i = 0; i < size; ++i)
+    {
+        if (!covered[i])
+            masked.push_back(data[i]);
+        else if ((text[i] & 0xC0) != 0x80)
+            masked.push_back('*');
+    }
+    return action;
+}
+
+size_t KeywordFilter::termCount() const
+{
+    std::shared_ptr<const Automaton> automaton = std::atomic_load(&automaton_);
+    return automaton ? automaton->termCount() : 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <memory>
+#include <ctime>
+#include <sys/types.h>
+
+// 群消息敏感词过滤
+// 词表编译为Aho-Corasick自动机并展开成DFA(状态 x 字节等价类 的稠密转移表),一次扫描同时匹配所有词,
+// 耗时与词表大小无关;自动机处于根状态时先用SIMD跳过不可能作为任何词首字节的数据
+// ASCII字母不区分大小写;其它字节(含UTF-8中文)按原样匹配
+//
+// 词表文件每行一个词,可在前面加动作和空白:
+//   reject 词   拒绝整条消息
+//   mask 词     把命中的部分替换为*(每个字符一个*),不写动作时默认为mask
+//   flag 词     原样转发,记录日志供人工审核
+// 空行和#开头的行忽略
+// 词表文件修改后由reloadIfChanged重新编译,新自动机原子替换旧的,正在扫描的消息继续使用旧自动机
+class KeywordFilter
+{
+public:
+    static constexpr const char *DEFAULT_PATH = "banned_words.txt"; // 相对于服务器工作目录
+    static constexpr size_t MAX_TERM_SIZE = 255;                     // 更长的词忽略
+    static constexpr size_t MAX_TABLE_BYTES = 256 * 1024 * 1024;     // 转移表大小上限,超过时拒绝加载新词表
+
+    // 同一条消息命中多个词时取最严重的动作
+    enum class Action : uint8_t
+    {
+        NONE,
+        FLAG,
+        MASK,
+        REJECT
+    };
+
+    explicit KeywordFilter(const std::string &path = DEFAULT_PATH);
+    ~KeywordFilter();
+
+    // 禁用拷贝构造和赋值
+    KeywordFilter(const KeywordFilter &) = delete;
+    KeywordFilter &operator=(const KeywordFilter &) = delete;
+
+    // 词表文件的修改时间或大小变化(包括被删除)时重新编译,返回是否发生了替换
+    // 只应由一个线程调用(定时器回调);与check并发安全
+    bool reloadIfChanged();
+
+    // 扫描文本,返回命中的最严重动作;term为决定该动作的命中文本
+    // 动作为MASK时masked为打码后的文本
+    Action check(const char *data, size_t size, std::string &masked, std::string &term) const;
+
+    size_t termCount() const;
+
+private:
+    class Automaton;
+
+    std::string path_;
+    std::shared_ptr<const Automaton> automaton_; // 通过std::atomic_load/atomic_store读写
+    // 上一次加载时词表文件的状态
+    bool file_exists_;
+    time_t file_mtime_;
+    long file_mtime_nsec_;
+    off_t file_size_;
+};
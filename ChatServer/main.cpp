@@ -18,8 +18,14 @@ void signalHandler(int signal)
     }
 }
 
-// 使用示例: ./chatserver 1234 4
+// 使用示例: ./chatserver 1234 4 [ring] [500] [50:256] [256] [100] [168]
 // 其中1234是端口号,4是线程数,如果不指定线程数,则使用默认值(CPU核心数的两倍)
+// 第三个参数为ring时聊天消息改用广播环扇出,默认由线程池扇出
+// 第四个参数为合并发送窗口(微秒),默认0即不合并,最大5000
+// 第五个参数为进入聊天室时补发的历史消息 条数[:KB],默认50:256,0表示不补发
+// 第六个参数为所有聊天室保留消息的内存上限(MB),默认256
+// 第七个参数为消息持久化日志的fdatasync周期(毫秒),默认100,0表示每次写入后都落盘,off表示不持久化
+// 第八个参数为离线私聊的保留时间(小时),默认168,off表示不保存离线私聊
 int main(int argc, char *argv[])
 {
     StartLoggerDaemon();
@@ -55,13 +61,119 @@ int main(int argc, char *argv[])
             thread_count = std::atoi(argv[2]);
         }
 
+        FanoutMode fanout_mode = FanoutMode::POOL;
+        if (argc > 3)
+        {
+            if (std::string(argv[3]) == "ring")
+            {
+                fanout_mode = FanoutMode::RING;
+            }
+            else if (std::string(argv[3]) != "pool")
+            {
+                std::cerr << "无效的扇出方式: " << argv[3] << " (可选 pool 或 ring)" << std::endl;
+                return 1;
+            }
+        }
+
+        std::chrono::microseconds coalesce_window(0);
+        if (argc > 4)
+        {
+            long window_us = std::atol(argv[4]);
+            if (window_us < 0 || window_us > ReactorServer::MAX_COALESCE_WINDOW.count())
+            {
+                std::cerr << "无效的合并发送窗口: " << argv[4] << " (0 到 "
+                          << ReactorServer::MAX_COALESCE_WINDOW.count() << " 微秒)" << std::endl;
+                return 1;
+            }
+            coalesce_window = std::chrono::microseconds(window_us);
+        }
+
+        size_t history_messages = ReactorServer::DEFAULT_JOIN_HISTORY_MESSAGES;
+        size_t history_kb = ReactorServer::DEFAULT_JOIN_HISTORY_BYTES / 1024;
+        if (argc > 5)
+        {
+            char *end = nullptr;
+            history_messages = std::strtoul(argv[5], &end, 10);
+            if (*end == ':')
+            {
+                history_kb = std::strtoul(end + 1, &end, 10);
+            }
+            if (end == argv[5] || *end != '\0')
+            {
+                std::cerr << "无效的历史消息设置: " << argv[5] << " (格式为 条数[:KB])" << std::endl;
+                return 1;
+            }
+        }
+
+        if (argc > 6)
+        {
+            long budget_mb = std::atol(argv[6]);
+            if (budget_mb <= 0)
+            {
+                std::cerr << "无效的保留消息内存上限: " << argv[6] << " MB" << std::endl;
+                return 1;
+            }
+            RoomLog::setTotalBudget(static_cast<size_t>(budget_mb) * 1024 * 1024);
+        }
+
+        bool message_log_enabled = true;
+        MessageLog::Options message_log_options;
+        if (argc > 7)
+        {
+            char *end = nullptr;
+            long sync_ms = std::strtol(argv[7], &end, 10);
+            if (std::string(argv[7]) == "off")
+            {
+                message_log_enabled = false;
+            }
+            else if (end == argv[7] || *end != '\0' || sync_ms < 0)
+            {
+                std::cerr << "无效的落盘周期: " << argv[7] << " (毫秒数或off)" << std::endl;
+                return 1;
+            }
+            else
+            {
+                message_log_options.sync_interval = std::chrono::milliseconds(sync_ms);
+            }
+        }
+
+        bool offline_inbox_enabled = true;
+        OfflineInbox::Options offline_inbox_options;
+        if (argc > 8)
+        {
+            char *end = nullptr;
+            long ttl_hours = std::strtol(argv[8], &end, 10);
+            if (std::string(argv[8]) == "off")
+            {
+                offline_inbox_enabled = false;
+            }
+            else if (end == argv[8] || *end != '\0' || ttl_hours <= 0)
+            {
+                std::cerr << "无效的离线私聊保留时间: " << argv[8] << " (小时数或off)" << std::endl;
+                return 1;
+            }
+            else
+            {
+                offline_inbox_options.ttl = std::chrono::hours(ttl_hours);
+            }
+        }
+
         LOG_INFO("===== Reactor聊天室服务器准备启动 =====");
         LOG_INFO("将要监听端口: {}", port);
         // 三元表达式两个结果必须类型兼容
         LOG_INFO("将使用线程数: {}", thread_count == 0 ? "自动检测" : std::to_string(thread_count));
 
         // 创建并启动服务器
-        g_server = std::make_unique<ReactorServer>(port, thread_count);
+        g_server = std::make_unique<ReactorServer>(port, thread_count, fanout_mode, coalesce_window);
+        g_server->setJoinHistory(history_messages, history_kb * 1024);
+        if (message_log_enabled)
+        {
+            g_server->enableMessageLog(message_log_options);
+        }
+        if (offline_inbox_enabled)
+        {
+            g_server->enableOfflineInbox(offline_inbox_options);
+        }
         g_server->start();
 
         // 主线程等待服务器运行
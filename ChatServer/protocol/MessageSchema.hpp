@@ -0,0 +1,513 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+// 消息结构与编解码的唯一定义
+// 每种消息在这里声明一次消息体布局,编码/解码/帧长度函数由模板在编译期生成,线格式布局用static_assert固定
+// 编码直接写入调用方提供的缓冲区,不做任何临时分配
+// 服务器、Qt客户端和压测程序共用这一份实现,只依赖标准库
+// 注意:结构体按主机字节序直接上线,服务器(x86-64)和客户端(Windows x64)均为小端平台
+
+#define MAX_NAMEBUFFER 64
+#define MAX_FILENAME 256
+
+enum MSG_type : uint32_t // 固定底层类型:线上读到的任意值都是合法的枚举值,由maxBodySize识别未知类型
+{
+    REGISTER,
+    REGISTER_success,
+    REGISTER_failed,
+    LOGIN,
+    LOGIN_success,
+    LOGIN_failed,
+
+    INITIAL,
+    JOIN,
+    EXIT,
+    GROUP_MSG,
+    FILE_MSG,
+    FILE_DATA,
+    FILE_END,
+    TEST,            // 新增测试协议类型
+    TEST_success,    // 服务器对TEST协议的成功响应
+    FILE_ACCEPT,     // 服务器通知发送方:需要上传文件内容
+    FILE_EXISTS,     // 服务器通知发送方:已持有同哈希文件,无需上传
+    FILE_CREDIT,     // 服务器给文件流发送方追加发送额度(字节)
+    BATCH,           // 一帧内携带多条子消息,见BatchItemHeader
+    ROSTER,          // 服务器发给v2客户端的带版本号的用户表快照或增量,见RosterHeader
+    PING,            // 心跳请求,收到方原样回复PONG
+    PONG,            // 心跳响应,消息体与PING相同
+    ACK,             // 客户端:已连续收到的最大聊天室序号; 服务器:告知发送方其消息分配到的序号
+    RESUME,          // 客户端:从该序号之后补发聊天室消息; 服务器:实际补发起点之前的序号
+    ROOM_JOIN,       // 客户端:切换到该名称的聊天室(不存在时创建); 服务器:当前所在的聊天室名称
+    ROOM_LEAVE,      // 客户端:离开当前聊天室,回到大厅
+    ROOM_LIST,       // 客户端:查询聊天室列表; 服务器:"名称:人数"列表,逗号分隔
+    DIRECT_MSG,      // 私聊消息,见DirectInfo
+    DIRECT_FAILED,   // 服务器通知发送方:私聊的接收方不在线,消息体为原DirectInfo
+    JOIN_failed      // 服务器拒绝JOIN:用户名为空或已有同名用户在线,消息体为原因(文本),连接保持未登录状态
+};
+
+// 定义消息头结构
+// 这里的长度字段是指消息内容的长度，不包括头部
+// 头部包含发送者名称、消息类型和消息长度
+struct MSG_header
+{
+    char sender_name[MAX_NAMEBUFFER];
+    MSG_type Type;
+    size_t length;
+};
+
+// 文件信息结构（用于FILE_MSG）
+struct FileInfo
+{
+    char filename[MAX_FILENAME];
+    size_t file_size;
+    uint64_t content_hash; // 文件内容的XXH64哈希,0表示未提供(不参与去重)
+    uint32_t stream_id;    // 发送方分配的文件流ID,同一连接上并发的文件流互不相同
+    uint32_t flags;        // FILE_FLAG_*标志位,未使用的位置0
+};
+
+// FileInfo.flags:发送方遵守FILE_CREDIT额度发送数据
+constexpr uint32_t FILE_FLAG_FLOW_CONTROL = 0x1;
+// FileInfo.flags:FILE_DATA分片的压缩算法,二者至多设置一个
+constexpr uint32_t FILE_FLAG_COMPRESS_LZ4 = 0x2;  // 速度优先
+constexpr uint32_t FILE_FLAG_COMPRESS_ZSTD = 0x4; // 压缩率优先
+constexpr uint32_t FILE_FLAG_COMPRESSION_MASK = FILE_FLAG_COMPRESS_LZ4 | FILE_FLAG_COMPRESS_ZSTD;
+
+// 旧版客户端的FileInfo不含content_hash及之后的字段
+constexpr size_t LEGACY_FILEINFO_SIZE = offsetof(FileInfo, content_hash);
+// 带content_hash但不含stream_id的FileInfo,同样按单路传输处理
+constexpr size_t HASHED_FILEINFO_SIZE = offsetof(FileInfo, stream_id);
+// 单路传输的发送方所对应的流ID
+constexpr uint32_t LEGACY_STREAM_ID = 0;
+// 发送方可以在FILE_MSG的FileInfo之后附加整文件的SHA-256摘要,文件池只按服务器校验过的摘要去重;
+// 摘要只发给服务器,服务器转发给接收方的FILE_MSG仍是定长的FileInfo
+constexpr size_t FILE_DIGEST_SIZE = 32;
+
+// 文件流消息(FILE_DATA/FILE_END/FILE_ACCEPT/FILE_EXISTS)数据部分的开头
+struct FileStreamHeader
+{
+    uint32_t stream_id;
+};
+
+// 压缩文件流中FILE_DATA的分片头,紧跟在FileStreamHeader之后
+// 其后数据长度等于raw_length时表示该分片未压缩
+struct FileChunkHeader
+{
+    uint32_t raw_length; // 分片解压后的字节数
+};
+
+// FILE_CREDIT消息的数据部分
+struct FileCreditInfo
+{
+    uint32_t stream_id;
+    uint32_t reserved;
+    uint64_t credit_bytes; // 追加的可发送文件数据字节数
+};
+
+// BATCH消息体由若干子消息依次排列,每条子消息为BatchItemHeader加数据
+// 子消息没有自己的发送者字段,发送者即BATCH帧的发送者
+struct BatchItemHeader
+{
+    uint32_t type;   // MSG_type
+    uint32_t length; // 子消息数据长度
+};
+
+// DIRECT_MSG消息体:DirectInfo后跟文本
+// 发送方填写接收方的用户ID(v2客户端)或用户名(target_id为0时),服务器转发时两项都改为接收方的实际ID和用户名
+struct DirectInfo
+{
+    uint32_t target_id;
+    char target_name[MAX_NAMEBUFFER];
+};
+
+// 单个BATCH帧携带的子消息数上限
+constexpr size_t MAX_BATCH_ITEMS = 4096;
+
+// ROSTER消息体:RosterHeader后跟count个条目,每个条目为RosterEntryHeader加用户名
+// v2客户端的JOIN消息体为8字节的用户表版本(0表示本地没有缓存),服务器据此回复增量或分页的完整快照
+struct RosterHeader
+{
+    uint64_t epoch; // 应用本页后客户端用户表对应的版本
+    uint32_t flags; // ROSTER_FLAG_*
+    uint32_t count; // 本页的条目数
+};
+
+struct RosterEntryHeader
+{
+    uint32_t user_id;
+    uint8_t op;          // ROSTER_OP_*
+    uint8_t name_length; // 其后用户名的字节数,ROSTER_OP_LEAVE时为0
+    uint16_t reserved;
+};
+
+constexpr uint32_t ROSTER_FLAG_RESET = 0x1; // 快照的第一页:接收方先清空本地用户表
+constexpr uint32_t ROSTER_FLAG_MORE = 0x2;  // 后面还有同一版本的分页
+constexpr uint8_t ROSTER_OP_LEAVE = 0;
+constexpr uint8_t ROSTER_OP_JOIN = 1;
+
+// PING/PONG的消息体:PONG原样带回PING的序号,发起方据此计算往返时延
+struct PingInfo
+{
+    uint64_t sequence;
+};
+
+// ACK/RESUME的消息体
+struct SequenceInfo
+{
+    uint64_t sequence;
+};
+
+// 每页ROSTER的条目数上限,用户名不超过MAX_NAMEBUFFER字节时一页不超过约72KB
+constexpr size_t ROSTER_PAGE_ENTRIES = 1000;
+
+// 客户端发来的消息体长度上限:帧头解析后立即检查,超出上限的连接直接断开,不再等待消息体
+constexpr size_t MAX_AUTH_BODY_SIZE = 8 * 1024;             // LOGIN/REGISTER:用户名加RSA加密的密码
+constexpr size_t MAX_PRESENCE_BODY_SIZE = 1024;             // JOIN/EXIT/ROOM_*
+constexpr size_t MAX_TEXT_BODY_SIZE = 256 * 1024;           // GROUP_MSG/TEST/DIRECT_MSG的文本
+constexpr size_t MAX_FILE_CHUNK_SIZE = 16 * 1024 * 1024;    // 单个FILE_DATA的文件数据(客户端按1MB分片)
+constexpr size_t MAX_BATCH_BODY_SIZE = 1024 * 1024;
+
+// 线格式布局:任何改动都会改变协议,必须同时升级两端
+static_assert(sizeof(MSG_type) == 4, "MSG_type必须为4字节");
+static_assert(offsetof(MSG_header, sender_name) == 0 && offsetof(MSG_header, Type) == 64 &&
+                  offsetof(MSG_header, length) == 72 && sizeof(MSG_header) == 80,
+              "MSG_header线格式布局改变");
+static_assert(offsetof(FileInfo, file_size) == 256 && offsetof(FileInfo, content_hash) == 264 &&
+                  offsetof(FileInfo, stream_id) == 272 && offsetof(FileInfo, flags) == 276 && sizeof(FileInfo) == 280,
+              "FileInfo线格式布局改变");
+static_assert(sizeof(FileStreamHeader) == 4, "FileStreamHeader线格式布局改变");
+static_assert(sizeof(FileChunkHeader) == 4, "FileChunkHeader线格式布局改变");
+static_assert(offsetof(FileCreditInfo, credit_bytes) == 8 && sizeof(FileCreditInfo) == 16,
+              "FileCreditInfo线格式布局改变");
+static_assert(offsetof(BatchItemHeader, length) == 4 && sizeof(BatchItemHeader) == 8,
+              "BatchItemHeader线格式布局改变");
+static_assert(offsetof(DirectInfo, target_name) == 4 && sizeof(DirectInfo) == 68, "DirectInfo线格式布局改变");
+static_assert(sizeof(PingInfo) == 8, "PingInfo线格式布局改变");
+static_assert(sizeof(SequenceInfo) == 8, "SequenceInfo线格式布局改变");
+static_assert(offsetof(RosterHeader, flags) == 8 && sizeof(RosterHeader) == 16, "RosterHeader线格式布局改变");
+static_assert(offsetof(RosterEntryHeader, op) == 4 && sizeof(RosterEntryHeader) == 8,
+              "RosterEntryHeader线格式布局改变");
+
+namespace schema
+{
+    // 没有定长消息体的消息(文本消息),消息体全部是变长数据
+    struct NoBody
+    {
+    };
+
+    template <typename Body>
+    struct BodySize : std::integral_constant<size_t, sizeof(Body)>
+    {
+    };
+    template <>
+    struct BodySize<NoBody> : std::integral_constant<size_t, 0>
+    {
+    };
+
+    // 消息体布局:定长部分Body,之后是否允许变长数据,以及兼容旧版时可接受的最短定长部分
+    template <typename B, bool Payload, size_t MinSize = BodySize<B>::value>
+    struct Layout
+    {
+        static_assert(std::is_trivially_copyable<B>::value && std::is_standard_layout<B>::value,
+                      "消息体必须可以按字节直接拷贝");
+        static_assert(MinSize <= BodySize<B>::value, "最短长度不能超过消息体");
+
+        using Body = B;
+        static constexpr size_t body_size = BodySize<B>::value;
+        static constexpr size_t min_body_size = MinSize;
+        static constexpr bool has_payload = Payload;
+    };
+
+    // 每种消息的布局,未特化的消息类型为文本消息
+    template <MSG_type T>
+    struct Message : Layout<NoBody, true>
+    {
+    };
+    template <>
+    struct Message<FILE_MSG> : Layout<FileInfo, false, LEGACY_FILEINFO_SIZE>
+    {
+    };
+    template <>
+    struct Message<FILE_DATA> : Layout<FileStreamHeader, true>
+    {
+    };
+    template <>
+    struct Message<FILE_END> : Layout<FileStreamHeader, false>
+    {
+    };
+    template <>
+    struct Message<FILE_ACCEPT> : Layout<FileStreamHeader, false>
+    {
+    };
+    template <>
+    struct Message<FILE_EXISTS> : Layout<FileStreamHeader, false>
+    {
+    };
+    template <>
+    struct Message<PING> : Layout<PingInfo, false>
+    {
+    };
+    template <>
+    struct Message<PONG> : Layout<PingInfo, false>
+    {
+    };
+    template <>
+    struct Message<ACK> : Layout<SequenceInfo, false>
+    {
+    };
+    template <>
+    struct Message<RESUME> : Layout<SequenceInfo, false>
+    {
+    };
+    template <>
+    struct Message<FILE_CREDIT> : Layout<FileCreditInfo, false>
+    {
+    };
+    template <>
+    struct Message<DIRECT_MSG> : Layout<DirectInfo, true>
+    {
+    };
+    template <>
+    struct Message<DIRECT_FAILED> : Layout<DirectInfo, false>
+    {
+    };
+
+    template <MSG_type T>
+    using BodyOf = typename Message<T>::Body;
+
+    // 完整消息帧(消息头+消息体)的字节数
+    template <MSG_type T>
+    constexpr size_t frameSize(size_t payload_size = 0)
+    {
+        return sizeof(MSG_header) + Message<T>::body_size + payload_size;
+    }
+
+    // 写入消息头,out至少sizeof(MSG_header)字节;发送者名称超长时截断,其余字节补0
+    inline void encodeHeader(char *out, MSG_type type, const char *sender, size_t length)
+    {
+        MSG_header header;
+        memset(&header, 0, sizeof(header));
+        strncpy(header.sender_name, sender, MAX_NAMEBUFFER - 1);
+        header.Type = type;
+        header.length = length;
+        memcpy(out, &header, sizeof(header));
+    }
+
+    inline void decodeHeader(const char *data, MSG_header &header)
+    {
+        memcpy(&header, data, sizeof(header));
+    }
+
+    // 编码完整消息帧到out(至少frameSize<T>(payload_size)字节),返回写入的字节数
+    template <MSG_type T>
+    size_t encode(char *out, const char *sender, const BodyOf<T> &body,
+                  const void *payload = nullptr, size_t payload_size = 0)
+    {
+        using M = Message<T>;
+        static_assert(M::body_size > 0, "文本消息使用encodeText");
+        encodeHeader(out, T, sender, M::body_size + payload_size);
+        memcpy(out + sizeof(MSG_header), &body, M::body_size);
+        if (payload_size > 0)
+        {
+            memcpy(out + sizeof(MSG_header) + M::body_size, payload, payload_size);
+        }
+        return frameSize<T>(payload_size);
+    }
+
+    // 编码文本消息(消息类型在运行期决定),out至少sizeof(MSG_header)+size字节
+    inline size_t encodeText(char *out, MSG_type type, const char *sender, const void *text, size_t size)
+    {
+        encodeHeader(out, type, sender, size);
+        if (size > 0)
+        {
+            memcpy(out + sizeof(MSG_header), text, size);
+        }
+        return sizeof(MSG_header) + size;
+    }
+
+    // 解码消息体(data/size为消息头之后的部分)
+    // 定长部分短于完整结构体的旧版格式缺少的字段补0;payload指向定长部分之后的变长数据
+    template <MSG_type T>
+    bool decode(const char *data, size_t size, BodyOf<T> &body,
+                const char **payload = nullptr, size_t *payload_size = nullptr)
+    {
+        using M = Message<T>;
+        static_assert(M::body_size > 0, "文本消息没有定长消息体");
+        if (size < M::min_body_size || (!M::has_payload && size > M::body_size))
+        {
+            return false;
+        }
+
+        size_t fixed = size < M::body_size ? size : M::body_size;
+        memset(&body, 0, sizeof(body));
+        memcpy(&body, data, fixed);
+        if (payload)
+        {
+            *payload = data + fixed;
+        }
+        if (payload_size)
+        {
+            *payload_size = size - fixed;
+        }
+        return true;
+    }
+
+    // BATCH子消息占用的字节数
+    constexpr size_t batchItemSize(size_t size)
+    {
+        return sizeof(BatchItemHeader) + size;
+    }
+
+    // 在BATCH消息体中追加一条子消息,out至少batchItemSize(size)字节,返回写入的字节数
+    inline size_t encodeBatchItem(char *out, MSG_type type, const void *data, size_t size)
+    {
+        BatchItemHeader item{static_cast<uint32_t>(type), static_cast<uint32_t>(size)};
+        memcpy(out, &item, sizeof(item));
+        if (size > 0)
+        {
+            memcpy(out + sizeof(item), data, size);
+        }
+        return batchItemSize(size);
+    }
+
+    // 一次遍历BATCH消息体(消息头之后的部分),对每条子消息调用visit(MSG_type, const char *data, size_t size)
+    // visit返回false时停止;子消息长度越界、数量超过MAX_BATCH_ITEMS或visit返回false时整体返回false
+    template <typename Visitor>
+    bool forEachBatchItem(const char *data, size_t size, Visitor &&visit)
+    {
+        size_t offset = 0;
+        size_t count = 0;
+        while (offset < size)
+        {
+            if (size - offset < sizeof(BatchItemHeader) || ++count > MAX_BATCH_ITEMS)
+            {
+                return false;
+            }
+            BatchItemHeader item;
+            memcpy(&item, data + offset, sizeof(item));
+            offset += sizeof(item);
+            if (item.length > size - offset)
+            {
+                return false;
+            }
+            if (!visit(static_cast<MSG_type>(item.type), data + offset, static_cast<size_t>(item.length)))
+            {
+                return false;
+            }
+            offset += item.length;
+        }
+        return true;
+    }
+
+    // ROSTER条目占用的字节数
+    constexpr size_t rosterEntrySize(size_t name_length)
+    {
+        return sizeof(RosterEntryHeader) + name_length;
+    }
+
+    // 在ROSTER消息体中追加一个条目,out至少rosterEntrySize(name_length)字节,返回写入的字节数
+    inline size_t encodeRosterEntry(char *out, uint32_t user_id, uint8_t op, const char *name, size_t name_length)
+    {
+        RosterEntryHeader entry{user_id, op, static_cast<uint8_t>(name_length), 0};
+        memcpy(out, &entry, sizeof(entry));
+        if (name_length > 0)
+        {
+            memcpy(out + sizeof(entry), name, name_length);
+        }
+        return rosterEntrySize(name_length);
+    }
+
+    // 解析ROSTER消息体,对每个条目调用visit(uint32_t user_id, uint8_t op, const char *name, size_t name_length)
+    // 条目越界或数量与count不符时返回false
+    template <typename Visitor>
+    bool forEachRosterEntry(const char *data, size_t size, RosterHeader &header, Visitor &&visit)
+    {
+        if (size < sizeof(RosterHeader))
+        {
+            return false;
+        }
+        memcpy(&header, data, sizeof(header));
+        size_t offset = sizeof(RosterHeader);
+        for (uint32_t i = 0; i < header.count; ++i)
+        {
+            if (size - offset < sizeof(RosterEntryHeader))
+            {
+                return false;
+            }
+            RosterEntryHeader entry;
+            memcpy(&entry, data + offset, sizeof(entry));
+            offset += sizeof(entry);
+            if (entry.name_length > size - offset)
+            {
+                return false;
+            }
+            visit(entry.user_id, entry.op, data + offset, static_cast<size_t>(entry.name_length));
+            offset += entry.name_length;
+        }
+        return offset == size;
+    }
+
+    // 客户端发往服务器的各类消息的消息体长度上限,0表示不接受带消息体的该类消息;未知类型返回false
+    constexpr bool maxBodySize(MSG_type type, size_t &limit)
+    {
+        switch (type)
+        {
+        case REGISTER:
+        case LOGIN:
+            limit = MAX_AUTH_BODY_SIZE;
+            return true;
+        case JOIN:
+        case EXIT:
+        case ROOM_JOIN:
+        case ROOM_LEAVE:
+        case ROOM_LIST:
+            limit = MAX_PRESENCE_BODY_SIZE;
+            return true;
+        case GROUP_MSG:
+        case TEST:
+            limit = MAX_TEXT_BODY_SIZE;
+            return true;
+        case DIRECT_MSG:
+            limit = Message<DIRECT_MSG>::body_size + MAX_TEXT_BODY_SIZE;
+            return true;
+        case FILE_MSG:
+            limit = Message<FILE_MSG>::body_size + FILE_DIGEST_SIZE;
+            return true;
+        case FILE_DATA:
+            limit = Message<FILE_DATA>::body_size + sizeof(FileChunkHeader) + MAX_FILE_CHUNK_SIZE;
+            return true;
+        case FILE_END:
+            limit = Message<FILE_END>::body_size;
+            return true;
+        case BATCH:
+            limit = MAX_BATCH_BODY_SIZE;
+            return true;
+        case PING:
+        case PONG:
+            limit = Message<PING>::body_size;
+            return true;
+        case ACK:
+        case RESUME:
+            limit = Message<ACK>::body_size;
+            return true;
+        case REGISTER_success:
+        case REGISTER_failed:
+        case LOGIN_success:
+        case LOGIN_failed:
+        case INITIAL:
+        case TEST_success:
+        case FILE_ACCEPT:
+        case FILE_EXISTS:
+        case FILE_CREDIT:
+        case ROSTER:
+        case DIRECT_FAILED:
+        case JOIN_failed:
+            limit = 0; // 只由服务器发出
+            return true;
+        }
+        return false;
+    }
+}
@@ -2,44 +2,81 @@
 
 #include <string>
 #include <cstring>
+#include <cstddef>
+#include <cstdint>
 #include <vector>
+#include <memory>
+#include <atomic>
 #include <arpa/inet.h>
 #include "logger/log_macros.hpp"
-
-#define MAX_NAMEBUFFER 64
-#define MAX_FILENAME 256
+#include "MessageSchema.hpp"
 
 /*
 协议设计:
 0. 消息头的length表示消息内容的长度，不包括头部
-1. 客户端请求连接后发送JOIN消息
+1. 客户端请求连接后发送JOIN消息;用户名为空或已有同名用户在线时服务器回复JOIN_failed(原因),客户端可换名重试
 2. 服务器接收到JOIN消息后，回复INITIAL消息，数据为在线用户列表,同时向其他客户端发送JOIN消息
 3. 服务器接收到GROUP_MSG消息后，向所有在线用户广播该消息
 4. 文件传输协议：
    - FILE_MSG: 文件传输开始，数据为文件元数据--FileInfo
    - FILE_DATA: 文件数据块
    - FILE_END: 文件传输结束标志
+   - FileInfo中带有content_hash(XXH64)时,发送方等服务器回复FILE_ACCEPT后才开始发送FILE_DATA;
+     FileInfo之后还附有整文件SHA-256摘要时,服务器先按摘要查内容寻址的文件池,
+     已有该文件则改为回复FILE_EXISTS并直接由服务器向其他客户端下发已有副本,
+     新文件上传完毕后由服务器重新计算SHA-256,与声明一致才入池
+   - content_hash为0(或旧版客户端的短FileInfo)时保持原流程,直接发送FILE_DATA
+   - 多路文件流:FileInfo中的stream_id由发送方分配,同一连接上可同时存在多个文件流;
+     FILE_DATA/FILE_END/FILE_ACCEPT/FILE_EXISTS的数据部分以FileStreamHeader开头,
+     接收方用(发送者名称, stream_id)区分并发的传输
+   - 旧版短FileInfo(不含stream_id)的发送方只能单路传输,其FILE_DATA/FILE_END不带FileStreamHeader,
+     服务器将其视为stream_id为0的流,转发给接收方时统一补上FileStreamHeader
+   - 基于额度的流控:FileInfo.flags带FILE_FLAG_FLOW_CONTROL的文件流,发送方只能发送服务器授予额度内的数据;
+     服务器在FILE_MSG后授予初始窗口,每个数据块被最慢的接收方发送完毕后,再以FILE_CREDIT归还对应额度,
+     因此在途文件数据的内存占用与聊天室人数无关地保持有界
+   - 可选的分片压缩:FileInfo.flags带FILE_FLAG_COMPRESS_LZ4或FILE_FLAG_COMPRESS_ZSTD的文件流,
+     每个FILE_DATA在FileStreamHeader之后是FileChunkHeader加压缩数据(压缩无收益的分片原样存放);
+     压缩与解压只在客户端进行,服务器原样转发压缩字节,流控额度也按压缩后的字节计算
 5. 客户端发送EXIT消息时，服务器将其从在线用户列表中移除，并向其他用户广播该用户已退出
+6. 线格式:默认使用本文件的MSG_header帧头;客户端可在连接后先发送HELLO协商紧凑的v2帧头(见WireFormat.hpp)
+   服务器内部始终按MSG_header格式处理和缓存消息,只在收发两端与v2帧头互相转换,消息体保持不变
+   JOIN/EXIT的消息体携带用户名,INITIAL对v2客户端为"ID:用户名"列表,供v2客户端建立用户ID到用户名的映射
+7. 用户ID:服务器在JOIN时为用户分配稠密的32位ID(退出后回收复用),在线用户表以ID为下标保存用户名和连接;
+   EXIT广播发出后才回收ID,因此v2客户端收到的EXIT帧头仍是退出者的ID
+8. BATCH:一帧内依次排列多条子消息(BatchItemHeader加数据),目前只接受GROUP_MSG子消息;
+   服务器一次解析校验后整帧转发,v2客户端收到同一个BATCH帧,旧版格式的客户端收到拆开的GROUP_MSG
+9. 长度上限:服务器解析帧头后立即按schema::maxBodySize检查消息类型和长度,未知类型或超长的消息直接断开连接,
+   不缓冲其消息体;每个连接的读缓冲区不超过MAX_INGRESS_BUFFER。
+   大的FILE_DATA(带内容哈希的文件流)不等整帧到齐就开始转发,发送方中途断开时该帧剩余部分以0补齐,
+   接收方通过内容哈希校验发现文件损坏;发送方停止发送超过5秒时同样补0并结束该文件流(FILE_END),
+   避免该帧一直挡住接收方的其它消息,发送方迟到的剩余数据被丢弃
+10. 用户表版本:每次上线/下线使用户表版本加1并记入有界的变更日志(UserRegistry)。v2客户端在JOIN消息体中
+   携带本地用户表的版本,服务器回复ROSTER:版本仍在日志范围内时只含其后的增量,否则是分页的完整快照;
+   未携带版本的客户端仍收到文本格式的INITIAL
+11. 心跳:服务器每10秒向已JOIN的连接发送PING(8字节序号),客户端原样回复PONG;往返时延从PING写入socket算起,
+   按连接和全局分别记入log2直方图。支持心跳的连接(v2或回复过PONG)在PING写出后连续3个周期未回复即被关闭,
+   旧版客户端不认识PING,仍依赖TCP发现断线。客户端也可以发送PING,服务器原样回复PONG
+12. 聊天室序号:广播的聊天消息按到达顺序分配单调递增的序号并记入有界的聊天室日志(RoomLog)。v2客户端发送
+   RESUME(8字节,上次收到的序号,首次连接为0)后,收到的聊天消息在帧头中携带序号(WIRE_FLAG_SEQUENCE),
+   自己发出的消息只回复ACK(分配到的序号);客户端定期发送ACK累积确认。RESUME在JOIN之前发送时,补发与JOIN
+   在同一把锁内完成,补发的消息与之后的实时消息之间既不重复也不遗漏;服务器回复RESUME(补发起点之前的序号),
+   大于请求的序号说明中间的消息已超出日志范围。补发的消息(以及进入聊天室时补发的最近历史)的发送者可能早已下线,
+   其ID已回收或被他人复用,协商到v3的客户端收到的补发帧头带发送者用户名(WIRE_FLAG_SENDER_NAME),不依赖补发时的在线用户表
+13. 群消息(含BATCH中的子消息)在服务器入口校验UTF-8,非法的字节序列替换为U+FFFD后再转发,
+   接收方收到的文本总是合法的UTF-8;随后按敏感词表(KeywordFilter)拒绝、打码或标记,BATCH中被拒绝的子消息单独丢弃
+14. 聊天室:每个连接同一时刻在一个聊天室中,JOIN登录后进入大厅(lobby)。GROUP_MSG/BATCH、FILE_*以及JOIN/EXIT
+   只发给同一聊天室的成员,序号(见12)按聊天室各自分配。ROOM_JOIN(消息体为名称,不存在时创建)离开当前聊天室
+   并进入目标聊天室,ROOM_LEAVE回到大厅;服务器依次回复ROOM_JOIN(进入的聊天室名称)、INITIAL(该聊天室的成员列表)
+   和带序号连接的RESUME(新聊天室的当前序号),原聊天室成员收到EXIT,新聊天室成员收到JOIN。ROOM_LIST回复
+   "名称:人数"列表。文件流发往FILE_MSG时所在的聊天室,中途切换聊天室不影响进行中的传输。
+   v2的ROSTER仍是全体在线用户的ID字典,只用于解析发送者ID
+15. 私聊:DIRECT_MSG的消息体为DirectInfo(接收方ID或用户名)加文本,与所在聊天室无关。服务器经在线用户表按ID下标
+   或用户名索引直接找到接收方连接,不遍历连接表;文本与群消息经过相同的UTF-8校验和敏感词过滤,转发时DirectInfo
+   改为接收方的实际ID和用户名。接收方不在线时按用户名存入其离线收件箱(OfflineInbox,有大小上限和保留时间),
+   接收方JOIN后分批投递,DirectInfo中的ID为0,v3客户端收到的帧头带发送者用户名(发送者此时可能已下线);
+   只有登录过的用户名才有收件箱(登记表随收件箱保存,重启后仍有效),接收方从未登录过、只给出ID(无法确定用户名)
+   或收件箱已满时发送方收到DIRECT_FAILED
 */
-enum MSG_type
-{
-    REGISTER,
-    REGISTER_success,
-    REGISTER_failed,
-    LOGIN,
-    LOGIN_success,
-    LOGIN_failed,
-
-    INITIAL,
-    JOIN,
-    EXIT,
-    GROUP_MSG,
-    FILE_MSG,
-    FILE_DATA,
-    FILE_END,
-    TEST,            // 新增测试协议类型
-    TEST_success     // 服务器对TEST协议的成功响应
-};
 
 // enum_to_string
 inline const char *getMessageTypeName(MSG_type type)
@@ -72,40 +109,65 @@ inline const char *getMessageTypeName(MSG_type type)
         return "FILE_DATA";
     case FILE_END:
         return "FILE_END";
+    case TEST:
+        return "TEST";
+    case TEST_success:
+        return "TEST_success";
+    case FILE_ACCEPT:
+        return "FILE_ACCEPT";
+    case FILE_EXISTS:
+        return "FILE_EXISTS";
+    case FILE_CREDIT:
+        return "FILE_CREDIT";
+    case BATCH:
+        return "BATCH";
+    case ROSTER:
+        return "ROSTER";
+    case PING:
+        return "PING";
+    case PONG:
+        return "PONG";
+    case ACK:
+        return "ACK";
+    case RESUME:
+        return "RESUME";
+    case ROOM_JOIN:
+        return "ROOM_JOIN";
+    case ROOM_LEAVE:
+        return "ROOM_LEAVE";
+    case ROOM_LIST:
+        return "ROOM_LIST";
+    case DIRECT_MSG:
+        return "DIRECT_MSG";
+    case DIRECT_FAILED:
+        return "DIRECT_FAILED";
+    case JOIN_failed:
+        return "JOIN_failed";
     default:
         return "UNKNOWN";
     }
 }
 
-// 定义消息头结构
-// 这里的长度字段是指消息内容的长度，不包括头部
-// 头部包含发送者名称、消息类型和消息长度
-struct MSG_header
-{
-    char sender_name[MAX_NAMEBUFFER];
-    MSG_type Type;
-    size_t length;
-};
+// 编码完成的消息帧,广播时所有接收方的写队列共享同一份,不再逐个拷贝
+using SharedFrame = std::shared_ptr<const std::vector<char>>;
+// 边收边转发(cut-through)的消息帧中已经到达的字节数,接收方只发送这之前的部分;为空表示整帧已就绪
+using FrameProgress = std::shared_ptr<const std::atomic<size_t>>;
 
-// 文件信息结构（用于FILE_MSG）
-struct FileInfo
+// 改写消息帧头部的发送者名称,消息体保持不动
+// 服务器转发客户端发来的消息时只改写必须由服务器保证的字段,无需解码后重新编码
+inline void rewriteSenderName(std::vector<char> &frame, const std::string &sender)
 {
-    char filename[MAX_FILENAME];
-    size_t file_size;
-};
+    char name[MAX_NAMEBUFFER] = {};
+    strncpy(name, sender.c_str(), MAX_NAMEBUFFER - 1);
+    memcpy(frame.data() + offsetof(MSG_header, sender_name), name, MAX_NAMEBUFFER);
+}
 
+// 以下编码函数生成独立的消息帧(一次分配,即返回的vector本身),帧布局由MessageSchema.hpp生成
 // 消息编码函数--将消息类型、发送者名称和消息内容编码为字节流(char数组)
 inline std::vector<char> encodeMessage(MSG_type type, const std::string &msg, const std::string &sender = "Server")
 {
-    MSG_header header;
-    strncpy(header.sender_name, sender.c_str(), MAX_NAMEBUFFER - 1);
-    header.sender_name[MAX_NAMEBUFFER - 1] = '\0';
-    header.Type = type;
-    header.length = msg.length();
-
-    std::vector<char> packet(sizeof(header) + msg.length());
-    memcpy(packet.data(), &header, sizeof(header));
-    memcpy(packet.data() + sizeof(header), msg.c_str(), msg.length());
+    std::vector<char> packet(sizeof(MSG_header) + msg.length());
+    schema::encodeText(packet.data(), type, sender.c_str(), msg.data(), msg.length());
 
     LOG_DEBUG("[发送] 消息类型: {}, 发送者: {}, 长度: {}, 内容: {}",
               getMessageTypeName(type), sender, msg.length(), msg);
@@ -127,61 +189,92 @@ inline std::vector<char> encodeMessage(const MSG_header &header, const std::stri
     return message;
 }
 
-// 编码文件开始消息--发送者名称、文件名和文件大小
-inline std::vector<char> encodeFileStartMessage(const std::string &sender, const std::string &filename, size_t file_size)
+// 编码文件开始消息--发送者名称、文件名、文件大小、内容哈希、流ID和标志位
+inline std::vector<char> encodeFileStartMessage(const std::string &sender, const std::string &filename, size_t file_size,
+                                                uint64_t content_hash, uint32_t stream_id, uint32_t flags = 0)
 {
-    MSG_header header;
-    strncpy(header.sender_name, sender.c_str(), MAX_NAMEBUFFER - 1);
-    header.sender_name[MAX_NAMEBUFFER - 1] = '\0';
-    header.Type = FILE_MSG;
-    header.length = sizeof(FileInfo);
-
-    FileInfo file_info;
+    FileInfo file_info{};
     strncpy(file_info.filename, filename.c_str(), MAX_FILENAME - 1);
-    file_info.filename[MAX_FILENAME - 1] = '\0';
     file_info.file_size = file_size;
+    file_info.content_hash = content_hash;
+    file_info.stream_id = stream_id;
+    file_info.flags = flags;
 
-    std::vector<char> packet(sizeof(header) + sizeof(FileInfo));
-    memcpy(packet.data(), &header, sizeof(header));
-    memcpy(packet.data() + sizeof(header), &file_info, sizeof(FileInfo));
+    std::vector<char> packet(schema::frameSize<FILE_MSG>());
+    schema::encode<FILE_MSG>(packet.data(), sender.c_str(), file_info);
 
-    LOG_DEBUG("[发送] 文件开始消息 - 发送者: {}, 文件名: {}, 大小: {}",
-              sender, filename, file_size);
+    LOG_DEBUG("[发送] 文件开始消息 - 发送者: {}, 流: {}, 文件名: {}, 大小: {}",
+              sender, stream_id, filename, file_size);
 
     return packet;
 }
 
-// 编码文件数据消息
-inline std::vector<char> encodeFileDataMessage(const std::string &sender, const std::vector<char> &data)
+// 编码文件数据消息--数据部分为FileStreamHeader加文件数据
+inline std::vector<char> encodeFileDataMessage(const std::string &sender, uint32_t stream_id,
+                                               const char *data, size_t size)
 {
-    MSG_header header;
-    strncpy(header.sender_name, sender.c_str(), MAX_NAMEBUFFER - 1);
-    header.sender_name[MAX_NAMEBUFFER - 1] = '\0';
-    header.Type = FILE_DATA;
-    header.length = data.size();
+    std::vector<char> packet(schema::frameSize<FILE_DATA>(size));
+    schema::encode<FILE_DATA>(packet.data(), sender.c_str(), FileStreamHeader{stream_id}, data, size);
 
-    std::vector<char> packet(sizeof(header) + data.size());
-    memcpy(packet.data(), &header, sizeof(header));
-    memcpy(packet.data() + sizeof(header), data.data(), data.size());
+    LOG_DEBUG("[发送] 文件数据消息 - 发送者: {}, 流: {}, 数据大小: {}", sender, stream_id, size);
 
-    LOG_DEBUG("[发送] 文件数据消息 - 发送者: {}, 数据大小: {}", sender, data.size());
+    return packet;
+}
+
+// 编码只携带流ID的文件流消息:FILE_END/FILE_ACCEPT/FILE_EXISTS
+inline std::vector<char> encodeFileStreamMessage(MSG_type type, const std::string &sender, uint32_t stream_id)
+{
+    static_assert(schema::frameSize<FILE_END>() == schema::frameSize<FILE_ACCEPT>() &&
+                      schema::frameSize<FILE_END>() == schema::frameSize<FILE_EXISTS>(),
+                  "文件流消息布局应当一致");
+
+    // 三种消息布局相同,消息类型在运行期决定
+    std::vector<char> packet(schema::frameSize<FILE_END>());
+    FileStreamHeader stream_header{stream_id};
+    schema::encodeText(packet.data(), type, sender.c_str(), &stream_header, sizeof(stream_header));
+
+    LOG_DEBUG("[发送] {} - 发送者: {}, 流: {}", getMessageTypeName(type), sender, stream_id);
 
     return packet;
 }
 
-// 编码文件结束消息
-inline std::vector<char> encodeFileEndMessage(const std::string &sender)
+// 编码文件流额度消息
+inline std::vector<char> encodeFileCreditMessage(uint32_t stream_id, uint64_t credit_bytes)
 {
-    MSG_header header;
-    strncpy(header.sender_name, sender.c_str(), MAX_NAMEBUFFER - 1);
-    header.sender_name[MAX_NAMEBUFFER - 1] = '\0';
-    header.Type = FILE_END;
-    header.length = 0;
+    FileCreditInfo credit{};
+    credit.stream_id = stream_id;
+    credit.credit_bytes = credit_bytes;
 
-    std::vector<char> packet(sizeof(header));
-    memcpy(packet.data(), &header, sizeof(header));
+    std::vector<char> packet(schema::frameSize<FILE_CREDIT>());
+    schema::encode<FILE_CREDIT>(packet.data(), "SERVER", credit);
 
-    LOG_DEBUG("[发送] 文件结束消息 - 发送者: {}", sender);
+    LOG_DEBUG("[发送] 文件额度消息 - 流: {}, 额度: {}", stream_id, credit_bytes);
 
     return packet;
-}
\ No newline at end of file
+}
+
+// 编码序号消息(ACK或RESUME,二者布局相同)
+inline std::vector<char> encodeSequenceMessage(MSG_type type, uint64_t sequence)
+{
+    SequenceInfo info{sequence};
+    std::vector<char> packet(schema::frameSize<ACK>());
+    schema::encodeText(packet.data(), type, "SERVER", &info, sizeof(info));
+    return packet;
+}
+
+// 编码心跳消息(PING或PONG,二者布局相同)
+inline std::vector<char> encodePingMessage(MSG_type type, uint64_t sequence)
+{
+    PingInfo ping{sequence};
+    std::vector<char> packet(schema::frameSize<PING>());
+    schema::encodeText(packet.data(), type, "SERVER", &ping, sizeof(ping));
+    return packet;
+}
+
+// 编码私聊失败消息,消息体为发送方原来填写的DirectInfo
+inline std::vector<char> encodeDirectFailedMessage(const DirectInfo &info)
+{
+    std::vector<char> packet(schema::frameSize<DIRECT_FAILED>());
+    schema::encode<DIRECT_FAILED>(packet.data(), "SERVER", info);
+    return packet;
+}
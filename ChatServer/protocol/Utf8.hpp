@@ -0,0 +1,269 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define UTF8_HAVE_AVX2 1
+#endif
+
+// UTF-8校验与修复(RFC 3629:拒绝过长编码、代理区码点和大于U+10FFFF的码点)
+// 群消息在服务器入口校验一次再扇出,接收方不必各自处理乱码
+// x86-64上运行时检测AVX2,使用Keiser-Lemire查表算法每次处理32字节;其它平台或不支持AVX2时使用标量实现
+// 修复只在校验失败时进行,走标量路径即可
+namespace utf8
+{
+    // 解析p开头的一个字符:合法时返回字节数(1~4);非法时返回-k,k为需要替换的最长非法前缀(至少1字节)
+    inline int sequenceLength(const unsigned char *p, size_t size)
+    {
+        unsigned char lead = p[0];
+        if (lead < 0x80)
+            return 1;
+
+        int need;
+        unsigned char low = 0x80, high = 0xBF; // 第二个字节的合法范围,其余后续字节均为80~BF
+        if (lead >= 0xC2 && lead <= 0xDF)
+        {
+            need = 1;
+        }
+        else if (lead >= 0xE0 && lead <= 0xEF)
+        {
+            need = 2;
+            if (lead == 0xE0)
+                low = 0xA0; // 过长编码
+            else if (lead == 0xED)
+                high = 0x9F; // 代理区D800~DFFF
+        }
+        else if (lead >= 0xF0 && lead <= 0xF4)
+        {
+            need = 3;
+            if (lead == 0xF0)
+                low = 0x90; // 过长编码
+            else if (lead == 0xF4)
+                high = 0x8F; // 超过U+10FFFF
+        }
+        else
+        {
+            return -1; // 孤立的后续字节、C0/C1过长编码、F5~FF
+        }
+
+        for (int i = 1; i <= need; ++i)
+        {
+            if (static_cast<size_t>(i) >= size || p[i] < low || p[i] > high)
+                return -i;
+            low = 0x80;
+            high = 0xBF;
+        }
+        return need + 1;
+    }
+
+    inline bool validateScalar(const char *data, size_t size)
+    {
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+        size_t i = 0;
+        while (i < size)
+        {
+            // ASCII一次跳过8字节
+            if (size - i >= 8)
+            {
+                uint64_t word;
+                memcpy(&word, p + i, sizeof(word));
+                if ((word & 0x8080808080808080ULL) == 0)
+                {
+                    i += 8;
+                    continue;
+                }
+            }
+            int n = sequenceLength(p + i, size - i);
+            if (n < 0)
+                return false;
+            i += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+#ifdef UTF8_HAVE_AVX2
+    namespace detail
+    {
+        // 查表算法的错误类别:一对相邻字节(前一字节的高/低4位,当前字节的高4位)查三张表,三者按位与非0即出错
+        constexpr uint8_t TOO_SHORT = 1 << 0;      // 11______ 0_______ 或 11______ 11______
+        constexpr uint8_t TOO_LONG = 1 << 1;       // 0_______ 10______
+        constexpr uint8_t OVERLONG_3 = 1 << 2;     // 11100000 100_____
+        constexpr uint8_t TOO_LARGE = 1 << 3;      // 11110100 1001____ 等
+        constexpr uint8_t SURROGATE = 1 << 4;      // 11101101 101_____
+        constexpr uint8_t OVERLONG_2 = 1 << 5;     // 1100000_ 10______
+        constexpr uint8_t TOO_LARGE_1000 = 1 << 6; // 11110101 1000____ 等
+        constexpr uint8_t OVERLONG_4 = 1 << 6;     // 11110000 1000____
+        constexpr uint8_t TWO_CONTS = 1 << 7;      // 10______ 10______(3/4字节字符中合法,另行检查)
+        constexpr uint8_t CARRY = TOO_SHORT | TOO_LONG | TWO_CONTS;
+
+        __attribute__((target("avx2"))) inline __m256i table16(uint8_t v0, uint8_t v1, uint8_t v2, uint8_t v3,
+                                                                uint8_t v4, uint8_t v5, uint8_t v6, uint8_t v7,
+                                                                uint8_t v8, uint8_t v9, uint8_t v10, uint8_t v11,
+                                                                uint8_t v12, uint8_t v13, uint8_t v14, uint8_t v15)
+        {
+            // pshufb在每个128位通道内独立查表,两个通道放同一张表
+            return _mm256_setr_epi8(v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15,
+                                    v0, v1, v2, v3, v4, v5, v6, v7, v8, v9, v10, v11, v12, v13, v14, v15);
+        }
+
+        // 把上一块的末尾N字节接到当前块前面:结果的第i字节是输入中第i-N个字节
+        template <int N>
+        __attribute__((target("avx2"))) inline __m256i prev(__m256i input, __m256i prev_input)
+        {
+            return _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev_input, input, 0x21), 16 - N);
+        }
+
+        __attribute__((target("avx2"))) inline __m256i high4(__m256i v)
+        {
+            return _mm256_and_si256(_mm256_srli_epi16(v, 4), _mm256_set1_epi8(0x0F));
+        }
+
+        struct Avx2Checker
+        {
+            __m256i error;
+            __m256i prev_input;
+            __m256i prev_incomplete; // 上一块末尾是否有未结束的多字节字符
+
+            __attribute__((target("avx2"))) Avx2Checker()
+                : error(_mm256_setzero_si256()), prev_input(_mm256_setzero_si256()),
+                  prev_incomplete(_mm256_setzero_si256())
+            {
+            }
+
+            __attribute__((target("avx2"))) void check(__m256i input)
+            {
+                // 整块都是ASCII时只需确认上一块没有截断的字符
+                if (_mm256_movemask_epi8(input) == 0)
+                {
+                    error = _mm256_or_si256(error, prev_incomplete);
+                    prev_input = input;
+                    prev_incomplete = _mm256_setzero_si256();
+                    return;
+                }
+
+                __m256i prev1 = prev<1>(input, prev_input);
+                __m256i byte_1_high = _mm256_shuffle_epi8(
+                    table16(TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+                            TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+                            TOO_SHORT | OVERLONG_2,
+                            TOO_SHORT,
+                            TOO_SHORT | OVERLONG_3 | SURROGATE,
+                            TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4),
+                    high4(prev1));
+                __m256i byte_1_low = _mm256_shuffle_epi8(
+                    table16(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+                            CARRY | OVERLONG_2,
+                            CARRY,
+                            CARRY,
+                            CARRY | TOO_LARGE,
+                            CARRY | TOO_LARGE | TOO_LARGE_1000,
+                            CARRY | TOO_LARGE | TOO_LARGE_1000,
+                            CARRY | TOO_LARGE | TOO_LARGE_1000,
+                            CARRY | TOO_LARGE | TOO_LARGE_1000,
+                            CARRY | TOO_LARGE | TOO_LARGE_1000,
+                            CARRY | TOO_LARGE | TOO_LARGE_1000,
+                            CARRY | TOO_LARGE | TOO_LARGE_1000,
+                            CARRY | TOO_LARGE | TOO_LARGE_1000,
+                            CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+                            CARRY | TOO_LARGE | TOO_LARGE_1000,
+                            CARRY | TOO_LARGE | TOO_LARGE_1000),
+                    _mm256_and_si256(prev1, _mm256_set1_epi8(0x0F)));
+                __m256i byte_2_high = _mm256_shuffle_epi8(
+                    table16(TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+                            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+                            TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+                            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+                            TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+                            TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT),
+                    high4(input));
+                __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+                // 两字节前是3/4字节首字节、或三字节前是4字节首字节的位置必须是后续字节,
+                // 此时TWO_CONTS(0x80)恰好应当置位,异或后剩下的位都是错误
+                __m256i is_third = _mm256_subs_epu8(prev<2>(input, prev_input), _mm256_set1_epi8(0xE0 - 0x80));
+                __m256i is_fourth = _mm256_subs_epu8(prev<3>(input, prev_input), _mm256_set1_epi8(0xF0 - 0x80));
+                __m256i must23_80 = _mm256_and_si256(_mm256_or_si256(is_third, is_fourth),
+                                                     _mm256_set1_epi8(static_cast<char>(0x80)));
+                error = _mm256_or_si256(error, _mm256_xor_si256(must23_80, special));
+
+                // 末尾3字节中出现的首字节还需要后续字节
+                const __m256i max_value = _mm256_setr_epi8(
+                    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                    static_cast<char>(0xF0 - 1), static_cast<char>(0xE0 - 1), static_cast<char>(0xC0 - 1));
+                prev_incomplete = _mm256_subs_epu8(input, max_value);
+                prev_input = input;
+            }
+
+            __attribute__((target("avx2"))) bool finish()
+            {
+                error = _mm256_or_si256(error, prev_incomplete);
+                return _mm256_testz_si256(error, error) != 0;
+            }
+        };
+
+        __attribute__((target("avx2"))) inline bool validateAvx2(const char *data, size_t size)
+        {
+            Avx2Checker checker;
+            size_t i = 0;
+            for (; i + 32 <= size; i += 32)
+            {
+                checker.check(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i)));
+            }
+            if (i < size)
+            {
+                // 不足32字节的尾部补0(ASCII),截断的多字节字符会被识别为TOO_SHORT
+                alignas(32) char tail[32] = {};
+                memcpy(tail, data + i, size - i);
+                checker.check(_mm256_load_si256(reinterpret_cast<const __m256i *>(tail)));
+            }
+            return checker.finish();
+        }
+
+        inline bool hasAvx2()
+        {
+            static const bool supported = __builtin_cpu_supports("avx2");
+            return supported;
+        }
+    } // namespace detail
+#endif
+
+    // 校验data是否为合法的UTF-8
+    inline bool validate(const char *data, size_t size)
+    {
+#ifdef UTF8_HAVE_AVX2
+        if (detail::hasAvx2())
+            return detail::validateAvx2(data, size);
+#endif
+        return validateScalar(data, size);
+    }
+
+    // 把每个最长非法前缀替换为U+FFFD(与QString::fromUtf8等主流解码器的替换方式一致),合法部分原样保留
+    inline std::string repair(const char *data, size_t size)
+    {
+        static const char REPLACEMENT[] = "\xEF\xBF\xBD";
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(data);
+        std::string out;
+        out.reserve(size + 8);
+        size_t i = 0;
+        while (i < size)
+        {
+            int n = sequenceLength(p + i, size - i);
+            if (n > 0)
+            {
+                out.append(data + i, static_cast<size_t>(n));
+                i += static_cast<size_t>(n);
+            }
+            else
+            {
+                out.append(REPLACEMENT, 3);
+                i += static_cast<size_t>(-n);
+            }
+        }
+        return out;
+    }
+} // namespace utf8
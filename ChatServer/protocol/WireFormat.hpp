@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// v2紧凑线格式(与旧版MSG_header并存)
+// 旧版帧头是直接发送的MSG_header结构体:64字节用户名+4字节枚举+4字节填充+8字节长度,共80字节且依赖主机字节序
+// v2帧头为小端变长编码,一条短聊天消息的帧头只有4~5字节:
+//   uint8  type       消息类型(MSG_type)
+//   uint8  flags      WIRE_FLAG_*,未使用的位置0
+//   varint sender_id  发送者ID,0表示服务器
+//   varint length     消息体长度
+//   varint sequence   仅在flags含WIRE_FLAG_SEQUENCE时出现:聊天室消息的序号
+//   uint8+bytes name  仅在flags含WIRE_FLAG_SENDER_NAME时出现:发送者用户名(长度+UTF-8),此时sender_id为0
+// 握手:客户端连接后发送的第一帧若是4字节HELLO {0x00,'R','C',版本},服务器回复同样格式的HELLO(携带选定的版本),
+// 此后双方都使用该版本的帧头;旧版客户端的第一帧是以用户名开头的MSG_header,首字节不为0,据此区分
+// 服务器和Qt客户端共用这一份实现,只依赖标准库
+constexpr uint8_t WIRE_VERSION_LEGACY = 1;
+constexpr uint8_t WIRE_VERSION_V2 = 2;
+// 帧头格式与v2相同,另外认识WIRE_FLAG_SENDER_NAME;服务器只向协商到此版本的连接发送带用户名的帧头
+constexpr uint8_t WIRE_VERSION_V3 = 3;
+
+constexpr size_t WIRE_HELLO_SIZE = 4;
+
+// 帧头携带序号;服务器只向发送过RESUME的连接发送带此标志的帧头,旧的v2客户端不会收到
+constexpr uint8_t WIRE_FLAG_SEQUENCE = 0x01;
+// 帧头直接携带发送者用户名:补发的历史消息、离线消息的发送者可能已下线,其ID已回收或接收方不认识
+constexpr uint8_t WIRE_FLAG_SENDER_NAME = 0x02;
+
+// v2下尚未分配发送者ID的消息(LOGIN/REGISTER/JOIN)在消息体开头携带用户名:uint8长度+用户名
+constexpr size_t WIRE_V2_MAX_NAME_SIZE = 63;
+
+// type+flags, uint32 varint, 2个uint64 varint, 用户名
+constexpr size_t WIRE_V2_MAX_HEADER_SIZE = 2 + 5 + 10 + 10 + 1 + WIRE_V2_MAX_NAME_SIZE;
+
+struct WireHeaderV2
+{
+    uint8_t type;
+    uint8_t flags;
+    uint32_t sender_id;
+    uint64_t length;
+    uint64_t sequence; // flags含WIRE_FLAG_SEQUENCE时有效
+    uint8_t sender_name_size;                // flags含WIRE_FLAG_SENDER_NAME时有效
+    char sender_name[WIRE_V2_MAX_NAME_SIZE]; // 不以0结尾
+};
+
+// 生成HELLO帧,out至少WIRE_HELLO_SIZE字节
+inline void encodeWireHello(unsigned char *out, uint8_t version)
+{
+    out[0] = 0x00;
+    out[1] = 'R';
+    out[2] = 'C';
+    out[3] = version;
+}
+
+// 判断数据开头是否为HELLO帧:返回1表示是(version为其版本),0表示数据不足无法判断,-1表示不是
+inline int decodeWireHello(const unsigned char *data, size_t size, uint8_t &version)
+{
+    static const unsigned char magic[3] = {0x00, 'R', 'C'};
+    size_t check = size < 3 ? size : 3;
+    if (memcmp(data, magic, check) != 0)
+        return -1;
+    if (size < WIRE_HELLO_SIZE)
+        return 0;
+    version = data[3];
+    return 1;
+}
+
+// LEB128无符号变长整数,每字节低7位为数据,最高位表示后面还有字节
+inline size_t encodeVarint(unsigned char *out, uint64_t value)
+{
+    size_t n = 0;
+    while (value >= 0x80)
+    {
+        out[n++] = static_cast<unsigned char>(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = static_cast<unsigned char>(value);
+    return n;
+}
+
+// 返回消耗的字节数,数据不足返回0,超过max_bytes仍未结束(格式错误)返回-1
+inline int decodeVarint(const unsigned char *data, size_t size, uint64_t &value, size_t max_bytes)
+{
+    value = 0;
+    for (size_t i = 0; i < max_bytes; ++i)
+    {
+        if (i >= size)
+            return 0;
+        value |= static_cast<uint64_t>(data[i] & 0x7F) << (7 * i);
+        if ((data[i] & 0x80) == 0)
+            return static_cast<int>(i + 1);
+    }
+    return -1;
+}
+
+// 编码v2帧头,out至少WIRE_V2_MAX_HEADER_SIZE字节,返回帧头长度
+inline size_t encodeWireHeaderV2(unsigned char *out, const WireHeaderV2 &header)
+{
+    size_t n = 0;
+    out[n++] = header.type;
+    out[n++] = header.flags;
+    n += encodeVarint(out + n, header.sender_id);
+    n += encodeVarint(out + n, header.length);
+    if (header.flags & WIRE_FLAG_SEQUENCE)
+        n += encodeVarint(out + n, header.sequence);
+    if (header.flags & WIRE_FLAG_SENDER_NAME)
+    {
+        size_t name_size = header.sender_name_size < WIRE_V2_MAX_NAME_SIZE ? header.sender_name_size : WIRE_V2_MAX_NAME_SIZE;
+        out[n++] = static_cast<unsigned char>(name_size);
+        memcpy(out + n, header.sender_name, name_size);
+        n += name_size;
+    }
+    return n;
+}
+
+// 解析v2帧头:返回帧头长度,数据不足返回0,格式错误返回-1
+inline int decodeWireHeaderV2(const unsigned char *data, size_t size, WireHeaderV2 &header)
+{
+    if (size < 2)
+        return 0;
+    header.type = data[0];
+    header.flags = data[1];
+
+    uint64_t sender_id = 0;
+    int id_bytes = decodeVarint(data + 2, size - 2, sender_id, 5);
+    if (id_bytes <= 0)
+        return id_bytes;
+    if (sender_id > UINT32_MAX)
+        return -1;
+    header.sender_id = static_cast<uint32_t>(sender_id);
+
+    size_t offset = 2 + static_cast<size_t>(id_bytes);
+    int length_bytes = decodeVarint(data + offset, size - offset, header.length, 10);
+    if (length_bytes <= 0)
+        return length_bytes;
+    offset += static_cast<size_t>(length_bytes);
+
+    header.sequence = 0;
+    if (header.flags & WIRE_FLAG_SEQUENCE)
+    {
+        int sequence_bytes = decodeVarint(data + offset, size - offset, header.sequence, 10);
+        if (sequence_bytes <= 0)
+            return sequence_bytes;
+        offset += static_cast<size_t>(sequence_bytes);
+    }
+
+    header.sender_name_size = 0;
+    if (header.flags & WIRE_FLAG_SENDER_NAME)
+    {
+        if (offset >= size)
+            return 0;
+        size_t name_size = data[offset];
+        if (name_size > WIRE_V2_MAX_NAME_SIZE)
+            return -1;
+        if (size - offset - 1 < name_size)
+            return 0;
+        header.sender_name_size = static_cast<uint8_t>(name_size);
+        memcpy(header.sender_name, data + offset + 1, name_size);
+        offset += 1 + name_size;
+    }
+    return static_cast<int>(offset);
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+// XXH64流式哈希实现(与xxHash官方XXH64算法输出一致)
+// 用于文件内容寻址:客户端发送前计算整文件哈希,服务器在FILE_DATA流经时增量计算并校验
+// 只依赖标准库,服务器和Qt客户端共用这一份实现,保证两端哈希结果一致
+// 注意:按小端读取输入,服务器(x86-64)和客户端(Windows x64)均为小端平台
+class XXHash64
+{
+public:
+    explicit XXHash64(uint64_t seed = 0) { reset(seed); }
+
+    void reset(uint64_t seed = 0)
+    {
+        seed_ = seed;
+        v1_ = seed + PRIME1 + PRIME2;
+        v2_ = seed + PRIME2;
+        v3_ = seed;
+        v4_ = seed - PRIME1;
+        total_len_ = 0;
+        buffer_size_ = 0;
+    }
+
+    void update(const void *input, size_t length)
+    {
+        const unsigned char *p = static_cast<const unsigned char *>(input);
+        const unsigned char *end = p + length;
+        total_len_ += length;
+
+        // 先补齐上次剩余的不足32字节的数据
+        if (buffer_size_ + length < STRIPE)
+        {
+            memcpy(buffer_ + buffer_size_, p, length);
+            buffer_size_ += length;
+            return;
+        }
+        if (buffer_size_ > 0)
+        {
+            size_t fill = STRIPE - buffer_size_;
+            memcpy(buffer_ + buffer_size_, p, fill);
+            processStripe(buffer_);
+            p += fill;
+            buffer_size_ = 0;
+        }
+
+        // 主循环:每次处理32字节,四条独立的累加链便于CPU流水线并行
+        while (p + STRIPE <= end)
+        {
+            processStripe(p);
+            p += STRIPE;
+        }
+
+        if (p < end)
+        {
+            buffer_size_ = static_cast<size_t>(end - p);
+            memcpy(buffer_, p, buffer_size_);
+        }
+    }
+
+    uint64_t digest() const
+    {
+        uint64_t h;
+        if (total_len_ >= STRIPE)
+        {
+            h = rotl(v1_, 1) + rotl(v2_, 7) + rotl(v3_, 12) + rotl(v4_, 18);
+            h = mergeRound(h, v1_);
+            h = mergeRound(h, v2_);
+            h = mergeRound(h, v3_);
+            h = mergeRound(h, v4_);
+        }
+        else
+        {
+            h = seed_ + PRIME5;
+        }
+        h += total_len_;
+
+        const unsigned char *p = buffer_;
+        const unsigned char *end = buffer_ + buffer_size_;
+        while (p + 8 <= end)
+        {
+            h ^= round(0, read64(p));
+            h = rotl(h, 27) * PRIME1 + PRIME4;
+            p += 8;
+        }
+        if (p + 4 <= end)
+        {
+            h ^= static_cast<uint64_t>(read32(p)) * PRIME1;
+            h = rotl(h, 23) * PRIME2 + PRIME3;
+            p += 4;
+        }
+        while (p < end)
+        {
+            h ^= static_cast<uint64_t>(*p) * PRIME5;
+            h = rotl(h, 11) * PRIME1;
+            ++p;
+        }
+
+        // avalanche:打散高低位
+        h ^= h >> 33;
+        h *= PRIME2;
+        h ^= h >> 29;
+        h *= PRIME3;
+        h ^= h >> 32;
+        return h;
+    }
+
+    // 一次性计算整块数据的哈希
+    static uint64_t hash(const void *input, size_t length, uint64_t seed = 0)
+    {
+        XXHash64 hasher(seed);
+        hasher.update(input, length);
+        return hasher.digest();
+    }
+
+private:
+    static constexpr uint64_t PRIME1 = 11400714785074694791ULL;
+    static constexpr uint64_t PRIME2 = 14029467366897019727ULL;
+    static constexpr uint64_t PRIME3 = 1609587929392839161ULL;
+    static constexpr uint64_t PRIME4 = 9650029242287828579ULL;
+    static constexpr uint64_t PRIME5 = 2870177450012600261ULL;
+    static constexpr size_t STRIPE = 32;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    static uint64_t read64(const unsigned char *p)
+    {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint32_t read32(const unsigned char *p)
+    {
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint64_t round(uint64_t acc, uint64_t input)
+    {
+        acc += input * PRIME2;
+        acc = rotl(acc, 31);
+        acc *= PRIME1;
+        return acc;
+    }
+
+    static uint64_t mergeRound(uint64_t acc, uint64_t val)
+    {
+        val = round(0, val);
+        acc ^= val;
+        acc = acc * PRIME1 + PRIME4;
+        return acc;
+    }
+
+    void processStripe(const unsigned char *p)
+    {
+        v1_ = round(v1_, read64(p));
+        v2_ = round(v2_, read64(p + 8));
+        v3_ = round(v3_, read64(p + 16));
+        v4_ = round(v4_, read64(p + 24));
+    }
+
+    uint64_t seed_;
+    uint64_t v1_, v2_, v3_, v4_;
+    uint64_t total_len_;
+    unsigned char buffer_[STRIPE];
+    size_t buffer_size_;
+};
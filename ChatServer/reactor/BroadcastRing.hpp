@@ -0,0 +1,229 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Disruptor风格的广播环:生产者把一条消息写入环一次,每个消费通道(lane)用自己的游标顺序读取全部条目,
+// 只处理自己负责的那部分接收方。生产者之间用原子计数领取槽位,写完后按槽位发布序号,不加锁;
+// 通道之间互不同步,生产者只在环满时等待最慢的通道,通道只在环空时休眠。
+// 每个通道是一个专用线程,按发布顺序处理条目,因此同一接收方(固定属于一个通道)收到的顺序与发布顺序一致
+// 最后一个处理完条目的通道立即释放它,条目引用的资源(消息帧、接收方连接)不会在环中滞留到槽位被复用
+template <typename Entry>
+class BroadcastRing
+{
+public:
+    // 在通道线程上调用,处理该通道负责的接收方;不应阻塞或抛出异常
+    using Handler = std::function<void(size_t lane, const Entry &entry)>;
+
+    // capacity取整为2的幂
+    BroadcastRing(size_t capacity, size_t lanes, Handler handler);
+    ~BroadcastRing() { stop(); }
+
+    // 禁用拷贝构造和赋值
+    BroadcastRing(const BroadcastRing &) = delete;
+    BroadcastRing &operator=(const BroadcastRing &) = delete;
+
+    size_t laneCount() const { return lanes_.size(); }
+
+    // 发布一个条目;环满时等待最慢的通道腾出槽位。已停止时返回false
+    bool publish(Entry entry);
+    // 已领取的条目数,即下一个条目的序号;配合waitDrained(target)只等待此前领取的条目
+    uint64_t claimed() const { return claim_.load(); }
+    // 等待调用之前领取的全部条目都被所有通道处理完
+    void waitDrained() { waitDrained(claim_.load()); }
+    // 等待序号小于target的条目都被所有通道处理完,之后发布的条目不影响等待
+    void waitDrained(uint64_t target) { waitCursor(target); }
+    // 停止并等待通道线程退出,尚未处理的条目被丢弃
+    void stop();
+
+private:
+    static constexpr int SPIN_LIMIT = 64; // 休眠前让出CPU的次数
+
+    struct alignas(64) Slot
+    {
+        std::atomic<uint64_t> published{0}; // 已发布的序号加1,0表示从未发布
+        std::atomic<size_t> remaining{0};   // 尚未处理该条目的通道数,归0的通道负责释放条目
+        Entry entry;
+    };
+
+    struct alignas(64) Lane
+    {
+        std::atomic<uint64_t> cursor{0}; // 下一个待处理的序号,之前的条目都已处理完
+        std::thread thread;
+    };
+
+    void run(size_t lane);
+    bool waitPublished(const Slot &slot, uint64_t sequence);
+    // 等待所有通道的游标都不小于target
+    void waitCursor(uint64_t target);
+    uint64_t minCursor() const;
+
+    const size_t mask_;
+    std::vector<Slot> slots_;
+    std::vector<Lane> lanes_;
+    Handler handler_;
+
+    alignas(64) std::atomic<uint64_t> claim_{0}; // 下一个待领取的序号
+    std::atomic<bool> stopped_{false};
+
+    // 通道等待新条目
+    std::mutex data_mutex_;
+    std::condition_variable data_cv_;
+    std::atomic<int> data_waiters_{0};
+    // 生产者等待空槽位,或等待通道处理完
+    std::mutex space_mutex_;
+    std::condition_variable space_cv_;
+    std::atomic<int> space_waiters_{0};
+};
+
+namespace broadcast_ring_detail
+{
+    inline size_t roundUpPowerOfTwo(size_t value)
+    {
+        size_t result = 1;
+        while (result < value)
+            result <<= 1;
+        return result;
+    }
+}
+
+template <typename Entry>
+BroadcastRing<Entry>::BroadcastRing(size_t capacity, size_t lanes, Handler handler)
+    : mask_(broadcast_ring_detail::roundUpPowerOfTwo(capacity < 2 ? 2 : capacity) - 1),
+      slots_(mask_ + 1),
+      lanes_(lanes == 0 ? 1 : lanes),
+      handler_(std::move(handler))
+{
+    for (size_t i = 0; i < lanes_.size(); ++i)
+    {
+        lanes_[i].thread = std::thread(&BroadcastRing::run, this, i);
+    }
+}
+
+template <typename Entry>
+bool BroadcastRing<Entry>::publish(Entry entry)
+{
+    if (stopped_)
+        return false;
+
+    uint64_t sequence = claim_.fetch_add(1);
+    // 该槽位上一轮的条目被所有通道处理完后才能覆盖
+    if (sequence > mask_)
+    {
+        waitCursor(sequence - mask_);
+        if (stopped_)
+            return false;
+    }
+
+    Slot &slot = slots_[sequence & mask_];
+    slot.entry = std::move(entry);
+    slot.remaining.store(lanes_.size(), std::memory_order_relaxed);
+    slot.published.store(sequence + 1);
+
+    // 与通道登记休眠的顺序配合(均为seq_cst):通道要么看到已发布的序号,要么在这里被看到并唤醒
+    if (data_waiters_.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(data_mutex_);
+        data_cv_.notify_all();
+    }
+    return true;
+}
+
+template <typename Entry>
+void BroadcastRing<Entry>::stop()
+{
+    {
+        std::lock_guard<std::mutex> data_lock(data_mutex_);
+        std::lock_guard<std::mutex> space_lock(space_mutex_);
+        if (stopped_.exchange(true))
+            return;
+    }
+    data_cv_.notify_all();
+    space_cv_.notify_all();
+    for (Lane &lane : lanes_)
+    {
+        if (lane.thread.joinable())
+            lane.thread.join();
+    }
+}
+
+template <typename Entry>
+void BroadcastRing<Entry>::run(size_t lane)
+{
+    uint64_t next = 0;
+    while (true)
+    {
+        Slot &slot = slots_[next & mask_];
+        if (slot.published.load(std::memory_order_acquire) != next + 1 && !waitPublished(slot, next))
+            return;
+
+        handler_(lane, slot.entry);
+        // 其他通道都已处理完时释放条目;在推进游标之前完成,生产者覆盖该槽位时看到的是空条目
+        if (slot.remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            slot.entry = Entry();
+        }
+        lanes_[lane].cursor.store(++next);
+
+        if (space_waiters_.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(space_mutex_);
+            space_cv_.notify_all();
+        }
+    }
+}
+
+template <typename Entry>
+bool BroadcastRing<Entry>::waitPublished(const Slot &slot, uint64_t sequence)
+{
+    for (int i = 0; i < SPIN_LIMIT; ++i)
+    {
+        if (slot.published.load(std::memory_order_acquire) == sequence + 1)
+            return true;
+        std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> lock(data_mutex_);
+    ++data_waiters_;
+    data_cv_.wait(lock, [&]
+                  { return stopped_ || slot.published.load() == sequence + 1; });
+    --data_waiters_;
+    return !stopped_;
+}
+
+template <typename Entry>
+void BroadcastRing<Entry>::waitCursor(uint64_t target)
+{
+    for (int i = 0; i < SPIN_LIMIT; ++i)
+    {
+        if (stopped_ || minCursor() >= target)
+            return;
+        std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> lock(space_mutex_);
+    ++space_waiters_;
+    space_cv_.wait(lock, [&]
+                   { return stopped_ || minCursor() >= target; });
+    --space_waiters_;
+}
+
+template <typename Entry>
+uint64_t BroadcastRing<Entry>::minCursor() const
+{
+    uint64_t result = UINT64_MAX;
+    for (const Lane &lane : lanes_)
+    {
+        uint64_t cursor = lane.cursor.load();
+        if (cursor < result)
+            result = cursor;
+    }
+    return result;
+}
@@ -1,24 +1,155 @@
 #include "ClientHandler.hpp"
 #include "ReactorServer.hpp"
 #include "logger/log_macros.hpp"
+#include "protocol/Utf8.hpp"
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <cstring>
 #include <sstream>
 #include <algorithm>
+#include <fstream>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 extern std::shared_ptr<AuthClient> g_authClient;
 
+namespace
+{
+// 从文件池向其他客户端下发已有副本
+// 按最慢接收方的发送进度推进:在途数据不超过一个额度窗口,数据块被所有接收方发送完毕后才继续读取,
+// 避免把整个文件一次性读入各接收方的写队列
+class SpoolReplay : public std::enable_shared_from_this<SpoolReplay>
+{
+public:
+    SpoolReplay(ReactorServer *server, const RoomPtr &room, int exclude_fd, const std::string &sender,
+                uint32_t stream_id, const FileSpool::Entry &entry, uint64_t window)
+        : server_(server),
+          room_(room),
+          exclude_fd_(exclude_fd),
+          sender_(sender),
+          stream_id_(stream_id),
+          path_(entry.path),
+          in_(entry.path, std::ios::binary),
+          remaining_(entry.size),
+          window_(window),
+          in_flight_(0),
+          pump_pending_(false),
+          finished_(false)
+    {
+    }
+
+    bool isOpen() const { return in_.is_open(); }
+
+    void pump()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pump_pending_ = false;
+        if (finished_)
+            return;
+
+        std::vector<char> chunk;
+        while (remaining_ > 0 && in_flight_ < window_)
+        {
+            size_t want = std::min(remaining_, FileSpool::REPLAY_CHUNK_SIZE);
+            chunk.resize(want);
+            in_.read(chunk.data(), static_cast<std::streamsize>(want));
+            size_t got = static_cast<size_t>(in_.gcount());
+            if (got == 0)
+            {
+                LOG_ERROR("读取文件池文件 {} 提前结束,剩余 {} 字节", path_, remaining_);
+                remaining_ = 0;
+                break;
+            }
+            remaining_ -= got;
+            in_flight_ += got;
+            // 令牌在finished_置位之后才释放,没有接收方时不会再投递pump
+            std::shared_ptr<void> token = makeToken(got);
+            if (server_->broadcastMessage(room_, encodeFileDataMessage(sender_, stream_id_, chunk.data(), got),
+                                          exclude_fd_, token) == 0)
+            {
+                // 接收方都已离开聊天室或断开,不必再读完整个文件
+                LOG_INFO("文件池下发 {} 已没有接收方,剩余 {} 字节不再发送", path_, remaining_);
+                finished_ = true;
+                return;
+            }
+        }
+
+        if (remaining_ == 0)
+        {
+            finished_ = true;
+            server_->broadcastMessage(room_, encodeFileStreamMessage(FILE_END, sender_, stream_id_), exclude_fd_);
+        }
+    }
+
+private:
+    std::shared_ptr<void> makeToken(size_t bytes)
+    {
+        std::shared_ptr<SpoolReplay> self = shared_from_this();
+        return std::shared_ptr<void>(nullptr, [self, bytes](void *) { self->onChunkSent(bytes); });
+    }
+
+    void onChunkSent(size_t bytes)
+    {
+        in_flight_ -= bytes;
+        if (finished_ || pump_pending_.exchange(true))
+            return;
+
+        // 没有接收方时令牌在pump内部即被释放,此时mutex_已被持有,所以不能直接pump,统一投递到线程池
+        std::shared_ptr<SpoolReplay> self = shared_from_this();
+        try
+        {
+            server_->getReactor().postTask([self]() { self->pump(); });
+        }
+        catch (const std::exception &e)
+        {
+            LOG_WARN("文件池下发 {} 中止: {}", path_, e.what());
+        }
+    }
+
+    ReactorServer *server_;
+    RoomPtr room_;
+    int exclude_fd_;
+    std::string sender_;
+    uint32_t stream_id_;
+    std::string path_;
+    std::ifstream in_;
+    size_t remaining_;
+    uint64_t window_;
+    std::atomic<uint64_t> in_flight_;
+    std::atomic<bool> pump_pending_;
+    std::atomic<bool> finished_;
+    std::mutex mutex_;
+};
+} // namespace
+
 ClientHandler::ClientHandler(int client_fd, const std::string &address, ReactorServer *server)
     : client_fd_(client_fd),
       server_(server),
       read_buffer_(),
+      inbound_header_size_(sizeof(MSG_header)),
       write_queue_(),
       write_mutex_(),
+      last_enqueue_(),
+      flush_scheduled_(false),
+      corked_(false),
       read_buffer_mutex_(),
-      is_receiving_file_(false),
-      current_file_info_()
+      hello_checked_(false),
+      wire_version_(WIRE_VERSION_LEGACY),
+      user_id_(0),
+      name_(UserRegistry::emptyName()),
+      ping_sequence_(0),
+      ping_outstanding_(false),
+      missed_pongs_(0),
+      heartbeat_capable_(false),
+      sequenced_(false),
+      acked_sequence_(0),
+      resume_pending_(false),
+      resume_sequence_(0),
+      inbox_draining_(false),
+      file_streams_(),
+      discard_bytes_(0),
+      legacy_file_framing_(false)
 {
     client_.fd = client_fd;
     client_.address = address;
@@ -41,12 +172,19 @@ void ClientHandler::handleRead()
     {
         std::lock_guard<std::mutex> lock(read_buffer_mutex_);
 
-        // 在 read_buffer_ 尾部预留空间
+        // 读缓冲区达到上限时先处理已有的消息,剩余数据留在内核中,由下面的FIONREAD检查继续读取
         size_t old_size = read_buffer_.size();
-        read_buffer_.resize(old_size + TEMP_BUFFER_SIZE);
+        if (old_size >= MAX_INGRESS_BUFFER)
+        {
+            break;
+        }
+        size_t room = std::min(TEMP_BUFFER_SIZE, MAX_INGRESS_BUFFER - old_size);
+
+        // 在 read_buffer_ 尾部预留空间
+        read_buffer_.resize(old_size + room);
         char* write_ptr = read_buffer_.data() + old_size;
 
-        ssize_t bytes_read = recv(client_fd_, write_ptr, TEMP_BUFFER_SIZE, 0);
+        ssize_t bytes_read = recv(client_fd_, write_ptr, room, 0);
         if (bytes_read > 0)
         {
             // 按实际读取量修正 buffer 尾部
@@ -87,6 +225,19 @@ void ClientHandler::handleRead()
 
     // 2. 处理消息
     processMessages();
+
+    // 合法的消息帧都小于读缓冲区上限,处理之后仍然占满说明对端数据无法解析
+    bool overflow;
+    {
+        std::lock_guard<std::mutex> lock(read_buffer_mutex_);
+        overflow = read_buffer_.size() >= MAX_INGRESS_BUFFER;
+    }
+    if (overflow)
+    {
+        LOG_ERROR("客户端 {} 的读缓冲区超过上限 {} 字节", client_.address, MAX_INGRESS_BUFFER);
+        handleError();
+        return;
+    }
 }
 
 
@@ -143,20 +294,64 @@ void ClientHandler::processMessages()
 bool ClientHandler::processOneMessage()
 {
     // 4. processOneMessage 只读取消息头并根据类型进行分发
-    MSG_header header;
-
+    if (!hello_checked_)
     {
-        std::lock_guard<std::mutex> lock(read_buffer_mutex_);
+        bool waiting = false;
+        if (!handleWireHello(waiting))
+        {
+            return false;
+        }
+        if (waiting)
+        {
+            return true; // 等待更多数据
+        }
+    }
 
-        // 检查是否有足够的数据读取消息头
-        if (read_buffer_.size() < sizeof(MSG_header))
+    // 正在边收边转发的FILE_DATA:缓冲区开头是该帧的后续数据
+    {
+        std::lock_guard<std::mutex> file_lock(file_receive_mutex_);
+        if (discard_bytes_ > 0)
+        {
+            // 停滞后被中止的帧:接收方已收到补0的完整帧,迟到的剩余部分不再转发
+            std::lock_guard<std::mutex> lock(read_buffer_mutex_);
+            size_t take = std::min(read_buffer_.size(), discard_bytes_);
+            read_buffer_.erase(read_buffer_.begin(), read_buffer_.begin() + take);
+            discard_bytes_ -= take;
+            return true;
+        }
+        if (cut_through_)
         {
-            LOG_DEBUG("缓冲区数据不足以读取消息头，等待更多数据");
-            return true; // 不是错误，只是需要更多数据
+            continueCutThrough();
+            return true;
         }
+    }
 
-        // 读取消息头
-        memcpy(&header, read_buffer_.data(), sizeof(header));
+    MSG_header header;
+    size_t header_size = 0;
+    if (!peekMessageHeader(header, header_size))
+    {
+        LOG_ERROR("客户端 {} 的消息头格式错误", client_.address);
+        return false;
+    }
+    if (header_size == 0)
+    {
+        LOG_DEBUG("缓冲区数据不足以读取消息头，等待更多数据");
+        return true; // 不是错误，只是需要更多数据
+    }
+    inbound_header_size_ = header_size;
+
+    // 帧头解析后立即检查类型和长度,不为非法或超长的消息缓冲任何消息体
+    size_t max_body_size = 0;
+    if (!schema::maxBodySize(header.Type, max_body_size))
+    {
+        LOG_ERROR("客户端 {} 发送了未知的消息类型: {}", client_.address, static_cast<int>(header.Type));
+        return false;
+    }
+    if (header.length > max_body_size)
+    {
+        LOG_ERROR("客户端 {} 的{}消息长度 {} 超过上限 {}", client_.address, getMessageTypeName(header.Type),
+                  header.length, max_body_size);
+        return false;
     }
 
     std::string sender(header.sender_name, strnlen(header.sender_name, sizeof(header.sender_name)));
@@ -173,338 +368,1586 @@ bool ClientHandler::processOneMessage()
         return handleFileDataMessage(header);
     case FILE_END:
         return handleFileEndMessage(header);
+    case GROUP_MSG:
+        return handleGroupMessage(header);
+    case BATCH:
+        return handleBatchMessage(header);
+    case DIRECT_MSG:
+        return handleDirectMessage(header);
     default:
         return handleRegularMessage(header);
     }
 }
 
-bool ClientHandler::handleRegularMessage(const MSG_header &header)
+bool ClientHandler::handleWireHello(bool &waiting)
 {
-    // 5. handleRegularMessage 处理常规消息类型
-    std::string msg_content;
-
+    uint8_t requested = 0;
+    int hello;
     {
         std::lock_guard<std::mutex> lock(read_buffer_mutex_);
-
-        size_t total_message_size = sizeof(MSG_header) + header.length;
-        if (read_buffer_.size() < total_message_size)
+        if (read_buffer_.empty())
         {
-            LOG_DEBUG("缓冲区数据不足以读取完整消息，需要 {} 字节，当前有 {} 字节",
-                      total_message_size, read_buffer_.size());
-            return true; // 等待更多数据
+            waiting = true;
+            return true;
         }
 
-        // 读取消息内容
-        if (header.length > 0)
+        hello = decodeWireHello(reinterpret_cast<const unsigned char *>(read_buffer_.data()), read_buffer_.size(),
+                                requested);
+        if (hello == 0)
         {
-            msg_content.assign(read_buffer_.begin() + sizeof(MSG_header),
-                               read_buffer_.begin() + total_message_size);
+            waiting = true;
+            return true;
+        }
+        hello_checked_ = true;
+        if (hello < 0)
+        {
+            return true; // 旧版客户端,第一帧就是普通消息
         }
+        read_buffer_.erase(read_buffer_.begin(), read_buffer_.begin() + WIRE_HELLO_SIZE);
+    }
 
-        // 从缓冲区移除已处理的消息
-        read_buffer_.erase(read_buffer_.begin(), read_buffer_.begin() + total_message_size);
+    // 选择双方都支持的最高版本;回复本身按握手格式发送,之后的消息才切换到新版本
+    uint8_t version = requested >= WIRE_VERSION_V3   ? WIRE_VERSION_V3
+                      : requested >= WIRE_VERSION_V2 ? WIRE_VERSION_V2
+                                                     : WIRE_VERSION_LEGACY;
+    auto reply = std::make_shared<std::vector<char>>(WIRE_HELLO_SIZE);
+    encodeWireHello(reinterpret_cast<unsigned char *>(reply->data()), version);
+    if (!enqueueWrite(PendingWrite{nullptr, std::move(reply), 0, 0, nullptr, nullptr}))
+    {
+        return false;
     }
+    wire_version_ = version;
 
-    // 6. 处理完整的消息进行二次分发
-    return handleCompleteMessage(header, msg_content);
+    LOG_INFO("客户端 {} 协商线格式版本: {} (请求 {})", client_.address, version, requested);
+    return true;
 }
 
-bool ClientHandler::handleFileStartMessage(const MSG_header &header)
+bool ClientHandler::peekMessageHeader(MSG_header &header, size_t &header_size)
 {
-    std::lock_guard<std::mutex> file_lock(file_receive_mutex_);
-    {
-        std::lock_guard<std::mutex> lock(read_buffer_mutex_);
+    std::lock_guard<std::mutex> lock(read_buffer_mutex_);
+    header_size = 0;
 
-        size_t total_message_size = sizeof(MSG_header) + header.length;
-        if (read_buffer_.size() < total_message_size)
+    if (wire_version_ == WIRE_VERSION_LEGACY)
+    {
+        if (read_buffer_.size() < sizeof(MSG_header))
         {
-            LOG_DEBUG("缓冲区数据不足以读取文件开始消息");
-            return true; // 等待更多数据
+            return true;
         }
+        schema::decodeHeader(read_buffer_.data(), header);
+        header_size = sizeof(MSG_header);
+        return true;
+    }
 
-        // 读取文件信息
-        if (header.length == sizeof(FileInfo))
-        {
-            FileInfo file_info;
-            memcpy(&file_info, read_buffer_.data() + sizeof(MSG_header), sizeof(FileInfo));
+    const unsigned char *data = reinterpret_cast<const unsigned char *>(read_buffer_.data());
+    WireHeaderV2 v2;
+    int v2_size = decodeWireHeaderV2(data, read_buffer_.size(), v2);
+    if (v2_size <= 0)
+    {
+        return v2_size == 0;
+    }
 
-            // 设置文件传输状态
-            is_receiving_file_ = true;
-            current_file_info_ = file_info;
+    // 统一转换为MSG_header,后续处理与旧版相同;v2帧头中客户端填写的sender_id不被信任,发送者以服务器记录为准
+    memset(&header, 0, sizeof(header));
+    strncpy(header.sender_name, getNameRef()->c_str(), MAX_NAMEBUFFER - 1);
+    header.Type = static_cast<MSG_type>(v2.type);
+    header.length = v2.length;
+    size_t size = static_cast<size_t>(v2_size);
 
-            LOG_INFO("开始文件传输: 发送者={}, 文件名={}, 文件大小={}",
-                     header.sender_name, file_info.filename, file_info.file_size);
+    // 尚未分配ID的消息在消息体开头携带用户名,视为帧头的一部分
+    if (header.Type == LOGIN || header.Type == REGISTER || header.Type == JOIN)
+    {
+        if (read_buffer_.size() < size + 1)
+        {
+            return true;
         }
-        else
+        size_t name_size = data[size];
+        if (name_size > WIRE_V2_MAX_NAME_SIZE || header.length < 1 + name_size)
+        {
+            return false;
+        }
+        if (read_buffer_.size() < size + 1 + name_size)
         {
-            LOG_ERROR("FILE_MSG消息长度不正确: {}, 期望: {}", header.length, sizeof(FileInfo));
-            // 从缓冲区移除错误的消息
-            read_buffer_.erase(read_buffer_.begin(), read_buffer_.begin() + total_message_size);
             return true;
         }
-
-        // 从缓冲区移除已处理的消息
-        read_buffer_.erase(read_buffer_.begin(), read_buffer_.begin() + total_message_size);
+        memset(header.sender_name, 0, sizeof(header.sender_name));
+        memcpy(header.sender_name, data + size + 1, name_size);
+        size += 1 + name_size;
+        header.length -= 1 + name_size;
     }
 
-    // 广播文件开始消息给其他客户端
-    server_->broadcastMessage(encodeFileStartMessage(header.sender_name,
-                                                     current_file_info_.filename,
-                                                     current_file_info_.file_size),
-                              client_fd_);
+    header_size = size;
     return true;
 }
 
-bool ClientHandler::handleFileDataMessage(const MSG_header &header)
+bool ClientHandler::handleRegularMessage(const MSG_header &header)
 {
-    std::lock_guard<std::mutex> file_lock(file_receive_mutex_);
-    if (!is_receiving_file_)
-    {
-        LOG_WARN("收到FILE_DATA消息但未处于文件接收状态");
-        // 跳过这个消息
-        std::lock_guard<std::mutex> lock(read_buffer_mutex_);
-        size_t total_message_size = sizeof(MSG_header) + header.length;
-        if (read_buffer_.size() >= total_message_size)
-        {
-            read_buffer_.erase(read_buffer_.begin(), read_buffer_.begin() + total_message_size);
-        }
-        return true;
-    }
-
-    std::vector<char> data_chunk;
+    // 5. handleRegularMessage 处理常规消息类型
+    std::string msg_content;
 
     {
         std::lock_guard<std::mutex> lock(read_buffer_mutex_);
 
-        size_t total_message_size = sizeof(MSG_header) + header.length;
+        size_t total_message_size = inbound_header_size_ + header.length;
         if (read_buffer_.size() < total_message_size)
         {
-            LOG_DEBUG("缓冲区数据不足以读取完整的文件数据消息");
+            LOG_DEBUG("缓冲区数据不足以读取完整消息，需要 {} 字节，当前有 {} 字节",
+                      total_message_size, read_buffer_.size());
             return true; // 等待更多数据
         }
 
-        // 读取文件数据
+        // 读取消息内容
         if (header.length > 0)
         {
-            data_chunk.assign(read_buffer_.begin() + sizeof(MSG_header),
-                              read_buffer_.begin() + total_message_size);
+            msg_content.assign(read_buffer_.begin() + inbound_header_size_,
+                               read_buffer_.begin() + total_message_size);
         }
 
         // 从缓冲区移除已处理的消息
         read_buffer_.erase(read_buffer_.begin(), read_buffer_.begin() + total_message_size);
     }
 
-    LOG_DEBUG("接收并转发文件数据块 {} 字节，来自 {}", data_chunk.size(), header.sender_name);
-
-    // 转发文件数据给其他客户端，使用正确的发送者名称
-    server_->broadcastMessage(encodeFileDataMessage(header.sender_name, data_chunk), client_fd_);
-
-    return true;
+    // 6. 处理完整的消息进行二次分发
+    return handleCompleteMessage(header, msg_content);
 }
 
-bool ClientHandler::handleFileEndMessage(const MSG_header &header)
+bool ClientHandler::takeMessageBody(const MSG_header &header, std::vector<char> &body)
 {
-    std::lock_guard<std::mutex> file_lock(file_receive_mutex_);
-    if (!is_receiving_file_)
-    {
-        LOG_WARN("收到FILE_END消息但未处于文件接收状态");
-        // 跳过这个消息头
-        std::lock_guard<std::mutex> lock(read_buffer_mutex_);
-        if (read_buffer_.size() >= sizeof(MSG_header))
-        {
-            read_buffer_.erase(read_buffer_.begin(), read_buffer_.begin() + sizeof(MSG_header));
-        }
-        return true;
-    }
+    std::lock_guard<std::mutex> lock(read_buffer_mutex_);
 
+    size_t total_message_size = inbound_header_size_ + header.length;
+    if (read_buffer_.size() < total_message_size)
     {
-        std::lock_guard<std::mutex> lock(read_buffer_mutex_);
-
-        // FILE_END消息只有头部，没有数据部分
-        if (read_buffer_.size() < sizeof(MSG_header))
-        {
-            LOG_DEBUG("缓冲区数据不足以读取FILE_END消息");
-            return true;
-        }
-
-        // 从缓冲区移除消息头
-        read_buffer_.erase(read_buffer_.begin(), read_buffer_.begin() + sizeof(MSG_header));
+        LOG_DEBUG("缓冲区数据不足以读取完整的{}消息", getMessageTypeName(header.Type));
+        return false; // 等待更多数据
     }
 
-    LOG_INFO("文件传输完成: 发送者={}, 文件名={}",
-             header.sender_name, current_file_info_.filename);
-
-    // 转发文件结束消息给其他客户端，使用正确的发送者名称
-    server_->broadcastMessage(encodeFileEndMessage(header.sender_name), client_fd_);
-
-    // 重置文件传输状态
-    resetFileTransferState();
+    body.assign(read_buffer_.begin() + inbound_header_size_, read_buffer_.begin() + total_message_size);
 
+    // 从缓冲区移除已处理的消息
+    read_buffer_.erase(read_buffer_.begin(), read_buffer_.begin() + total_message_size);
     return true;
 }
 
-void ClientHandler::resetFileTransferState()
-{
-    is_receiving_file_ = false;
-    memset(&current_file_info_, 0, sizeof(current_file_info_));
-}
-
-void ClientHandler::handleWrite()
+bool ClientHandler::takeMessageFrame(const MSG_header &header, std::vector<char> &frame)
 {
-    std::lock_guard<std::mutex> lock(write_mutex_);
+    std::lock_guard<std::mutex> lock(read_buffer_mutex_);
 
-    while (!write_queue_.empty())
+    size_t total_message_size = inbound_header_size_ + header.length;
+    if (read_buffer_.size() < total_message_size)
     {
-        const auto &message = write_queue_.front();
-
-        ssize_t sent = send(client_fd_, message.data(), message.size(), MSG_NOSIGNAL);
-        if (sent < 0)
-        {
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
-            {
-                break; // 发送缓冲区满，稍后重试
-            }
-            LOG_ERROR("发送消息失败，fd: {}, error: {}", client_fd_, strerror(errno));
-            handleError();
-            return;
-        }
-
-        if (static_cast<size_t>(sent) == message.size())
-        {
-            write_queue_.pop();
-            LOG_DEBUG("成功发送完整消息，大小: {} 字节", sent);
-        }
-        else
-        {
-            // 部分发送，修改队列中的消息
-            auto &front_msg = const_cast<std::vector<char> &>(write_queue_.front());
-            front_msg.erase(front_msg.begin(), front_msg.begin() + sent);
-            LOG_DEBUG("部分发送 {} 字节，剩余 {} 字节", sent, front_msg.size());
-            break;
-        }
+        LOG_DEBUG("缓冲区数据不足以读取完整的{}消息", getMessageTypeName(header.Type));
+        return false; // 等待更多数据
     }
 
-    // 如果写队列为空，移除写事件
-    if (write_queue_.empty())
+    // 服务器内部统一使用旧版格式的帧,v2帧头在这里换成MSG_header,只拷贝一次消息体
+    if (wire_version_ == WIRE_VERSION_LEGACY)
     {
-        server_->getReactor().modifyHandler(client_fd_, EventType::READ);
+        frame.assign(read_buffer_.begin(), read_buffer_.begin() + total_message_size);
     }
-}
-
-void ClientHandler::handleError()
-{
-    LOG_INFO("客户端连接异常或断开: {} (fd: {})", client_.address, client_fd_);
-
-    // 重置文件传输状态
-    if (is_receiving_file_)
+    else
     {
-        LOG_WARN("文件传输因连接断开而中断，文件名: {}", current_file_info_.filename);
-        resetFileTransferState();
+        frame.resize(sizeof(MSG_header) + header.length);
+        memcpy(frame.data(), &header, sizeof(MSG_header));
+        memcpy(frame.data() + sizeof(MSG_header), read_buffer_.data() + inbound_header_size_, header.length);
     }
 
-    handleExitMessage();
+    // 从缓冲区移除已处理的消息
+    read_buffer_.erase(read_buffer_.begin(), read_buffer_.begin() + total_message_size);
+    return true;
 }
 
-bool ClientHandler::sendMessage(const std::vector<char> &message)
+UserRegistry::NameRef ClientHandler::relaySenderName(const MSG_header &header) const
 {
-    // 这里做的只是将数据打包到发送队列并注册写事件,发送由hanleWrite处理
-    if (client_fd_ < 0)
+    if (isNameSet())
     {
-        LOG_ERROR("尝试向已关闭的连接发送消息");
-        return false;
+        return getNameRef();
     }
-
-    std::lock_guard<std::mutex> lock(write_mutex_);
-    write_queue_.push(message);
-
-    // 注册写事件
-    server_->getReactor().modifyHandler(client_fd_,
-                                        static_cast<EventType>(static_cast<uint32_t>(EventType::READ) |
-                                                               static_cast<uint32_t>(EventType::WRITE)));
-    return true;
+    return std::make_shared<const std::string>(header.sender_name, strnlen(header.sender_name, sizeof(header.sender_name)));
 }
 
-bool ClientHandler::handleCompleteMessage(const MSG_header &header, const std::string &msg)
+bool ClientHandler::parseFileStreamBody(const char *body, size_t body_size, uint32_t &stream_id, size_t &data_offset) const
 {
-    LOG_DEBUG("处理消息 - 类型: {}, 发送者: {}, 长度: {}",
-              getMessageTypeName(header.Type), header.sender_name, header.length);
+    // 旧版单路协议的数据部分不带FileStreamHeader
+    if (legacy_file_framing_)
+    {
+        stream_id = LEGACY_STREAM_ID;
+        data_offset = 0;
+        return true;
+    }
 
-    switch (header.Type)
+    // FILE_DATA与FILE_END的定长部分相同,FILE_END只是没有后续数据
+    FileStreamHeader stream_header;
+    if (!schema::decode<FILE_DATA>(body, body_size, stream_header))
     {
-    case REGISTER:
-    case LOGIN:
-        g_authClient->processAuthRequest(client_fd_, header, msg);
-        break;
-    case INITIAL:
-        LOG_WARN("收到未预期的INITIAL消息类型");
-        break;
-    case JOIN:
-        return handleJoinMessage(header);
-    case GROUP_MSG:
-        handleGroupMessage(header, msg);
-        break;
-    case FILE_MSG:
-    case FILE_DATA:
-    case FILE_END:
-        // 这些消息类型在processOneMessage中已经处理
-        LOG_WARN("文件相关消息不应该在此处处理");
-        break;
-    case EXIT:
-        handleExitMessage();
         return false;
-    case TEST:
-        hanleTestMessage(header, msg);
-        break;
-    default:
-        LOG_WARN("未知消息类型: {}", static_cast<int>(header.Type));
-        break;
     }
+    stream_id = stream_header.stream_id;
+    data_offset = schema::Message<FILE_DATA>::body_size;
     return true;
 }
 
-bool ClientHandler::handleJoinMessage(const MSG_header &header)
+bool ClientHandler::handleFileStartMessage(const MSG_header &header)
 {
-    std::string username = header.sender_name;
-
-    // 设置客户端名称
-    client_.name = username;
-    LOG_INFO("客户端 {} (fd: {}) 设置名称为: {}", client_.address, client_fd_, client_.name);
+    std::lock_guard<std::mutex> file_lock(file_receive_mutex_);
 
-    // 1. 发送在线用户列表给新用户
-    server_->syncUserListForClient(getFd());
+    std::vector<char> body;
+    if (!takeMessageBody(header, body))
+    {
+        return true; // 等待更多数据
+    }
 
-    // 2. 广播新用户加入的消息给其他所有用户
-    server_->broadcastMessage(encodeMessage(JOIN, "", username), client_fd_);
-    return true;
-}
+    // 读取文件信息,兼容不带content_hash/stream_id的旧版FileInfo;完整的FileInfo之后可以带SHA-256摘要
+    if (header.length != sizeof(FileInfo) + FILE_DIGEST_SIZE && header.length != sizeof(FileInfo) &&
+        header.length != HASHED_FILEINFO_SIZE && header.length != LEGACY_FILEINFO_SIZE)
+    {
+        LOG_ERROR("FILE_MSG消息长度不正确: {}, 期望: {}", header.length, sizeof(FileInfo));
+        return true;
+    }
 
-void ClientHandler::handleGroupMessage(const MSG_header &header, const std::string &msg)
-{
-    if (client_.name.empty())
+    // 文件只发给当前聊天室的成员
+    RoomPtr room = getRoom();
+    if (!room)
     {
-        LOG_WARN("未设置名称的客户端 {} 尝试发送群消息", client_.address);
-        return;
+        LOG_WARN("未进入聊天室的客户端 {} 尝试发送文件,忽略FILE_MSG", client_.address);
+        return true;
     }
-    LOG_INFO("转发群消息: {} -> {}", client_.name, msg);
 
-    server_->broadcastMessage(encodeMessage(header, msg), client_fd_);
-}
+    FileInfo file_info;
+    schema::decode<FILE_MSG>(body.data(), std::min(body.size(), sizeof(FileInfo)), file_info);
+    file_info.filename[MAX_FILENAME - 1] = '\0';
 
-void ClientHandler::handleExitMessage()
-{
-    LOG_INFO("客户端 {} 即将退出", client_.name);
+    // 文件池只按SHA-256去重,只带XXH64的发送方照常上传,不参与去重
+    std::string digest;
+    if (body.size() == sizeof(FileInfo) + FILE_DIGEST_SIZE)
+    {
+        digest = FileSpool::digestHex(reinterpret_cast<const unsigned char *>(body.data() + sizeof(FileInfo)));
+    }
 
-    std::string client_name = client_.name; // 备份客户端名称
-    int current_fd = client_fd_;
+    // 旧版FileInfo不带stream_id,此后该连接的文件消息都按单路协议解析
+    legacy_file_framing_ = (header.length < sizeof(FileInfo));
+    if (legacy_file_framing_)
+    {
+        file_info.stream_id = LEGACY_STREAM_ID;
+    }
+    uint32_t stream_id = file_info.stream_id;
+
+    LOG_INFO("开始文件传输: 发送者={}, 流={}, 文件名={}, 文件大小={}, 哈希={:016x}",
+             header.sender_name, stream_id, file_info.filename, file_info.file_size, file_info.content_hash);
+
+    if (file_streams_.count(stream_id) && !legacy_file_framing_)
+    {
+        LOG_WARN("文件流 {} 已在传输中,忽略重复的FILE_MSG", stream_id);
+        return true;
+    }
+    if (file_streams_.size() >= MAX_FILE_STREAMS && !file_streams_.count(stream_id))
+    {
+        LOG_WARN("客户端 {} 同时进行的文件流超过上限 {},忽略FILE_MSG", client_.address, MAX_FILE_STREAMS);
+        return true;
+    }
+
+    // 压缩流的FILE_DATA是压缩后的字节,服务器不解压,原样转发给接收方
+    uint32_t compression = legacy_file_framing_ ? 0 : (file_info.flags & FILE_FLAG_COMPRESSION_MASK);
+
+    FileSpool &spool = server_->getFileSpool();
+    if (file_info.content_hash != 0)
+    {
+        // 文件池中已有同一文件:通知发送方跳过上传,由服务器直接下发已有副本
+        FileSpool::Entry entry;
+        if (spool.find(digest, file_info.file_size, entry))
+        {
+            LOG_INFO("文件 {} ({}) 命中文件池,跳过上传", file_info.filename, digest);
+            sendMessage(encodeFileStreamMessage(FILE_EXISTS, "SERVER", stream_id));
+            serveSpooledFile(room, *relaySenderName(header), file_info, entry);
+            return true;
+        }
+
+        // 声明了哈希的发送方等待FILE_ACCEPT后才开始发送数据
+        sendMessage(encodeFileStreamMessage(FILE_ACCEPT, "SERVER", stream_id));
+    }
+
+    // 登记文件流(旧版单路协议的新FILE_MSG直接覆盖上一次未结束的传输)
+    FileStream &stream = file_streams_[stream_id];
+    stream.info = file_info;
+    stream.received_bytes = 0;
+    // 文件池按原始内容的摘要寻址并由服务器校验,压缩流无法在不解压的情况下校验,因此只转发不落盘
+    stream.spool_upload = compression ? nullptr : spool.beginUpload(digest, file_info.file_size);
+    stream.flow_controlled = !legacy_file_framing_ && (file_info.flags & FILE_FLAG_FLOW_CONTROL);
+    stream.credit = std::make_shared<std::atomic<uint64_t>>(stream.flow_controlled ? FILE_CREDIT_WINDOW : 0);
+    stream.room = room;
+
+    // 支持流控的发送方先拿到一个窗口的初始额度,之后每个数据块被所有接收方发送完毕再归还
+    if (stream.flow_controlled)
+    {
+        sendMessage(encodeFileCreditMessage(stream_id, FILE_CREDIT_WINDOW));
+    }
+
+    // 广播文件开始消息给聊天室中的其他客户端
+    server_->broadcastMessage(room, encodeFileStartMessage(*relaySenderName(header),
+                                                     file_info.filename,
+                                                     file_info.file_size,
+                                                     file_info.content_hash,
+                                                     stream_id,
+                                                     compression),
+                              client_fd_);
+    return true;
+}
+
+void ClientHandler::serveSpooledFile(const RoomPtr &room, const std::string &sender, const FileInfo &file_info,
+                                     const FileSpool::Entry &entry)
+{
+    auto replay = std::make_shared<SpoolReplay>(server_, room, client_fd_, sender, file_info.stream_id, entry,
+                                                FILE_CREDIT_WINDOW);
+    if (!replay->isOpen())
+    {
+        LOG_ERROR("打开文件池文件失败: {}", entry.path);
+        return;
+    }
+
+    // 按原有协议顺序下发:FILE_MSG -> 若干FILE_DATA -> FILE_END,接收方无需区分文件来自上传还是文件池
+    if (server_->broadcastMessage(room, encodeFileStartMessage(sender, file_info.filename, entry.size,
+                                                         file_info.content_hash, file_info.stream_id),
+                                  client_fd_) == 0)
+    {
+        // 聊天室中没有其他人,不读取文件
+        LOG_DEBUG("聊天室 {} 中没有接收方,跳过文件池下发 {}", room->name, entry.path);
+        return;
+    }
+
+    // 先下发第一个窗口,其余数据块由完成令牌驱动在线程池中继续下发
+    replay->pump();
+}
+
+std::shared_ptr<void> ClientHandler::makeCreditToken(uint32_t stream_id,
+                                                     const std::shared_ptr<std::atomic<uint64_t>> &credit,
+                                                     uint64_t credit_bytes)
+{
+    // 令牌只持有发送方的弱引用,发送方断开后接收方队列中残留的令牌直接失效
+    std::weak_ptr<ClientHandler> weak_self = shared_from_this();
+    return std::shared_ptr<void>(nullptr, [weak_self, credit, stream_id, credit_bytes](void *)
+                                 {
+                                     auto self = weak_self.lock();
+                                     if (!self)
+                                         return;
+                                     *credit += credit_bytes;
+                                     self->sendMessage(encodeFileCreditMessage(stream_id, credit_bytes));
+                                 });
+}
+
+bool ClientHandler::handleFileDataMessage(const MSG_header &header)
+{
+    // 在file_lock之前声明:没有接收方时令牌在函数返回时才释放,此时已不再持有file_receive_mutex_
+    std::shared_ptr<void> credit_token;
+    std::lock_guard<std::mutex> file_lock(file_receive_mutex_);
+
+    // 大的数据块不等整帧到齐,先把已到达的部分转发出去
+    if (header.length >= CUT_THROUGH_THRESHOLD && !legacy_file_framing_)
+    {
+        bool started = false;
+        beginCutThrough(header, credit_token, started);
+        if (started)
+        {
+            return true;
+        }
+    }
+
+    // 取出整个消息帧,新版多路协议的FILE_DATA改写发送者名称后原样转发
+    std::vector<char> frame;
+    if (!takeMessageFrame(header, frame))
+    {
+        return true; // 等待更多数据
+    }
+    const char *body = frame.data() + sizeof(MSG_header);
+    size_t body_size = frame.size() - sizeof(MSG_header);
+
+    uint32_t stream_id;
+    size_t data_offset;
+    if (!parseFileStreamBody(body, body_size, stream_id, data_offset))
+    {
+        LOG_WARN("FILE_DATA消息缺少流ID,长度: {}", header.length);
+        return true;
+    }
+
+    auto it = file_streams_.find(stream_id);
+    if (it == file_streams_.end())
+    {
+        // 跳过这个消息
+        LOG_WARN("收到未知文件流 {} 的FILE_DATA消息", stream_id);
+        return true;
+    }
+
+    FileStream &stream = it->second;
+    const char *data = body + data_offset;
+    size_t data_size = body_size - data_offset;
+    UserRegistry::NameRef sender_ref = relaySenderName(header);
+    const std::string &sender = *sender_ref;
+
+    if (stream.flow_controlled)
+    {
+        // 超出额度说明发送方没有遵守流控,终止该文件流
+        if (data_size > stream.credit->load())
+        {
+            LOG_ERROR("文件流 {} 超出发送额度: 数据块 {} 字节, 剩余额度 {} 字节",
+                      stream_id, data_size, stream.credit->load());
+            server_->broadcastMessage(stream.room, encodeFileStreamMessage(FILE_END, sender, stream_id), client_fd_);
+            file_streams_.erase(it);
+            return true;
+        }
+        *stream.credit -= data_size;
+        credit_token = makeCreditToken(stream_id, stream.credit, data_size);
+    }
+    stream.received_bytes += data_size;
+
+    LOG_DEBUG("接收并转发文件数据块 {} 字节，来自 {}, 流 {}", data_size, sender, stream_id);
+
+    spoolFileData(stream, data, data_size);
+
+    // 转发文件数据给其他客户端，使用正确的发送者名称
+    // 旧版单路协议的数据缺少FileStreamHeader,只能重新编码;其余情况只改写消息头,数据不再拷贝
+    if (legacy_file_framing_)
+    {
+        server_->broadcastMessage(stream.room, encodeFileDataMessage(sender, stream_id, data, data_size), client_fd_,
+                                  credit_token);
+    }
+    else
+    {
+        rewriteSenderName(frame, sender);
+        server_->broadcastFrame(stream.room, std::make_shared<const std::vector<char>>(std::move(frame)), client_fd_,
+                                credit_token);
+    }
+
+    return true;
+}
+
+void ClientHandler::spoolFileData(FileStream &stream, const char *data, size_t size)
+{
+    // 数据流经时顺带写入文件池并增量计算哈希,写入失败只影响去重,不影响转发
+    if (stream.spool_upload && !stream.spool_upload->append(data, size))
+    {
+        LOG_WARN("文件 {} 写入文件池失败,本次不参与去重", stream.info.filename);
+        stream.spool_upload.reset();
+    }
+}
+
+void ClientHandler::beginCutThrough(const MSG_header &header, std::shared_ptr<void> &credit_token, bool &started)
+{
+    started = false;
+    auto cut = std::make_unique<CutThrough>();
+    size_t data_size = header.length - sizeof(FileStreamHeader);
+    RoomPtr room;
+    {
+        std::lock_guard<std::mutex> lock(read_buffer_mutex_);
+        // 整帧已经到齐时按普通路径处理;流ID还没到时等待
+        size_t buffered = read_buffer_.size() - inbound_header_size_;
+        if (buffered >= header.length || buffered < sizeof(FileStreamHeader))
+        {
+            return;
+        }
+
+        FileStreamHeader stream_header;
+        schema::decode<FILE_DATA>(read_buffer_.data() + inbound_header_size_, buffered, stream_header);
+        auto it = file_streams_.find(stream_header.stream_id);
+        // 只有带内容哈希的文件流才边收边转发:发送方中途断开时帧的剩余部分只能补0,接收方靠哈希校验发现
+        // 未知的文件流和超出额度的数据块按整帧处理,到齐后再丢弃或终止
+        if (it == file_streams_.end() || it->second.info.content_hash == 0 ||
+            (it->second.flow_controlled && data_size > it->second.credit->load()))
+        {
+            return;
+        }
+
+        FileStream &stream = it->second;
+        if (stream.flow_controlled)
+        {
+            *stream.credit -= data_size;
+            credit_token = makeCreditToken(stream_header.stream_id, stream.credit, data_size);
+        }
+        stream.received_bytes += data_size;
+        room = stream.room;
+
+        // 帧缓冲区按完整长度分配,接收方的写队列直接引用它;消息头由服务器生成,发送者以服务器记录为准
+        cut->frame = std::make_shared<std::vector<char>>(sizeof(MSG_header) + header.length);
+        schema::encodeHeader(cut->frame->data(), FILE_DATA, relaySenderName(header)->c_str(), header.length);
+        memcpy(cut->frame->data() + sizeof(MSG_header), read_buffer_.data() + inbound_header_size_, buffered);
+        cut->filled = std::make_shared<std::atomic<size_t>>(sizeof(MSG_header) + buffered);
+        cut->stream_id = stream_header.stream_id;
+        cut->last_progress = std::chrono::steady_clock::now();
+        read_buffer_.clear();
+
+        spoolFileData(stream, cut->frame->data() + sizeof(MSG_header) + sizeof(FileStreamHeader),
+                      buffered - sizeof(FileStreamHeader));
+    }
+
+    LOG_DEBUG("边收边转发文件数据块 {} 字节, 流 {}, 已到达 {} 字节", data_size, cut->stream_id, cut->filled->load());
+    server_->broadcastFrame(room, cut->frame, client_fd_, credit_token, cut->filled, &cut->recipients);
+    cut_through_ = std::move(cut);
+    started = true;
+}
+
+void ClientHandler::continueCutThrough()
+{
+    CutThrough &cut = *cut_through_;
+    size_t filled = cut.filled->load(std::memory_order_relaxed);
+    size_t take;
+    {
+        std::lock_guard<std::mutex> lock(read_buffer_mutex_);
+        take = std::min(read_buffer_.size(), cut.frame->size() - filled);
+        memcpy(cut.frame->data() + filled, read_buffer_.data(), take);
+        read_buffer_.erase(read_buffer_.begin(), read_buffer_.begin() + take);
+    }
+    if (take == 0)
+    {
+        return;
+    }
+
+    auto it = file_streams_.find(cut.stream_id);
+    if (it != file_streams_.end())
+    {
+        spoolFileData(it->second, cut.frame->data() + filled, take);
+    }
+
+    // 先写数据再发布长度,接收方的写线程按该长度读取
+    cut.last_progress = std::chrono::steady_clock::now();
+    cut.filled->store(filled + take, std::memory_order_release);
+    publishCutThrough();
+}
+
+void ClientHandler::publishCutThrough()
+{
+    for (const auto &weak : cut_through_->recipients)
+    {
+        if (auto recipient = weak.lock())
+        {
+            recipient->resumeWrite();
+        }
+    }
+
+    if (cut_through_->filled->load() == cut_through_->frame->size())
+    {
+        cut_through_.reset();
+    }
+}
+
+void ClientHandler::abortStalledCutThrough()
+{
+    std::lock_guard<std::mutex> file_lock(file_receive_mutex_);
+    if (!cut_through_ || std::chrono::steady_clock::now() - cut_through_->last_progress < CUT_THROUGH_STALL_TIMEOUT)
+    {
+        return;
+    }
+
+    // 与连接断开时相同:剩余部分按0补齐,接收方的写队列得以继续,随后的FILE_END让接收方结束该文件
+    uint32_t stream_id = cut_through_->stream_id;
+    size_t missing = cut_through_->frame->size() - cut_through_->filled->load();
+    LOG_WARN("客户端 {} 的文件流 {} 停滞超过 {} 秒,中止边收边转发的数据块(缺少 {} 字节)", client_.address, stream_id,
+             CUT_THROUGH_STALL_TIMEOUT.count(), missing);
+    cut_through_->filled->store(cut_through_->frame->size(), std::memory_order_release);
+    publishCutThrough();
+    discard_bytes_ = missing;
+
+    auto it = file_streams_.find(stream_id);
+    if (it != file_streams_.end())
+    {
+        std::string name = getName();
+        server_->broadcastMessage(it->second.room, encodeFileStreamMessage(FILE_END, name, stream_id), client_fd_);
+        // 未提交的文件池上传随之丢弃;发送方之后的FILE_DATA/FILE_END按未知文件流忽略
+        file_streams_.erase(it);
+    }
+}
+
+bool ClientHandler::handleFileEndMessage(const MSG_header &header)
+{
+    std::lock_guard<std::mutex> file_lock(file_receive_mutex_);
+
+    std::vector<char> body;
+    if (!takeMessageBody(header, body))
+    {
+        return true; // 等待更多数据
+    }
+
+    uint32_t stream_id;
+    size_t data_offset;
+    if (!parseFileStreamBody(body.data(), body.size(), stream_id, data_offset))
+    {
+        LOG_WARN("FILE_END消息缺少流ID,长度: {}", header.length);
+        return true;
+    }
+
+    auto it = file_streams_.find(stream_id);
+    if (it == file_streams_.end())
+    {
+        LOG_WARN("收到未知文件流 {} 的FILE_END消息", stream_id);
+        return true;
+    }
+
+    FileStream &stream = it->second;
+    LOG_INFO("文件传输完成: 发送者={}, 流={}, 文件名={}, 接收 {} 字节",
+             header.sender_name, stream_id, stream.info.filename, stream.received_bytes);
+
+    if (stream.spool_upload)
+    {
+        server_->getFileSpool().commit(*stream.spool_upload);
+    }
+
+    // 转发文件结束消息给其他客户端，使用正确的发送者名称
+    server_->broadcastMessage(stream.room, encodeFileStreamMessage(FILE_END, *relaySenderName(header), stream_id),
+                              client_fd_);
+
+    // 移除文件流,未提交的文件池上传随之丢弃临时文件
+    file_streams_.erase(it);
+
+    return true;
+}
+
+void ClientHandler::abortFileStreams()
+{
+    std::lock_guard<std::mutex> file_lock(file_receive_mutex_);
+
+    // 边收边转发的帧已部分发给接收方,剩余部分按0补齐(帧缓冲区分配时已清零),保证接收方的帧边界完整
+    // 接收方收到随后的FILE_END后通过内容哈希校验发现文件损坏
+    if (cut_through_)
+    {
+        LOG_WARN("边收边转发的文件数据块因连接断开而中断，流: {}", cut_through_->stream_id);
+        cut_through_->filled->store(cut_through_->frame->size(), std::memory_order_release);
+        publishCutThrough();
+    }
+
+    std::string name = getName();
+    for (const auto &pair : file_streams_)
+    {
+        LOG_WARN("文件传输因连接断开而中断，流: {}, 文件名: {}", pair.first, pair.second.info.filename);
+
+        // 通知接收方该文件流已结束,接收方据字节数判断文件不完整,无需等待超时
+        if (!name.empty())
+        {
+            server_->broadcastMessage(pair.second.room, encodeFileStreamMessage(FILE_END, name, pair.first), client_fd_);
+        }
+    }
+    file_streams_.clear();
+}
+
+void ClientHandler::handleWrite()
+{
+    // 完成令牌的释放可能触发向其他连接发送消息,必须在释放write_mutex_之后进行
+    std::vector<std::shared_ptr<void>> sent_tokens;
+    bool send_failed = false;
+
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+
+        while (!write_queue_.empty())
+        {
+            // 队列中的多条消息合并为一次sendmsg:每条消息的替换帧头和原帧的剩余部分各占一段iovec
+            // 边收边转发的帧只发送已到达的部分,它之后的消息要等它完整后才能发送
+            struct iovec iov[MAX_WRITE_IOV];
+            int iov_count = 0;
+            size_t total = 0;
+            for (PendingWrite &pending : write_queue_)
+            {
+                if (iov_count + 2 > MAX_WRITE_IOV)
+                {
+                    break;
+                }
+                size_t prefix_size = pending.prefix ? pending.prefix->size() : 0;
+                size_t frame_end = pending.progress ? pending.progress->load(std::memory_order_acquire)
+                                                    : pending.frame->size();
+                if (pending.sent < prefix_size)
+                {
+                    iov[iov_count].iov_base = const_cast<char *>(pending.prefix->data() + pending.sent);
+                    iov[iov_count].iov_len = prefix_size - pending.sent;
+                    total += iov[iov_count].iov_len;
+                    ++iov_count;
+                }
+                size_t body_sent = pending.sent > prefix_size ? pending.sent - prefix_size : 0;
+                size_t body_left = frame_end - pending.frame_offset - body_sent;
+                if (body_left > 0)
+                {
+                    iov[iov_count].iov_base =
+                        const_cast<char *>(pending.frame->data() + pending.frame_offset + body_sent);
+                    iov[iov_count].iov_len = body_left;
+                    total += body_left;
+                    ++iov_count;
+                }
+                if (frame_end != pending.frame->size())
+                {
+                    break;
+                }
+            }
+            if (total == 0)
+            {
+                break; // 只剩边收边转发的帧,已到达的部分全部发出,等待发送方追加数据时唤醒
+            }
+
+            struct msghdr msg{};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iov_count;
+            ssize_t sent = sendmsg(client_fd_, &msg, MSG_NOSIGNAL);
+            if (sent < 0)
+            {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    break; // 发送缓冲区满，稍后重试
+                }
+                LOG_ERROR("发送消息失败，fd: {}, error: {}", client_fd_, strerror(errno));
+                send_failed = true;
+                break;
+            }
+
+            // 按发出的字节数依次推进各条消息,完整发出的消息出队;未发完的记录偏移量,下次从偏移处继续
+            size_t remaining = static_cast<size_t>(sent);
+            size_t completed = 0;
+            while (remaining > 0 && !write_queue_.empty())
+            {
+                PendingWrite &pending = write_queue_.front();
+                size_t prefix_size = pending.prefix ? pending.prefix->size() : 0;
+                size_t frame_end = pending.progress ? pending.progress->load(std::memory_order_acquire)
+                                                    : pending.frame->size();
+                size_t left = prefix_size + frame_end - pending.frame_offset - pending.sent;
+                size_t step = std::min(left, remaining);
+                pending.sent += step;
+                remaining -= step;
+                if (step < left || frame_end != pending.frame->size())
+                {
+                    break;
+                }
+                if (pending.on_sent)
+                {
+                    sent_tokens.push_back(std::move(pending.on_sent));
+                }
+                write_queue_.pop_front();
+                ++completed;
+            }
+            LOG_DEBUG("发送 {} 字节, 完整发出 {} 条消息, 队列剩余 {} 条", sent, completed, write_queue_.size());
+
+            if (static_cast<size_t>(sent) < total)
+            {
+                break; // 发送缓冲区已满
+            }
+            // 本次收集的部分全部发出,继续发送队列中剩余的消息,并再检查一次边收边转发的帧是否有新数据
+        }
+
+        // 如果写队列为空，移除写事件
+        if (!send_failed && write_queue_.empty())
+        {
+            server_->getReactor().modifyHandler(client_fd_, EventType::READ);
+        }
+    }
+
+    sent_tokens.clear();
+    if (send_failed)
+    {
+        handleError();
+    }
+}
+
+void ClientHandler::handleError()
+{
+    LOG_INFO("客户端连接异常或断开: {} (fd: {})", client_.address, client_fd_);
+
+    // 中断所有进行中的文件流
+    abortFileStreams();
+
+    handleExitMessage();
+}
+
+bool ClientHandler::sendMessage(const std::vector<char> &message, std::shared_ptr<void> on_sent)
+{
+    return sendFrame(std::make_shared<const std::vector<char>>(message), std::move(on_sent));
+}
+
+bool ClientHandler::sendFrame(SharedFrame frame, std::shared_ptr<void> on_sent, SharedFrame v2_header,
+                              FrameProgress progress)
+{
+    if (wire_version_ == WIRE_VERSION_LEGACY)
+    {
+        return enqueueWrite(PendingWrite{nullptr, std::move(frame), 0, 0, std::move(on_sent), std::move(progress)});
+    }
+
+    // v2连接:发送新帧头加上原帧的消息体部分,消息体不拷贝
+    if (!v2_header)
+    {
+        v2_header = server_->makeV2Header(*frame);
+    }
+    return enqueueWrite(PendingWrite{std::move(v2_header), std::move(frame), sizeof(MSG_header), 0, std::move(on_sent),
+                                     std::move(progress)});
+}
+
+void ClientHandler::resumeWrite()
+{
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    if (client_fd_ < 0 || write_queue_.empty())
+    {
+        return;
+    }
+    server_->getReactor().modifyHandler(client_fd_,
+                                        static_cast<EventType>(static_cast<uint32_t>(EventType::READ) |
+                                                               static_cast<uint32_t>(EventType::WRITE)));
+}
+
+void ClientHandler::flushCoalesced()
+{
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    flush_scheduled_ = false;
+    if (client_fd_ < 0 || corked_ || write_queue_.empty())
+    {
+        return;
+    }
+    server_->getReactor().modifyHandler(client_fd_,
+                                        static_cast<EventType>(static_cast<uint32_t>(EventType::READ) |
+                                                               static_cast<uint32_t>(EventType::WRITE)));
+}
+
+void ClientHandler::cork()
+{
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    corked_ = true;
+}
+
+void ClientHandler::uncork()
+{
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    corked_ = false;
+    if (client_fd_ < 0 || flush_scheduled_ || write_queue_.empty())
+    {
+        return;
+    }
+    server_->getReactor().modifyHandler(client_fd_,
+                                        static_cast<EventType>(static_cast<uint32_t>(EventType::READ) |
+                                                               static_cast<uint32_t>(EventType::WRITE)));
+}
+
+bool ClientHandler::enqueueWrite(PendingWrite pending)
+{
+    // 这里做的只是将数据打包到发送队列并注册写事件,发送由hanleWrite处理
+    if (client_fd_ < 0)
+    {
+        LOG_ERROR("尝试向已关闭的连接发送消息");
+        return false;
+    }
+
+    bool schedule_flush = false;
+    {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        bool was_empty = write_queue_.empty();
+        write_queue_.push_back(std::move(pending));
+        if (corked_)
+        {
+            return true; // uncork时注册写事件
+        }
+
+        // 自适应合并:距上一条消息入队不到一个合并窗口说明该连接流量密集,推迟到窗口结束时与窗口内的后续消息
+        // 一起发出;流量稀疏时每条消息立即发出,不增加延迟
+        std::chrono::microseconds window = server_->getCoalesceWindow();
+        bool busy = false;
+        if (window.count() > 0)
+        {
+            auto now = std::chrono::steady_clock::now();
+            busy = now - last_enqueue_ < window;
+            last_enqueue_ = now;
+        }
+
+        // 队列原本非空时写事件已注册(或已在等待合并窗口结束),新消息随之前的消息一起发出
+        if (was_empty)
+        {
+            if (busy)
+            {
+                schedule_flush = !flush_scheduled_;
+                flush_scheduled_ = true;
+            }
+            else
+            {
+                server_->getReactor().modifyHandler(client_fd_,
+                                                    static_cast<EventType>(static_cast<uint32_t>(EventType::READ) |
+                                                                           static_cast<uint32_t>(EventType::WRITE)));
+            }
+        }
+    }
+
+    if (schedule_flush)
+    {
+        server_->scheduleFlush(weak_from_this());
+    }
+    return true;
+}
+
+bool ClientHandler::handleCompleteMessage(const MSG_header &header, const std::string &msg)
+{
+    LOG_DEBUG("处理消息 - 类型: {}, 发送者: {}, 长度: {}",
+              getMessageTypeName(header.Type), header.sender_name, header.length);
+
+    switch (header.Type)
+    {
+    case REGISTER:
+    case LOGIN:
+        // 认证结果同样经写队列发送,按协商的线格式编码
+        sendMessage(encodeMessage(g_authClient->processAuthRequest(header, msg), "", ""));
+        break;
+    case INITIAL:
+        LOG_WARN("收到未预期的INITIAL消息类型");
+        break;
+    case JOIN:
+        return handleJoinMessage(header, msg);
+    case GROUP_MSG:
+    case DIRECT_MSG:
+    case FILE_MSG:
+    case FILE_DATA:
+    case FILE_END:
+        // 这些消息类型在processOneMessage中已经处理
+        LOG_WARN("{}消息不应该在此处处理", getMessageTypeName(header.Type));
+        break;
+    case EXIT:
+        handleExitMessage();
+        return false;
+    case TEST:
+        hanleTestMessage(header, msg);
+        break;
+    case PING:
+        handlePingMessage(msg);
+        break;
+    case PONG:
+        handlePongMessage(msg);
+        break;
+    case ACK:
+        handleAckMessage(msg);
+        break;
+    case RESUME:
+        handleResumeMessage(msg);
+        break;
+    case ROOM_JOIN:
+        handleRoomJoinMessage(msg);
+        break;
+    case ROOM_LEAVE:
+        switchRoom(RoomDirectory::LOBBY_NAME);
+        break;
+    case ROOM_LIST:
+        handleRoomListMessage();
+        break;
+    default:
+        LOG_WARN("未知消息类型: {}", static_cast<int>(header.Type));
+        break;
+    }
+    return true;
+}
+
+bool ClientHandler::handleJoinMessage(const MSG_header &header, const std::string &msg)
+{
+    // 帧头中的用户名不保证以'\0'结尾
+    std::string username(header.sender_name, strnlen(header.sender_name, MAX_NAMEBUFFER));
+
+    // 登记到在线用户表并分配用户ID,此后路由只使用ID
+    if (isNameSet())
+    {
+        LOG_WARN("客户端 {} (fd: {}) 重复JOIN,忽略", client_.address, client_fd_);
+        return true;
+    }
+    if (username.empty())
+    {
+        LOG_WARN("客户端 {} (fd: {}) 的JOIN没有用户名,拒绝", client_.address, client_fd_);
+        sendMessage(encodeMessage(JOIN_failed, "用户名不能为空", "SERVER"));
+        return true;
+    }
+    auto name = std::make_shared<const std::string>(username);
+    uint32_t user_id = server_->getUsers().add(name, shared_from_this());
+    if (user_id == UserRegistry::INVALID_ID)
+    {
+        // 查重在add内部完成,这里再查一次只为区分原因
+        if (server_->getUsers().idOf(username) != UserRegistry::INVALID_ID)
+        {
+            LOG_WARN("客户端 {} (fd: {}) 的用户名 {} 已在线,拒绝JOIN", client_.address, client_fd_, username);
+            sendMessage(encodeMessage(JOIN_failed, "用户名已在线", "SERVER"));
+        }
+        else
+        {
+            LOG_ERROR("在线用户表已满,客户端 {} (fd: {}) 无法JOIN", client_.address, client_fd_);
+            sendMessage(encodeMessage(JOIN_failed, "服务器在线人数已满", "SERVER"));
+        }
+        return true;
+    }
+    std::atomic_store(&name_, UserRegistry::NameRef(std::move(name)));
+    user_id_ = user_id;
+    LOG_INFO("客户端 {} (fd: {}) 设置名称为: {}, 用户ID: {}", client_.address, client_fd_, username, user_id_.load());
+
+    // 1. v2客户端在JOIN消息体中携带本地用户表的版本,补发该版本之后的变更(全体在线用户的ID字典)
+    if (wire_version_ >= WIRE_VERSION_V2 && msg.size() == sizeof(uint64_t))
+    {
+        uint64_t known_epoch;
+        memcpy(&known_epoch, msg.data(), sizeof(known_epoch));
+        server_->syncRosterForClient(getFd(), known_epoch);
+    }
+
+    // 2. 进入大厅:向大厅成员广播JOIN,向新用户发送大厅的成员列表
+    // JOIN之前收到过RESUME时,进入与补发聊天室消息在同一临界区内完成,补发的消息排在成员列表之后
+    uint64_t *resume = nullptr;
+    if (resume_pending_)
+    {
+        resume_pending_ = false;
+        resume = &resume_sequence_;
+    }
+    server_->enterRoom(shared_from_this(), server_->getRooms().lobby(), false, resume);
+
+    // 3. 登记用户名,此后离线时也能收到私聊;投递离线期间收到的私聊,排在大厅的成员列表和历史消息之后
+    if (OfflineInbox *inbox = server_->getOfflineInbox())
+    {
+        inbox->addKnownUser(getName());
+    }
+    deliverOfflineInbox();
+    return true;
+}
+
+bool ClientHandler::filterGroupText(const std::string &name, const char *data, size_t size, std::string &text,
+                                    bool &rewritten)
+{
+    rewritten = false;
+
+    // 扇出之前校验一次UTF-8,每个接收方不必各自处理乱码
+    if (!utf8::validate(data, size))
+    {
+        if (!REPAIR_INVALID_UTF8)
+        {
+            LOG_WARN("客户端 {} 的消息不是合法的UTF-8,已丢弃", name);
+            return false;
+        }
+        LOG_WARN("客户端 {} 的消息不是合法的UTF-8,非法字节已替换", name);
+        text = utf8::repair(data, size);
+        data = text.data();
+        size = text.size();
+        rewritten = true;
+    }
+
+    std::string masked, term;
+    switch (server_->getKeywordFilter().check(data, size, masked, term))
+    {
+    case KeywordFilter::Action::REJECT:
+        LOG_WARN("客户端 {} 的消息包含屏蔽词 \"{}\",已拒绝", name, term);
+        return false;
+    case KeywordFilter::Action::MASK:
+        LOG_INFO("客户端 {} 的消息包含屏蔽词 \"{}\",已打码", name, term);
+        text = std::move(masked);
+        rewritten = true;
+        break;
+    case KeywordFilter::Action::FLAG:
+        LOG_WARN("客户端 {} 的消息包含标记词 \"{}\",照常转发", name, term);
+        break;
+    case KeywordFilter::Action::NONE:
+        break;
+    }
+    return true;
+}
+
+bool ClientHandler::handleGroupMessage(const MSG_header &header)
+{
+    std::vector<char> frame;
+    if (!takeMessageFrame(header, frame))
+    {
+        return true; // 等待更多数据
+    }
+
+    UserRegistry::NameRef name_ref = getNameRef();
+    const std::string &name = *name_ref;
+    RoomPtr room = getRoom();
+    if (name.empty() || !room)
+    {
+        LOG_WARN("未设置名称的客户端 {} 尝试发送群消息", client_.address);
+        return true;
+    }
+
+    std::string text;
+    bool rewritten;
+    if (!filterGroupText(name, frame.data() + sizeof(MSG_header), frame.size() - sizeof(MSG_header), text, rewritten))
+    {
+        return true;
+    }
+    if (rewritten)
+    {
+        frame.resize(sizeof(MSG_header) + text.size());
+        schema::encodeText(frame.data(), GROUP_MSG, name.c_str(), text.data(), text.size());
+    }
+    LOG_INFO("转发群消息: {} -> {}: {}", name, room->name,
+             std::string(frame.data() + sizeof(MSG_header), frame.size() - sizeof(MSG_header)));
+
+    // 发送者名称以服务器记录的为准,消息体原样转发
+    rewriteSenderName(frame, name);
+    server_->broadcastRoomMessage(room, std::make_shared<const std::vector<char>>(std::move(frame)), client_fd_);
+    return true;
+}
+
+bool ClientHandler::handleBatchMessage(const MSG_header &header)
+{
+    std::vector<char> frame;
+    if (!takeMessageFrame(header, frame))
+    {
+        return true; // 等待更多数据
+    }
+
+    UserRegistry::NameRef name_ref = getNameRef();
+    const std::string &name = *name_ref;
+    RoomPtr room = getRoom();
+    if (name.empty() || !room)
+    {
+        LOG_WARN("未设置名称的客户端 {} 尝试发送BATCH消息", client_.address);
+        return true;
+    }
+
+    // 一次遍历校验全部子消息,不逐条派发;目前只允许群消息
+    // 同时逐条做与GROUP_MSG相同的文本处理,结果写入rebuilt,只有子消息被改写或丢弃时才使用
+    std::vector<char> rebuilt(sizeof(MSG_header));
+    bool changed = false;
+    size_t count = 0;
+    bool valid = schema::forEachBatchItem(frame.data() + sizeof(MSG_header), frame.size() - sizeof(MSG_header),
+                                          [&](MSG_type type, const char *data, size_t size)
+                                          {
+                                              if (type != GROUP_MSG)
+                                                  return false;
+                                              std::string text;
+                                              bool rewritten;
+                                              if (!filterGroupText(name, data, size, text, rewritten))
+                                              {
+                                                  changed = true;
+                                                  return true;
+                                              }
+                                              if (rewritten)
+                                              {
+                                                  changed = true;
+                                                  data = text.data();
+                                                  size = text.size();
+                                              }
+                                              size_t offset = rebuilt.size();
+                                              rebuilt.resize(offset + schema::batchItemSize(size));
+                                              schema::encodeBatchItem(rebuilt.data() + offset, type, data, size);
+                                              ++count;
+                                              return true;
+                                          });
+    if (!valid)
+    {
+        LOG_WARN("客户端 {} 的BATCH消息格式错误或包含不支持的子消息,已丢弃", name);
+        return true;
+    }
+    if (count == 0)
+    {
+        return true;
+    }
+    if (changed)
+    {
+        schema::encodeHeader(rebuilt.data(), BATCH, name.c_str(), rebuilt.size() - sizeof(MSG_header));
+        frame = std::move(rebuilt);
+    }
+    LOG_DEBUG("转发批量群消息: {} -> {}: {} 条", name, room->name, count);
+
+    // 与GROUP_MSG相同:只改写发送者名称,整帧转发
+    rewriteSenderName(frame, name);
+    server_->broadcastRoomMessage(room, std::make_shared<const std::vector<char>>(std::move(frame)), client_fd_);
+    return true;
+}
+
+bool ClientHandler::handleDirectMessage(const MSG_header &header)
+{
+    std::vector<char> frame;
+    if (!takeMessageFrame(header, frame))
+    {
+        return true; // 等待更多数据
+    }
+
+    UserRegistry::NameRef name_ref = getNameRef();
+    const std::string &name = *name_ref;
+    if (name.empty())
+    {
+        LOG_WARN("未设置名称的客户端 {} 尝试发送私聊消息", client_.address);
+        return true;
+    }
+
+    DirectInfo info;
+    const char *text_data;
+    size_t text_size;
+    if (!schema::decode<DIRECT_MSG>(frame.data() + sizeof(MSG_header), frame.size() - sizeof(MSG_header), info,
+                                    &text_data, &text_size))
+    {
+        LOG_WARN("客户端 {} 的私聊消息格式错误,已丢弃", name);
+        return true;
+    }
+
+    // 按ID下标或用户名索引定位接收方,不经过连接表
+    std::string target_name(info.target_name, strnlen(info.target_name, sizeof(info.target_name)));
+    uint32_t target_id = UserRegistry::INVALID_ID;
+    auto target = server_->getUsers().resolve(info.target_id, target_name, target_id);
+    // 接收方不在线时存入其离线收件箱,需要用户名:只给出ID时无法确定离线的是谁;从未登录过的用户名没有收件箱
+    OfflineInbox *inbox = server_->getOfflineInbox();
+    if (!target && (!inbox || target_name.empty() || !inbox->isKnownUser(target_name)))
+    {
+        LOG_INFO("私聊 {} -> {}({}) 的接收方不在线或不存在", name, target_name, info.target_id);
+        sendMessage(encodeDirectFailedMessage(info));
+        return true;
+    }
+
+    std::string text;
+    bool rewritten;
+    if (!filterGroupText(name, text_data, text_size, text, rewritten))
+    {
+        return true;
+    }
+
+    // 转发时DirectInfo改为接收方的实际ID和用户名(离线时ID为0),文本未改写时整帧原样转发
+    DirectInfo requested = info;
+    memset(&info, 0, sizeof(info));
+    info.target_id = target_id;
+    strncpy(info.target_name, target_name.c_str(), MAX_NAMEBUFFER - 1);
+    if (rewritten)
+    {
+        frame.resize(schema::frameSize<DIRECT_MSG>(text.size()));
+        schema::encode<DIRECT_MSG>(frame.data(), name.c_str(), info, text.data(), text.size());
+    }
+    else
+    {
+        memcpy(frame.data() + sizeof(MSG_header), &info, sizeof(info));
+        rewriteSenderName(frame, name);
+    }
+    if (target)
+    {
+        LOG_DEBUG("转发私聊消息: {} -> {}({}), {} 字节", name, target_name, target_id,
+                  frame.size() - sizeof(MSG_header));
+        target->sendFrame(std::make_shared<const std::vector<char>>(std::move(frame)));
+        return true;
+    }
+
+    if (!inbox->store(target_name, frame))
+    {
+        LOG_INFO("私聊 {} -> {} 的接收方不在线, 离线收件箱无法存入", name, target_name);
+        sendMessage(encodeDirectFailedMessage(requested));
+        return true;
+    }
+    LOG_DEBUG("私聊 {} -> {} 的接收方不在线, 已存入离线收件箱, {} 字节", name, target_name,
+              frame.size() - sizeof(MSG_header));
+
+    // 接收方可能在查找之后、存入之前登录,其收件箱投递已经结束,由这里补上
+    if (auto online = server_->getUsers().resolve(UserRegistry::INVALID_ID, target_name, target_id))
+    {
+        online->deliverOfflineInbox();
+    }
+    return true;
+}
+
+void ClientHandler::deliverOfflineInbox()
+{
+    OfflineInbox *inbox = server_->getOfflineInbox();
+    if (!inbox || !isNameSet() || inbox_draining_.exchange(true))
+    {
+        return;
+    }
+    pumpOfflineInbox(0);
+}
+
+void ClientHandler::pumpOfflineInbox(uint64_t position)
+{
+    OfflineInbox *inbox = server_->getOfflineInbox();
+    std::string name = getName();
+    bool drained = false;
+    while (client_fd_ >= 0 && !name.empty())
+    {
+        OfflineInbox::Batch batch;
+        inbox->read(name, position, batch);
+        if (!batch.frames.empty())
+        {
+            // 完成令牌挂在这一批的最后一条上;连接关闭时被丢弃的消息不确认,下次登录重新投递
+            std::weak_ptr<ClientHandler> weak_self = shared_from_this();
+            uint64_t end_position = batch.end_position;
+            auto on_sent = std::shared_ptr<void>(nullptr, [weak_self, end_position](void *)
+                                                 {
+                                                     auto self = weak_self.lock();
+                                                     if (!self)
+                                                         return;
+                                                     // 令牌在写路径上释放,确认和读取下一批投递到线程池
+                                                     try
+                                                     {
+                                                         self->server_->getReactor().postTask([self, end_position]()
+                                                                                              { self->onOfflineBatchSent(end_position); });
+                                                     }
+                                                     catch (const std::exception &e)
+                                                     {
+                                                         LOG_WARN("离线收件箱投递中止: {}", e.what());
+                                                         self->inbox_draining_ = false;
+                                                     } });
+
+            // 一批消息合并为尽量少的sendmsg发出
+            // 发送者存入时的ID可能早已回收,认识帧头用户名的客户端直接收到帧中记录的发送者用户名
+            bool with_name = acceptsSenderName();
+            cork();
+            for (size_t i = 0; i < batch.frames.size(); ++i)
+            {
+                SharedFrame v2_header = with_name ? server_->makeV2Header(*batch.frames[i], 0, true) : nullptr;
+                sendFrame(std::move(batch.frames[i]), i + 1 == batch.frames.size() ? on_sent : nullptr,
+                          std::move(v2_header));
+            }
+            uncork();
+            LOG_DEBUG("向 {} 投递 {} 条离线私聊, 跳过过期的 {} 条", name, batch.frames.size(), batch.expired);
+            return;
+        }
+
+        // 没有可投递的消息:收件箱已读完,或者这一批都已过期、损坏的部分被跳过
+        if (!inbox->commit(name, batch.end_position))
+        {
+            drained = true;
+            break;
+        }
+        if (batch.expired == 0)
+        {
+            break; // 读取失败,留待下次登录
+        }
+        position = batch.end_position;
+    }
+    finishOfflineInbox(drained);
+}
+
+void ClientHandler::onOfflineBatchSent(uint64_t end_position)
+{
+    if (client_fd_ < 0)
+    {
+        inbox_draining_ = false;
+        return;
+    }
+    if (server_->getOfflineInbox()->commit(getName(), end_position))
+    {
+        pumpOfflineInbox(end_position);
+    }
+    else
+    {
+        finishOfflineInbox(true);
+    }
+}
+
+void ClientHandler::finishOfflineInbox(bool drained)
+{
+    inbox_draining_ = false;
+    // 收件箱删除之后、标志清除之前存入的消息:存入方看到投递仍在进行而没有触发,这里补上
+    if (drained && client_fd_ >= 0 && server_->getOfflineInbox()->hasPending(getName()))
+    {
+        std::shared_ptr<ClientHandler> self = shared_from_this();
+        try
+        {
+            server_->getReactor().postTask([self]()
+                                           { self->deliverOfflineInbox(); });
+        }
+        catch (const std::exception &e)
+        {
+            LOG_WARN("离线收件箱投递中止: {}", e.what());
+        }
+    }
+}
+
+void ClientHandler::handleExitMessage()
+{
+    std::string client_name = getName(); // 备份客户端名称
+    LOG_INFO("客户端 {} 即将退出", client_name);
+    if (rtt_.count() > 0)
+    {
+        LOG_INFO("客户端 {} 往返时延: 样本 {}, 最近 {} us, p50 <{} us, p99 <{} us", client_.address, rtt_.count(),
+                 rtt_.last(), rtt_.percentile(50), rtt_.percentile(99));
+    }
+
+    int current_fd = client_fd_;
 
     // 步骤1: 从服务器核心数据结构中移除此客户端
     server_->removeClient(current_fd);
 
-    // 步骤2: 如果客户端已经登录，则广播其退出消息
-    if (!client_name.empty())
+    // 步骤2: 如果客户端已经登录，则离开所在的聊天室并向其余成员广播退出消息
+    RoomPtr room = getRoom();
+    if (room)
+    {
+        server_->leaveRoom(shared_from_this(), room);
+        setRoom(nullptr);
+    }
+
+    // 步骤3: 退出消息已带着用户ID进入各接收方的写队列,再注销ID;之后该ID可能分配给新用户
+    uint32_t user_id = user_id_.exchange(UserRegistry::INVALID_ID);
+    if (user_id != UserRegistry::INVALID_ID)
+    {
+        std::atomic_store(&name_, UserRegistry::emptyName());
+        server_->getUsers().remove(user_id);
+    }
+}
+
+void ClientHandler::heartbeat()
+{
+    abortStalledCutThrough();
+
+    uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> lock(heartbeat_mutex_);
+        if (ping_outstanding_)
+        {
+            // 上一个PING仍未回复,不重发:回复迟到时仍能得到真实的往返时延
+            // PING还排在写队列中(如大的文件数据之后)时对端无从回复,写出之前不记未回复
+            if (ping_sent_at_ == std::chrono::steady_clock::time_point())
+            {
+                return;
+            }
+            ++missed_pongs_;
+            // 只关闭确认支持心跳的连接(v2线格式或回复过PONG),旧版客户端不认识PING,仍靠TCP发现断线
+            bool capable = heartbeat_capable_ || wire_version_ >= WIRE_VERSION_V2;
+            if (capable && missed_pongs_ >= MAX_MISSED_PONGS && client_fd_ >= 0)
+            {
+                LOG_WARN("客户端 {} (fd: {}) 连续 {} 次未回复心跳,关闭连接", client_.address, client_fd_,
+                         missed_pongs_);
+                // 关闭读写两端后reactor收到挂断事件,按普通断线流程清理
+                shutdown(client_fd_, SHUT_RDWR);
+            }
+            return;
+        }
+        sequence = ++ping_sequence_;
+        ping_outstanding_ = true;
+        ping_sent_at_ = std::chrono::steady_clock::time_point();
+    }
+
+    // 以PING真正写入socket的时刻为起点,往返时延不包含在本服务器写队列中的排队时间
+    std::weak_ptr<ClientHandler> weak_self = shared_from_this();
+    auto on_sent = std::shared_ptr<void>(nullptr, [weak_self, sequence](void *)
+                                         {
+                                             auto self = weak_self.lock();
+                                             if (!self)
+                                                 return;
+                                             std::lock_guard<std::mutex> lock(self->heartbeat_mutex_);
+                                             if (self->ping_outstanding_ && self->ping_sequence_ == sequence)
+                                                 self->ping_sent_at_ = std::chrono::steady_clock::now();
+                                         });
+    sendMessage(encodePingMessage(PING, sequence), std::move(on_sent));
+}
+
+void ClientHandler::handlePingMessage(const std::string &msg)
+{
+    // 客户端测量自己的往返时延,原样回复
+    PingInfo ping;
+    if (!schema::decode<PING>(msg.data(), msg.size(), ping))
+    {
+        LOG_WARN("客户端 {} 的PING消息格式错误", client_.address);
+        return;
+    }
+    sendMessage(encodePingMessage(PONG, ping.sequence));
+}
+
+void ClientHandler::handlePongMessage(const std::string &msg)
+{
+    PingInfo pong;
+    if (!schema::decode<PONG>(msg.data(), msg.size(), pong))
+    {
+        LOG_WARN("客户端 {} 的PONG消息格式错误", client_.address);
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point sent_at;
+    {
+        std::lock_guard<std::mutex> lock(heartbeat_mutex_);
+        if (!ping_outstanding_ || pong.sequence != ping_sequence_)
+        {
+            return; // 不对应当前的PING
+        }
+        ping_outstanding_ = false;
+        missed_pongs_ = 0;
+        heartbeat_capable_ = true;
+        sent_at = ping_sent_at_;
+    }
+
+    // PING的完成令牌可能在PONG处理之后才释放,此时没有可靠的起点,不计入统计
+    if (sent_at == std::chrono::steady_clock::time_point())
+    {
+        return;
+    }
+    uint64_t rtt_us = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(now - sent_at).count());
+    rtt_.record(rtt_us);
+    server_->recordRtt(rtt_us);
+    LOG_DEBUG("客户端 {} 往返时延 {} us", client_.address, rtt_us);
+}
+
+void ClientHandler::handleAckMessage(const std::string &msg)
+{
+    SequenceInfo ack;
+    if (!schema::decode<ACK>(msg.data(), msg.size(), ack))
+    {
+        LOG_WARN("客户端 {} 的ACK消息格式错误", client_.address);
+        return;
+    }
+    // 累积确认,只增不减
+    uint64_t acked = acked_sequence_;
+    while (ack.sequence > acked && !acked_sequence_.compare_exchange_weak(acked, ack.sequence))
+    {
+    }
+}
+
+void ClientHandler::handleResumeMessage(const std::string &msg)
+{
+    SequenceInfo resume;
+    if (!schema::decode<RESUME>(msg.data(), msg.size(), resume))
+    {
+        LOG_WARN("客户端 {} 的RESUME消息格式错误", client_.address);
+        return;
+    }
+    // 序号只能放在v2帧头中
+    if (wire_version_ < WIRE_VERSION_V2)
+    {
+        LOG_WARN("旧版格式的客户端 {} 不支持RESUME,忽略", client_.address);
+        return;
+    }
+
+    // JOIN之前发送的RESUME在JOIN时与登记一起执行,补发和实时消息之间不重不漏;
+    // JOIN之后才发送时立即补发,其间已收到的不带序号的消息可能重复
+    if (!isNameSet())
+    {
+        resume_pending_ = true;
+        resume_sequence_ = resume.sequence;
+        return;
+    }
+    server_->resumeRoom(shared_from_this(), resume.sequence);
+}
+
+void ClientHandler::handleRoomJoinMessage(const std::string &msg)
+{
+    // 消息体为聊天室名称,容忍结尾的0
+    switchRoom(std::string(msg.data(), strnlen(msg.data(), msg.size())));
+}
+
+void ClientHandler::switchRoom(const std::string &name)
+{
+    RoomPtr current = getRoom();
+    if (!current)
+    {
+        LOG_WARN("未设置名称的客户端 {} 尝试切换聊天室", client_.address);
+        return;
+    }
+
+    // 名称不合法或聊天室数达到上限时留在原聊天室,回复当前聊天室的名称
+    RoomDirectory &rooms = server_->getRooms();
+    RoomPtr target = rooms.obtain(name);
+    if (!target)
+    {
+        LOG_WARN("客户端 {} 无法进入聊天室 \"{}\": 名称不合法或聊天室数已达上限", getName(), name);
+        sendMessage(encodeMessage(ROOM_JOIN, current->name, "SERVER"));
+        return;
+    }
+    if (target == current)
+    {
+        sendMessage(encodeMessage(ROOM_JOIN, current->name, "SERVER"));
+        return;
+    }
+
+    auto self = shared_from_this();
+    server_->leaveRoom(self, current);
+    // 目标聊天室可能在获取之后、进入之前因最后一个成员离开而被删除,此时重新获取(新建)
+    while (!server_->enterRoom(self, target, true))
+    {
+        target = rooms.obtain(name);
+        if (!target)
+        {
+            target = rooms.lobby();
+        }
+    }
+}
+
+void ClientHandler::handleRoomListMessage()
+{
+    std::ostringstream oss;
+    auto rooms = server_->getRooms().list(RoomDirectory::MAX_LISTED_ROOMS);
+    for (size_t i = 0; i < rooms.size(); ++i)
     {
-        server_->broadcastMessage(encodeMessage(EXIT, "", client_name), -1);
+        oss << rooms[i].first << ":" << rooms[i].second << (i == rooms.size() - 1 ? "" : ",");
     }
+    sendMessage(encodeMessage(ROOM_LIST, oss.str(), "SERVER"));
 }
 
 void ClientHandler::cleanup()
@@ -522,16 +1965,16 @@ void ClientHandler::cleanup()
         read_buffer_.clear();
     }
 
+    // 丢弃的消息同样释放其完成令牌,但要在释放write_mutex_之后进行
+    std::deque<PendingWrite> dropped;
     {
         std::lock_guard<std::mutex> lock(write_mutex_);
-        while (!write_queue_.empty())
-        {
-            write_queue_.pop();
-        }
+        write_queue_.swap(dropped);
     }
+    dropped.clear();
 
     // 重置文件传输状态
-    resetFileTransferState();
+    file_streams_.clear();
 }
 
 void ClientHandler::hanleTestMessage(const MSG_header &header, const std::string &msg)
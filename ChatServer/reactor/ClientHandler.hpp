@@ -3,16 +3,26 @@
 #include "authClient/Authentication.hpp"
 #include "Reactor.hpp"
 #include "ReactorServer.hpp"
+#include "UserRegistry.hpp"
+#include "RoomDirectory.hpp"
 #include "protocol/Protocol.hpp"
+#include "protocol/WireFormat.hpp"
+#include "storage/FileSpool.hpp"
+#include "RttHistogram.hpp"
 #include <string>
 #include <vector>
 #include <mutex>
 #include <queue>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
+#include <chrono>
 #include <sys/ioctl.h> // for ioctl, FIONREAD
 
 class ReactorServer;
 
-class ClientHandler : public EventHandler
+class ClientHandler : public EventHandler, public std::enable_shared_from_this<ClientHandler>
 {
 public:
     ClientHandler(int client_fd, const std::string &address, ReactorServer *server);
@@ -23,35 +33,160 @@ public:
     void handleError() override;
 
     int getFd() const { return client_fd_; }
-    const std::string &getName() const { return client_.name; }
-    bool isNameSet() const { return !client_.name.empty(); }
-    bool sendMessage(const std::vector<char> &message);
+    // 用户名在JOIN时驻留,连接与在线用户表共享同一份,读取不查用户表、不拷贝;未JOIN时为空串
+    UserRegistry::NameRef getNameRef() const { return std::atomic_load(&name_); }
+    std::string getName() const { return *getNameRef(); }
+    bool isNameSet() const { return user_id_ != UserRegistry::INVALID_ID; }
+    uint32_t getUserId() const { return user_id_; }
+    // 与对端协商的线格式版本(WIRE_VERSION_*)
+    uint8_t getWireVersion() const { return wire_version_; }
+    // 对端认识帧头中的发送者用户名(WIRE_FLAG_SENDER_NAME)
+    bool acceptsSenderName() const { return wire_version_ >= WIRE_VERSION_V3; }
+    // on_sent在该消息完整写入socket(或连接关闭丢弃)后释放,多个接收方共享同一个on_sent可得知最慢者何时发送完毕
+    bool sendMessage(const std::vector<char> &message, std::shared_ptr<void> on_sent = nullptr);
+    // 发送共享的消息帧,不拷贝消息内容
+    // frame总是旧版格式的完整帧;对端使用v2格式时用v2_header替换其80字节帧头发送,为空时现场生成
+    // progress非空表示帧内容仍在到达(cut-through),只发送已到达的部分,其余等待resumeWrite唤醒
+    bool sendFrame(SharedFrame frame, std::shared_ptr<void> on_sent = nullptr, SharedFrame v2_header = nullptr,
+                   FrameProgress progress = nullptr);
+    // 写队列中边收边转发的帧有新数据到达,重新注册写事件
+    void resumeWrite();
+    // 合并窗口结束,发出窗口内推迟的消息
+    void flushCoalesced();
+    // cork期间入队的消息暂不发送,uncork后与之前的消息合并为尽量少的sendmsg发出(如进入聊天室时补发的历史消息)
+    void cork();
+    void uncork();
+    // 心跳定时器每个周期调用一次:上一个PING已得到回复时发出新的PING,已写入socket仍未回复时记一次未回复,
+    // 连续MAX_MISSED_PONGS次未回复的连接被关闭;PING尚在写队列中的周期不计
+    void heartbeat();
+    // 本连接的往返时延,从PING写入socket到收到PONG
+    const RttHistogram &getRtt() const { return rtt_; }
+    // 发送过RESUME的v2连接接收带序号的聊天室消息
+    bool isSequenced() const { return sequenced_; }
+    void setSequenced(bool sequenced) { sequenced_ = sequenced; }
+    // 客户端最近一次ACK确认的聊天室序号,切换聊天室时清零(各聊天室的序号互不相关)
+    uint64_t getAckedSequence() const { return acked_sequence_; }
+    void resetAckedSequence() { acked_sequence_ = 0; }
+    // 当前所在的聊天室,JOIN之前和退出之后为空;由该连接的读路径修改,心跳等其它线程也会读取
+    RoomPtr getRoom() const { return std::atomic_load(&room_); }
+    void setRoom(RoomPtr room) { std::atomic_store(&room_, std::move(room)); }
+    // 投递离线期间收到的私聊:JOIN之后调用,发送方存入离线收件箱时发现接收方刚好在线也会调用;已在投递中时直接返回
+    void deliverOfflineInbox();
+
+    static constexpr int MAX_MISSED_PONGS = 3;
+    // 一次sendmsg最多合并的iovec数(每条消息最多两段:替换的帧头和消息体)
+    static constexpr int MAX_WRITE_IOV = 64;
 
 private:
     struct ClientInfo
     {
         int fd;
         std::string address;
-        std::string name;
     };
 
+    // 单个文件流的接收状态
+    struct FileStream
+    {
+        FileInfo info;
+        size_t received_bytes;
+        std::unique_ptr<FileSpool::Upload> spool_upload; // 写入文件池的状态(不需要落盘时为空)
+        bool flow_controlled;                            // 发送方遵守FILE_CREDIT额度
+        // 发送方剩余可发送的字节数;归还额度发生在接收方的写线程,不持有file_receive_mutex_,故用原子量
+        std::shared_ptr<std::atomic<uint64_t>> credit;
+        RoomPtr room; // FILE_MSG时所在的聊天室,之后切换聊天室不影响该文件流的接收方
+    };
+
+    // 写队列中的一条消息:可选的替换帧头prefix,加上frame中从frame_offset开始的部分,一次sendmsg发出
+    struct PendingWrite
+    {
+        SharedFrame prefix;
+        SharedFrame frame;
+        size_t frame_offset;
+        size_t sent;                  // 部分发送时已发送的字节数
+        std::shared_ptr<void> on_sent;
+        FrameProgress progress;       // 边收边转发的帧已到达的字节数
+    };
+
+    // 正在边收边转发的FILE_DATA:帧缓冲区已挂入接收方的写队列,发送方后续到达的数据直接追加到帧中
+    struct CutThrough
+    {
+        std::shared_ptr<std::vector<char>> frame;
+        std::shared_ptr<std::atomic<size_t>> filled;
+        uint32_t stream_id;
+        std::vector<std::weak_ptr<ClientHandler>> recipients;
+        std::chrono::steady_clock::time_point last_progress; // 最近一次有数据到达的时刻
+    };
+
+    static constexpr size_t MAX_FILE_STREAMS = 64;                // 单个连接同时进行的文件流上限
+    static constexpr uint64_t FILE_CREDIT_WINDOW = 4 * 1024 * 1024; // 每个文件流的在途数据窗口
+    static constexpr size_t MAX_INGRESS_BUFFER = 32 * 1024 * 1024;  // 读缓冲区上限,需大于任何合法消息帧
+    static constexpr size_t CUT_THROUGH_THRESHOLD = 256 * 1024;     // 达到该长度的FILE_DATA边收边转发
+    // 边收边转发的帧在接收方写队列中挡住其后的所有消息,发送方停止发送超过该时长即中止该文件流
+    static constexpr std::chrono::seconds CUT_THROUGH_STALL_TIMEOUT{5};
+    static constexpr bool REPAIR_INVALID_UTF8 = true;               // 非法UTF-8的群消息:true替换为U+FFFD后转发,false丢弃
+
     void cleanup();
     bool handleCompleteMessage(const MSG_header &header, const std::string &msg);
-    bool handleJoinMessage(const MSG_header &header);
-    void handleGroupMessage(const MSG_header &header, const std::string &msg);
+    bool handleJoinMessage(const MSG_header &header, const std::string &msg);
+    // 群消息和私聊文本的入口处理:UTF-8校验修复和敏感词过滤;返回false表示丢弃,rewritten为true时应转发text
+    bool filterGroupText(const std::string &name, const char *data, size_t size, std::string &text, bool &rewritten);
+    bool handleGroupMessage(const MSG_header &header);
+    bool handleBatchMessage(const MSG_header &header);
+    // 私聊:经在线用户表直接定位接收方连接,只发给这一个连接
+    bool handleDirectMessage(const MSG_header &header);
     void handleExitMessage();
     void hanleTestMessage(const MSG_header &header, const std::string &msg);
+    void handlePingMessage(const std::string &msg);
+    void handlePongMessage(const std::string &msg);
+    void handleAckMessage(const std::string &msg);
+    void handleResumeMessage(const std::string &msg);
+    // 聊天室切换与查询
+    void handleRoomJoinMessage(const std::string &msg);
+    void handleRoomListMessage();
+    // 离开当前聊天室并进入名为name的聊天室,向客户端回复ROOM_JOIN;名称不合法时留在原聊天室
+    void switchRoom(const std::string &name);
 
     // 消息处理相关
     void processMessages();
     bool processOneMessage();
     bool handleRegularMessage(const MSG_header &header);
+    // 连接的第一帧:识别并回复v2握手
+    bool handleWireHello(bool &waiting);
+    // 按协商的线格式解析读缓冲区开头的帧头,统一转换为MSG_header;数据不足时header_size为0
+    bool peekMessageHeader(MSG_header &header, size_t &header_size);
+    bool enqueueWrite(PendingWrite pending);
 
     // 文件传输相关方法
+    bool takeMessageBody(const MSG_header &header, std::vector<char> &body);
+    // 取出完整的消息帧(消息头+消息体),用于原样转发
+    bool takeMessageFrame(const MSG_header &header, std::vector<char> &frame);
+    bool parseFileStreamBody(const char *body, size_t body_size, uint32_t &stream_id, size_t &data_offset) const;
+    // 转发时使用的发送者名称:已JOIN的连接以服务器记录的名称为准,不信任消息头中的名称
+    UserRegistry::NameRef relaySenderName(const MSG_header &header) const;
     bool handleFileStartMessage(const MSG_header &header);
     bool handleFileDataMessage(const MSG_header &header);
     bool handleFileEndMessage(const MSG_header &header);
-    void resetFileTransferState();
+    void spoolFileData(FileStream &stream, const char *data, size_t size);
+    // 大的FILE_DATA消息体尚未到齐时开始转发;不满足条件时started为false,按整帧处理
+    void beginCutThrough(const MSG_header &header, std::shared_ptr<void> &credit_token, bool &started);
+    // 把读缓冲区中属于当前cut-through帧的数据追加到帧中
+    void continueCutThrough();
+    // 唤醒cut-through帧的接收方,帧已完整时结束cut-through;调用方持有file_receive_mutex_
+    void publishCutThrough();
+    // 心跳时检查:cut-through帧停滞超过CUT_THROUGH_STALL_TIMEOUT时补0结束该帧并向接收方发送FILE_END,
+    // 发送方之后补发的该帧剩余字节被丢弃
+    void abortStalledCutThrough();
+    void serveSpooledFile(const RoomPtr &room, const std::string &sender, const FileInfo &file_info,
+                          const FileSpool::Entry &entry);
+    // 生成转发数据块的完成令牌,所有接收方发送完毕后向发送方归还credit_bytes额度
+    std::shared_ptr<void> makeCreditToken(uint32_t stream_id, const std::shared_ptr<std::atomic<uint64_t>> &credit,
+                                          uint64_t credit_bytes);
+    void abortFileStreams();
+    // 离线收件箱分批投递:一批消息完整写入socket后才确认投递位置并读取下一批,写队列中最多只有一批离线消息
+    void pumpOfflineInbox(uint64_t position);
+    void onOfflineBatchSent(uint64_t end_position);
+    // 投递结束;drained为true时收件箱已投递完并删除
+    void finishOfflineInbox(bool drained);
 
     int client_fd_;
     ReactorServer *server_;
@@ -59,13 +194,44 @@ private:
 
     // 读写缓冲区和队列
     std::vector<char> read_buffer_;
-    std::queue<std::vector<char>> write_queue_;
+    size_t inbound_header_size_; // 当前正在处理的消息在读缓冲区中的帧头长度
+    std::deque<PendingWrite> write_queue_;
     std::mutex write_mutex_;
+    // 合并发送,受write_mutex_保护:最近一次入队的时刻,以及是否已登记到合并窗口结束时发送
+    std::chrono::steady_clock::time_point last_enqueue_;
+    bool flush_scheduled_;
+    bool corked_;
     std::mutex read_buffer_mutex_;
 
-    // 文件传输状态
-    bool is_receiving_file_;        // 是否正在接收文件
-    FileInfo current_file_info_;    // 当前文件信息
-    size_t received_file_bytes_;    // 已接收的文件字节数
+    // 线格式协商
+    bool hello_checked_;
+    std::atomic<uint8_t> wire_version_;
+    std::atomic<uint32_t> user_id_; // JOIN时由服务器分配,路由和v2帧头都以此代替用户名
+    UserRegistry::NameRef name_;    // 通过std::atomic_load/atomic_store读写,先于user_id_设置
+
+    // 心跳状态,受heartbeat_mutex_保护;同一时刻最多一个PING等待回复
+    std::mutex heartbeat_mutex_;
+    uint64_t ping_sequence_;
+    bool ping_outstanding_;
+    std::chrono::steady_clock::time_point ping_sent_at_; // PING写入socket的时刻,尚未写出时为默认值
+    int missed_pongs_;
+    bool heartbeat_capable_; // 回复过PONG,确认对端支持心跳
+    RttHistogram rtt_;
+
+    // 聊天室序号:JOIN之前收到的RESUME暂存到JOIN时执行(只在读路径上访问)
+    std::atomic<bool> sequenced_;
+    std::atomic<uint64_t> acked_sequence_;
+    bool resume_pending_;
+    uint64_t resume_sequence_;
+    RoomPtr room_; // 通过std::atomic_load/atomic_store读写
+
+    // 离线收件箱正在投递,同一时刻只有一个投递过程
+    std::atomic<bool> inbox_draining_;
+
+    // 文件传输状态:stream_id -> 文件流
+    std::unordered_map<uint32_t, FileStream> file_streams_;
+    std::unique_ptr<CutThrough> cut_through_; // 受file_receive_mutex_保护
+    size_t discard_bytes_;          // 已中止的cut-through帧尚未到达的字节数,到达后直接丢弃;受file_receive_mutex_保护
+    bool legacy_file_framing_;      // 对端使用不带stream_id的旧版文件协议(单路传输)
     std::mutex file_receive_mutex_; // 文件接收互斥锁
 };
\ No newline at end of file
@@ -0,0 +1,63 @@
+#include "ClientTable.hpp"
+
+ClientTable::ClientTable()
+{
+    for (Shard &shard : shards_)
+    {
+        shard.map = std::make_shared<const Map>();
+    }
+}
+
+void ClientTable::add(int fd, ClientPtr client)
+{
+    Shard &shard = shardOf(fd);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto map = std::make_shared<Map>(*shard.map);
+    (*map)[fd] = std::move(client);
+    std::atomic_store(&shard.map, std::shared_ptr<const Map>(std::move(map)));
+}
+
+ClientTable::ClientPtr ClientTable::remove(int fd)
+{
+    Shard &shard = shardOf(fd);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.map->find(fd);
+    if (it == shard.map->end())
+        return nullptr;
+
+    ClientPtr client = it->second;
+    auto map = std::make_shared<Map>(*shard.map);
+    map->erase(fd);
+    std::atomic_store(&shard.map, std::shared_ptr<const Map>(std::move(map)));
+    return client;
+}
+
+ClientTable::ClientPtr ClientTable::find(int fd) const
+{
+    std::shared_ptr<const Map> map = std::atomic_load(&shardOf(fd).map);
+    auto it = map->find(fd);
+    return it != map->end() ? it->second : nullptr;
+}
+
+std::vector<ClientTable::ClientPtr> ClientTable::snapshot() const
+{
+    std::vector<ClientPtr> clients;
+    for (const Shard &shard : shards_)
+    {
+        std::shared_ptr<const Map> map = std::atomic_load(&shard.map);
+        for (const auto &pair : *map)
+        {
+            clients.push_back(pair.second);
+        }
+    }
+    return clients;
+}
+
+void ClientTable::clear()
+{
+    for (Shard &shard : shards_)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        std::atomic_store(&shard.map, std::make_shared<const Map>());
+    }
+}
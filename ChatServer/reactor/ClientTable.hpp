@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+
+class ClientHandler;
+
+// 在线连接表:fd -> ClientHandler,按fd分为SHARD_COUNT个分片
+// 每个分片是写时复制的不可变哈希表:查找和遍历只原子地取一次分片指针,不加锁;
+// 增删只锁本分片,复制后整体替换,不同分片的增删互不阻塞。连接数远大于分片数时每次复制的条目数很少
+class ClientTable
+{
+public:
+    static constexpr size_t SHARD_COUNT = 64;
+
+    using ClientPtr = std::shared_ptr<ClientHandler>;
+
+    ClientTable();
+
+    // 禁用拷贝构造和赋值
+    ClientTable(const ClientTable &) = delete;
+    ClientTable &operator=(const ClientTable &) = delete;
+
+    void add(int fd, ClientPtr client);
+    // 移除并返回该连接,不存在时返回nullptr;调用方在分片锁之外做后续清理
+    ClientPtr remove(int fd);
+    ClientPtr find(int fd) const;
+    // 全部连接的快照,逐个分片取指针,不加锁
+    std::vector<ClientPtr> snapshot() const;
+    void clear();
+
+private:
+    using Map = std::unordered_map<int, ClientPtr>;
+
+    // 按缓存行对齐,相邻分片的锁不共享缓存行
+    struct alignas(64) Shard
+    {
+        std::mutex mutex;               // 只串行化本分片的写入
+        std::shared_ptr<const Map> map; // 通过std::atomic_load/atomic_store读写
+    };
+
+    Shard &shardOf(int fd) { return shards_[static_cast<size_t>(fd) % SHARD_COUNT]; }
+    const Shard &shardOf(int fd) const { return shards_[static_cast<size_t>(fd) % SHARD_COUNT]; }
+
+    Shard shards_[SHARD_COUNT];
+};
@@ -68,19 +68,24 @@ bool Reactor::registerHandler(std::shared_ptr<EventHandler> handler, EventType e
     ev.events = static_cast<uint32_t>(events) | EPOLLET; // 任何处理器默认边缘触发
     ev.data.fd = fd;
 
+    // 先登记处理器再加入epoll:accept在线程池中进行,加入epoll后reactor线程可能立即收到该fd的事件,
+    // 若此时还查不到处理器,边缘触发下这次事件就丢失了(客户端连接后立即发送的第一条消息迟迟得不到处理)
+    std::lock_guard<std::mutex> lock(handlers_mutex_);
+    handlers_[fd] = handler;
     if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) < 0)
     {
         LOG_ERROR("添加fd {}到epoll失败: {}", fd, strerror(errno));
+        handlers_.erase(fd);
         return false;
     }
 
-    handlers_[fd] = handler;
     LOG_DEBUG("注册事件处理器成功，fd: {}", fd);
     return true;
 }
 
 bool Reactor::removeHandler(int fd)
 {
+    std::lock_guard<std::mutex> lock(handlers_mutex_);
     auto it = handlers_.find(fd);
     if (it == handlers_.end())
     {
@@ -101,11 +106,13 @@ bool Reactor::removeHandler(int fd)
 
 bool Reactor::modifyHandler(int fd, EventType events)
 {
-    auto it = handlers_.find(fd);
-    if (it == handlers_.end())
     {
-        LOG_ERROR("尝试修改不存在的处理器，fd: {}", fd);
-        return false;
+        std::lock_guard<std::mutex> lock(handlers_mutex_);
+        if (handlers_.find(fd) == handlers_.end())
+        {
+            LOG_ERROR("尝试修改不存在的处理器，fd: {}", fd);
+            return false;
+        }
     }
 
     epoll_event ev;
@@ -152,20 +159,30 @@ void Reactor::handleEvents()
     }
 }
 
+bool Reactor::isRegistered(int fd, const std::shared_ptr<EventHandler> &handler)
+{
+    std::lock_guard<std::mutex> lock(handlers_mutex_);
+    auto it = handlers_.find(fd);
+    return it != handlers_.end() && it->second == handler;
+}
+
 void Reactor::processEvent(const epoll_event &event)
 {
     // 通过事件携带的fd获取对应的处理器
     int fd = event.data.fd;
     uint32_t events = event.events;
 
-    auto it = handlers_.find(fd);
-    if (it == handlers_.end())
+    std::shared_ptr<EventHandler> handler;
     {
-        LOG_WARN("收到未注册fd的事件: {}", fd);
-        return;
+        std::lock_guard<std::mutex> lock(handlers_mutex_);
+        auto it = handlers_.find(fd);
+        if (it == handlers_.end())
+        {
+            LOG_WARN("收到未注册fd的事件: {}", fd);
+            return;
+        }
+        handler = it->second;
     }
-
-    auto handler = it->second;
     if (!handler)
     {
         LOG_ERROR("事件处理器为空，fd: {}", fd);
@@ -199,19 +216,25 @@ void Reactor::processEvent(const epoll_event &event)
             LOG_DEBUG("处理读事件，fd: {}", fd);
             if (thread_pool_)
             {
+                // 先登记读事件再抢占标志:抢占失败时,正在处理的线程清除标志后一定能看到这次登记
+                handler->read_pending_ = true;
                 if (!handler->reading_flag_.test_and_set())
                 {
-                    postTask([handler]()
+                    postTask([this, handler, fd]()
                              {
-                                 handler->handleRead();
-                                 handler->reading_flag_.clear(); 
-                                 // 处理完成后清除标志
-                                 // 确保同一时间只有一个线程在处理一个客户端的读事件
-                             });
+                                 do
+                                 {
+                                     handler->read_pending_ = false;
+                                     handler->handleRead();
+                                     handler->reading_flag_.clear();
+                                     // 处理完成后清除标志
+                                     // 确保同一时间只有一个线程在处理一个客户端的读事件
+                                 } while (handler->read_pending_ && isRegistered(fd, handler) &&
+                                          !handler->reading_flag_.test_and_set()); });
                 }
                 else
                 {
-                    LOG_DEBUG("跳过重复的 handleRead 调度，fd: {}", fd);
+                    LOG_DEBUG("handleRead 正在执行，处理完后重新读取，fd: {}", fd);
                 }
             }
             else
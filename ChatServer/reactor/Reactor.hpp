@@ -4,6 +4,7 @@
 #include <sys/epoll.h>
 #include <functional>
 #include <unordered_map>
+#include <mutex>
 #include <memory>
 #include <atomic>
 #include <thread>
@@ -27,6 +28,9 @@ public:
     virtual void handleError() = 0;
     virtual int getFd() const = 0;
     std::atomic_flag reading_flag_ = ATOMIC_FLAG_INIT;
+    // 读事件到达时置位;正在处理的线程清除reading_flag_后发现它被置位,说明处理期间又有读事件被跳过,需再读一次
+    // (边缘触发下跳过的事件不会再次通知,timerfd未被读取时也不会再到期)
+    std::atomic<bool> read_pending_{false};
 };
 
 // Reactor事件循环器
@@ -65,10 +69,13 @@ private:
     int epoll_fd_;
     std::atomic<bool> running_;
     std::unordered_map<int, std::shared_ptr<EventHandler>> handlers_;
+    std::mutex handlers_mutex_; // 处理器在线程池中注册(accept)和移除,reactor线程同时在查找
     std::shared_ptr<ThreadPool> thread_pool_;
 
     void handleEvents();
     void processEvent(const epoll_event &event);
+    // handler仍注册在fd上(未被移除,fd也未被新连接复用)
+    bool isRegistered(int fd, const std::shared_ptr<EventHandler> &handler);
 };
 
 // 模板方法实现
@@ -14,8 +14,11 @@
 std::unique_ptr<ReactorServer> g_server;// 全局服务器指针
 
 // ReactorServer构造函数初始化线程池(在这之前会先调用Reactor的构造函数)
-ReactorServer::ReactorServer(int port, size_t thread_count)
-    : port_(port), listen_fd_(-1)
+ReactorServer::ReactorServer(int port, size_t thread_count, FanoutMode fanout_mode,
+                             std::chrono::microseconds coalesce_window)
+    : port_(port), listen_fd_(-1),
+      coalesce_window_(std::clamp(coalesce_window, std::chrono::microseconds(0), MAX_COALESCE_WINDOW)),
+      file_spool_(FileSpool::DEFAULT_DIR)
 {
     if (thread_count == 0)
     {
@@ -25,6 +28,19 @@ ReactorServer::ReactorServer(int port, size_t thread_count)
     }
     thread_pool_ = std::make_shared<ThreadPool>(thread_count);
     reactor_.setThreadPool(thread_pool_);
+
+    if (fanout_mode == FanoutMode::RING)
+    {
+        size_t lanes = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), MAX_RING_LANES);
+        fanout_ring_ = std::make_unique<BroadcastRing<RingEntry>>(RING_CAPACITY, lanes,
+                                                                  [this](size_t lane, const RingEntry &entry)
+                                                                  { deliverRingEntry(lane, entry); });
+        LOG_INFO("聊天消息使用广播环扇出, 通道数: {}", lanes);
+    }
+    if (coalesce_window_.count() > 0)
+    {
+        LOG_INFO("合并发送窗口: {} us", coalesce_window_.count());
+    }
     LOG_DEBUG("ReactorServer初始化，端口: {}, 线程数: {}", port_, thread_count);
 }
 
@@ -64,16 +80,34 @@ void ReactorServer::stop()
         reactor_thread_.join();
     }
 
+    // reactor线程退出后不再投递新任务;等待线程池中已投递的事件处理和定时器回调执行完,
+    // 之后才能释放它们访问的客户端表和在线用户表
+    if (thread_pool_)
+    {
+        thread_pool_->shutdown();
+    }
+    if (fanout_ring_)
+    {
+        fanout_ring_->stop();
+    }
+    // 不再有新消息,写完待写队列中的消息并落盘
+    if (message_log_)
+    {
+        message_log_->stop();
+    }
+    if (offline_inbox_)
+    {
+        offline_inbox_->stop();
+    }
+
     if (listen_fd_ >= 0)
     {
         close(listen_fd_);
         listen_fd_ = -1;
     }
 
-    {
-        std::lock_guard<std::mutex> lock(clients_mutex_);
-        clients_.clear();
-    }
+    clients_.clear();
+    rooms_.clear();
 
     // 通知main线程停止
     {
@@ -83,8 +117,6 @@ void ReactorServer::stop()
 
     cv.notify_all();
     LOG_INFO("ReactorServer已停止");
-
-    // 线程池是智能指针管理,其析构函数自动调用清理资源
 }
 
 bool ReactorServer::isRunning() const
@@ -95,94 +127,482 @@ bool ReactorServer::isRunning() const
 void ReactorServer::addClient(std::shared_ptr<ClientHandler> client)
 {
     // 添加的一部分在ServerAcceptor::handleAccept中完成了,所以这里和removeClient的逻辑不一一对应
-    std::lock_guard<std::mutex> lock(clients_mutex_);
-    clients_[client->getFd()] = client;
+    int client_fd = client->getFd();
+    clients_.add(client_fd, std::move(client));
 }
 
 void ReactorServer::removeClient(int client_fd)
 {
-    std::lock_guard<std::mutex> lock(clients_mutex_);
-    auto it = clients_.find(client_fd);
-    if (it != clients_.end())
+    // 先从客户端映射中移除,再在分片锁之外从Reactor中移除事件处理器
+    if (clients_.remove(client_fd))
     {
-        // 从Reactor中移除事件处理器
         reactor_.removeHandler(client_fd);
-        // 从客户端映射中移除
-        clients_.erase(it);
         LOG_INFO("客户端 (fd: {}) 已被移除", client_fd);
     }
 }
 
 std::shared_ptr<ClientHandler> ReactorServer::getClient(int client_fd)
 {
-    std::lock_guard<std::mutex> lock(clients_mutex_);
-    auto it = clients_.find(client_fd);
-    return (it != clients_.end()) ? it->second : nullptr;
+    return clients_.find(client_fd);
+}
+
+// 接收方只取自聊天室成员表;成员在JOIN登录后才进入聊天室,登录阶段的连接不会收到广播
+size_t ReactorServer::broadcastMessage(const RoomPtr &room, std::vector<char> message, int exclude_fd,
+                                       const std::shared_ptr<void> &on_sent)
+{
+    return broadcastFrame(room, std::make_shared<const std::vector<char>>(std::move(message)), exclude_fd, on_sent);
+}
+
+size_t ReactorServer::broadcastFrame(const RoomPtr &room, const SharedFrame &frame, int exclude_fd,
+                                     const std::shared_ptr<void> &on_sent, const FrameProgress &progress,
+                                     std::vector<std::weak_ptr<ClientHandler>> *recipients)
+{
+    // 取成员连接数组的快照,不加聊天室锁
+    std::shared_ptr<const Room::Recipients> members = std::atomic_load(&room->recipients);
+
+    LOG_DEBUG("向聊天室 {} 的 {} 个客户端广播消息，消息总大小: {} 字节",
+              room->name, members->size(), frame->size());
+    return deliverFrame(*members, frame, exclude_fd, on_sent, progress, recipients);
 }
 
-// 广播消息时注意:客户端有handler实际上不一定已经进入聊天室,要排除未设置名称的客户端(只有登录上来发送JOIN消息后才会设置名称)
-void ReactorServer::broadcastMessage(const std::vector<char> &message, int exclude_fd)
+size_t ReactorServer::deliverFrame(const Room::Recipients &clients, const SharedFrame &frame, int exclude_fd,
+                                   const std::shared_ptr<void> &on_sent, const FrameProgress &progress,
+                                   std::vector<std::weak_ptr<ClientHandler>> *recipients)
 {
-    std::vector<std::shared_ptr<ClientHandler>> clients_copy;
+    std::atomic<size_t> success_count{0};
+    std::mutex recipients_mutex;
+    // v2帧头只生成一次,所有v2接收方共用;分段并行时各段只读
+    SharedFrame v2_header = makeV2Header(*frame);
+    auto deliver = [&](size_t begin, size_t end)
     {
-        std::lock_guard<std::mutex> lock(clients_mutex_);
-        for (const auto &pair : clients_)
+        std::vector<std::weak_ptr<ClientHandler>> sent;
+        size_t count = 0;
+        for (size_t i = begin; i < end; ++i)
         {
-            if (pair.first != exclude_fd && pair.second->isNameSet())
+            const auto &client = clients[i];
+            if (client->getFd() == exclude_fd)
             {
-                clients_copy.push_back(pair.second);
+                continue;
             }
+            if (client->sendFrame(frame, on_sent, client->getWireVersion() >= WIRE_VERSION_V2 ? v2_header : nullptr,
+                                  progress))
+            {
+                count++;
+                if (recipients)
+                {
+                    sent.push_back(client);
+                }
+            }
+        }
+        success_count += count;
+        if (recipients && !sent.empty())
+        {
+            std::lock_guard<std::mutex> lock(recipients_mutex);
+            recipients->insert(recipients->end(), sent.begin(), sent.end());
+        }
+    };
+    fanOut(clients.size(), deliver);
+
+    LOG_DEBUG("成功发送给 {}/{} 个客户端", success_count.load(), clients.size());
+    return success_count.load();
+}
+
+void ReactorServer::broadcastRoomMessage(const RoomPtr &room, const SharedFrame &frame, int sender_fd)
+{
+    // 分配序号和挂入各接收方写队列在同一临界区内完成,每个接收方都按序号顺序收到消息
+    std::lock_guard<std::mutex> lock(room->mutex);
+    uint64_t sequence = room->log.append(frame);
+    if (message_log_)
+    {
+        // 只放入待写队列,落盘由日志的写线程成组完成;磁盘跟不上时丢弃,不阻塞广播
+        if (!message_log_->append(room->name, frame))
+        {
+            noteMessageLogDrop(room->name);
         }
     }
 
-    LOG_DEBUG("广播消息给 {} 个客户端，消息总大小: {} 字节",
-              clients_copy.size(), message.size());
+    // 各接收方共用的帧头预先生成,之后只读
+    RoomDelivery delivery;
+    prepareRoomDelivery(frame, sequence, delivery);
 
-    size_t success_count = 0;
-    // 发送消息给所有客户端,排除指定的客户端
-    for (auto &client : clients_copy)
+    if (fanout_ring_)
+    {
+        // 广播环:条目在聊天室锁内发布,环中的顺序与序号一致;各通道投递给自己负责的成员后即返回
+        fanout_ring_->publish(RingEntry{frame, sequence, sender_fd, std::move(delivery), lanePartitionLocked(*room)});
+        LOG_DEBUG("聊天室 {} 消息 {} 写入广播环, 成员 {} 人", room->name, sequence, room->members.size());
+        return;
+    }
+
+    // 持锁期间成员数组不会被替换,直接遍历
+    const Room::Recipients &members = *room->recipients;
+    fanOut(members.size(), [&](size_t begin, size_t end)
+           {
+               for (size_t i = begin; i < end; ++i)
+               {
+                   deliverToMember(*members[i], frame, sequence, sender_fd, delivery);
+               }
+           });
+
+    LOG_DEBUG("聊天室 {} 消息 {} 广播给 {} 个客户端，消息总大小: {} 字节", room->name, sequence, members.size(),
+              frame->size());
+}
+
+void ReactorServer::deliverToMember(ClientHandler &client, const SharedFrame &frame, uint64_t sequence, int sender_fd,
+                                    const RoomDelivery &delivery)
+{
+    if (client.getFd() != sender_fd)
+    {
+        deliverRoomMessage(client, frame, delivery);
+    }
+    else if (client.isSequenced())
+    {
+        // 发送方不会收到自己的消息,用ACK告知其序号,使其收到的序号保持连续
+        client.sendMessage(encodeSequenceMessage(ACK, sequence));
+    }
+}
+
+std::shared_ptr<const Room::LanePartition> ReactorServer::lanePartitionLocked(Room &room)
+{
+    if (!room.partition || room.partition->source != room.recipients)
     {
-        if (client->sendMessage(message))
+        // 连接按fd固定属于一个通道,切换聊天室后仍由同一通道投递
+        size_t lanes = fanout_ring_->laneCount();
+        auto partition = std::make_shared<Room::LanePartition>();
+        partition->source = room.recipients;
+        partition->lanes.resize(lanes);
+        for (size_t i = 0; i < room.recipients->size(); ++i)
         {
-            success_count++;
+            int fd = (*room.recipients)[i]->getFd();
+            partition->lanes[static_cast<size_t>(fd < 0 ? 0 : fd) % lanes].push_back(static_cast<uint32_t>(i));
         }
+        room.partition = std::move(partition);
+    }
+    return room.partition;
+}
+
+void ReactorServer::announceLocked(Room &room, const SharedFrame &frame)
+{
+    if (!fanout_ring_)
+    {
+        deliverFrame(*room.recipients, frame);
+        return;
     }
+    // 不占用聊天室序号(序号为0),也没有发送方;两种v2帧头都不带序号
+    RoomDelivery delivery;
+    delivery.v2_header = makeV2Header(*frame);
+    delivery.sequenced_header = delivery.v2_header;
+    fanout_ring_->publish(RingEntry{frame, 0, -1, std::move(delivery), lanePartitionLocked(room)});
+}
 
-    LOG_DEBUG("成功发送给 {}/{} 个客户端", success_count, clients_copy.size());
+void ReactorServer::deliverRingEntry(size_t lane, const RingEntry &entry)
+{
+    const Room::Recipients &members = *entry.partition->source;
+    for (uint32_t index : entry.partition->lanes[lane])
+    {
+        deliverToMember(*members[index], entry.frame, entry.sequence, entry.sender_fd, entry.delivery);
+    }
 }
 
-void ReactorServer::syncUserListForClient(int target_fd)
+void ReactorServer::prepareRoomDelivery(const SharedFrame &frame, uint64_t sequence, RoomDelivery &delivery,
+                                        bool with_name) const
 {
-    auto target_client = getClient(target_fd);
-    if (!target_client)
+    // 两种帧头共用一次发送者ID查找;携带用户名时不查用户表
+    MSG_header header;
+    schema::decodeHeader(frame->data(), header);
+    uint32_t sender_id = with_name ? UserRegistry::INVALID_ID
+                                   : users_.idOf(std::string(header.sender_name,
+                                                             strnlen(header.sender_name, MAX_NAMEBUFFER)));
+    delivery.v2_header = encodeV2Header(header, sender_id, 0, with_name);
+    delivery.sequenced_header = encodeV2Header(header, sender_id, sequence, with_name);
+    expandBatch(*frame, delivery.expanded);
+}
+
+void ReactorServer::expandBatch(const std::vector<char> &frame, std::vector<SharedFrame> &expanded)
+{
+    MSG_header header;
+    schema::decodeHeader(frame.data(), header);
+    if (header.Type != BATCH)
+    {
+        return;
+    }
+    const char *sender = frame.data() + offsetof(MSG_header, sender_name);
+    schema::forEachBatchItem(frame.data() + sizeof(MSG_header), frame.size() - sizeof(MSG_header),
+                             [&expanded, sender](MSG_type type, const char *data, size_t size)
+                             {
+                                 auto item = std::make_shared<std::vector<char>>(sizeof(MSG_header) + size);
+                                 schema::encodeText(item->data(), type, sender, data, size);
+                                 expanded.push_back(std::move(item));
+                                 return true;
+                             });
+}
+
+void ReactorServer::deliverRoomMessage(ClientHandler &client, const SharedFrame &frame, const RoomDelivery &delivery)
+{
+    if (client.getWireVersion() >= WIRE_VERSION_V2)
+    {
+        // 帧头按有无序号各生成一次,所有同类接收方共用
+        client.sendFrame(frame, nullptr, client.isSequenced() ? delivery.sequenced_header : delivery.v2_header);
+        return;
+    }
+
+    // 旧版格式的客户端不认识BATCH,收到拆开的GROUP_MSG(只生成一次,所有旧版接收方共用)
+    MSG_header header;
+    schema::decodeHeader(frame->data(), header);
+    if (header.Type != BATCH)
+    {
+        client.sendFrame(frame);
+        return;
+    }
+    for (const auto &item : delivery.expanded)
+    {
+        client.sendFrame(item);
+    }
+}
+
+void ReactorServer::resumeRoom(const std::shared_ptr<ClientHandler> &client, uint64_t last_sequence)
+{
+    // 成员变更只发生在该连接自己的读路径上,此处取到的聊天室在返回前不会变化
+    RoomPtr room = client->getRoom();
+    if (!room)
         return;
+    std::lock_guard<std::mutex> lock(room->mutex);
+    client->cork();
+    replayRoomLocked(*room, *client, last_sequence);
+    client->uncork();
+}
 
-    std::vector<std::string> users;
+void ReactorServer::replayRoomLocked(Room &room, ClientHandler &client, uint64_t last_sequence, bool sequenced)
+{
+    // 在聊天室锁内补发:之前的消息都在补发范围内,之后的消息都带更大的序号,不重不漏
+    std::vector<std::pair<uint64_t, SharedFrame>> messages;
+    uint64_t start = room.log.replaySince(last_sequence, messages);
+    if (sequenced)
     {
-        std::lock_guard<std::mutex> lock(clients_mutex_);
-        for (const auto &pair : clients_)
+        client.setSequenced(true);
+        client.sendMessage(encodeSequenceMessage(RESUME, start));
+    }
+
+    std::string name = client.getName();
+    for (const auto &message : messages)
+    {
+        // 自己发出的消息只补发ACK
+        const char *sender = message.second->data() + offsetof(MSG_header, sender_name);
+        if (sequenced && strncmp(sender, name.c_str(), MAX_NAMEBUFFER) == 0)
         {
-            // 列表包含除自己外的所有已登录用户
-            if (pair.first != target_fd && pair.second->isNameSet())
-            {
-                users.push_back(pair.second->getName());
-            }
+            client.sendMessage(encodeSequenceMessage(ACK, message.first));
+            continue;
         }
+        // 补发(包括进入聊天室时的历史消息)的发送者可能已下线,其ID已回收;能识别用户名的客户端直接在帧头中收到用户名
+        RoomDelivery delivery;
+        prepareRoomDelivery(message.second, message.first, delivery, client.acceptsSenderName());
+        deliverRoomMessage(client, message.second, delivery);
     }
 
-    if (users.empty())
-        return;
+    if (sequenced)
+    {
+        LOG_INFO("客户端 {} 从序号 {} 恢复聊天室 {} 的消息: 补发 {} 条{}", name, last_sequence, room.name,
+                 messages.size(), last_sequence != 0 && start > last_sequence ? ", 部分消息已无法补发" : "");
+    }
+    else if (!messages.empty())
+    {
+        LOG_INFO("客户端 {} 进入聊天室 {}: 补发最近的 {} 条消息", name, room.name, messages.size());
+    }
+}
+
+bool ReactorServer::enterRoom(const std::shared_ptr<ClientHandler> &client, const RoomPtr &room, bool confirm,
+                              const uint64_t *resume_sequence)
+{
+    std::string name = client->getName();
+    std::lock_guard<std::mutex> lock(room->mutex);
+    if (room->closed)
+        return false;
+    restoreHistoryLocked(*room);
+
+    // 确认、成员列表和补发的消息先积攒在写队列中,最后合并发出
+    client->cork();
+
+    // 确认消息排在新聊天室的任何消息之前,客户端据此切换序号
+    if (confirm)
+    {
+        client->sendMessage(encodeMessage(ROOM_JOIN, room->name, "SERVER"));
+    }
+
+    // 消息体也带上用户名:v2帧头只有发送者ID,接收方据此建立ID到用户名的映射(旧版客户端忽略消息体)
+    announceLocked(*room, std::make_shared<const std::vector<char>>(encodeMessage(JOIN, name, name)));
+    room->addMember(client->getUserId(), client);
+    client->setRoom(room);
+    client->resetAckedSequence();
+
+    sendRoomMembersLocked(*room, *client);
+    if (resume_sequence && *resume_sequence != 0)
+    {
+        replayRoomLocked(*room, *client, *resume_sequence);
+    }
+    else
+    {
+        // 没有补发起点(或从0开始,即客户端没有任何消息)时补发最近的历史消息,带序号的连接从第一条历史消息开始确认
+        uint64_t history_start = room->log.recentStart(join_history_messages_, join_history_bytes_);
+        replayRoomLocked(*room, *client, history_start, resume_sequence || client->isSequenced());
+    }
+    client->uncork();
+
+    LOG_INFO("客户端 {} 进入聊天室 {}, 成员 {} 人", name, room->name, room->members.size());
+    return true;
+}
+
+void ReactorServer::leaveRoom(const std::shared_ptr<ClientHandler> &client, const RoomPtr &room)
+{
+    std::string name = client->getName();
+    uint64_t drain_target = 0;
+    {
+        std::lock_guard<std::mutex> lock(room->mutex);
+        room->removeMember(client->getUserId());
+        // 退出消息在注销用户ID之前发出,v2接收方收到的帧头仍是退出者的ID;
+        // ring模式下排在该连接此前发出的聊天消息之后
+        announceLocked(*room, std::make_shared<const std::vector<char>>(encodeMessage(EXIT, name, name)));
+        // 含该连接的条目都在聊天室锁内发布,此刻之前已全部领取
+        if (fanout_ring_)
+        {
+            drain_target = fanout_ring_->claimed();
+        }
+        LOG_INFO("客户端 {} 离开聊天室 {}, 剩余成员 {} 人", name, room->name, room->members.size());
+    }
+    // 广播环中仍可能有发给该连接的旧聊天室消息或ACK,等它们投递完再发出切换聊天室的确认;
+    // 不持聊天室锁,只等到离开时已领取的条目,其他聊天室随后发布的消息不延长等待
+    if (fanout_ring_)
+    {
+        fanout_ring_->waitDrained(drain_target);
+    }
+    rooms_.removeIfEmpty(room);
+}
+
+void ReactorServer::sendRoomMembersLocked(const Room &room, ClientHandler &client)
+{
+    // 列表包含除自己外的聊天室成员
+    // v2客户端收到的是用户字典,列表项为"ID:用户名",此后的消息帧只携带发送者ID
+    bool with_ids = client.getWireVersion() >= WIRE_VERSION_V2;
+    auto users = users_.namesOf(room.members, client.getUserId());
 
     std::ostringstream oss;
     for (size_t i = 0; i < users.size(); ++i)
     {
-        oss << users[i] << (i == users.size() - 1 ? "" : ",");
+        if (with_ids)
+            oss << users[i].first << ":";
+        oss << users[i].second << (i == users.size() - 1 ? "" : ",");
     }
     std::string user_list = oss.str();
 
-    target_client->sendMessage(encodeMessage(INITIAL, user_list, "SERVER"));
+    // 空列表同样发送:客户端据此清空上一个聊天室的成员列表
+    client.sendMessage(encodeMessage(INITIAL, user_list, "SERVER"));
+
+    LOG_DEBUG("向 {} (fd: {}) 发送聊天室 {} 的成员列表: [{}]", client.getName(), client.getFd(), room.name, user_list);
+}
+
+void ReactorServer::syncRosterForClient(int target_fd, uint64_t known_epoch)
+{
+    auto target_client = getClient(target_fd);
+    if (!target_client)
+        return;
+    uint32_t self_id = target_client->getUserId();
+
+    // 增量不比快照大时只发送增量;自己的上线记录不发给自己(同一ID更早的占用者必有随后的下线记录)
+    std::vector<UserRegistry::RosterChange> changes;
+    uint64_t epoch = 0;
+    bool reset = known_epoch == 0 || !users_.changesSince(known_epoch, changes, epoch) ||
+                 changes.size() > users_.size();
+    if (reset)
+    {
+        changes.clear();
+        for (auto &user : users_.snapshot(self_id, &epoch))
+        {
+            changes.push_back(UserRegistry::RosterChange{epoch, user.first, true, std::move(user.second)});
+        }
+    }
+    else
+    {
+        changes.erase(std::remove_if(changes.begin(), changes.end(),
+                                     [self_id](const UserRegistry::RosterChange &change)
+                                     { return change.joined && change.id == self_id; }),
+                      changes.end());
+    }
+
+    // 按页发送,每页至少一帧:空的增量也告知客户端当前版本
+    size_t next = 0;
+    size_t pages = 0;
+    do
+    {
+        size_t end = std::min(next + ROSTER_PAGE_ENTRIES, changes.size());
+        std::string body(sizeof(RosterHeader), '\0');
+        RosterHeader header{epoch, 0, static_cast<uint32_t>(end - next)};
+        if (reset && next == 0)
+            header.flags |= ROSTER_FLAG_RESET;
+        if (end < changes.size())
+            header.flags |= ROSTER_FLAG_MORE;
+        memcpy(&body[0], &header, sizeof(header));
+
+        for (; next < end; ++next)
+        {
+            const auto &change = changes[next];
+            size_t name_length = change.joined ? std::min<size_t>(change.name.size(), MAX_NAMEBUFFER - 1) : 0;
+            size_t offset = body.size();
+            body.resize(offset + schema::rosterEntrySize(name_length));
+            schema::encodeRosterEntry(&body[offset], change.id, change.joined ? ROSTER_OP_JOIN : ROSTER_OP_LEAVE,
+                                      change.name.data(), name_length);
+        }
+        target_client->sendMessage(encodeMessage(ROSTER, body, "SERVER"));
+        ++pages;
+    } while (next < changes.size());
+
+    LOG_INFO("向 {} (fd: {}) 发送{}用户表: 版本 {}, {} 条, {} 页", target_client->getName(), target_fd,
+             reset ? "完整" : "增量", epoch, changes.size(), pages);
+}
+
+SharedFrame ReactorServer::makeV2Header(const std::vector<char> &frame, uint64_t sequence, bool with_name) const
+{
+    MSG_header header;
+    schema::decodeHeader(frame.data(), header);
+    if (with_name)
+    {
+        return encodeV2Header(header, UserRegistry::INVALID_ID, sequence, true);
+    }
+    return encodeV2Header(header,
+                          users_.idOf(std::string(header.sender_name, strnlen(header.sender_name, MAX_NAMEBUFFER))),
+                          sequence, false);
+}
+
+SharedFrame ReactorServer::encodeV2Header(const MSG_header &header, uint32_t sender_id, uint64_t sequence,
+                                          bool with_name)
+{
+    WireHeaderV2 v2{};
+    v2.type = static_cast<uint8_t>(header.Type);
+    v2.sender_id = sender_id;
+    v2.length = header.length;
+    if (sequence != 0)
+    {
+        v2.flags |= WIRE_FLAG_SEQUENCE;
+        v2.sequence = sequence;
+    }
+    if (with_name)
+    {
+        // 用户名取自帧本身记录的发送者,与用户表无关
+        v2.flags |= WIRE_FLAG_SENDER_NAME;
+        v2.sender_name_size = static_cast<uint8_t>(strnlen(header.sender_name, WIRE_V2_MAX_NAME_SIZE));
+        memcpy(v2.sender_name, header.sender_name, v2.sender_name_size);
+    }
+
+    unsigned char buffer[WIRE_V2_MAX_HEADER_SIZE];
+    size_t size = encodeWireHeaderV2(buffer, v2);
+    return std::make_shared<const std::vector<char>>(buffer, buffer + size);
+}
 
-    LOG_INFO("向 {} (fd: {}) 发送用户列表: [{}]", target_client->getName(), target_fd, user_list);
+std::vector<std::shared_ptr<ClientHandler>> ReactorServer::collectJoinedClients()
+{
+    std::vector<std::shared_ptr<ClientHandler>> clients_copy = clients_.snapshot();
+    clients_copy.erase(std::remove_if(clients_copy.begin(), clients_copy.end(),
+                                      [](const std::shared_ptr<ClientHandler> &client)
+                                      { return !client->isNameSet(); }),
+                       clients_copy.end());
+    return clients_copy;
 }
 
 void ReactorServer::initializeServer()
@@ -193,6 +613,170 @@ void ReactorServer::initializeServer()
     {
         throw std::runtime_error("注册服务器接受器失败");
     }
+
+    heartbeat_timer_ = std::make_shared<TimerHandler>(HEARTBEAT_INTERVAL, [this]()
+                                                      { heartbeat(); });
+    if (!reactor_.registerHandler(heartbeat_timer_, EventType::READ))
+    {
+        throw std::runtime_error("注册心跳定时器失败");
+    }
+
+    keyword_filter_.reloadIfChanged();
+    filter_timer_ = std::make_shared<TimerHandler>(FILTER_RELOAD_INTERVAL, [this]()
+                                                   { keyword_filter_.reloadIfChanged(); });
+    if (!reactor_.registerHandler(filter_timer_, EventType::READ))
+    {
+        throw std::runtime_error("注册敏感词表定时器失败");
+    }
+
+    if (coalesce_window_.count() > 0)
+    {
+        // 单次定时器:第一个连接登记时才开始计时,没有待发送的连接时不唤醒reactor
+        coalesce_timer_ = std::make_shared<TimerHandler>(
+            coalesce_window_, [this]()
+            { flushCoalesced(); },
+            false);
+        if (!reactor_.registerHandler(coalesce_timer_, EventType::READ))
+        {
+            throw std::runtime_error("注册合并发送定时器失败");
+        }
+    }
+}
+
+void ReactorServer::setJoinHistory(size_t messages, size_t bytes)
+{
+    join_history_messages_ = messages;
+    join_history_bytes_ = bytes;
+}
+
+void ReactorServer::enableMessageLog(const MessageLog::Options &options)
+{
+    message_log_ = std::make_unique<MessageLog>(options);
+    if (!message_log_->isEnabled())
+    {
+        message_log_.reset();
+        return;
+    }
+
+    // 读出最近的消息按聊天室暂存,聊天室被进入时再放回其日志(分配本次运行的序号),重启后进入聊天室的客户端仍能收到历史消息
+    uint64_t next = message_log_->nextOffset();
+    uint64_t start = std::max(message_log_->firstOffset(), next - std::min<uint64_t>(next, RESTORE_MESSAGES));
+    std::lock_guard<std::mutex> lock(restored_mutex_);
+    size_t restored = message_log_->read(start, RESTORE_MESSAGES, [this](const MessageLog::Record &record)
+                                         {
+                                             if (record.frame.size() < sizeof(MSG_header) ||
+                                                 !RoomDirectory::isValidName(record.room))
+                                                 return;
+                                             restored_history_[record.room].push_back(
+                                                 std::make_shared<const std::vector<char>>(record.frame)); });
+    LOG_INFO("从消息日志读出 {} 条聊天室消息, 聊天室 {} 个", restored, restored_history_.size());
+}
+
+void ReactorServer::noteMessageLogDrop(const std::string &room)
+{
+    uint64_t dropped = ++message_log_drops_;
+    int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now().time_since_epoch())
+                         .count();
+    int64_t last_ms = last_drop_warning_ms_.load();
+    // 第一次丢弃立即告警;之后在间隔内只计数,由抢到时间戳的线程汇总上报
+    if ((last_ms != 0 && now_ms - last_ms < std::chrono::milliseconds(DROP_WARNING_INTERVAL).count()) ||
+        !last_drop_warning_ms_.compare_exchange_strong(last_ms, now_ms))
+    {
+        return;
+    }
+    uint64_t reported = message_log_drops_reported_.exchange(dropped);
+    LOG_WARN("消息日志待写队列已满, 丢弃 {} 条消息(最近: 聊天室 {}, 累计 {} 条), 这些消息重启后无法恢复",
+             dropped - reported, room, dropped);
+}
+
+void ReactorServer::restoreHistoryLocked(Room &room)
+{
+    std::vector<SharedFrame> frames;
+    {
+        std::lock_guard<std::mutex> lock(restored_mutex_);
+        auto it = restored_history_.find(room.name);
+        if (it == restored_history_.end())
+            return;
+        frames.swap(it->second);
+        restored_history_.erase(it);
+    }
+
+    // 放在本次运行的消息之前:聊天室只有在被进入时才有消息,第一次进入时日志为空
+    for (const auto &frame : frames)
+    {
+        room.log.append(frame);
+    }
+    LOG_INFO("聊天室 {} 放回重启前的 {} 条消息", room.name, frames.size());
+}
+
+void ReactorServer::enableOfflineInbox(const OfflineInbox::Options &options)
+{
+    offline_inbox_ = std::make_unique<OfflineInbox>(options);
+    if (!offline_inbox_->isEnabled())
+    {
+        offline_inbox_.reset();
+    }
+}
+
+void ReactorServer::scheduleFlush(std::weak_ptr<ClientHandler> client)
+{
+    std::lock_guard<std::mutex> lock(coalesce_mutex_);
+    // 登记表由空变为非空时开始计时;之后登记的连接在同一次到期时发送,窗口不会被推迟
+    if (coalesce_pending_.empty() && coalesce_timer_)
+    {
+        coalesce_timer_->arm();
+    }
+    coalesce_pending_.push_back(std::move(client));
+}
+
+void ReactorServer::flushCoalesced()
+{
+    std::vector<std::weak_ptr<ClientHandler>> pending;
+    {
+        std::lock_guard<std::mutex> lock(coalesce_mutex_);
+        pending.swap(coalesce_pending_);
+    }
+    for (auto &weak_client : pending)
+    {
+        if (auto client = weak_client.lock())
+        {
+            client->flushCoalesced();
+        }
+    }
+}
+
+void ReactorServer::heartbeat()
+{
+    // 只向已JOIN的连接发送PING:登录阶段的客户端还不处理聊天消息
+    std::vector<std::shared_ptr<ClientHandler>> clients_copy = collectJoinedClients();
+    // 确认落后的条数按各连接所在聊天室的最新序号计算,每个聊天室只加一次锁
+    std::unordered_map<const Room *, uint64_t> last_sequences;
+    uint64_t max_ack_lag = 0;
+    for (auto &client : clients_copy)
+    {
+        client->heartbeat();
+        RoomPtr room = client->getRoom();
+        if (!room || !client->isSequenced() || client->getAckedSequence() == 0)
+            continue;
+
+        auto it = last_sequences.find(room.get());
+        if (it == last_sequences.end())
+        {
+            std::lock_guard<std::mutex> lock(room->mutex);
+            it = last_sequences.emplace(room.get(), room->log.lastSequence()).first;
+        }
+        uint64_t last_sequence = it->second;
+        max_ack_lag = std::max(max_ack_lag, last_sequence - std::min(last_sequence, client->getAckedSequence()));
+    }
+
+    if (rtt_.count() > 0)
+    {
+        LOG_INFO("心跳: 在线连接 {}, 聊天室 {} 个, 保留消息 {} KB, 往返时延样本 {}, p50 <{} us, p99 <{} us, "
+                 "最慢确认落后 {} 条",
+                 clients_copy.size(), rooms_.size(), RoomLog::totalBytes() / 1024, rtt_.count(), rtt_.percentile(50),
+                 rtt_.percentile(99), max_ack_lag);
+    }
 }
 
 void ReactorServer::createListenSocket()
@@ -2,8 +2,20 @@
 
 #include "Reactor.hpp"
 #include "protocol/Protocol.hpp"
+#include "protocol/WireFormat.hpp"
 #include "ServerAcceptor.hpp"
+#include "UserRegistry.hpp"
+#include "TimerHandler.hpp"
+#include "RttHistogram.hpp"
+#include "RoomDirectory.hpp"
+#include "ClientTable.hpp"
+#include "BroadcastRing.hpp"
+#include "storage/FileSpool.hpp"
+#include "storage/MessageLog.hpp"
+#include "storage/OfflineInbox.hpp"
+#include "filter/KeywordFilter.hpp"
 #include <string>
+#include <atomic>
 #include <unordered_map>
 #include <vector>
 #include <memory>
@@ -14,15 +26,25 @@
 #include <chrono>
 #include <thread>
 #include <condition_variable>
+#include <functional>
 
 // 前向声明
 class ClientHandler;
 class ServerAcceptor;
 
+// 聊天消息的扇出方式
+enum class FanoutMode
+{
+    POOL, // 由处理该消息的线程投递,大聊天室分段交给线程池并行
+    RING  // 写入广播环,各通道线程投递给自己负责的连接;进入/退出通知同样经过广播环,文件帧仍直接投递
+};
+
 class ReactorServer
 {
 public:
-    ReactorServer(int port, size_t thread_count = 0);
+    // coalesce_window为0时不合并发送,否则取值不超过MAX_COALESCE_WINDOW
+    ReactorServer(int port, size_t thread_count = 0, FanoutMode fanout_mode = FanoutMode::POOL,
+                  std::chrono::microseconds coalesce_window = std::chrono::microseconds(0));
     ~ReactorServer();
 
     // 禁用拷贝构造和赋值
@@ -40,14 +62,132 @@ public:
     void removeClient(int client_fd);
     std::shared_ptr<ClientHandler> getClient(int client_fd);
 
-    // 消息广播
-    void broadcastMessage(const std::vector<char> &message, int exclude_fd = -1);
-    void syncUserListForClient(int target_fd);
+    // 消息广播:接收方是room中除exclude_fd外的成员
+    // on_sent由所有接收方的写队列共享,最后一个接收方发送完毕后释放;返回挂入写队列的接收方数
+    size_t broadcastMessage(const RoomPtr &room, std::vector<char> message, int exclude_fd = -1,
+                            const std::shared_ptr<void> &on_sent = nullptr);
+    // 同一消息帧挂入所有接收方的写队列,广播开销与消息大小无关
+    // progress非空时帧内容仍在到达,recipients返回接收方,发送方追加数据后据此唤醒它们的写事件
+    // 不经过广播环:ring模式下文件帧可能先于更早发出、仍在环中的聊天消息到达,文件流内部的帧仍按发送顺序到达
+    size_t broadcastFrame(const RoomPtr &room, const SharedFrame &frame, int exclude_fd = -1,
+                          const std::shared_ptr<void> &on_sent = nullptr, const FrameProgress &progress = nullptr,
+                          std::vector<std::weak_ptr<ClientHandler>> *recipients = nullptr);
+    // 广播聊天室消息(GROUP_MSG/BATCH):分配序号并保留在聊天室日志中;发送过RESUME的v2接收方收到带序号的帧头,
+    // 发送方收到ACK;BATCH对v2接收方整帧转发,旧版格式的接收方收到拆开的GROUP_MSG
+    void broadcastRoomMessage(const RoomPtr &room, const SharedFrame &frame, int sender_fd);
+    // 连接开始接收其所在聊天室的带序号消息,补发序号大于last_sequence的保留消息
+    void resumeRoom(const std::shared_ptr<ClientHandler> &client, uint64_t last_sequence);
+
+    // 聊天室成员变更,调用方为该连接的读路径(同一连接的进入/离开不会并发)
+    // 进入聊天室:登记成员,向其他成员广播JOIN,向该连接发送成员列表(INITIAL);confirm为true时先回复ROOM_JOIN。
+    // 带序号的连接随后收到RESUME;resume_sequence非空且不为0时从该序号补发,否则补发最近的历史消息(见setJoinHistory),
+    // 不带序号的连接同样收到历史消息。
+    // 以上在聊天室锁内完成,与聊天消息的扇出之间不重不漏。聊天室已被删除时返回false,调用方重新获取后再试
+    bool enterRoom(const std::shared_ptr<ClientHandler> &client, const RoomPtr &room, bool confirm,
+                   const uint64_t *resume_sequence = nullptr);
+    // 离开聊天室:注销成员并向其余成员广播EXIT,聊天室空了之后删除(大厅除外)
+    void leaveRoom(const std::shared_ptr<ClientHandler> &client, const RoomPtr &room);
+    // 向v2客户端发送ROSTER:known_epoch仍在变更日志范围内时只发送其后的增量,否则发送分页的完整快照
+    void syncRosterForClient(int target_fd, uint64_t known_epoch);
+
+    // 在线用户表:用户ID<->用户名<->连接,JOIN时登记,退出广播之后注销
+    UserRegistry &getUsers() { return users_; }
+    // 聊天室目录
+    RoomDirectory &getRooms() { return rooms_; }
+    // 由旧版格式的帧生成等价的v2帧头(消息体不变),sequence非0时帧头携带聊天室序号
+    // with_name为true时帧头携带帧中记录的发送者用户名而不是ID,只发给acceptsSenderName()的连接
+    SharedFrame makeV2Header(const std::vector<char> &frame, uint64_t sequence = 0, bool with_name = false) const;
+    // 心跳:定时向所有在线连接发送PING,汇总各连接的往返时延
+    void recordRtt(uint64_t rtt_us) { rtt_.record(rtt_us); }
+    const RttHistogram &getRtt() const { return rtt_; }
     // Reactor访问
     Reactor &getReactor() { return reactor_; }
+    // 内容寻址文件池访问
+    FileSpool &getFileSpool() { return file_spool_; }
+    // 群消息敏感词过滤
+    const KeywordFilter &getKeywordFilter() const { return keyword_filter_; }
+    // 合并发送:流量密集的连接在窗口内入队的消息推迟到窗口结束时用一次sendmsg发出,窗口为0表示不合并
+    std::chrono::microseconds getCoalesceWindow() const { return coalesce_window_; }
+    // 登记连接在当前合并窗口结束时发送
+    void scheduleFlush(std::weak_ptr<ClientHandler> client);
+    // 进入聊天室时补发的历史消息:最近最多messages条、合计不超过bytes字节,messages为0时不补发;在start之前设置
+    void setJoinHistory(size_t messages, size_t bytes);
+    // 启用消息持久化:聊天室消息写入持久化日志,并从日志中读出各聊天室最近的消息,聊天室被进入时放回;在start之前调用
+    void enableMessageLog(const MessageLog::Options &options);
+    // 启用离线收件箱:接收方不在线的私聊存入其收件箱,JOIN后投递;在start之前调用
+    void enableOfflineInbox(const OfflineInbox::Options &options);
+    // 离线收件箱,未启用时为空
+    OfflineInbox *getOfflineInbox() { return offline_inbox_.get(); }
+
+    static constexpr std::chrono::microseconds MAX_COALESCE_WINDOW{5000};
+    static constexpr size_t DEFAULT_JOIN_HISTORY_MESSAGES = 50;
+    static constexpr size_t DEFAULT_JOIN_HISTORY_BYTES = 256 * 1024;
 
 private:
+    // 一条聊天室消息扇出时各类接收方共用的帧头和拆开的BATCH
+    struct RoomDelivery
+    {
+        SharedFrame v2_header;
+        SharedFrame sequenced_header;
+        std::vector<SharedFrame> expanded;
+    };
+
     void initializeServer();
+    void heartbeat();
+    // 合并窗口定时器到期:发送窗口内登记的连接;之后再有连接登记时重新计时
+    void flushCoalesced();
+    // 广播环中的一条聊天室消息或进入/退出通知(序号为0):成员按通道划分的快照在发布时确定
+    struct RingEntry
+    {
+        SharedFrame frame;
+        uint64_t sequence = 0;
+        int sender_fd = -1;
+        RoomDelivery delivery;
+        std::shared_ptr<const Room::LanePartition> partition;
+    };
+
+    void deliverRoomMessage(ClientHandler &client, const SharedFrame &frame, const RoomDelivery &delivery);
+    // 向一个成员投递:发送方本人只收到ACK
+    void deliverToMember(ClientHandler &client, const SharedFrame &frame, uint64_t sequence, int sender_fd,
+                         const RoomDelivery &delivery);
+    // 在通道线程上投递广播环条目给该通道负责的成员
+    void deliverRingEntry(size_t lane, const RingEntry &entry);
+    // 成员按通道划分的快照,成员变更后重新生成;调用方持有room.mutex
+    // 向当前成员通知进入/退出(JOIN/EXIT):ring模式下也写入广播环,与聊天消息保持同一顺序;调用方持有room.mutex
+    void announceLocked(Room &room, const SharedFrame &frame);
+    std::shared_ptr<const Room::LanePartition> lanePartitionLocked(Room &room);
+    // 预先生成一条聊天室消息的全部共用帧头(含序号)和拆开的BATCH,之后deliverRoomMessage对delivery只读
+    void prepareRoomDelivery(const SharedFrame &frame, uint64_t sequence, RoomDelivery &delivery,
+                             bool with_name = false) const;
+    static void expandBatch(const std::vector<char> &frame, std::vector<SharedFrame> &expanded);
+    static SharedFrame encodeV2Header(const MSG_header &header, uint32_t sender_id, uint64_t sequence,
+                                      bool with_name);
+    // 接收方达到PARALLEL_FANOUT_THRESHOLD时按FANOUT_CHUNK分段,由线程池并行执行deliver(begin, end),调用线程也参与;
+    // 全部段完成后才返回,调用方持有的聊天室锁仍保证每个接收方按序号顺序收到消息
+    template <class F>
+    void fanOut(size_t count, F &&deliver)
+    {
+        if (count >= PARALLEL_FANOUT_THRESHOLD && thread_pool_)
+            thread_pool_->parallelFor(count, FANOUT_CHUNK, std::forward<F>(deliver));
+        else if (count > 0)
+            deliver(size_t(0), count);
+    }
+    // 同一消息帧挂入clients中除exclude_fd外各连接的写队列,v2帧头只生成一次;返回成功挂入的连接数
+    size_t deliverFrame(const Room::Recipients &clients, const SharedFrame &frame, int exclude_fd = -1,
+                        const std::shared_ptr<void> &on_sent = nullptr, const FrameProgress &progress = nullptr,
+                        std::vector<std::weak_ptr<ClientHandler>> *recipients = nullptr);
+    // 以下调用方持有room.mutex
+    // 向连接补发序号大于last_sequence的保留消息:sequenced为true时先发送RESUME,之后的帧头带序号,自己发出的消息只补发ACK;
+    // 否则作为进入聊天室时的历史消息,按普通聊天消息发送
+    void replayRoomLocked(Room &room, ClientHandler &client, uint64_t last_sequence, bool sequenced = true);
+    // 向连接发送聊天室成员列表(INITIAL),v2客户端收到"ID:用户名"列表
+    void sendRoomMembersLocked(const Room &room, ClientHandler &client);
+    // 消息未能写入持久化日志:计数并限频告警
+    void noteMessageLogDrop(const std::string &room);
+    // 把重启前该聊天室的消息放回其日志(只在第一次进入时有)
+    void restoreHistoryLocked(Room &room);
+    // 已JOIN的在线客户端快照
+    std::vector<std::shared_ptr<ClientHandler>> collectJoinedClients();
     void createListenSocket();
 
     int port_;
@@ -58,13 +198,65 @@ private:
     std::shared_ptr<ThreadPool> thread_pool_;
     std::thread reactor_thread_;
 
-    // 维护在线客户映射表fd到ClientHandler的映射
-    std::unordered_map<int, std::shared_ptr<ClientHandler>> clients_;
-    mutable std::mutex clients_mutex_;
+    // 维护在线客户映射表fd到ClientHandler的映射,分片存放,读取不加锁
+    ClientTable clients_;
+
+    // 在线用户表,v2线格式用用户ID代替64字节的用户名
+    UserRegistry users_;
+
+    // 聊天室目录,每个聊天室有自己的成员表和消息日志
+    RoomDirectory rooms_;
 
     // 服务器监听器
     std::shared_ptr<ServerAcceptor> acceptor_;
 
+    // 大聊天室的并行扇出:每段的接收方数,以及启用并行的最少接收方数
+    static constexpr size_t FANOUT_CHUNK = 512;
+    static constexpr size_t PARALLEL_FANOUT_THRESHOLD = 2 * FANOUT_CHUNK;
+    // 广播环模式:环的条目数和最多的通道数(通道数取CPU核心数)
+    static constexpr size_t RING_CAPACITY = 4096;
+    static constexpr size_t MAX_RING_LANES = 16;
+    std::unique_ptr<BroadcastRing<RingEntry>> fanout_ring_;
+
+    // 心跳定时器和所有连接汇总的往返时延
+    static constexpr std::chrono::milliseconds HEARTBEAT_INTERVAL{10000};
+    std::shared_ptr<TimerHandler> heartbeat_timer_;
+    RttHistogram rtt_;
+
+    // 进入聊天室时补发的历史消息数和字节数上限
+    size_t join_history_messages_ = DEFAULT_JOIN_HISTORY_MESSAGES;
+    size_t join_history_bytes_ = DEFAULT_JOIN_HISTORY_BYTES;
+
+    // 合并发送的窗口和在窗口结束时待发送的连接
+    const std::chrono::microseconds coalesce_window_;
+    std::mutex coalesce_mutex_;
+    std::vector<std::weak_ptr<ClientHandler>> coalesce_pending_;
+    std::shared_ptr<TimerHandler> coalesce_timer_;
+
+    // 上传文件的内容寻址存储,用于重复文件去重
+    FileSpool file_spool_;
+
+    // 聊天室消息的持久化日志,未启用时为空;重启时最多恢复RESTORE_MESSAGES条
+    static constexpr size_t RESTORE_MESSAGES = RoomLog::MAX_MESSAGES;
+    std::unique_ptr<MessageLog> message_log_;
+    // 待写队列满而未能写入日志的消息数;开始丢弃时立即告警,之后最多每DROP_WARNING_INTERVAL告警一次
+    static constexpr std::chrono::seconds DROP_WARNING_INTERVAL{10};
+    std::atomic<uint64_t> message_log_drops_{0};
+    std::atomic<uint64_t> message_log_drops_reported_{0};
+    std::atomic<int64_t> last_drop_warning_ms_{0};
+    // 从消息日志读出、尚未放回聊天室的消息:聊天室名称 -> 帧(按原顺序)
+    // 聊天室被进入时才取走,重启不会创建没有成员的聊天室(不占MAX_ROOMS,也不出现在ROOM_LIST中)
+    std::unordered_map<std::string, std::vector<SharedFrame>> restored_history_;
+    std::mutex restored_mutex_;
+
+    // 离线私聊的收件箱,未启用时为空
+    std::unique_ptr<OfflineInbox> offline_inbox_;
+
+    // 敏感词过滤,定时检查词表文件,修改后不停服重新加载
+    static constexpr std::chrono::milliseconds FILTER_RELOAD_INTERVAL{5000};
+    KeywordFilter keyword_filter_;
+    std::shared_ptr<TimerHandler> filter_timer_;
+
     // 用于通知main主线程退出
     bool running = true;
     std::mutex mtx;
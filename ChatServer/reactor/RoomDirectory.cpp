@@ -0,0 +1,133 @@
+#include "RoomDirectory.hpp"
+#include "protocol/Utf8.hpp"
+#include <algorithm>
+
+void Room::addMember(uint32_t user_id, const std::shared_ptr<ClientHandler> &conn)
+{
+    if (positions.count(user_id))
+        return;
+    positions[user_id] = members.size();
+    members.push_back(user_id);
+
+    auto updated = std::make_shared<Recipients>();
+    updated->reserve(recipients->size() + 1);
+    *updated = *recipients;
+    updated->push_back(conn);
+    std::atomic_store(&recipients, std::shared_ptr<const Recipients>(std::move(updated)));
+}
+
+void Room::removeMember(uint32_t user_id)
+{
+    auto it = positions.find(user_id);
+    if (it == positions.end())
+        return;
+
+    // 与末尾的成员交换后删除,数组保持紧凑;连接数组做同样的交换,下标保持对应
+    size_t index = it->second;
+    uint32_t last = members.back();
+    members[index] = last;
+    positions[last] = index;
+    members.pop_back();
+    positions.erase(user_id);
+
+    auto updated = std::make_shared<Recipients>(*recipients);
+    (*updated)[index] = std::move(updated->back());
+    updated->pop_back();
+    std::atomic_store(&recipients, std::shared_ptr<const Recipients>(std::move(updated)));
+    // 旧的通道划分引用着含离开者连接的快照,不等下一次广播,立即释放
+    partition.reset();
+}
+
+RoomDirectory::RoomDirectory()
+    : lobby_(std::make_shared<Room>(LOBBY_NAME))
+{
+    rooms_[LOBBY_NAME] = lobby_;
+}
+
+RoomPtr RoomDirectory::obtain(const std::string &name)
+{
+    if (!isValidName(name))
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = rooms_.find(name);
+    if (it != rooms_.end())
+        return it->second;
+    if (rooms_.size() >= MAX_ROOMS)
+        return nullptr;
+
+    RoomPtr room = std::make_shared<Room>(name);
+    rooms_[name] = room;
+    return room;
+}
+
+void RoomDirectory::removeIfEmpty(const RoomPtr &room)
+{
+    if (room == lobby_)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::lock_guard<std::mutex> room_lock(room->mutex);
+    if (!room->members.empty() || room->closed)
+        return;
+
+    room->closed = true;
+    auto it = rooms_.find(room->name);
+    if (it != rooms_.end() && it->second == room)
+    {
+        rooms_.erase(it);
+    }
+}
+
+std::vector<std::pair<std::string, size_t>> RoomDirectory::list(size_t limit) const
+{
+    std::vector<std::pair<std::string, size_t>> rooms;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        rooms.reserve(rooms_.size());
+        for (const auto &pair : rooms_)
+        {
+            std::lock_guard<std::mutex> room_lock(pair.second->mutex);
+            rooms.emplace_back(pair.first, pair.second->members.size());
+        }
+    }
+    std::sort(rooms.begin(), rooms.end(),
+              [](const std::pair<std::string, size_t> &a, const std::pair<std::string, size_t> &b)
+              { return a.second != b.second ? a.second > b.second : a.first < b.first; });
+    if (rooms.size() > limit)
+    {
+        rooms.resize(limit);
+    }
+    return rooms;
+}
+
+size_t RoomDirectory::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return rooms_.size();
+}
+
+void RoomDirectory::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto &pair : rooms_)
+    {
+        std::lock_guard<std::mutex> room_lock(pair.second->mutex);
+        pair.second->members.clear();
+        pair.second->positions.clear();
+        pair.second->partition.reset();
+        std::atomic_store(&pair.second->recipients, std::make_shared<const Room::Recipients>());
+    }
+}
+
+bool RoomDirectory::isValidName(const std::string &name)
+{
+    if (name.empty() || name.size() > MAX_NAME_SIZE)
+        return false;
+    for (unsigned char c : name)
+    {
+        if (c < 0x20 || c == 0x7F || c == ',' || c == ':')
+            return false;
+    }
+    return utf8::validate(name.data(), name.size());
+}
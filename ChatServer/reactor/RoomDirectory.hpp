@@ -0,0 +1,86 @@
+#pragma once
+
+#include "RoomLog.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+class ClientHandler;
+
+// 聊天室:成员是紧凑的用户ID数组,扇出只遍历本聊天室的成员
+// 每个连接同一时刻只在一个聊天室中;登录后进入大厅
+struct Room
+{
+    // 成员连接的不可变数组,与members按下标一一对应
+    using Recipients = std::vector<std::shared_ptr<ClientHandler>>;
+
+    explicit Room(const std::string &room_name)
+        : name(room_name), recipients(std::make_shared<const Recipients>()) {}
+
+    const std::string name;
+    // 保护以下成员;广播聊天消息时持有,保证分配序号与挂入接收方写队列的顺序一致
+    std::mutex mutex;
+    std::vector<uint32_t> members;                  // 成员的用户ID
+    std::unordered_map<uint32_t, size_t> positions; // 用户ID -> 在members中的下标,删除时与末尾交换
+    RoomLog log;
+    bool closed = false; // 最后一个成员离开后已从目录中删除,进入时需要重新获取
+    // 写时复制:只在成员进出时复制并整体替换,广播时直接遍历,不再逐条消息查用户表和复制连接数组
+    // 持锁时可直接读取;不持锁的读取方用std::atomic_load取得快照,旧数组在最后一个读取方放手后释放
+    std::shared_ptr<const Recipients> recipients;
+
+    // 广播环模式下按投递通道划分的成员下标,对应source快照中的位置
+    struct LanePartition
+    {
+        std::shared_ptr<const Recipients> source;
+        std::vector<std::vector<uint32_t>> lanes;
+    };
+    // 成员变更后的第一次广播时重新生成;持锁读写
+    std::shared_ptr<const LanePartition> partition;
+
+    // 以下调用方持有mutex
+    void addMember(uint32_t user_id, const std::shared_ptr<ClientHandler> &conn);
+    void removeMember(uint32_t user_id);
+};
+
+using RoomPtr = std::shared_ptr<Room>;
+
+// 聊天室目录:名称 -> 聊天室;聊天室在第一个成员进入时创建,最后一个成员离开时删除(大厅始终存在)
+// 锁顺序:目录锁 -> 聊天室锁
+class RoomDirectory
+{
+public:
+    static constexpr const char *LOBBY_NAME = "lobby";
+    static constexpr size_t MAX_NAME_SIZE = 63; // 与用户名相同,不含结尾的0
+    static constexpr size_t MAX_ROOMS = 65536;
+    static constexpr size_t MAX_LISTED_ROOMS = 1000; // ROOM_LIST最多返回的聊天室数
+
+    RoomDirectory();
+
+    // 禁用拷贝构造和赋值
+    RoomDirectory(const RoomDirectory &) = delete;
+    RoomDirectory &operator=(const RoomDirectory &) = delete;
+
+    const RoomPtr &lobby() const { return lobby_; }
+
+    // 按名称查找,不存在时创建;名称不合法或聊天室数达到上限时返回nullptr
+    RoomPtr obtain(const std::string &name);
+    // 聊天室已空时从目录中删除并标记为closed(大厅除外)
+    void removeIfEmpty(const RoomPtr &room);
+    // (名称, 成员数)列表,人数多的在前,最多limit项
+    std::vector<std::pair<std::string, size_t>> list(size_t limit) const;
+    size_t size() const;
+    // 释放所有聊天室的成员连接(服务器停止时调用,连接与其所在聊天室互相引用)
+    void clear();
+
+    // 名称为1~MAX_NAME_SIZE字节的合法UTF-8,不含控制字符和列表分隔符(',' ':')
+    static bool isValidName(const std::string &name);
+
+private:
+    RoomPtr lobby_;
+    std::unordered_map<std::string, RoomPtr> rooms_;
+    mutable std::mutex mutex_;
+};
@@ -0,0 +1,70 @@
+#include "RoomLog.hpp"
+#include <random>
+
+std::atomic<size_t> RoomLog::total_bytes_{0};
+std::atomic<size_t> RoomLog::total_budget_{RoomLog::DEFAULT_TOTAL_BUDGET};
+
+RoomLog::RoomLog()
+    : bytes_(0)
+{
+    // 每个聊天室的序号从随机的高32位开始(低32位为0):不同聊天室、服务器的不同次运行的序号区间几乎不可能重叠,
+    // 客户端带着其它聊天室或上一次运行的序号RESUME时不会被误当作本聊天室的序号补发
+    std::random_device device;
+    base_sequence_ = (static_cast<uint64_t>(device()) | 1) << 32;
+    next_sequence_ = base_sequence_;
+    first_sequence_ = next_sequence_;
+}
+
+RoomLog::~RoomLog()
+{
+    total_bytes_.fetch_sub(bytes_, std::memory_order_relaxed);
+}
+
+uint64_t RoomLog::append(const SharedFrame &frame)
+{
+    frames_.push_back(frame);
+    bytes_ += frame->size();
+    total_bytes_.fetch_add(frame->size(), std::memory_order_relaxed);
+    while (frames_.size() > MAX_MESSAGES ||
+           ((bytes_ > MAX_BYTES || totalBytes() > total_budget_.load(std::memory_order_relaxed)) && frames_.size() > 1))
+    {
+        size_t size = frames_.front()->size();
+        bytes_ -= size;
+        total_bytes_.fetch_sub(size, std::memory_order_relaxed);
+        frames_.pop_front();
+        ++first_sequence_;
+    }
+    return next_sequence_++;
+}
+
+uint64_t RoomLog::replaySince(uint64_t since, std::vector<std::pair<uint64_t, SharedFrame>> &messages) const
+{
+    uint64_t last = lastSequence();
+    // since为base_sequence_ - 1表示从第一条消息开始补发
+    if (since + 1 < base_sequence_ || since >= last)
+    {
+        return last;
+    }
+
+    uint64_t start = since < first_sequence_ ? first_sequence_ - 1 : since;
+    messages.reserve(static_cast<size_t>(last - start));
+    for (uint64_t sequence = start + 1; sequence <= last; ++sequence)
+    {
+        messages.emplace_back(sequence, frames_[static_cast<size_t>(sequence - first_sequence_)]);
+    }
+    return start;
+}
+
+uint64_t RoomLog::recentStart(size_t max_messages, size_t max_bytes) const
+{
+    size_t count = 0;
+    size_t bytes = 0;
+    for (auto it = frames_.rbegin(); it != frames_.rend() && count < max_messages; ++it)
+    {
+        bytes += (*it)->size();
+        if (bytes > max_bytes && count > 0)
+            break;
+        ++count;
+    }
+    return lastSequence() - count;
+}
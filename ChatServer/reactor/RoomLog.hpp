@@ -0,0 +1,50 @@
+#pragma once
+
+#include "protocol/Protocol.hpp"
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <vector>
+#include <utility>
+
+// 聊天室消息日志:为广播的聊天消息分配连续递增的序号,并在内存中保留最近的消息,供重连的客户端按序号补发
+// 保留的是共享的消息帧,与各接收方写队列中的是同一份,不额外拷贝消息内容
+// 本身不加锁:由ReactorServer在分配序号和扇出期间持有的锁保护,使每个接收方都按序号顺序收到消息
+class RoomLog
+{
+public:
+    static constexpr size_t MAX_MESSAGES = 10000;           // 最多保留的消息数
+    static constexpr size_t MAX_BYTES = 16 * 1024 * 1024;   // 保留消息的总字节数上限
+    static constexpr size_t DEFAULT_TOTAL_BUDGET = 256 * 1024 * 1024;
+
+    RoomLog();
+    ~RoomLog();
+
+    // 禁用拷贝构造和赋值
+    RoomLog(const RoomLog &) = delete;
+    RoomLog &operator=(const RoomLog &) = delete;
+
+    // 追加一条消息并返回其序号
+    uint64_t append(const SharedFrame &frame);
+    uint64_t lastSequence() const { return next_sequence_ - 1; }
+
+    // 取出序号大于since的保留消息,返回补发起点之前的序号:
+    // since早于保留范围时返回值大于since,二者之间的消息已无法补发;since为0或不是本聊天室本次运行分配的序号时不补发,返回最新序号
+    uint64_t replaySince(uint64_t since, std::vector<std::pair<uint64_t, SharedFrame>> &messages) const;
+    // 最近最多max_messages条、合计不超过max_bytes字节(至少一条)的保留消息之前的序号,用作replaySince的起点
+    uint64_t recentStart(size_t max_messages, size_t max_bytes) const;
+
+    // 所有聊天室保留消息的总字节数及其上限:超出上限时,追加消息的聊天室先丢弃自己最早的消息
+    static size_t totalBytes() { return total_bytes_.load(std::memory_order_relaxed); }
+    static void setTotalBudget(size_t bytes) { total_budget_.store(bytes, std::memory_order_relaxed); }
+
+private:
+    std::deque<SharedFrame> frames_; // frames_[i]的序号为first_sequence_ + i
+    uint64_t base_sequence_;         // 第一条消息的序号
+    uint64_t first_sequence_;
+    uint64_t next_sequence_;
+    size_t bytes_;
+
+    static std::atomic<size_t> total_bytes_;
+    static std::atomic<size_t> total_budget_;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+// 往返时延直方图:按微秒取log2分桶,第i个桶统计[2^i, 2^(i+1))微秒,最后一个桶收纳更大的值
+// 32个计数器共128字节,每个连接一份,另有一份服务器汇总;计数器为原子变量,可以在记录的同时读取
+class RttHistogram
+{
+public:
+    static constexpr size_t BUCKETS = 32;
+
+    void record(uint64_t rtt_us)
+    {
+        size_t bucket = 0;
+        while (bucket + 1 < BUCKETS && (rtt_us >> (bucket + 1)) != 0)
+        {
+            ++bucket;
+        }
+        counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+        last_us_.store(rtt_us, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const
+    {
+        uint64_t total = 0;
+        for (const auto &bucket : counts_)
+        {
+            total += bucket.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // 分位数(0~100)所在桶的上界(微秒),没有样本时返回0
+    uint64_t percentile(double p) const
+    {
+        uint64_t total = count();
+        if (total == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(total));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; ++i)
+        {
+            seen += counts_[i].load(std::memory_order_relaxed);
+            if (seen > rank)
+            {
+                return (uint64_t(1) << (i + 1)) - 1;
+            }
+        }
+        return (uint64_t(1) << BUCKETS) - 1;
+    }
+
+    uint64_t last() const { return last_us_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint32_t> counts_[BUCKETS] = {};
+    std::atomic<uint64_t> last_us_{0};
+};
@@ -0,0 +1,76 @@
+#include "TimerHandler.hpp"
+#include "logger/log_macros.hpp"
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cstring>
+#include <stdexcept>
+
+TimerHandler::TimerHandler(std::chrono::microseconds interval, std::function<void()> callback, bool periodic)
+    : timer_fd_(-1), interval_(interval), callback_(std::move(callback))
+{
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd_ < 0)
+    {
+        throw std::runtime_error("创建定时器失败: " + std::string(strerror(errno)));
+    }
+
+    if (periodic && !setTime(interval, interval))
+    {
+        close(timer_fd_);
+        throw std::runtime_error("设置定时器失败: " + std::string(strerror(errno)));
+    }
+    LOG_DEBUG("创建{}定时器，fd: {}, 周期: {} us", periodic ? "周期" : "单次", timer_fd_, interval.count());
+}
+
+TimerHandler::~TimerHandler()
+{
+    if (timer_fd_ >= 0)
+    {
+        close(timer_fd_);
+    }
+}
+
+bool TimerHandler::arm()
+{
+    if (!setTime(interval_, std::chrono::microseconds(0)))
+    {
+        LOG_ERROR("设置定时器失败，fd: {}: {}", timer_fd_, strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool TimerHandler::setTime(std::chrono::microseconds value, std::chrono::microseconds interval)
+{
+    // it_interval为0时只到期一次
+    itimerspec spec{};
+    spec.it_value.tv_sec = value.count() / 1000000;
+    spec.it_value.tv_nsec = (value.count() % 1000000) * 1000;
+    spec.it_interval.tv_sec = interval.count() / 1000000;
+    spec.it_interval.tv_nsec = (interval.count() % 1000000) * 1000;
+    return timerfd_settime(timer_fd_, 0, &spec, nullptr) == 0;
+}
+
+void TimerHandler::handleRead()
+{
+    // 边缘触发:读出到期次数清空计数;错过的多次到期只执行一次回调
+    uint64_t expirations = 0;
+    bool expired = false;
+    while (read(timer_fd_, &expirations, sizeof(expirations)) == sizeof(expirations))
+    {
+        expired = true;
+    }
+    if (expired && callback_)
+    {
+        callback_();
+    }
+}
+
+void TimerHandler::handleWrite()
+{
+}
+
+void TimerHandler::handleError()
+{
+    LOG_ERROR("定时器出错，fd: {}", timer_fd_);
+}
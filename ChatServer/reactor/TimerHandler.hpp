@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Reactor.hpp"
+#include <chrono>
+#include <functional>
+
+// 定时器 - 基于timerfd,像普通连接一样注册到Reactor
+// 到期时reactor线程收到读事件,回调在线程池中执行;同一定时器的回调由reading_flag_串行化,不会重叠
+// 周期定时器创建后即开始计时;单次定时器创建时不计时,每次arm()之后到期一次,空闲时不产生任何唤醒
+class TimerHandler : public EventHandler
+{
+public:
+    // 周期可以短到微秒级(用于合并发送窗口),毫秒周期隐式转换
+    TimerHandler(std::chrono::microseconds interval, std::function<void()> callback, bool periodic = true);
+    ~TimerHandler() override;
+
+    void handleRead() override;
+    void handleWrite() override;
+    void handleError() override;
+    int getFd() const override { return timer_fd_; }
+
+    // 单次定时器:interval之后到期一次;尚未到期时重新计时。可在任意线程调用
+    bool arm();
+
+private:
+    bool setTime(std::chrono::microseconds value, std::chrono::microseconds interval);
+
+    int timer_fd_;
+    const std::chrono::microseconds interval_;
+    std::function<void()> callback_;
+};
@@ -0,0 +1,233 @@
+#include "UserRegistry.hpp"
+#include <chrono>
+#include <functional>
+
+const UserRegistry::NameRef &UserRegistry::emptyName()
+{
+    static const NameRef empty = std::make_shared<const std::string>();
+    return empty;
+}
+
+UserRegistry::UserRegistry()
+    : next_id_(1), // 占位ID 0
+      // 版本从启动时刻的纳秒数开始,客户端带着服务器上一次运行的版本重连时必然小于本次日志的起点,只会得到完整快照
+      epoch_(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                       std::chrono::system_clock::now().time_since_epoch())
+                                       .count()))
+{
+    for (auto &chunk : chunks_)
+    {
+        chunk.store(nullptr, std::memory_order_relaxed);
+    }
+    for (auto &shard : name_shards_)
+    {
+        shard.map = std::make_shared<const NameMap>();
+    }
+}
+
+UserRegistry::~UserRegistry()
+{
+    for (auto &chunk : chunks_)
+    {
+        delete chunk.load(std::memory_order_relaxed);
+    }
+}
+
+UserRegistry::NameShard &UserRegistry::shardOf(const std::string &name)
+{
+    return name_shards_[std::hash<std::string>()(name) % NAME_SHARDS];
+}
+
+const UserRegistry::NameShard &UserRegistry::shardOf(const std::string &name) const
+{
+    return name_shards_[std::hash<std::string>()(name) % NAME_SHARDS];
+}
+
+UserRegistry::EntryRef UserRegistry::entryOf(uint32_t id) const
+{
+    if (id == INVALID_ID || id >= CHUNK_SIZE * MAX_CHUNKS)
+        return nullptr;
+    Chunk *chunk = chunks_[id / CHUNK_SIZE].load(std::memory_order_acquire);
+    return chunk ? std::atomic_load(&chunk->slots[id % CHUNK_SIZE]) : nullptr;
+}
+
+void UserRegistry::recordChange(uint32_t id, bool joined, const std::string &name)
+{
+    changes_.push_back(RosterChange{++epoch_, id, joined, name});
+    if (changes_.size() > MAX_ROSTER_CHANGES)
+    {
+        changes_.pop_front();
+    }
+}
+
+uint32_t UserRegistry::add(const NameRef &name, const std::shared_ptr<ClientHandler> &conn)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    // 查重与登记在同一把锁内,同名的并发JOIN只有一个成功;否则后来者会顶替名称索引,先登录的用户无法再按名称寻址
+    // 连接已销毁、只差注销的旧登记不算占用
+    NameShard &shard = shardOf(*name);
+    auto existing = shard.map->find(*name);
+    if (existing != shard.map->end())
+    {
+        EntryRef entry = entryOf(existing->second);
+        if (entry && !entry->conn.expired())
+            return INVALID_ID;
+    }
+
+    uint32_t id;
+    if (!free_ids_.empty())
+    {
+        id = free_ids_.back();
+        free_ids_.pop_back();
+    }
+    else
+    {
+        if (next_id_ >= CHUNK_SIZE * MAX_CHUNKS)
+            return INVALID_ID;
+        id = next_id_++;
+    }
+
+    // 块地址发布后不再变化,读者拿到的块指针始终有效
+    std::atomic<Chunk *> &chunk_slot = chunks_[id / CHUNK_SIZE];
+    Chunk *chunk = chunk_slot.load(std::memory_order_relaxed);
+    if (!chunk)
+    {
+        chunk = new Chunk();
+        chunk_slot.store(chunk, std::memory_order_release);
+    }
+    std::atomic_store(&chunk->slots[id % CHUNK_SIZE], EntryRef(std::make_shared<const Entry>(Entry{name, conn})));
+
+    auto map = std::make_shared<NameMap>(*shard.map);
+    (*map)[*name] = id;
+    std::atomic_store(&shard.map, std::shared_ptr<const NameMap>(std::move(map)));
+
+    recordChange(id, true, *name);
+    return id;
+}
+
+void UserRegistry::remove(uint32_t id)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    EntryRef entry = entryOf(id);
+    if (!entry)
+        return;
+
+    NameShard &shard = shardOf(*entry->name);
+    auto it = shard.map->find(*entry->name);
+    if (it != shard.map->end() && it->second == id)
+    {
+        auto map = std::make_shared<NameMap>(*shard.map);
+        map->erase(*entry->name);
+        std::atomic_store(&shard.map, std::shared_ptr<const NameMap>(std::move(map)));
+    }
+    recordChange(id, false, *entry->name);
+    std::atomic_store(&chunks_[id / CHUNK_SIZE].load(std::memory_order_relaxed)->slots[id % CHUNK_SIZE], EntryRef());
+    free_ids_.push_back(id);
+}
+
+std::string UserRegistry::nameOf(uint32_t id) const
+{
+    EntryRef entry = entryOf(id);
+    return entry ? *entry->name : std::string();
+}
+
+uint32_t UserRegistry::idOf(const std::string &name) const
+{
+    auto map = std::atomic_load(&shardOf(name).map);
+    auto it = map->find(name);
+    return it != map->end() ? it->second : INVALID_ID;
+}
+
+std::shared_ptr<ClientHandler> UserRegistry::connectionOf(uint32_t id) const
+{
+    EntryRef entry = entryOf(id);
+    return entry ? entry->conn.lock() : nullptr;
+}
+
+std::shared_ptr<ClientHandler> UserRegistry::connectionOf(const std::string &name) const
+{
+    EntryRef entry = entryOf(idOf(name));
+    // 查到ID之后该ID可能已被回收并分配给别人
+    if (!entry || *entry->name != name)
+        return nullptr;
+    return entry->conn.lock();
+}
+
+std::shared_ptr<ClientHandler> UserRegistry::resolve(uint32_t id, std::string &name, uint32_t &resolved_id) const
+{
+    bool by_name = (id == INVALID_ID);
+    if (by_name)
+    {
+        id = idOf(name);
+    }
+    EntryRef entry = entryOf(id);
+    if (!entry || (by_name && *entry->name != name))
+        return nullptr;
+
+    auto conn = entry->conn.lock();
+    if (conn)
+    {
+        resolved_id = id;
+        name = *entry->name;
+    }
+    return conn;
+}
+
+std::vector<std::pair<uint32_t, std::string>> UserRegistry::namesOf(const std::vector<uint32_t> &ids,
+                                                                   uint32_t exclude_id) const
+{
+    std::vector<std::pair<uint32_t, std::string>> users;
+    users.reserve(ids.size());
+    for (uint32_t id : ids)
+    {
+        if (id == exclude_id)
+            continue;
+        if (EntryRef entry = entryOf(id))
+        {
+            users.emplace_back(id, *entry->name);
+        }
+    }
+    return users;
+}
+
+size_t UserRegistry::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return next_id_ - 1 - free_ids_.size();
+}
+
+std::vector<std::pair<uint32_t, std::string>> UserRegistry::snapshot(uint32_t exclude_id, uint64_t *epoch) const
+{
+    std::vector<std::pair<uint32_t, std::string>> users;
+    // 加锁使快照与版本号一致
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (epoch)
+        *epoch = epoch_;
+    for (uint32_t id = 1; id < next_id_; ++id)
+    {
+        if (id == exclude_id)
+            continue;
+        if (EntryRef entry = entryOf(id))
+        {
+            users.emplace_back(id, *entry->name);
+        }
+    }
+    return users;
+}
+
+bool UserRegistry::changesSince(uint64_t since, std::vector<RosterChange> &changes, uint64_t &current) const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    current = epoch_;
+    if (since > epoch_)
+        return false;
+    // 日志中最早一条变更之前的版本才能补齐;没有日志时只有当前版本可用
+    uint64_t oldest = changes_.empty() ? epoch_ : changes_.front().epoch - 1;
+    if (since < oldest)
+        return false;
+
+    // 版本连续递增,直接按偏移定位
+    size_t first = static_cast<size_t>(since - oldest);
+    changes.assign(changes_.begin() + static_cast<std::ptrdiff_t>(first), changes_.end());
+    return true;
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <utility>
+
+class ClientHandler;
+
+// 在线用户表:JOIN时把用户名驻留为稠密的32位用户ID
+// ID直接作为下标访问 ID->用户名/连接 表,查找是一次数组访问;另维护 用户名->ID 索引供按名查找连接
+// 用户退出后ID回收复用,表的大小与同时在线人数同阶
+// 每次上线/下线使用户表版本(epoch)加1并记入有界的变更日志,持有旧版本的客户端只需补发其后的变更
+// 按ID/用户名的查找在每条消息的转发路径上,不加锁:ID表是按块分配、块地址不再变化的槽位数组,
+// 每个槽位是不可变条目的指针;用户名索引与ClientTable一样分片写时复制。只有上线/下线加锁
+class UserRegistry
+{
+public:
+    static constexpr uint32_t INVALID_ID = 0; // 0保留给服务器,也表示未JOIN
+    static constexpr size_t MAX_ROSTER_CHANGES = 4096; // 变更日志保留的条数,更早的版本只能发送完整快照
+    static constexpr size_t CHUNK_SIZE = 4096;         // ID表每块的槽位数,块按需分配
+    static constexpr size_t MAX_CHUNKS = 4096;         // ID上限为CHUNK_SIZE * MAX_CHUNKS
+    static constexpr size_t NAME_SHARDS = 64;          // 用户名索引的分片数
+
+    // 驻留的用户名:上线时创建一次,用户表和连接共享,转发时不再拷贝
+    using NameRef = std::shared_ptr<const std::string>;
+    // 共享的空用户名,未JOIN的连接使用
+    static const NameRef &emptyName();
+
+    struct RosterChange
+    {
+        uint64_t epoch; // 应用该变更后的版本
+        uint32_t id;
+        bool joined;    // true为上线,false为下线
+        std::string name;
+    };
+
+    UserRegistry();
+    ~UserRegistry();
+
+    // 禁用拷贝构造和赋值
+    UserRegistry(const UserRegistry &) = delete;
+    UserRegistry &operator=(const UserRegistry &) = delete;
+
+    // 分配用户ID;已有同名用户在线或ID耗尽时返回INVALID_ID,名称与ID始终一一对应
+    uint32_t add(const NameRef &name, const std::shared_ptr<ClientHandler> &conn);
+    // 释放用户ID,之后该ID可能分配给新用户
+    void remove(uint32_t id);
+
+    std::string nameOf(uint32_t id) const;
+    uint32_t idOf(const std::string &name) const;
+    std::shared_ptr<ClientHandler> connectionOf(uint32_t id) const;
+    std::shared_ptr<ClientHandler> connectionOf(const std::string &name) const;
+    // 按ID(非0时)或用户名查找在线用户,一次加锁同时返回连接、ID和用户名;不在线时返回nullptr
+    std::shared_ptr<ClientHandler> resolve(uint32_t id, std::string &name, uint32_t &resolved_id) const;
+    size_t size() const; // 在线用户数
+    // 批量查找:把聊天室的成员ID数组一次转换为用户名,跳过exclude_id和已下线的ID
+    std::vector<std::pair<uint32_t, std::string>> namesOf(const std::vector<uint32_t> &ids,
+                                                          uint32_t exclude_id = INVALID_ID) const;
+
+    // 在线用户字典(ID, 用户名),按ID升序,排除exclude_id;epoch非空时同时返回快照对应的版本
+    std::vector<std::pair<uint32_t, std::string>> snapshot(uint32_t exclude_id = INVALID_ID,
+                                                           uint64_t *epoch = nullptr) const;
+    // 取出版本since之后的全部变更,current为当前版本;since已不在变更日志范围内(或来自服务器的上一次运行)时返回false
+    bool changesSince(uint64_t since, std::vector<RosterChange> &changes, uint64_t &current) const;
+
+private:
+    // 条目创建后不再修改,下线时整体替换为空指针
+    struct Entry
+    {
+        NameRef name;
+        std::weak_ptr<ClientHandler> conn; // 不延长连接的生命周期
+    };
+    using EntryRef = std::shared_ptr<const Entry>;
+
+    struct Chunk
+    {
+        EntryRef slots[CHUNK_SIZE]; // 通过std::atomic_load/atomic_store读写,空指针表示未使用
+    };
+
+    using NameMap = std::unordered_map<std::string, uint32_t>;
+
+    // 按缓存行对齐,相邻分片的指针不共享缓存行
+    struct alignas(64) NameShard
+    {
+        std::shared_ptr<const NameMap> map; // 通过std::atomic_load/atomic_store读写
+    };
+
+    EntryRef entryOf(uint32_t id) const;
+    NameShard &shardOf(const std::string &name);
+    const NameShard &shardOf(const std::string &name) const;
+    void recordChange(uint32_t id, bool joined, const std::string &name);
+
+    std::atomic<Chunk *> chunks_[MAX_CHUNKS]; // 下标为ID / CHUNK_SIZE,块一经分配直到析构才释放
+    NameShard name_shards_[NAME_SHARDS];
+
+    // 以下成员受mutex_保护
+    uint32_t next_id_;               // 从未分配过的最小ID
+    std::vector<uint32_t> free_ids_; // 已释放可复用的ID
+    uint64_t epoch_;                     // 当前版本
+    std::deque<RosterChange> changes_;   // 最近的变更,按版本递增
+    mutable std::mutex mutex_;
+};
@@ -0,0 +1,198 @@
+#include "FileSpool.hpp"
+#include "logger/log_macros.hpp"
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+FileSpool::Upload::Upload(const std::string &expected_digest, size_t expected_size, const std::string &tmp_path)
+    : expected_digest_(expected_digest),
+      expected_size_(expected_size),
+      written_bytes_(0),
+      tmp_path_(tmp_path),
+      out_(tmp_path, std::ios::binary | std::ios::trunc),
+      sha256_(EVP_MD_CTX_new(), EVP_MD_CTX_free),
+      ok_(out_.is_open() && sha256_ && EVP_DigestInit_ex(sha256_.get(), EVP_sha256(), nullptr) == 1),
+      committed_(false)
+{
+}
+
+FileSpool::Upload::~Upload()
+{
+    if (!committed_)
+    {
+        out_.close();
+        std::error_code ec;
+        fs::remove(tmp_path_, ec);
+    }
+}
+
+bool FileSpool::Upload::append(const char *data, size_t length)
+{
+    if (!ok_)
+        return false;
+
+    // 超出声明大小的数据说明上传内容与FILE_MSG不符,放弃落盘
+    if (written_bytes_ + length > expected_size_)
+    {
+        ok_ = false;
+        return false;
+    }
+
+    if (EVP_DigestUpdate(sha256_.get(), data, length) != 1)
+    {
+        ok_ = false;
+        return false;
+    }
+    out_.write(data, static_cast<std::streamsize>(length));
+    written_bytes_ += length;
+    ok_ = out_.good();
+    return ok_;
+}
+
+FileSpool::FileSpool(const std::string &dir, size_t capacity_bytes)
+    : dir_(dir), capacity_(capacity_bytes), total_bytes_(0), enabled_(false), upload_seq_(0)
+{
+    std::error_code ec;
+    fs::create_directories(dir_, ec);
+    if (ec)
+    {
+        LOG_ERROR("创建文件池目录 {} 失败: {}, 文件去重功能关闭", dir_, ec.message());
+        return;
+    }
+    enabled_ = true;
+    loadIndex();
+}
+
+void FileSpool::loadIndex()
+{
+    std::error_code ec;
+    for (const auto &item : fs::directory_iterator(dir_, ec))
+    {
+        if (!item.is_regular_file())
+            continue;
+
+        const std::string name = item.path().filename().string();
+
+        // 上次运行残留的临时文件直接清理
+        if (item.path().extension() == ".part")
+        {
+            fs::remove(item.path(), ec);
+            continue;
+        }
+
+        // 只认64位十六进制的文件名;旧版按XXH64命名的文件不再参与去重,一并清理
+        if (name.size() != DIGEST_SIZE * 2 ||
+            name.find_first_not_of("0123456789abcdef") != std::string::npos)
+        {
+            if (name.size() == 16)
+                fs::remove(item.path(), ec);
+            continue;
+        }
+
+        size_t size = static_cast<size_t>(item.file_size());
+        index_[name] = Entry{item.path().string(), size};
+        total_bytes_ += size;
+    }
+
+    LOG_INFO("文件池 {} 加载完成: {} 个文件, 共 {} 字节", dir_, index_.size(), total_bytes_);
+}
+
+std::string FileSpool::digestHex(const unsigned char *digest)
+{
+    static const char hex[] = "0123456789abcdef";
+    std::string out(DIGEST_SIZE * 2, '0');
+    for (size_t i = 0; i < DIGEST_SIZE; ++i)
+    {
+        out[2 * i] = hex[digest[i] >> 4];
+        out[2 * i + 1] = hex[digest[i] & 0x0F];
+    }
+    return out;
+}
+
+std::string FileSpool::pathFor(const std::string &digest) const
+{
+    return (fs::path(dir_) / digest).string();
+}
+
+bool FileSpool::find(const std::string &digest, size_t size, Entry &out) const
+{
+    if (!enabled_ || digest.empty())
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = index_.find(digest);
+    if (it == index_.end() || it->second.size != size)
+        return false;
+
+    out = it->second;
+    return true;
+}
+
+std::unique_ptr<FileSpool::Upload> FileSpool::beginUpload(const std::string &digest, size_t size)
+{
+    if (!enabled_ || digest.empty())
+        return nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (index_.count(digest) || total_bytes_ + size > capacity_)
+            return nullptr;
+    }
+
+    // 同一文件可能被多个客户端同时上传,临时文件名带序号互不干扰,先提交者生效
+    std::string tmp_path = pathFor(digest) + "." + std::to_string(upload_seq_++) + ".part";
+    std::unique_ptr<Upload> upload(new Upload(digest, size, tmp_path));
+    if (!upload->ok_)
+    {
+        LOG_ERROR("创建文件池临时文件失败: {}", tmp_path);
+        return nullptr;
+    }
+    return upload;
+}
+
+bool FileSpool::commit(Upload &upload)
+{
+    if (!upload.ok_)
+        return false;
+
+    upload.out_.close();
+    if (!upload.out_ || upload.written_bytes_ != upload.expected_size_)
+    {
+        LOG_WARN("文件池上传大小不符: 期望 {} 字节, 实际 {} 字节", upload.expected_size_, upload.written_bytes_);
+        return false;
+    }
+
+    // 只有服务器亲自算出的摘要与声明一致才入池,防止伪造摘要污染文件池
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_size = 0;
+    if (EVP_DigestFinal_ex(upload.sha256_.get(), digest, &digest_size) != 1 || digest_size != DIGEST_SIZE)
+    {
+        LOG_ERROR("文件池计算SHA-256失败");
+        return false;
+    }
+    std::string actual_digest = digestHex(digest);
+    if (actual_digest != upload.expected_digest_)
+    {
+        LOG_WARN("文件池上传摘要不符: 声明 {}, 实际 {}", upload.expected_digest_, actual_digest);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index_.count(actual_digest))
+        return false; // 其他连接已提交同一文件
+
+    std::string final_path = pathFor(actual_digest);
+    std::error_code ec;
+    fs::rename(upload.tmp_path_, final_path, ec);
+    if (ec)
+    {
+        LOG_ERROR("文件池提交失败: {}", ec.message());
+        return false;
+    }
+
+    upload.committed_ = true;
+    index_[actual_digest] = Entry{final_path, upload.written_bytes_};
+    total_bytes_ += upload.written_bytes_;
+    LOG_INFO("文件已加入文件池: {}, {} 字节", actual_digest, upload.written_bytes_);
+    return true;
+}
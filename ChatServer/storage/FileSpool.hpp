@@ -0,0 +1,85 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+#include <openssl/evp.h>
+
+// 内容寻址的文件池
+// 上传的文件以其SHA-256摘要(64位十六进制)命名存放在spool目录下,内存中维护 摘要->文件 的索引
+// 同一文件再次被发送时,服务器直接用已有副本下发给其他客户端,发送方无需再次上传
+// XXH64不抗碰撞,可以构造出与他人文件哈希相同的内容抢先入池,因此去重只认服务器亲自校验过的SHA-256
+class FileSpool
+{
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 8ULL * 1024 * 1024 * 1024; // 文件池总容量上限8GB
+    static constexpr size_t REPLAY_CHUNK_SIZE = 1024 * 1024;              // 下发已有副本时的分片大小
+    static constexpr const char *DEFAULT_DIR = "file_spool";              // 相对于服务器工作目录
+    static constexpr size_t DIGEST_SIZE = 32;                             // SHA-256摘要的字节数
+
+    struct Entry
+    {
+        std::string path;
+        size_t size;
+    };
+
+    // 一次上传的落盘状态:FILE_DATA流经时增量写入临时文件并计算摘要,FILE_END时提交
+    class Upload
+    {
+    public:
+        ~Upload(); // 未成功提交的上传在析构时删除临时文件
+
+        Upload(const Upload &) = delete;
+        Upload &operator=(const Upload &) = delete;
+
+        bool append(const char *data, size_t length);
+
+    private:
+        friend class FileSpool;
+        Upload(const std::string &expected_digest, size_t expected_size, const std::string &tmp_path);
+
+        std::string expected_digest_; // 十六进制
+        size_t expected_size_;
+        size_t written_bytes_;
+        std::string tmp_path_;
+        std::ofstream out_;
+        std::unique_ptr<EVP_MD_CTX, void (*)(EVP_MD_CTX *)> sha256_;
+        bool ok_;
+        bool committed_;
+    };
+
+    explicit FileSpool(const std::string &dir, size_t capacity_bytes = DEFAULT_CAPACITY);
+
+    // 禁用拷贝构造和赋值
+    FileSpool(const FileSpool &) = delete;
+    FileSpool &operator=(const FileSpool &) = delete;
+
+    bool isEnabled() const { return enabled_; }
+
+    // 把DIGEST_SIZE字节的摘要转成文件池使用的十六进制形式
+    static std::string digestHex(const unsigned char *digest);
+
+    // 按摘要和大小查找已有文件
+    bool find(const std::string &digest, size_t size, Entry &out) const;
+
+    // 开始一次上传,不需要落盘(未提供摘要、已存在或容量不足)时返回nullptr
+    std::unique_ptr<Upload> beginUpload(const std::string &digest, size_t size);
+
+    // 校验大小和摘要,通过后将临时文件移入文件池并加入索引
+    bool commit(Upload &upload);
+
+private:
+    void loadIndex();
+    std::string pathFor(const std::string &digest) const;
+
+    std::string dir_;
+    size_t capacity_;
+    size_t total_bytes_;
+    bool enabled_;
+    std::unordered_map<std::string, Entry> index_;
+    mutable std::mutex mutex_;
+    std::atomic<uint64_t> upload_seq_;
+};
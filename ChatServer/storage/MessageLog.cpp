@@ -0,0 +1,717 @@
+#include "MessageLog.hpp"
+#include "protocol/XXHash64.hpp"
+#include "logger/log_macros.hpp"
+#include <filesystem>
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // 记录格式(小端):u32 长度(其后的字节数) | u32 校验(其后内容XXH64的低32位) | u64 偏移 | u64 时间戳(毫秒)
+    //                 | u8 聊天室名称长度 | 聊天室名称 | 消息帧
+    constexpr size_t LENGTH_SIZE = 4;
+    constexpr size_t CHECKSUM_SIZE = 4;
+    constexpr size_t RECORD_HEADER_SIZE = LENGTH_SIZE + CHECKSUM_SIZE + 8 + 8 + 1;
+    constexpr size_t MAX_ROOM_NAME = 255;
+
+    uint64_t nowMs()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                         std::chrono::system_clock::now().time_since_epoch())
+                                         .count());
+    }
+
+    uint32_t checksumOf(const char *data, size_t length)
+    {
+        return static_cast<uint32_t>(XXHash64::hash(data, length));
+    }
+
+    void encodeRecord(std::vector<char> &out, uint64_t offset, uint64_t timestamp_ms, const std::string &room,
+                      const std::vector<char> &frame)
+    {
+        size_t room_size = std::min(room.size(), MAX_ROOM_NAME);
+        uint32_t length = static_cast<uint32_t>(RECORD_HEADER_SIZE - LENGTH_SIZE + room_size + frame.size());
+        size_t start = out.size();
+        out.resize(start + LENGTH_SIZE + length);
+        char *p = out.data() + start;
+        memcpy(p, &length, LENGTH_SIZE);
+        char *body = p + LENGTH_SIZE + CHECKSUM_SIZE;
+        memcpy(body, &offset, 8);
+        memcpy(body + 8, &timestamp_ms, 8);
+        body[16] = static_cast<char>(room_size);
+        memcpy(body + 17, room.data(), room_size);
+        memcpy(body + 17 + room_size, frame.data(), frame.size());
+        uint32_t checksum = checksumOf(body, length - CHECKSUM_SIZE);
+        memcpy(p + LENGTH_SIZE, &checksum, CHECKSUM_SIZE);
+    }
+}
+
+MessageLog::Segment::~Segment()
+{
+    if (index)
+    {
+        munmap(index, index_capacity * sizeof(IndexEntry));
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+MessageLog::MessageLog(const Options &options)
+    : options_(options), enabled_(false), pending_bytes_(0), dropped_(0), stopping_(false)
+{
+    options_.segment_bytes = std::min(std::max<size_t>(options_.segment_bytes, 1), SEGMENT_BYTES);
+    std::error_code ec;
+    fs::create_directories(options_.dir, ec);
+    if (ec)
+    {
+        LOG_ERROR("创建消息日志目录 {} 失败: {}, 消息持久化关闭", options_.dir, ec.message());
+        return;
+    }
+
+    loadSegments();
+    if (segments_.empty() && !openSegment(0, true))
+    {
+        LOG_ERROR("创建消息日志段失败, 消息持久化关闭");
+        return;
+    }
+    // 停机期间可能已超过保留时间,不等第一个检查周期
+    enforceRetention();
+
+    enabled_ = true;
+    writer_thread_ = std::thread(&MessageLog::writerLoop, this);
+    retention_thread_ = std::thread(&MessageLog::retentionLoop, this);
+}
+
+MessageLog::~MessageLog()
+{
+    stop();
+}
+
+std::string MessageLog::pathFor(uint64_t base_offset, const char *extension) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%020" PRIu64 "%s", base_offset, extension);
+    return (fs::path(options_.dir) / name).string();
+}
+
+void MessageLog::loadSegments()
+{
+    std::vector<uint64_t> bases;
+    std::error_code ec;
+    for (const auto &item : fs::directory_iterator(options_.dir, ec))
+    {
+        if (!item.is_regular_file() || item.path().extension() != ".log")
+            continue;
+        uint64_t base = 0;
+        const std::string stem = item.path().stem().string();
+        if (stem.size() != 20 || sscanf(stem.c_str(), "%" SCNu64, &base) != 1)
+            continue;
+        bases.push_back(base);
+    }
+    std::sort(bases.begin(), bases.end());
+
+    size_t records = 0;
+    for (size_t i = 0; i < bases.size(); ++i)
+    {
+        // 最后一段是上次运行的活动段,需要扫描校验;之前的段已封存,直接使用其索引
+        SegmentPtr segment = i + 1 < bases.size() ? openSealedSegment(bases[i], bases[i + 1])
+                                                  : openSegment(bases[i], false);
+        if (!segment)
+        {
+            continue;
+        }
+        records += segment->next_offset - segment->base_offset;
+    }
+
+    if (!segments_.empty())
+    {
+        LOG_INFO("消息日志 {} 加载完成: {} 个段, 偏移 {} ~ {}, 共 {} 条记录", options_.dir, segments_.size(),
+                 firstOffset(), nextOffset(), records);
+    }
+}
+
+MessageLog::SegmentPtr MessageLog::openSegment(uint64_t base_offset, bool create)
+{
+    auto segment = std::make_shared<Segment>();
+    segment->base_offset = base_offset;
+    segment->next_offset = base_offset;
+    segment->log_path = pathFor(base_offset, ".log");
+    segment->index_path = pathFor(base_offset, ".idx");
+    segment->fd = open(segment->log_path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+    if (segment->fd < 0)
+    {
+        LOG_ERROR("打开消息日志段 {} 失败: {}", segment->log_path, strerror(errno));
+        return nullptr;
+    }
+
+    // 新段和上次运行的活动段都按可写映射索引,已有的段重新扫描,截掉断电等原因留下的不完整尾部
+    if (!mapIndex(*segment, true) || (!create && !recoverSegment(*segment)))
+    {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(segments_mutex_);
+    segments_[base_offset] = segment;
+    return segment;
+}
+
+MessageLog::SegmentPtr MessageLog::openSealedSegment(uint64_t base_offset, uint64_t end_offset)
+{
+    auto segment = std::make_shared<Segment>();
+    segment->base_offset = base_offset;
+    segment->next_offset = base_offset;
+    segment->log_path = pathFor(base_offset, ".log");
+    segment->index_path = pathFor(base_offset, ".idx");
+    segment->fd = open(segment->log_path.c_str(), O_RDWR | O_CLOEXEC);
+    if (segment->fd < 0)
+    {
+        LOG_ERROR("打开消息日志段 {} 失败: {}", segment->log_path, strerror(errno));
+        return nullptr;
+    }
+    off_t file_size = lseek(segment->fd, 0, SEEK_END);
+    std::error_code ec;
+    size_t index_size = static_cast<size_t>(fs::file_size(segment->index_path, ec));
+    if (ec)
+    {
+        index_size = 0;
+    }
+    if (file_size < 0)
+    {
+        return nullptr;
+    }
+
+    if (index_size == 0 || index_size % sizeof(IndexEntry) != 0)
+    {
+        // 索引缺失或损坏:重新扫描段文件生成
+        LOG_WARN("消息日志索引 {} 缺失或损坏, 重新生成", segment->index_path);
+        if (!mapIndex(*segment, true) || !recoverSegment(*segment))
+        {
+            return nullptr;
+        }
+        sealSegment(*segment);
+    }
+    else
+    {
+        segment->index_entries = index_size / sizeof(IndexEntry);
+        if (!mapIndex(*segment, false))
+        {
+            return nullptr;
+        }
+        segment->size = static_cast<size_t>(file_size);
+        segment->next_offset = end_offset;
+        segment->sealed = true;
+
+        // 从最后一项索引扫描到段尾,取得最新记录的时间(按时间清理时使用)
+        uint64_t scan_offset = 0;
+        size_t pos = seekPosition(*segment, end_offset, scan_offset);
+        Record record;
+        size_t record_size = 0;
+        while (readRecord(segment->fd, pos, segment->size, record, record_size))
+        {
+            segment->last_timestamp_ms = record.timestamp_ms;
+            pos += record_size;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(segments_mutex_);
+    segments_[base_offset] = segment;
+    return segment;
+}
+
+bool MessageLog::mapIndex(Segment &segment, bool writable)
+{
+    int flags = O_CLOEXEC | (writable ? O_RDWR | O_CREAT : O_RDONLY);
+    int index_fd = open(segment.index_path.c_str(), flags, 0644);
+    if (index_fd < 0)
+    {
+        LOG_ERROR("打开消息日志索引 {} 失败: {}", segment.index_path, strerror(errno));
+        return false;
+    }
+
+    size_t capacity = writable ? MAX_INDEX_ENTRIES : segment.index_entries;
+    bool ok = true;
+    if (writable && ftruncate(index_fd, static_cast<off_t>(capacity * sizeof(IndexEntry))) < 0)
+    {
+        LOG_ERROR("预分配消息日志索引 {} 失败: {}", segment.index_path, strerror(errno));
+        ok = false;
+    }
+
+    void *mapped = MAP_FAILED;
+    if (ok && capacity > 0)
+    {
+        mapped = mmap(nullptr, capacity * sizeof(IndexEntry), writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                      MAP_SHARED, index_fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            LOG_ERROR("映射消息日志索引 {} 失败: {}", segment.index_path, strerror(errno));
+            ok = false;
+        }
+    }
+    close(index_fd);
+    if (!ok)
+    {
+        return false;
+    }
+
+    if (segment.index)
+    {
+        munmap(segment.index, segment.index_capacity * sizeof(IndexEntry));
+    }
+    segment.index = capacity > 0 ? static_cast<IndexEntry *>(mapped) : nullptr;
+    segment.index_capacity = capacity;
+    return true;
+}
+
+bool MessageLog::recoverSegment(Segment &segment)
+{
+    off_t file_size = lseek(segment.fd, 0, SEEK_END);
+    if (file_size < 0)
+    {
+        return false;
+    }
+
+    size_t pos = 0;
+    Record record;
+    size_t record_size = 0;
+    segment.index_entries = 0;
+    while (readRecord(segment.fd, pos, static_cast<size_t>(file_size), record, record_size) &&
+           record.offset == segment.next_offset)
+    {
+        if ((segment.index_entries == 0 || pos - segment.last_indexed_position >= INDEX_INTERVAL_BYTES) &&
+            segment.index_entries < segment.index_capacity)
+        {
+            segment.index[segment.index_entries++] =
+                IndexEntry{static_cast<uint32_t>(record.offset - segment.base_offset), static_cast<uint32_t>(pos)};
+            segment.last_indexed_position = pos;
+        }
+        segment.last_timestamp_ms = record.timestamp_ms;
+        ++segment.next_offset;
+        pos += record_size;
+    }
+
+    if (pos < static_cast<size_t>(file_size))
+    {
+        LOG_WARN("消息日志段 {} 尾部有 {} 字节不完整的记录, 已截断", segment.log_path,
+                 static_cast<size_t>(file_size) - pos);
+        if (ftruncate(segment.fd, static_cast<off_t>(pos)) < 0)
+        {
+            LOG_ERROR("截断消息日志段 {} 失败: {}", segment.log_path, strerror(errno));
+            return false;
+        }
+    }
+    segment.size = pos;
+    return true;
+}
+
+void MessageLog::sealSegment(Segment &segment)
+{
+    // 索引收缩到实际项数并改为只读映射
+    if (segment.index)
+    {
+        msync(segment.index, segment.index_capacity * sizeof(IndexEntry), MS_SYNC);
+        munmap(segment.index, segment.index_capacity * sizeof(IndexEntry));
+        segment.index = nullptr;
+        segment.index_capacity = 0;
+    }
+    if (truncate(segment.index_path.c_str(), static_cast<off_t>(segment.index_entries * sizeof(IndexEntry))) < 0)
+    {
+        LOG_ERROR("收缩消息日志索引 {} 失败: {}", segment.index_path, strerror(errno));
+    }
+    mapIndex(segment, false);
+    segment.sealed = true;
+}
+
+bool MessageLog::rollSegment()
+{
+    SegmentPtr active;
+    {
+        std::lock_guard<std::mutex> lock(segments_mutex_);
+        active = segments_.rbegin()->second;
+    }
+    if (fdatasync(active->fd) < 0)
+    {
+        LOG_ERROR("消息日志段 {} fdatasync失败: {}", active->log_path, strerror(errno));
+    }
+
+    // 读取方只在持锁时访问段的索引和大小
+    {
+        std::lock_guard<std::mutex> lock(segments_mutex_);
+        sealSegment(*active);
+    }
+    SegmentPtr next = openSegment(active->next_offset, true);
+    if (!next)
+    {
+        return false;
+    }
+    LOG_INFO("消息日志滚动到新段 {}", next->log_path);
+    return true;
+}
+
+bool MessageLog::append(const std::string &room, const SharedFrame &frame)
+{
+    if (!enabled_)
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        if (stopping_ || pending_bytes_ + frame->size() > MAX_PENDING_BYTES)
+        {
+            ++dropped_;
+            return false;
+        }
+        pending_.push_back(Pending{room, frame, nowMs()});
+        pending_bytes_ += frame->size();
+    }
+    pending_cv_.notify_one();
+    return true;
+}
+
+uint64_t MessageLog::firstOffset() const
+{
+    std::lock_guard<std::mutex> lock(segments_mutex_);
+    return segments_.empty() ? 0 : segments_.begin()->second->base_offset;
+}
+
+uint64_t MessageLog::nextOffset() const
+{
+    std::lock_guard<std::mutex> lock(segments_mutex_);
+    return segments_.empty() ? 0 : segments_.rbegin()->second->next_offset;
+}
+
+void MessageLog::writerLoop()
+{
+    std::vector<Pending> batch;
+    auto last_sync = std::chrono::steady_clock::now();
+    bool unsynced = false;
+    while (true)
+    {
+        bool stopping = false;
+        {
+            std::unique_lock<std::mutex> lock(pending_mutex_);
+            // 有未落盘的数据时最多等到下一次fdatasync的时刻
+            auto ready = [this]
+            { return stopping_ || !pending_.empty(); };
+            if (unsynced)
+                pending_cv_.wait_until(lock, last_sync + options_.sync_interval, ready);
+            else
+                pending_cv_.wait(lock, ready);
+            batch.swap(pending_);
+            pending_bytes_ = 0;
+            stopping = stopping_;
+        }
+
+        // 等待期间到达的消息成组提交:一次pwrite写入整批记录
+        if (!batch.empty())
+        {
+            commitBatch(batch);
+            batch.clear();
+            unsynced = true;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (unsynced && (stopping || now - last_sync >= options_.sync_interval))
+        {
+            SegmentPtr active;
+            {
+                std::lock_guard<std::mutex> lock(segments_mutex_);
+                active = segments_.rbegin()->second;
+            }
+            if (fdatasync(active->fd) < 0)
+            {
+                LOG_ERROR("消息日志段 {} fdatasync失败: {}", active->log_path, strerror(errno));
+            }
+            last_sync = now;
+            unsynced = false;
+        }
+
+        if (stopping)
+        {
+            std::lock_guard<std::mutex> lock(pending_mutex_);
+            if (pending_.empty())
+                break;
+        }
+    }
+}
+
+void MessageLog::commitBatch(std::vector<Pending> &batch)
+{
+    SegmentPtr active;
+    {
+        std::lock_guard<std::mutex> lock(segments_mutex_);
+        active = segments_.rbegin()->second;
+    }
+
+    std::vector<char> buffer;
+    size_t buffer_start = active->size; // buffer在段文件中的起始位置
+    uint64_t next_offset = active->next_offset;
+    std::vector<IndexEntry> new_entries;
+    size_t last_indexed = active->last_indexed_position;
+    uint64_t last_timestamp = active->last_timestamp_ms;
+
+    // 把已编码的部分写入段文件,之后才对读取方可见
+    auto flush = [&]() -> bool
+    {
+        if (!buffer.empty() && !writeAll(active->fd, buffer.data(), buffer.size(), buffer_start))
+        {
+            LOG_ERROR("写入消息日志段 {} 失败: {}", active->log_path, strerror(errno));
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(segments_mutex_);
+        for (const IndexEntry &entry : new_entries)
+        {
+            if (active->index_entries < active->index_capacity)
+                active->index[active->index_entries++] = entry;
+        }
+        active->last_indexed_position = last_indexed;
+        active->size = buffer_start + buffer.size();
+        active->next_offset = next_offset;
+        active->last_timestamp_ms = last_timestamp;
+        return true;
+    };
+
+    for (const Pending &pending : batch)
+    {
+        size_t position = buffer_start + buffer.size();
+        size_t record_size = RECORD_HEADER_SIZE + std::min(pending.room.size(), MAX_ROOM_NAME) + pending.frame->size();
+        // 段写满时先写入已编码的部分,再滚动到新段;单条记录超过段大小时独占一个段
+        if (position > 0 && position + record_size > options_.segment_bytes)
+        {
+            if (!flush() || !rollSegment())
+            {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(segments_mutex_);
+            active = segments_.rbegin()->second;
+            buffer.clear();
+            new_entries.clear();
+            buffer_start = 0;
+            position = 0;
+            last_indexed = 0;
+        }
+
+        if ((active->index_entries == 0 && new_entries.empty()) || position - last_indexed >= INDEX_INTERVAL_BYTES)
+        {
+            new_entries.push_back(
+                IndexEntry{static_cast<uint32_t>(next_offset - active->base_offset), static_cast<uint32_t>(position)});
+            last_indexed = position;
+        }
+        encodeRecord(buffer, next_offset++, pending.timestamp_ms, pending.room, *pending.frame);
+        last_timestamp = pending.timestamp_ms;
+    }
+    flush();
+}
+
+bool MessageLog::writeAll(int fd, const char *data, size_t length, size_t position)
+{
+    while (length > 0)
+    {
+        ssize_t written = pwrite(fd, data, length, static_cast<off_t>(position));
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+        position += static_cast<size_t>(written);
+    }
+    return true;
+}
+
+size_t MessageLog::seekPosition(const Segment &segment, uint64_t offset, uint64_t &scan_offset)
+{
+    // 二分查找不大于offset的最后一项
+    size_t lo = 0;
+    size_t hi = segment.index_entries;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+        if (segment.base_offset + segment.index[mid].relative_offset <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+    {
+        scan_offset = segment.base_offset;
+        return 0;
+    }
+    scan_offset = segment.base_offset + segment.index[lo - 1].relative_offset;
+    return segment.index[lo - 1].position;
+}
+
+bool MessageLog::readRecord(int fd, size_t pos, size_t limit, Record &record, size_t &record_size)
+{
+    char header[RECORD_HEADER_SIZE];
+    if (pos + RECORD_HEADER_SIZE > limit ||
+        pread(fd, header, RECORD_HEADER_SIZE, static_cast<off_t>(pos)) != static_cast<ssize_t>(RECORD_HEADER_SIZE))
+    {
+        return false;
+    }
+
+    uint32_t length = 0;
+    uint32_t checksum = 0;
+    memcpy(&length, header, LENGTH_SIZE);
+    memcpy(&checksum, header + LENGTH_SIZE, CHECKSUM_SIZE);
+    size_t room_size = static_cast<unsigned char>(header[RECORD_HEADER_SIZE - 1]);
+    if (length < RECORD_HEADER_SIZE - LENGTH_SIZE + room_size || pos + LENGTH_SIZE + length > limit)
+    {
+        return false;
+    }
+
+    std::vector<char> body(length - CHECKSUM_SIZE);
+    if (pread(fd, body.data(), body.size(), static_cast<off_t>(pos + LENGTH_SIZE + CHECKSUM_SIZE)) !=
+            static_cast<ssize_t>(body.size()) ||
+        checksumOf(body.data(), body.size()) != checksum)
+    {
+        return false;
+    }
+
+    memcpy(&record.offset, body.data(), 8);
+    memcpy(&record.timestamp_ms, body.data() + 8, 8);
+    record.room.assign(body.data() + 17, room_size);
+    record.frame.assign(body.begin() + 17 + static_cast<std::ptrdiff_t>(room_size), body.end());
+    record_size = LENGTH_SIZE + length;
+    return true;
+}
+
+size_t MessageLog::read(uint64_t offset, size_t max_records, const std::function<void(const Record &)> &visit) const
+{
+    size_t count = 0;
+    while (count < max_records)
+    {
+        // 持锁取得段及其已写入的范围,读文件时不持锁;段被删除时文件在最后一个持有者放手后才关闭
+        SegmentPtr segment;
+        size_t limit = 0;
+        uint64_t end_offset = 0;
+        uint64_t scan_offset = 0;
+        size_t pos = 0;
+        {
+            std::lock_guard<std::mutex> lock(segments_mutex_);
+            auto it = segments_.upper_bound(offset);
+            if (it == segments_.begin())
+            {
+                if (it == segments_.end())
+                    break;
+                offset = it->first; // 早于保留范围,从最早的记录开始
+            }
+            else
+            {
+                --it;
+            }
+            segment = it->second;
+            limit = segment->size;
+            end_offset = segment->next_offset;
+            if (offset >= end_offset)
+            {
+                if (++it == segments_.end())
+                    break;
+                offset = it->first;
+                continue;
+            }
+            pos = seekPosition(*segment, offset, scan_offset);
+        }
+
+        Record record;
+        size_t record_size = 0;
+        while (count < max_records && scan_offset < end_offset &&
+               readRecord(segment->fd, pos, limit, record, record_size))
+        {
+            if (record.offset >= offset)
+            {
+                visit(record);
+                ++count;
+            }
+            ++scan_offset;
+            pos += record_size;
+        }
+        if (scan_offset < end_offset)
+        {
+            break; // 读满或段文件损坏
+        }
+        offset = end_offset;
+    }
+    return count;
+}
+
+void MessageLog::retentionLoop()
+{
+    std::unique_lock<std::mutex> lock(stop_mutex_);
+    while (!stop_cv_.wait_for(lock, RETENTION_CHECK_INTERVAL, [this]
+                              { return stopping_; }))
+    {
+        lock.unlock();
+        enforceRetention();
+        lock.lock();
+    }
+}
+
+void MessageLog::enforceRetention()
+{
+    // 从最早的段开始删除,活动段始终保留
+    std::vector<SegmentPtr> expired;
+    uint64_t min_timestamp = nowMs() - static_cast<uint64_t>(
+                                           std::chrono::duration_cast<std::chrono::milliseconds>(options_.retention_age)
+                                               .count());
+    {
+        std::lock_guard<std::mutex> lock(segments_mutex_);
+        size_t total = 0;
+        for (const auto &item : segments_)
+        {
+            total += item.second->size;
+        }
+        while (segments_.size() > 1)
+        {
+            const SegmentPtr &oldest = segments_.begin()->second;
+            if (total <= options_.retention_bytes && oldest->last_timestamp_ms >= min_timestamp)
+                break;
+            total -= oldest->size;
+            expired.push_back(oldest);
+            segments_.erase(segments_.begin());
+        }
+    }
+
+    for (const SegmentPtr &segment : expired)
+    {
+        std::error_code ec;
+        fs::remove(segment->log_path, ec);
+        fs::remove(segment->index_path, ec);
+        LOG_INFO("消息日志删除过期的段 {}, 偏移 {} ~ {}", segment->log_path, segment->base_offset,
+                 segment->next_offset);
+    }
+}
+
+void MessageLog::stop()
+{
+    {
+        std::lock_guard<std::mutex> pending_lock(pending_mutex_);
+        std::lock_guard<std::mutex> stop_lock(stop_mutex_);
+        if (stopping_)
+            return;
+        stopping_ = true;
+    }
+    pending_cv_.notify_all();
+    stop_cv_.notify_all();
+    if (writer_thread_.joinable())
+    {
+        writer_thread_.join();
+    }
+    if (retention_thread_.joinable())
+    {
+        retention_thread_.join();
+    }
+    if (dropped_ > 0)
+    {
+        LOG_WARN("消息日志待写队列满, 共丢弃 {} 条消息", dropped_);
+    }
+}
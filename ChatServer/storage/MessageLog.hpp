@@ -0,0 +1,152 @@
+#pragma once
+
+#include "protocol/Protocol.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// 聊天消息的持久化日志:只追加,按段存放在目录下,服务器重启后据此恢复各聊天室最近的消息
+// 每条记录有全局递增的偏移(offset);段文件以其第一条记录的偏移命名(<偏移>.log),
+// 旁边的<偏移>.idx是mmap的稀疏偏移索引,按偏移定位时只需扫描一个索引间隔
+// 广播路径只把消息放入待写队列,由写线程成组提交(一次pwrite写入一批记录),按设定的周期fdatasync,
+// 聊天消息的延迟不受落盘影响;启动时及之后由后台线程定期按总大小和保留时间删除最早的段
+class MessageLog
+{
+public:
+    static constexpr const char *DEFAULT_DIR = "message_log";                    // 相对于服务器工作目录
+    static constexpr size_t SEGMENT_BYTES = 64 * 1024 * 1024;                    // 段文件写满后滚动到新段,也是段大小的上限
+    static constexpr size_t INDEX_INTERVAL_BYTES = 4096;                         // 每隔这么多字节记一项索引
+    static constexpr size_t MAX_PENDING_BYTES = 64 * 1024 * 1024;                // 磁盘跟不上时丢弃新消息,不阻塞广播
+    static constexpr std::chrono::milliseconds DEFAULT_SYNC_INTERVAL{100};       // 0表示每次成组提交后都fdatasync
+    static constexpr size_t DEFAULT_RETENTION_BYTES = 4ULL * 1024 * 1024 * 1024; // 所有段的总大小上限
+    static constexpr std::chrono::hours DEFAULT_RETENTION_AGE{24 * 7};           // 段中最新的记录早于此时删除
+    static constexpr std::chrono::seconds RETENTION_CHECK_INTERVAL{60};
+
+    struct Options
+    {
+        std::string dir = DEFAULT_DIR;
+        std::chrono::milliseconds sync_interval = DEFAULT_SYNC_INTERVAL;
+        size_t retention_bytes = DEFAULT_RETENTION_BYTES;
+        std::chrono::hours retention_age = DEFAULT_RETENTION_AGE;
+        size_t segment_bytes = SEGMENT_BYTES; // 不超过SEGMENT_BYTES(索引按该大小映射)
+    };
+
+    struct Record
+    {
+        uint64_t offset;
+        uint64_t timestamp_ms; // 写入时的系统时间(毫秒)
+        std::string room;
+        std::vector<char> frame; // 旧版格式的完整帧
+    };
+
+    explicit MessageLog(const Options &options);
+    ~MessageLog(); // 写完队列中的消息后停止
+
+    // 禁用拷贝构造和赋值
+    MessageLog(const MessageLog &) = delete;
+    MessageLog &operator=(const MessageLog &) = delete;
+
+    bool isEnabled() const { return enabled_; }
+
+    // 放入待写队列即返回,不等待落盘;日志未启用或待写队列已满时返回false
+    bool append(const std::string &room, const SharedFrame &frame);
+
+    // 最早的保留记录和下一条记录(尚未写入)的偏移
+    uint64_t firstOffset() const;
+    uint64_t nextOffset() const;
+
+    // 从offset开始按顺序读取最多max_records条已写入的记录,返回读取的条数
+    size_t read(uint64_t offset, size_t max_records, const std::function<void(const Record &)> &visit) const;
+
+    // 写完队列中的消息,fdatasync后停止后台线程
+    void stop();
+
+private:
+    // 索引项:记录相对段基准偏移的序号和在段文件中的位置
+    struct IndexEntry
+    {
+        uint32_t relative_offset;
+        uint32_t position;
+    };
+    static constexpr size_t MAX_INDEX_ENTRIES = SEGMENT_BYTES / INDEX_INTERVAL_BYTES + 1;
+
+    // 一个段:段文件保持打开供读取;被删除的段在最后一个读取方放手后关闭
+    struct Segment
+    {
+        ~Segment();
+
+        uint64_t base_offset = 0;
+        std::string log_path;
+        std::string index_path;
+        int fd = -1;
+        size_t size = 0;          // 已写入的字节数
+        uint64_t next_offset = 0; // 段中下一条记录的偏移
+        uint64_t last_timestamp_ms = 0;
+        IndexEntry *index = nullptr; // mmap的索引:活动段映射为可写的MAX_INDEX_ENTRIES项,已封存的段只读映射实际项数
+        size_t index_capacity = 0;
+        size_t index_entries = 0;
+        size_t last_indexed_position = 0;
+        bool sealed = false;
+    };
+    using SegmentPtr = std::shared_ptr<Segment>;
+
+    struct Pending
+    {
+        std::string room;
+        SharedFrame frame;
+        uint64_t timestamp_ms;
+    };
+
+    void loadSegments();
+    // 扫描段文件校验记录,截掉不完整的尾部,重建索引
+    bool recoverSegment(Segment &segment);
+    // 打开活动段(create为true时新建)
+    SegmentPtr openSegment(uint64_t base_offset, bool create);
+    // 打开已封存的段,其记录的偏移到end_offset(下一段的基准偏移)为止
+    SegmentPtr openSealedSegment(uint64_t base_offset, uint64_t end_offset);
+    bool mapIndex(Segment &segment, bool writable);
+    void sealSegment(Segment &segment);
+    bool rollSegment();
+    std::string pathFor(uint64_t base_offset, const char *extension) const;
+
+    void writerLoop();
+    // 编码并写入一批记录,必要时滚动段
+    void commitBatch(std::vector<Pending> &batch);
+    // 在段文件的position处写入(恢复时截掉的尾部之后不会留下空洞)
+    bool writeAll(int fd, const char *data, size_t length, size_t position);
+    void retentionLoop();
+    void enforceRetention();
+
+    // 在段中查找不大于offset的最后一项索引,返回扫描起点
+    static size_t seekPosition(const Segment &segment, uint64_t offset, uint64_t &scan_offset);
+    // 解析pos处的一条记录,不完整或校验失败时返回false
+    static bool readRecord(int fd, size_t pos, size_t limit, Record &record, size_t &record_size);
+
+    Options options_;
+    bool enabled_;
+
+    // 段表:基准偏移 -> 段,最后一个是活动段;读取方、写线程和清理线程共用
+    std::map<uint64_t, SegmentPtr> segments_;
+    mutable std::mutex segments_mutex_;
+
+    // 待写队列
+    std::vector<Pending> pending_;
+    size_t pending_bytes_;
+    uint64_t dropped_;
+    std::mutex pending_mutex_;
+    std::condition_variable pending_cv_;
+
+    bool stopping_;
+    std::mutex stop_mutex_;
+    std::condition_variable stop_cv_;
+    std::thread writer_thread_;
+    std::thread retention_thread_;
+};
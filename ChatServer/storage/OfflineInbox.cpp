@@ -0,0 +1,559 @@
+#include "OfflineInbox.hpp"
+#include "protocol/XXHash64.hpp"
+#include "logger/log_macros.hpp"
+#include <filesystem>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    // 文件格式(小端):文件头 u32 魔数 | u32 保留 | u64 已投递到的位置(第一条未投递记录的起点)
+    // 之后依次为记录:u32 长度(其后的字节数) | u32 校验(其后内容XXH64的低32位) | u64 时间戳(毫秒) | 消息帧
+    constexpr uint32_t FILE_MAGIC = 0x31584249; // "IBX1"
+    constexpr size_t FILE_HEADER_SIZE = 16;
+    constexpr size_t CONSUMED_OFFSET = 8;
+    constexpr size_t LENGTH_SIZE = 4;
+    constexpr size_t CHECKSUM_SIZE = 4;
+    constexpr size_t RECORD_HEADER_SIZE = LENGTH_SIZE + CHECKSUM_SIZE + 8;
+    constexpr const char *FILE_EXTENSION = ".inbox";
+    constexpr const char *KNOWN_USERS_FILE = "known_users";
+
+    uint64_t nowMs()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                         std::chrono::system_clock::now().time_since_epoch())
+                                         .count());
+    }
+
+    uint32_t checksumOf(const char *data, size_t length)
+    {
+        return static_cast<uint32_t>(XXHash64::hash(data, length));
+    }
+
+    bool readAt(int fd, char *data, size_t length, uint64_t position)
+    {
+        while (length > 0)
+        {
+            ssize_t got = pread(fd, data, length, static_cast<off_t>(position));
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got <= 0)
+                return false;
+            data += got;
+            length -= static_cast<size_t>(got);
+            position += static_cast<uint64_t>(got);
+        }
+        return true;
+    }
+
+    bool writeAt(int fd, const char *data, size_t length, uint64_t position)
+    {
+        while (length > 0)
+        {
+            ssize_t written = pwrite(fd, data, length, static_cast<off_t>(position));
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            data += written;
+            length -= static_cast<size_t>(written);
+            position += static_cast<uint64_t>(written);
+        }
+        return true;
+    }
+
+    // 文件头中已投递到的位置,文件头无效时返回false
+    bool readConsumed(int fd, uint64_t &consumed)
+    {
+        char header[FILE_HEADER_SIZE];
+        if (!readAt(fd, header, sizeof(header), 0))
+            return false;
+        uint32_t magic;
+        memcpy(&magic, header, sizeof(magic));
+        memcpy(&consumed, header + CONSUMED_OFFSET, sizeof(consumed));
+        return magic == FILE_MAGIC && consumed >= FILE_HEADER_SIZE;
+    }
+
+    int hexValue(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        return -1;
+    }
+
+    // 用户名可能含有任意字节,文件名和登记表中使用其十六进制编码
+    std::string encodeName(const std::string &user)
+    {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        hex.reserve(user.size() * 2);
+        for (unsigned char c : user)
+        {
+            hex.push_back(digits[c >> 4]);
+            hex.push_back(digits[c & 0x0f]);
+        }
+        return hex;
+    }
+
+    // 由文件名还原用户名
+    bool decodeName(const std::string &hex, std::string &name)
+    {
+        if (hex.empty() || hex.size() % 2 != 0)
+            return false;
+        name.clear();
+        for (size_t i = 0; i < hex.size(); i += 2)
+        {
+            int high = hexValue(hex[i]);
+            int low = hexValue(hex[i + 1]);
+            if (high < 0 || low < 0)
+                return false;
+            name.push_back(static_cast<char>(high << 4 | low));
+        }
+        return true;
+    }
+}
+
+OfflineInbox::OfflineInbox(const Options &options)
+    : options_(options), enabled_(false), total_bytes_(0), known_fd_(-1), stopping_(false)
+{
+    std::error_code ec;
+    fs::create_directories(options_.dir, ec);
+    if (ec)
+    {
+        LOG_ERROR("创建离线收件箱目录 {} 失败: {}, 离线私聊关闭", options_.dir, ec.message());
+        return;
+    }
+
+    std::string known_path = (fs::path(options_.dir) / KNOWN_USERS_FILE).string();
+    known_fd_ = open(known_path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (known_fd_ < 0)
+    {
+        LOG_ERROR("打开 {} 失败: {}, 离线私聊关闭", known_path, strerror(errno));
+        return;
+    }
+    loadKnownUsers();
+
+    scan(true);
+    LOG_INFO("离线收件箱 {} 加载完成: 共 {} KB, 登记用户 {} 个", options_.dir, total_bytes_.load() / 1024,
+             known_users_.size());
+
+    enabled_ = true;
+    purge_thread_ = std::thread(&OfflineInbox::purgeLoop, this);
+}
+
+OfflineInbox::~OfflineInbox()
+{
+    stop();
+    if (known_fd_ >= 0)
+    {
+        close(known_fd_);
+    }
+}
+
+std::string OfflineInbox::pathFor(const std::string &user) const
+{
+    return (fs::path(options_.dir) / (encodeName(user) + FILE_EXTENSION)).string();
+}
+
+void OfflineInbox::loadKnownUsers()
+{
+    struct stat st;
+    if (fstat(known_fd_, &st) != 0 || st.st_size == 0)
+        return;
+    std::string content(static_cast<size_t>(st.st_size), '\0');
+    if (!readAt(known_fd_, &content[0], content.size(), 0))
+    {
+        LOG_ERROR("读取离线收件箱的用户登记表失败: {}", strerror(errno));
+        return;
+    }
+
+    size_t start = 0;
+    for (size_t end = content.find('\n'); end != std::string::npos; end = content.find('\n', start))
+    {
+        std::string user;
+        if (decodeName(content.substr(start, end - start), user))
+        {
+            known_users_.insert(std::move(user));
+        }
+        start = end + 1;
+    }
+    // 没有换行结尾的最后一行是崩溃时写了一半的登记,截掉后新的登记从行首开始
+    if (start < content.size() && ftruncate(known_fd_, static_cast<off_t>(start)) != 0)
+    {
+        LOG_ERROR("截断离线收件箱的用户登记表失败: {}", strerror(errno));
+    }
+}
+
+void OfflineInbox::addKnownUser(const std::string &user)
+{
+    if (!enabled_ || user.empty())
+    {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(known_mutex_);
+    if (known_users_.count(user))
+    {
+        return;
+    }
+    if (known_users_.size() >= options_.max_known_users)
+    {
+        LOG_WARN("离线收件箱登记的用户数达到上限 {}, {} 收不到离线私聊", options_.max_known_users, user);
+        return;
+    }
+    // 一行一次write,O_APPEND保证整行追加在文件末尾
+    std::string line = encodeName(user) + '\n';
+    if (write(known_fd_, line.data(), line.size()) != static_cast<ssize_t>(line.size()))
+    {
+        LOG_ERROR("登记离线收件箱用户 {} 失败: {}", user, strerror(errno));
+        return;
+    }
+    known_users_.insert(user);
+}
+
+bool OfflineInbox::isKnownUser(const std::string &user) const
+{
+    std::lock_guard<std::mutex> lock(known_mutex_);
+    return known_users_.count(user) != 0;
+}
+
+std::mutex &OfflineInbox::lockFor(const std::string &user) const
+{
+    return locks_[std::hash<std::string>()(user) % LOCK_STRIPES];
+}
+
+void OfflineInbox::releaseBytes(uint64_t bytes)
+{
+    uint64_t current = total_bytes_.load();
+    while (!total_bytes_.compare_exchange_weak(current, current - std::min(current, bytes)))
+    {
+    }
+}
+
+bool OfflineInbox::store(const std::string &user, const std::vector<char> &frame)
+{
+    if (!enabled_ || user.empty() || !isKnownUser(user))
+    {
+        return false;
+    }
+    size_t record_size = RECORD_HEADER_SIZE + frame.size();
+
+    std::lock_guard<std::mutex> lock(lockFor(user));
+    std::string path = pathFor(user);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        LOG_ERROR("打开离线收件箱 {} 失败: {}", path, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        LOG_ERROR("读取离线收件箱 {} 的大小失败: {}", path, strerror(errno));
+        close(fd);
+        return false;
+    }
+    uint64_t size = static_cast<uint64_t>(st.st_size);
+    // 新建的文件(或上次创建时没有写完文件头)从头写入文件头
+    bool created = size < FILE_HEADER_SIZE;
+    uint64_t consumed = FILE_HEADER_SIZE;
+    if (!created && !readConsumed(fd, consumed))
+    {
+        LOG_ERROR("离线收件箱 {} 的文件头损坏", path);
+        close(fd);
+        return false;
+    }
+
+    uint64_t position = created ? 0 : size;
+    uint64_t pending = created ? 0 : size - std::min(size, consumed);
+    if (pending + record_size > options_.max_user_bytes)
+    {
+        LOG_WARN("用户 {} 的离线收件箱已满, 未投递 {} KB", user, pending / 1024);
+        close(fd);
+        return false;
+    }
+    if (total_bytes_.load() + record_size > options_.max_total_bytes)
+    {
+        LOG_WARN("离线收件箱总大小达到上限 {} MB, 拒绝存入 {} 的消息", options_.max_total_bytes / 1024 / 1024, user);
+        close(fd);
+        return false;
+    }
+
+    std::vector<char> buffer;
+    buffer.reserve((created ? FILE_HEADER_SIZE : 0) + record_size);
+    if (created)
+    {
+        buffer.resize(FILE_HEADER_SIZE, 0);
+        memcpy(buffer.data(), &FILE_MAGIC, sizeof(FILE_MAGIC));
+        uint64_t start = FILE_HEADER_SIZE;
+        memcpy(buffer.data() + CONSUMED_OFFSET, &start, sizeof(start));
+    }
+    size_t record_start = buffer.size();
+    buffer.resize(record_start + record_size);
+    char *p = buffer.data() + record_start;
+    uint32_t length = static_cast<uint32_t>(record_size - LENGTH_SIZE);
+    uint64_t timestamp_ms = nowMs();
+    memcpy(p, &length, LENGTH_SIZE);
+    char *body = p + LENGTH_SIZE + CHECKSUM_SIZE;
+    memcpy(body, &timestamp_ms, sizeof(timestamp_ms));
+    memcpy(body + sizeof(timestamp_ms), frame.data(), frame.size());
+    uint32_t checksum = checksumOf(body, length - CHECKSUM_SIZE);
+    memcpy(p + LENGTH_SIZE, &checksum, CHECKSUM_SIZE);
+
+    bool ok = writeAt(fd, buffer.data(), buffer.size(), position);
+    if (!ok)
+    {
+        LOG_ERROR("写入离线收件箱 {} 失败: {}", path, strerror(errno));
+        // 截掉写了一半的记录,之后的写入不会跟在残缺的记录后面
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0)
+        {
+            LOG_ERROR("截断离线收件箱 {} 失败: {}", path, strerror(errno));
+        }
+    }
+    else
+    {
+        total_bytes_ += position + buffer.size() - size;
+    }
+    close(fd);
+    return ok;
+}
+
+bool OfflineInbox::hasPending(const std::string &user) const
+{
+    if (!enabled_)
+    {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(lockFor(user));
+    int fd = open(pathFor(user).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    uint64_t consumed = 0;
+    bool pending = fstat(fd, &st) == 0 && readConsumed(fd, consumed) &&
+                   static_cast<uint64_t>(st.st_size) > consumed;
+    close(fd);
+    return pending;
+}
+
+void OfflineInbox::read(const std::string &user, uint64_t position, Batch &batch) const
+{
+    batch = Batch();
+    batch.end_position = position;
+    if (!enabled_)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(lockFor(user));
+    std::string path = pathFor(user);
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    struct stat st;
+    uint64_t consumed = 0;
+    if (fstat(fd, &st) != 0 || !readConsumed(fd, consumed))
+    {
+        close(fd);
+        return;
+    }
+    uint64_t size = static_cast<uint64_t>(st.st_size);
+    // 同名的另一个连接可能已经确认到更后面的位置
+    position = std::max(position, consumed);
+    batch.end_position = position;
+
+    // 一次pread读取一批记录;第一条记录比一批的上限还大时单独读取整条
+    std::vector<char> buffer(std::min<uint64_t>(size - std::min(size, position), DRAIN_BATCH_BYTES));
+    if (buffer.empty() || !readAt(fd, buffer.data(), buffer.size(), position))
+    {
+        close(fd);
+        return;
+    }
+
+    uint64_t min_timestamp = nowMs() - static_cast<uint64_t>(
+                                           std::chrono::duration_cast<std::chrono::milliseconds>(options_.ttl).count());
+    size_t parsed = 0;
+    bool corrupted = false;
+    while (parsed + RECORD_HEADER_SIZE <= buffer.size() && batch.frames.size() < DRAIN_BATCH_MESSAGES)
+    {
+        uint32_t length;
+        memcpy(&length, buffer.data() + parsed, LENGTH_SIZE);
+        size_t record_size = LENGTH_SIZE + length;
+        if (record_size < RECORD_HEADER_SIZE + sizeof(MSG_header) || position + parsed + record_size > size)
+        {
+            corrupted = true;
+            break;
+        }
+        if (parsed + record_size > buffer.size())
+        {
+            if (parsed > 0)
+                break; // 留给下一批
+            buffer.resize(record_size);
+            if (!readAt(fd, buffer.data(), record_size, position))
+            {
+                corrupted = true;
+                break;
+            }
+        }
+
+        const char *p = buffer.data() + parsed;
+        const char *body = p + LENGTH_SIZE + CHECKSUM_SIZE;
+        uint32_t checksum;
+        memcpy(&checksum, p + LENGTH_SIZE, CHECKSUM_SIZE);
+        if (checksum != checksumOf(body, length - CHECKSUM_SIZE))
+        {
+            corrupted = true;
+            break;
+        }
+        uint64_t timestamp_ms;
+        memcpy(&timestamp_ms, body, sizeof(timestamp_ms));
+        if (timestamp_ms < min_timestamp)
+        {
+            ++batch.expired;
+        }
+        else
+        {
+            const char *frame = body + sizeof(timestamp_ms);
+            batch.frames.push_back(std::make_shared<const std::vector<char>>(frame, p + record_size));
+        }
+        parsed += record_size;
+    }
+    close(fd);
+
+    batch.end_position = position + parsed;
+    if (corrupted)
+    {
+        // 之后的内容无法可靠地划分记录,全部跳过
+        LOG_ERROR("离线收件箱 {} 在位置 {} 处损坏, 跳过之后的 {} 字节", path, batch.end_position,
+                  size - batch.end_position);
+        batch.end_position = size;
+    }
+}
+
+bool OfflineInbox::commit(const std::string &user, uint64_t position)
+{
+    if (!enabled_)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(lockFor(user));
+    std::string path = pathFor(user);
+    int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    uint64_t consumed = 0;
+    if (fstat(fd, &st) != 0 || !readConsumed(fd, consumed))
+    {
+        close(fd);
+        return false;
+    }
+    uint64_t size = static_cast<uint64_t>(st.st_size);
+    if (position >= size)
+    {
+        // 全部投递完毕,删除文件;之后再有消息时重新创建
+        close(fd);
+        if (unlink(path.c_str()) == 0)
+        {
+            releaseBytes(size);
+        }
+        return false;
+    }
+
+    if (position > consumed && !writeAt(fd, reinterpret_cast<const char *>(&position), sizeof(position),
+                                        CONSUMED_OFFSET))
+    {
+        LOG_ERROR("更新离线收件箱 {} 的投递位置失败: {}", path, strerror(errno));
+    }
+    close(fd);
+    return true;
+}
+
+void OfflineInbox::scan(bool startup)
+{
+    time_t expire_before = time(nullptr) - std::chrono::duration_cast<std::chrono::seconds>(options_.ttl).count();
+    uint64_t total = 0;
+    size_t removed = 0;
+    std::error_code ec;
+    for (const auto &item : fs::directory_iterator(options_.dir, ec))
+    {
+        std::string user;
+        if (item.path().extension() != FILE_EXTENSION || !decodeName(item.path().stem().string(), user))
+            continue;
+
+        std::lock_guard<std::mutex> lock(lockFor(user));
+        std::string path = item.path().string();
+        struct stat st;
+        if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+            continue; // 可能刚被投递完删除
+        // 每次存入都更新修改时间,最后一次存入早于保留时间说明其中的消息都已过期
+        if (st.st_mtime >= expire_before)
+        {
+            total += static_cast<uint64_t>(st.st_size);
+            continue;
+        }
+        if (unlink(path.c_str()) == 0)
+        {
+            ++removed;
+            if (!startup)
+                releaseBytes(static_cast<uint64_t>(st.st_size));
+        }
+    }
+
+    if (startup)
+    {
+        total_bytes_ = total;
+    }
+    if (removed > 0)
+    {
+        LOG_INFO("删除 {} 个过期的离线收件箱", removed);
+    }
+}
+
+void OfflineInbox::purgeLoop()
+{
+    std::unique_lock<std::mutex> lock(stop_mutex_);
+    while (!stop_cv_.wait_for(lock, PURGE_INTERVAL, [this]
+                              { return stopping_; }))
+    {
+        lock.unlock();
+        scan(false);
+        lock.lock();
+    }
+}
+
+void OfflineInbox::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(stop_mutex_);
+        if (stopping_)
+            return;
+        stopping_ = true;
+    }
+    stop_cv_.notify_all();
+    if (purge_thread_.joinable())
+    {
+        purge_thread_.join();
+    }
+}
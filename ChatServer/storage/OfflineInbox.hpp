@@ -0,0 +1,104 @@
+#pragma once
+
+#include "protocol/Protocol.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+// 离线收件箱:接收方不在线时私聊消息按用户名存入其收件箱,登录后分批投递
+// 每个用户一个只追加的文件(文件名为用户名的十六进制编码),文件头记录已投递到的位置,
+// 全部投递完后删除文件;单个用户和全部收件箱的未投递字节数都有上限,超过保留时间的消息不再投递
+// 写入只经过页缓存(不fdatasync),进程崩溃不丢消息,断电可能丢失最近写入的部分
+// 只有登录过的用户名才有收件箱:登录过的用户名登记在目录中的known_users文件里(每行一个十六进制编码的用户名),
+// 否则任何人都能向任意编造的用户名发私聊,在磁盘上留下无人读取的收件箱
+class OfflineInbox
+{
+public:
+    static constexpr const char *DEFAULT_DIR = "offline_inbox";                   // 相对于服务器工作目录
+    static constexpr size_t DEFAULT_MAX_USER_BYTES = 64 * 1024 * 1024;           // 单个用户未投递消息的上限
+    static constexpr size_t DEFAULT_MAX_TOTAL_BYTES = 2ULL * 1024 * 1024 * 1024; // 所有收件箱文件的总大小上限
+    static constexpr std::chrono::hours DEFAULT_TTL{24 * 7};                     // 消息的保留时间
+    static constexpr std::chrono::minutes PURGE_INTERVAL{10};                    // 删除过期收件箱的检查周期
+    static constexpr size_t DEFAULT_MAX_KNOWN_USERS = 1000000;                   // 登记的用户名上限,之后的新用户名不再登记
+    // 投递时每批读取的上限:一批消息完整写入socket后才读取下一批
+    static constexpr size_t DRAIN_BATCH_BYTES = 256 * 1024;
+    static constexpr size_t DRAIN_BATCH_MESSAGES = 1024;
+
+    struct Options
+    {
+        std::string dir = DEFAULT_DIR;
+        size_t max_user_bytes = DEFAULT_MAX_USER_BYTES;
+        size_t max_total_bytes = DEFAULT_MAX_TOTAL_BYTES;
+        std::chrono::hours ttl = DEFAULT_TTL;
+        size_t max_known_users = DEFAULT_MAX_KNOWN_USERS;
+    };
+
+    // 一次读取的结果
+    struct Batch
+    {
+        std::vector<SharedFrame> frames; // 旧版格式的完整帧,按存入的顺序
+        uint64_t end_position = 0;       // 本批之后的读取位置,投递完成后交给commit
+        size_t expired = 0;              // 跳过的过期消息数
+    };
+
+    explicit OfflineInbox(const Options &options);
+    ~OfflineInbox();
+
+    // 禁用拷贝构造和赋值
+    OfflineInbox(const OfflineInbox &) = delete;
+    OfflineInbox &operator=(const OfflineInbox &) = delete;
+
+    bool isEnabled() const { return enabled_; }
+
+    // 登记一个登录过的用户名,重启后仍然有效;达到上限时不再登记
+    void addKnownUser(const std::string &user);
+    // user是否登录过:只应为登录过的用户存入消息
+    bool isKnownUser(const std::string &user) const;
+
+    // 把一条消息存入user的收件箱;user没有登记、超过上限或写入失败时返回false
+    bool store(const std::string &user, const std::vector<char> &frame);
+    // user的收件箱中是否有未投递的消息
+    bool hasPending(const std::string &user) const;
+    // 从position开始读取一批消息,position为0时从上次确认的位置开始;收件箱不存在或已读完时batch.frames为空
+    // 存储损坏时跳过之后的内容
+    void read(const std::string &user, uint64_t position, Batch &batch) const;
+    // 确认position之前的消息都已投递;之后没有消息时删除收件箱并返回false
+    bool commit(const std::string &user, uint64_t position);
+
+    // 停止后台清理线程
+    void stop();
+
+private:
+    static constexpr size_t LOCK_STRIPES = 64;
+
+    std::string pathFor(const std::string &user) const;
+    // 读取known_users文件,截掉崩溃时写了一半的最后一行
+    void loadKnownUsers();
+    std::mutex &lockFor(const std::string &user) const;
+    void releaseBytes(uint64_t bytes);
+    // 删除最后一次写入早于保留时间的收件箱;startup为true时同时统计剩余收件箱的总大小
+    void scan(bool startup);
+    void purgeLoop();
+
+    Options options_;
+    bool enabled_;
+    // 同一用户的读写和删除按用户名哈希到同一把锁上串行执行
+    mutable std::array<std::mutex, LOCK_STRIPES> locks_;
+    std::atomic<uint64_t> total_bytes_;
+
+    mutable std::mutex known_mutex_;
+    std::unordered_set<std::string> known_users_;
+    int known_fd_; // 以追加方式打开的known_users文件
+
+    bool stopping_;
+    std::mutex stop_mutex_;
+    std::condition_variable stop_cv_;
+    std::thread purge_thread_;
+};
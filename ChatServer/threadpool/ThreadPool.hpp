@@ -10,6 +10,7 @@
 #include <functional>
 #include <stdexcept>
 #include <atomic>
+#include <algorithm>
 
 class ThreadPool
 {
@@ -30,6 +31,12 @@ public:
     // std::future<T>：表示一个异步操作的结果,通过 future.get() 在需要时获取任务的返回值（如果任务还没完成会阻塞等待）；
     // std::invoke_result_t<F, Args...>：C++17 类型萃取工具，自动推断 F(Args...) 的返回类型
 
+    // 把[0, count)按grain切分成若干段,并行执行body(begin, end),全部段执行完毕后返回
+    // 调用线程自己也领取并执行段,空闲的工作线程帮忙领取剩余的段;工作线程都在忙(甚至在等待调用方持有的锁)时
+    // 调用线程独自完成全部段,不会因等待线程池而死锁。body不应抛出异常
+    template <class F>
+    void parallelFor(size_t count, size_t grain, F &&body);
+
     // 获取线程池状态
     size_t getThreadCount() const { return threads_.size(); }
     size_t getQueueSize() const;
@@ -89,4 +96,65 @@ auto ThreadPool::enqueue(F &&f, Args &&...args)
     // 通知一个等待的线程
     condition_.notify_one();
     return res;
-}
\ No newline at end of file
+}
+
+template <class F>
+void ThreadPool::parallelFor(size_t count, size_t grain, F &&body)
+{
+    grain = std::max(grain, size_t(1));
+    const size_t chunks = (count + grain - 1) / grain;
+    if (chunks <= 1)
+    {
+        if (count > 0)
+        {
+            body(size_t(0), count);
+        }
+        return;
+    }
+
+    struct State
+    {
+        std::atomic<size_t> next{0};     // 下一个待领取的段
+        std::atomic<size_t> finished{0}; // 已执行完的段数
+        std::mutex mutex;
+        std::condition_variable done;
+    };
+    auto state = std::make_shared<State>();
+    auto *fn = &body;
+
+    // 领取段直到全部领完;领不到段的线程不再访问body,调用方返回后迟到的工作线程也是安全的
+    auto run = [state, fn, count, grain, chunks]()
+    {
+        size_t ran = 0;
+        size_t chunk;
+        while ((chunk = state->next.fetch_add(1)) < chunks)
+        {
+            size_t begin = chunk * grain;
+            (*fn)(begin, std::min(begin + grain, count));
+            ++ran;
+        }
+        if (ran > 0 && state->finished.fetch_add(ran) + ran == chunks)
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->done.notify_all();
+        }
+    };
+
+    size_t helpers = std::min(chunks - 1, threads_.size());
+    for (size_t i = 0; i < helpers && !stop_; ++i)
+    {
+        try
+        {
+            enqueue(run);
+        }
+        catch (const std::runtime_error &)
+        {
+            break; // 线程池正在关闭,剩余的段由调用线程执行
+        }
+    }
+
+    run();
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&state, chunks]
+                     { return state->finished.load() == chunks; });
+}
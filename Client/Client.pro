@@ -12,11 +12,15 @@ CONFIG += c++17
 SOURCES += \
     log_in.cpp \
     main.cpp \
-    client_widget.cpp
+    client_widget.cpp \
+    file_codec.cpp \
+    wire_codec.cpp
 
 HEADERS += \
     client_widget.h \
-    log_in.h
+    file_codec.h \
+    log_in.h \
+    wire_codec.h
 
 FORMS += \
     client_widget.ui \
@@ -28,10 +32,17 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 !isEmpty(target.path): INSTALLS += target
 
 INCLUDEPATH += C:/OpenSSL-Win64/include
+# 与服务器共用的协议头文件(如XXHash64.hpp)
+INCLUDEPATH += $$PWD/../ChatServer
 
 LIBS += "C:/OpenSSL-Win64/lib/VC/x64/MD/libssl.lib"
 LIBS += "C:/OpenSSL-Win64/lib/VC/x64/MD/libcrypto.lib"
 
+# 文件分片压缩(vcpkg安装的lz4和zstd)
+INCLUDEPATH += C:/vcpkg/installed/x64-windows/include
+LIBS += "C:/vcpkg/installed/x64-windows/lib/lz4.lib"
+LIBS += "C:/vcpkg/installed/x64-windows/lib/zstd.lib"
+
 DISTFILES += \
     public.pem
 
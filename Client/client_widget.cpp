@@ -6,10 +6,21 @@
 #include <QProgressBar>
 #include <QLabel>
 #include <QFileInfo>
-
-client_widget::client_widget(QWidget *parent, QTcpSocket* Tcpsocket)
+#include <QTemporaryFile>
+#include <QCryptographicHash>
+#include "file_codec.h"
+#include "wire_codec.h"
+#include "protocol/XXHash64.hpp"
+
+// 1MB分片效率更高:现代网络的TCP窗口通常在64KB-1MB范围,1MB能充分利用TCP窗口
+static const int OPTIMAL_CHUNK_SIZE = 1024 * 1024;
+// socket待发送数据超过该值时暂停文件发送,等bytesWritten信号再继续
+static const qint64 SEND_HIGH_WATER = OPTIMAL_CHUNK_SIZE * 2;
+
+client_widget::client_widget(QWidget *parent, QTcpSocket* Tcpsocket, WireCodec* codec)
     : QWidget(parent)
     , tcpsocket(Tcpsocket)
+    , wire_codec(codec)
     , ui(new Ui::client_widget)
 {
     ui->setupUi(this);
@@ -25,6 +36,14 @@ client_widget::client_widget(QWidget *parent, QTcpSocket* Tcpsocket)
     // 设置定时器为“单次触发”模式，触发一次后自动停止，不会重复自己再次启动开始计时
     file_timeout_timer->setInterval(30000); // 30秒超时
     connect(file_timeout_timer, &QTimer::timeout, this, &client_widget::onFileTransferTimeout);
+
+    // 设置socket发送缓冲区为四分片,发送缓冲区有空间时继续推送文件分片
+    tcpsocket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, OPTIMAL_CHUNK_SIZE * 4);
+    connect(tcpsocket, &QTcpSocket::bytesWritten, this, [this]()
+    {
+        if (!outgoing_files.isEmpty())
+            pumpFileStreams();
+    });
 }
 
 // 保证样式表（QSS）正常生效
@@ -38,18 +57,31 @@ void client_widget::paintEvent(QPaintEvent *)
 
 client_widget::~client_widget()
 {
-    resetFileTransferState();
+    // 面板控件随父对象销毁,这里只释放文件流状态和打开的文件
+    for (FileTransferState* state : outgoing_files)
+    {
+        delete state->file;
+        delete state;
+    }
+    for (FileTransferState* state : incoming_files)
+    {
+        delete state->file;
+        delete state;
+    }
     delete ui;
 }
 
 void client_widget::initialize(const QString& username)
 {
-    MSG_header header;
-    header.Type = JOIN;
-    header.length = 0;
-    std::strncpy(header.sender_name, username.toUtf8().constData(), sizeof(header.sender_name));
+    // v2下在JOIN之前发送RESUME,此后收到的聊天室消息带序号;重连时从上次收到的序号继续补发
+    if (wire_codec->version() >= WIRE_VERSION_V2)
+    {
+        quint64 last_sequence = wire_codec->lastSequence();
+        tcpsocket->write(wire_codec->encode(RESUME, username,
+                                            QByteArray(reinterpret_cast<const char*>(&last_sequence), sizeof(last_sequence))));
+    }
 
-    qint64 bytesWritten = tcpsocket->write(reinterpret_cast<const char*>(&header), sizeof(header));
+    qint64 bytesWritten = tcpsocket->write(wire_codec->encode(JOIN, username, QByteArray()));
     if (bytesWritten == -1)
     {
         QMessageBox::critical(this, tr("错误"), tr("JOIN发送失败: %1").arg(tcpsocket->errorString()));
@@ -76,169 +108,232 @@ void client_widget::sendMsg()
     QString msg = ui->sender_edit->text();
     if (msg.isEmpty()) return;
 
-    MSG_header header;
-    std::strncpy(header.sender_name, user_name.toUtf8().constData(), sizeof(header.sender_name));
-    header.Type = GROUP_MSG;
-    header.length = msg.toUtf8().size();
+    // 私聊命令:"/msg 用户名 内容"
+    if (msg.startsWith("/msg "))
+    {
+        QString rest = msg.mid(5).trimmed();
+        int space = rest.indexOf(' ');
+        if (space <= 0) return;
+        QString target = rest.left(space);
+        QByteArray text = rest.mid(space + 1).toUtf8();
+
+        DirectInfo info{};
+        std::strncpy(info.target_name, target.toUtf8().constData(), sizeof(info.target_name) - 1);
+        QByteArray body(reinterpret_cast<const char*>(&info), sizeof(info));
+        body.append(text);
+        writeMessage(DIRECT_MSG, body);
+
+        ui->sender_edit->clear();
+        ui->textBrowser->append(QString("[私聊 -> %1] %2: %3").arg(target, user_name, QString::fromUtf8(text)));
+        return;
+    }
+
+    // 聊天室命令:"/join 名称"切换聊天室,"/leave"回到大厅,"/rooms"查询聊天室列表
+    if (msg.startsWith("/join "))
+    {
+        writeMessage(ROOM_JOIN, msg.mid(6).trimmed().toUtf8());
+        ui->sender_edit->clear();
+        return;
+    }
+    if (msg == "/leave" || msg == "/rooms")
+    {
+        writeMessage(msg == "/leave" ? ROOM_LEAVE : ROOM_LIST, QByteArray());
+        ui->sender_edit->clear();
+        return;
+    }
 
-    QByteArray data;
-    data.append(reinterpret_cast<const char*>(&header), sizeof(header));
-    data.append(msg.toUtf8());
-    tcpsocket->write(data);
+    writeMessage(GROUP_MSG, msg.toUtf8());
 
     ui->sender_edit->clear();
     ui->textBrowser->append(user_name + ": " + msg);
 }
 
+void client_widget::writeMessage(MSG_type type, const QByteArray& body)
+{
+    tcpsocket->write(wire_codec->encode(type, user_name, body));
+}
+
 void client_widget::sendFile()
 {
-    if (file_state.is_sending)
+    // 支持一次选择多个文件,每个文件一个文件流,交错发送
+    QStringList file_paths = QFileDialog::getOpenFileNames(this, tr("选择文件"), "", tr("所有文件 (*)"));
+    for (const QString& file_path : file_paths)
     {
-        QMessageBox::information(this, tr("提示"), tr("正在发送文件，请等待完成"));
-        return;
+        startFileUpload(file_path);
     }
+}
 
-    QString file_path = QFileDialog::getOpenFileName(this, tr("选择文件"), "", tr("所有文件 (*)"));
-    if (file_path.isEmpty()) return;
-
-    QFile file(file_path);
-    if (!file.open(QIODevice::ReadOnly))
+void client_widget::startFileUpload(const QString& file_path)
+{
+    QFile* file = new QFile(file_path);
+    if (!file->open(QIODevice::ReadOnly))
     {
-        QMessageBox::critical(this, tr("错误"), tr("无法打开文件: %1").arg(file.errorString()));
+        QMessageBox::critical(this, tr("错误"), tr("无法打开文件: %1").arg(file->errorString()));
+        delete file;
         return;
     }
 
-    QFileInfo file_info(file_path);
-    QString filename = file_info.fileName();
+    QString filename = QFileInfo(file_path).fileName();
+
+    // 发送前计算整文件哈希,服务器已有同一文件时可以跳过上传
+    QByteArray digest;
+    quint64 content_hash = hashFile(*file, digest);
+    // 日志、CSV、源码包等文本类文件压缩后再发送,已压缩的文件原样发送
+    quint32 codec = FileCodec::chooseCodec(*file);
+
+    FileTransferState* state = new FileTransferState;
+    state->stream_id = next_stream_id++;
+    state->is_sending = true;
+    state->awaiting_accept = true; // 等待服务器回复后再决定是否上传
+    state->filename = file_path;
+    state->sender_name = user_name;
+    state->total_size = file->size();
+    state->file = file;
+    state->codec = codec;
+    outgoing_files.insert(state->stream_id, state);
 
     // 发送文件开始消息
-    MSG_header header;
     // std::strncpy 会拷贝字符串直到遇到 '\0' 或达到最大长度，如果拷贝的字符串长度小于目标缓冲区，会用 '\0' 填充剩余空间
-    // 保证目标缓冲区以 '\0' 结尾（只要源字符串长度不超过缓冲区大小）。
-    // std::memcpy 是按字节复制固定大小数据，不会自动添加 '\0'，不会检查字符串结束符。
-    std::strncpy(header.sender_name, user_name.toUtf8().constData(), sizeof(header.sender_name));
-    header.Type = FILE_MSG;
-    header.length = sizeof(FileInfo);
-
-    FileInfo file_info_struct;
-    std::strncpy(file_info_struct.filename, filename.toUtf8().constData(), sizeof(file_info_struct.filename));
-    file_info_struct.file_size = file.size();
-
-    QByteArray start_data;
-    start_data.append(reinterpret_cast<const char*>(&header), sizeof(header));
-    start_data.append(reinterpret_cast<const char*>(&file_info_struct), sizeof(FileInfo));
-    tcpsocket->write(start_data);
-
-    // 初始化发送状态
-    file_state.is_sending = true;
-    file_state.filename = file_path;
-    file_state.total_size = file.size();
-    file_state.sent_bytes = 0;
-
-    showFileTransferDialog(QString("正在发送文件: %1").arg(filename));
-
+    FileInfo file_info_struct{};
+    std::strncpy(file_info_struct.filename, filename.toUtf8().constData(), sizeof(file_info_struct.filename) - 1);
+    file_info_struct.file_size = state->total_size;
+    file_info_struct.content_hash = content_hash;
+    file_info_struct.stream_id = state->stream_id;
+    file_info_struct.flags = FILE_FLAG_FLOW_CONTROL | codec;
+    // SHA-256摘要附在FileInfo之后,服务器按它去重,XXH64只用于接收方校验
+    QByteArray file_msg(reinterpret_cast<const char*>(&file_info_struct), schema::Message<FILE_MSG>::body_size);
+    file_msg.append(digest);
+    writeMessage(FILE_MSG, file_msg);
+
+    addTransferRow(state, QString("正在发送文件: %1").arg(filename));
     ui->textBrowser->append(QString("开始发送文件: %1").arg(filename));
-
-    // 开始分块传输
-    chunkedFileTransfer(file, filename);
 }
 
-
-void client_widget::chunkedFileTransfer(QFile& file, const QString& filename)
+quint64 client_widget::hashFile(QFile& file, QByteArray& digest)
 {
-    // 1. 优化分片大小 - 1MB效率更高
-    // 现代网络的TCP窗口通常在64KB-1MB范围，1MB能充分利用TCP窗口
-    // 以太网MTU是1500字节，1MB分片会被TCP自动分解成合适的网络包
-    const int OPTIMAL_CHUNK_SIZE = 1024 * 1024; // 1MB
-    // const int OPTIMAL_CHUNK_SIZE = 200 * 1024;
-
-    // 2. 设置socket缓冲区优化为四分片
-    tcpsocket->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, OPTIMAL_CHUNK_SIZE * 4);
-
-    // 3. 预分配数据包内存，避免频繁分配
-    QByteArray data_packet;
-    data_packet.reserve(sizeof(MSG_header) + OPTIMAL_CHUNK_SIZE);
-
-    // 4. 批量事件处理，减少processEvents调用
-    int chunk_counter = 0;
-    const int EVENT_PROCESS_INTERVAL = 8; // 每8个分片处理一次事件
-
-    file_state.abort = false; // 启动传输前初始化
-
-    // file close掉后,file.atEnd()返回true,跳出循环
+    XXHash64 hasher;
+    QCryptographicHash sha256(QCryptographicHash::Sha256);
     while (!file.atEnd())
     {
-        if (file_state.abort) // 检测是否用户取消
-        {
-            ui->textBrowser->append("用户取消了文件发送");
-            file.close();
-            resetFileTransferState();
-            return;
-        }
-
-        // 读取分片大小
         QByteArray chunk = file.read(OPTIMAL_CHUNK_SIZE);
         if (chunk.isEmpty()) break;
+        hasher.update(chunk.constData(), chunk.size());
+        sha256.addData(chunk);
+    }
+    file.seek(0);
+    digest = sha256.result();
+    return hasher.digest();
+}
 
-        // 构造包头
-        MSG_header data_header;
-        std::strncpy(data_header.sender_name, user_name.toUtf8().constData(), sizeof(data_header.sender_name));
-        data_header.Type = FILE_DATA;
-        data_header.length = chunk.size();
+void client_widget::handleFileAccept(quint32 stream_id)
+{
+    FileTransferState* state = outgoing_files.value(stream_id);
+    if (!state || !state->awaiting_accept)
+    {
+        return;
+    }
+    state->awaiting_accept = false;
 
-        // 重用数据包内存
-        data_packet.clear();
-        data_packet.append(reinterpret_cast<const char*>(&data_header), sizeof(data_header));
-        data_packet.append(chunk);
+    // 开始分块传输,由pumpFileStreams在事件循环中推送
+    if (!pump_scheduled)
+    {
+        pump_scheduled = true;
+        QTimer::singleShot(0, this, &client_widget::pumpFileStreams);
+    }
+}
 
-        qint64 bytes_written = tcpsocket->write(data_packet);
-        if (bytes_written == -1)
-        {
-            QMessageBox::critical(this, tr("错误"), tr("文件发送失败: %1").arg(tcpsocket->errorString()));
-            file.close();
-            resetFileTransferState();
-            return;
-        }
+void client_widget::handleFileExists(quint32 stream_id)
+{
+    FileTransferState* state = outgoing_files.value(stream_id);
+    if (!state || !state->awaiting_accept)
+    {
+        return;
+    }
 
-        file_state.sent_bytes += chunk.size();
+    // 服务器已用已有副本完成下发,本地无需上传
+    ui->textBrowser->append(QString("文件发送完成(服务器已有该文件，秒传): %1")
+                                .arg(QFileInfo(state->filename).fileName()));
+    removeTransfer(state);
+}
 
-        // 流控：防止socket缓冲区过满
-        if (tcpsocket->bytesToWrite() > OPTIMAL_CHUNK_SIZE * 2)
-        {
-            tcpsocket->waitForBytesWritten(50); // 等待50ms让数据发送出去
-        }
+void client_widget::handleFileCredit(quint32 stream_id, quint64 credit_bytes)
+{
+    FileTransferState* state = outgoing_files.value(stream_id);
+    if (!state)
+    {
+        return; // 文件流已结束,额度作废
+    }
+    state->credit += credit_bytes;
 
-        // 批量处理事件，减少UI卡顿
-        if (++chunk_counter >= EVENT_PROCESS_INTERVAL)
-        {
-            updateFileProgress();
-            QCoreApplication::processEvents();
-            chunk_counter = 0;
-        }
+    if (!state->awaiting_accept && !pump_scheduled)
+    {
+        pump_scheduled = true;
+        QTimer::singleShot(0, this, &client_widget::pumpFileStreams);
     }
+}
 
-    // 发送完成后最终更新进度
-    updateFileProgress();
+void client_widget::pumpFileStreams()
+{
+    pump_scheduled = false;
 
-    // 发送文件结束消息
-    MSG_header end_header;
-    std::strncpy(end_header.sender_name, user_name.toUtf8().constData(), sizeof(end_header.sender_name));
-    end_header.Type = FILE_END;
-    end_header.length = 0;
-    tcpsocket->write(reinterpret_cast<const char*>(&end_header), sizeof(end_header));
+    // 轮询所有已获准上传的文件流,每轮每个流发送一个分片,多个文件交错发送
+    // 流控：socket待发送数据超过高水位时返回事件循环,等bytesWritten信号再继续,避免界面卡顿
+    // 每个流还受服务器授予的额度限制,额度用完后等FILE_CREDIT到达再继续,接收方慢时不会把数据堆积在服务器
+    bool progressed = true;
+    while (progressed && tcpsocket->bytesToWrite() < SEND_HIGH_WATER)
+    {
+        progressed = false;
+        const QList<quint32> stream_ids = outgoing_files.keys();
+        for (quint32 stream_id : stream_ids)
+        {
+            FileTransferState* state = outgoing_files.value(stream_id);
+            if (!state || state->awaiting_accept)
+                continue;
+
+            // 额度按线上字节计算,压缩分片最坏情况是原样存放再加一个分片头
+            quint64 overhead = state->codec ? sizeof(FileChunkHeader) : 0;
+            quint64 budget = state->credit > overhead ? state->credit - overhead : 0;
+            if (budget == 0 && !state->file->atEnd())
+                continue;
+
+            FileStreamHeader stream_header{stream_id};
+            QByteArray chunk = state->file->read(qMin<quint64>(OPTIMAL_CHUNK_SIZE, budget));
+            if (!chunk.isEmpty())
+            {
+                QByteArray payload = state->codec ? FileCodec::encodeChunk(state->codec, chunk) : chunk;
+                QByteArray body;
+                body.reserve(sizeof(stream_header) + payload.size());
+                body.append(reinterpret_cast<const char*>(&stream_header), sizeof(stream_header));
+                body.append(payload);
+                writeMessage(FILE_DATA, body);
+
+                state->transferred_bytes += chunk.size();
+                state->credit -= payload.size();
+                updateFileProgress(state);
+                progressed = true;
+            }
 
-    file.close();
+            if (chunk.isEmpty() || state->file->atEnd())
+            {
+                // 发送文件结束消息
+                writeMessage(FILE_END, QByteArray(reinterpret_cast<const char*>(&stream_header), sizeof(stream_header)));
+                ui->textBrowser->append(QString("文件发送完成: %1").arg(QFileInfo(state->filename).fileName()));
+                removeTransfer(state);
+            }
 
-    if (file_state.abort)
-    {
-        ui->textBrowser->append("用户取消了文件发送");
-    } else
-    {
-        ui->textBrowser->append(QString("文件发送完成: %1").arg(filename));
-        QMessageBox::information(this, tr("成功"), tr("文件发送完成!"));
+            if (tcpsocket->bytesToWrite() >= SEND_HIGH_WATER)
+                break;
+        }
     }
+}
 
-    resetFileTransferState();
+void client_widget::cancelFileUpload(FileTransferState* state)
+{
+    // 提前发送FILE_END,接收方据字节数判断文件不完整
+    FileStreamHeader stream_header{state->stream_id};
+    writeMessage(FILE_END, QByteArray(reinterpret_cast<const char*>(&stream_header), sizeof(stream_header)));
+    ui->textBrowser->append(QString("用户取消了文件发送: %1").arg(QFileInfo(state->filename).fileName()));
+    removeTransfer(state);
 }
 
 
@@ -264,33 +359,20 @@ void client_widget::readMsg()
 
     // qDebug() << "readMsg读取数据大小为" << msg_buffer.buffer.size();
 
-    while (true)
+    // 先从缓冲区取出整条消息再派发:派发过程中若有弹窗等嵌套事件循环重入readMsg,解析状态仍然正确
+    MSG_header header;
+    QByteArray body;
+    while (wire_codec->decode(msg_buffer.buffer, header, body))
     {
-        if (msg_buffer.state == ReadState::ReadingHeader)
-        {
-            if (msg_buffer.buffer.size() < static_cast<int>(sizeof(MSG_header)))
-                return; // 等待更多数据
-
-            memcpy(&msg_buffer.current_header, msg_buffer.buffer.constData(), sizeof(MSG_header));
-            msg_buffer.buffer.remove(0, sizeof(MSG_header));
-            msg_buffer.state = ReadState::ReadingBody;
-        }
-
-        if (msg_buffer.state == ReadState::ReadingBody)
-        {
-            int body_len = msg_buffer.current_header.length;
-            if (msg_buffer.buffer.size() < body_len)
-                return; // 等待更多数据
-
-            QByteArray body = msg_buffer.buffer.left(body_len);// left用来从字节数组的开头截取指定长度的子数组
-            msg_buffer.buffer.remove(0, body_len);
-
-            // 当解析出一个完整的包之后进行派发消息
-            dispatchMessage(msg_buffer.current_header, body);
+        // 当解析出一个完整的包之后进行派发消息
+        dispatchMessage(header, body);
+    }
 
-            // 回到读取下一个 header 状态
-            msg_buffer.state = ReadState::ReadingHeader;
-        }
+    // 累积确认收到的聊天室序号,每次读取最多发送一次;切换聊天室后序号重新开始,不能只比较大小
+    if (wire_codec->lastSequence() != acked_sequence)
+    {
+        acked_sequence = wire_codec->lastSequence();
+        writeMessage(ACK, QByteArray(reinterpret_cast<const char*>(&acked_sequence), sizeof(acked_sequence)));
     }
 }
 
@@ -338,7 +420,8 @@ void client_widget::dispatchMessage(const MSG_header& header, const QByteArray&
     case FILE_MSG:
     {
         FileInfo file_info;
-        memcpy(&file_info, body.constData(), sizeof(FileInfo));
+        if (!schema::decode<FILE_MSG>(body.constData(), body.size(), file_info))
+            break;
         handleFileMsg(header, file_info);
         break;
     }
@@ -349,9 +432,100 @@ void client_widget::dispatchMessage(const MSG_header& header, const QByteArray&
     }
     case FILE_END:
     {
-        handleFileEnd(header);
+        handleFileEnd(header, body);
+        break;
+    }
+    case FILE_ACCEPT:
+    case FILE_EXISTS:
+    {
+        // FILE_ACCEPT与FILE_EXISTS布局相同
+        FileStreamHeader stream_header;
+        if (!schema::decode<FILE_ACCEPT>(body.constData(), body.size(), stream_header))
+            break;
+        if (header.Type == FILE_ACCEPT)
+            handleFileAccept(stream_header.stream_id);
+        else
+            handleFileExists(stream_header.stream_id);
         break;
     }
+    case FILE_CREDIT:
+    {
+        FileCreditInfo credit_info;
+        if (!schema::decode<FILE_CREDIT>(body.constData(), body.size(), credit_info))
+            break;
+        handleFileCredit(credit_info.stream_id, credit_info.credit_bytes);
+        break;
+    }
+    case BATCH:
+    {
+        // 逐条派发子消息,子消息的发送者即BATCH帧的发送者
+        MSG_header item_header = header;
+        schema::forEachBatchItem(body.constData(), static_cast<size_t>(body.size()),
+                                 [this, &item_header](MSG_type type, const char* data, size_t size)
+                                 {
+                                     if (type == BATCH)
+                                         return false; // 不允许嵌套
+                                     item_header.Type = type;
+                                     item_header.length = size;
+                                     dispatchMessage(item_header, QByteArray(data, static_cast<int>(size)));
+                                     return true;
+                                 });
+        break;
+    }
+    case PING:
+        // 服务器心跳,原样回复;长时间不回复的连接会被服务器关闭
+        writeMessage(PONG, body);
+        break;
+    case ROOM_JOIN:
+    {
+        // 服务器确认当前所在的聊天室,成员列表随后以INITIAL发来
+        QString room = QString::fromUtf8(body);
+        ui->textBrowser->append(QString("%1: %2 %3").arg("SERVER", "已进入聊天室", room));
+        ui->Now_user->setText(QString("当前在线用户:%1 [%2]").arg(user_name, room));
+        break;
+    }
+    case DIRECT_MSG:
+    {
+        DirectInfo info;
+        const char* text = nullptr;
+        size_t text_size = 0;
+        if (!schema::decode<DIRECT_MSG>(body.constData(), body.size(), info, &text, &text_size))
+            break;
+        ui->textBrowser->append(QString("[私聊] %1: %2").arg(header.sender_name,
+                                                             QString::fromUtf8(text, static_cast<int>(text_size))));
+        break;
+    }
+    case DIRECT_FAILED:
+    {
+        DirectInfo info;
+        if (!schema::decode<DIRECT_FAILED>(body.constData(), body.size(), info))
+            break;
+        QString target = QString::fromUtf8(info.target_name, static_cast<int>(strnlen(info.target_name, sizeof(info.target_name))));
+        ui->textBrowser->append(QString("%1: %2 %3").arg("SERVER", target, "不在线,私聊未送达."));
+        break;
+    }
+    case JOIN_failed:
+    {
+        // 用户名为空或已有同名用户在线,服务器未登记本连接
+        QMessageBox::warning(this, tr("登录失败"), tr("服务器拒绝加入聊天室: %1").arg(QString::fromUtf8(body)));
+        ui->textBrowser->append(QString("%1: %2").arg("SERVER", "加入聊天室失败: " + QString::fromUtf8(body)));
+        break;
+    }
+    case ROOM_LIST:
+    {
+        QStringList rooms = QString::fromUtf8(body).split(',', Qt::SkipEmptyParts);
+        ui->textBrowser->append(QString("%1: %2 %3").arg("SERVER", "聊天室列表(名称:人数)", rooms.join(' ')));
+        break;
+    }
+    case PONG:
+    case ACK:
+    case RESUME:
+    case ROOM_LEAVE:
+        // 序号由WireCodec记录
+        break;
+    case ROSTER:
+        // ROSTER的中间分页:WireCodec已合并到用户表,最后一页到达时转换为INITIAL
+        break;
     default:
     {
         qDebug() << "未知的消息类型";
@@ -360,222 +534,295 @@ void client_widget::dispatchMessage(const MSG_header& header, const QByteArray&
     }
 }
 
+QString client_widget::incomingKey(const QString& sender, quint32 stream_id)
+{
+    return sender + "#" + QString::number(stream_id);
+}
+
 void client_widget::handleFileMsg(const MSG_header& header, const FileInfo& file_info)
 {
-    // 如果正在传输文件，先重置状态
-    if (file_state.is_receiving || file_state.is_sending)
+    QString sender = QString::fromUtf8(header.sender_name);
+    QString key = incomingKey(sender, file_info.stream_id);
+
+    // 同一文件流重新开始,丢弃之前未完成的部分
+    if (FileTransferState* old_state = incoming_files.value(key))
     {
-        resetFileTransferState();
+        removeTransfer(old_state);
     }
 
-    // 弹出询问对话框，是否接收文件
-    QMessageBox::StandardButton reply = QMessageBox::question(
-        this,
-        "文件接收",
-        tr("%1 向您发送文件 \"%2\" (大小: %3 字节)\n是否接收？")
-            .arg(header.sender_name)
-            .arg(file_info.filename)
-            .arg(file_info.file_size),
-        QMessageBox::Yes | QMessageBox::No
-        );
-
-    if (reply == QMessageBox::No)
+    // 在用户决定是否接收之前先写入临时文件,避免询问期间到达的数据丢失
+    QTemporaryFile* temp_file = new QTemporaryFile;
+    if (!temp_file->open())
     {
+        QMessageBox::critical(this, tr("错误"), tr("无法创建临时文件: %1").arg(temp_file->errorString()));
+        delete temp_file;
         return;
     }
 
-    // 选择保存路径
-    QString save_path = QFileDialog::getSaveFileName(
-        this,
-        "保存文件",
-        file_info.filename,
-        "所有文件 (*)"
-        );
+    FileTransferState* state = new FileTransferState;
+    state->stream_id = file_info.stream_id;
+    state->filename = QString::fromUtf8(file_info.filename);
+    state->sender_name = sender;
+    state->total_size = file_info.file_size;
+    state->file = temp_file;
+    state->codec = file_info.flags & FILE_FLAG_COMPRESSION_MASK;
+    state->content_hash = file_info.content_hash;
+    incoming_files.insert(key, state);
 
-    if (save_path.isEmpty()) return;
+    addTransferRow(state, tr("正在接收 %1 的文件: %2").arg(sender, state->filename));
 
-    // 初始化接收状态
-    file_state.is_receiving = true;
-    file_state.filename = save_path;
-    file_state.sender_name = header.sender_name;
-    file_state.total_size = file_info.file_size;
-    file_state.received_bytes = 0;
+    // 启动超时定时器
+    file_timeout_timer->start();
 
-    file_state.file = new QFile(save_path);
-    if (!file_state.file->open(QIODevice::WriteOnly))
+    ui->textBrowser->append(QString("开始接收来自 %1 的文件: %2").arg(sender, state->filename));
+
+    // 非模态询问是否接收文件,不在消息派发过程中嵌套事件循环
+    QMessageBox* box = new QMessageBox(QMessageBox::Question, "文件接收",
+                                       tr("%1 向您发送文件 \"%2\" (大小: %3 字节)\n是否接收？")
+                                           .arg(sender)
+                                           .arg(state->filename)
+                                           .arg(state->total_size),
+                                       QMessageBox::Yes | QMessageBox::No, this);
+    box->setAttribute(Qt::WA_DeleteOnClose);
+    connect(box, &QMessageBox::finished, this, [this, key](int result)
     {
-        QMessageBox::critical(this, tr("错误"), tr("无法创建文件: %1").arg(file_state.file->errorString()));
-        resetFileTransferState();
-        return;
-    }
+        FileTransferState* state = incoming_files.value(key);
+        if (!state) return; // 传输已超时或被取消
 
-    // 显示进度对话框
-    showFileTransferDialog(tr("正在接收文件: %1").arg(QFileInfo(save_path).fileName()));
+        if (result != QMessageBox::Yes)
+        {
+            removeTransfer(state);
+            return;
+        }
 
-    // 启动超时定时器
-    file_timeout_timer->start();
+        // 选择保存路径
+        QString save_path = QFileDialog::getSaveFileName(this, "保存文件", state->filename, "所有文件 (*)");
+
+        // 保存对话框期间文件流可能已被移除,重新查找
+        state = incoming_files.value(key);
+        if (!state) return;
+
+        if (save_path.isEmpty())
+        {
+            removeTransfer(state);
+            return;
+        }
 
-    ui->textBrowser->append(QString("开始接收来自 %1 的文件: %2")
-                                .arg(header.sender_name)
-                                .arg(file_info.filename));
+        state->save_path = save_path;
+        if (state->finished)
+        {
+            finishIncomingFile(state);
+        }
+    });
+    box->open();
 }
 
-void client_widget::handleFileData(const MSG_header& header, const QByteArray& data)
+void client_widget::handleFileData(const MSG_header& header, const QByteArray& body)
 {
-    if (!file_state.is_receiving || !file_state.file)
+    FileStreamHeader stream_header;
+    const char* data = nullptr;
+    size_t data_size = 0;
+    if (!schema::decode<FILE_DATA>(body.constData(), body.size(), stream_header, &data, &data_size))
     {
         return;
     }
 
-    // 写入文件数据
-    qint64 written = file_state.file->write(data);
-    if (written != data.size())
+    // 未知的文件流(已拒绝、已取消或已超时)直接丢弃
+    FileTransferState* state = incoming_files.value(incomingKey(QString::fromUtf8(header.sender_name), stream_header.stream_id));
+    if (!state || state->finished)
     {
-        QMessageBox::critical(this, tr("错误"), tr("写入文件失败"));
-        resetFileTransferState();
         return;
     }
 
-    // 更新接收字节数
-    file_state.received_bytes += written;
-    file_state.chunks_received++;
+    // 压缩流先解压分片
+    QByteArray raw;
+    if (state->codec)
+    {
+        if (!FileCodec::decodeChunk(state->codec, data, static_cast<qint64>(data_size), raw))
+        {
+            QMessageBox::critical(this, tr("错误"), tr("文件数据解压失败: %1").arg(state->filename));
+            removeTransfer(state);
+            return;
+        }
+        data = raw.constData();
+        data_size = static_cast<size_t>(raw.size());
+    }
 
-    // 减少UI更新频率 - 每16个分片更新一次
-    if (file_state.chunks_received >= 16 ||
-        file_state.received_bytes >= file_state.total_size)
+    // 写入文件数据
+    qint64 written = state->file->write(data, static_cast<qint64>(data_size));
+    if (written != static_cast<qint64>(data_size))
     {
-        updateFileProgress();
-        file_state.chunks_received = 0;
+        QMessageBox::critical(this, tr("错误"), tr("写入文件失败"));
+        removeTransfer(state);
+        return;
+    }
 
-        // 批量刷新文件缓冲区
-        file_state.file->flush();
-        // 调用 flush() 可确保所有缓冲区中的内容立即写入文件
+    state->hasher.update(data, data_size);
 
-        QCoreApplication::processEvents();
-    }
+    // 更新接收字节数
+    state->transferred_bytes += written;
+    updateFileProgress(state);
 
     // 重置超时计时器
     file_timeout_timer->start();
 }
 
-void client_widget::handleFileEnd(const MSG_header& header)
+void client_widget::handleFileEnd(const MSG_header& header, const QByteArray& body)
 {
-    if (!file_state.is_receiving)
+    FileStreamHeader stream_header;
+    if (!schema::decode<FILE_END>(body.constData(), body.size(), stream_header))
     {
         return;
     }
 
-    // 检查文件大小是否匹配
-    if (file_state.received_bytes == file_state.total_size)
+    FileTransferState* state = incoming_files.value(incomingKey(QString::fromUtf8(header.sender_name), stream_header.stream_id));
+    if (!state)
     {
-        ui->textBrowser->append(QString("文件接收完成: %1 (%2 字节)")
-                                    .arg(QFileInfo(file_state.filename).fileName())
-                                    .arg(file_state.received_bytes));
-        QMessageBox::information(this, tr("成功"), tr("文件接收完成!"));
+        return;
     }
-    else
+
+    state->finished = true;
+    if (state->save_path.isEmpty())
     {
-        ui->textBrowser->append(QString("文件接收不完整: 期望 %1 字节，实际接收 %2 字节")
-                                    .arg(file_state.total_size)
-                                    .arg(file_state.received_bytes));
-        QMessageBox::warning(this, tr("警告"), tr("文件接收不完整"));
+        // 用户还没选择保存位置,等选择后再完成
+        state->status_label->setText(QString("%1 (等待选择保存位置)").arg(state->filename));
+        return;
     }
-
-    resetFileTransferState();
+    finishIncomingFile(state);
 }
 
-void client_widget::resetFileTransferState()
+void client_widget::finishIncomingFile(FileTransferState* state)
 {
-    file_state.abort = true; // 置为 true，通知发送方中断
+    QTemporaryFile* temp_file = static_cast<QTemporaryFile*>(state->file);
+    temp_file->flush();
 
-    if (file_state.file)
+    // 检查文件大小和内容哈希是否匹配
+    // 服务器边收边转发大数据块时,发送方中途断开会以0补齐该数据块,只有哈希校验能发现
+    bool hash_ok = state->content_hash == 0 || state->hasher.digest() == state->content_hash;
+    if (state->transferred_bytes == state->total_size && hash_ok)
     {
-        file_state.file->close();
-        delete file_state.file;
-        file_state.file = nullptr;
-        file_state.chunks_received = 0;
+        // 临时文件移动到用户选择的保存位置
+        QFile::remove(state->save_path);
+        temp_file->setAutoRemove(false);
+        temp_file->close();
+        if (!QFile::rename(temp_file->fileName(), state->save_path))
+        {
+            QFile::remove(temp_file->fileName());
+            QMessageBox::critical(this, tr("错误"), tr("无法保存文件: %1").arg(state->save_path));
+        }
+        else
+        {
+            ui->textBrowser->append(QString("文件接收完成: %1 (%2 字节)")
+                                        .arg(QFileInfo(state->save_path).fileName())
+                                        .arg(state->transferred_bytes));
+        }
+    }
+    else if (state->transferred_bytes == state->total_size)
+    {
+        ui->textBrowser->append(QString("文件接收损坏: %1, 内容哈希校验失败").arg(state->filename));
+    }
+    else
+    {
+        ui->textBrowser->append(QString("文件接收不完整: %1, 期望 %2 字节，实际接收 %3 字节")
+                                    .arg(state->filename)
+                                    .arg(state->total_size)
+                                    .arg(state->transferred_bytes));
     }
 
-    file_state.is_receiving = false;
-    file_state.is_sending = false;
-    file_state.filename.clear();
-    file_state.sender_name.clear();
-    file_state.total_size = 0;
-    file_state.received_bytes = 0;
-    file_state.sent_bytes = 0;
-
-    file_timeout_timer->stop();
-    // 该函数处理UI资源
-    hideFileTransferDialog();
-}
-
-void client_widget::updateFileProgress()
-{
-    if (!file_progress || !file_status) return;
-
-    size_t current_bytes = file_state.is_receiving ? file_state.received_bytes : file_state.sent_bytes;
-    int progress = (int)((double)current_bytes / file_state.total_size * 100);
-
-    file_progress->setValue(progress);
-    file_status->setText(QString("%1/%2 字节 (%3%)")
-                             .arg(current_bytes)
-                             .arg(file_state.total_size)
-                             .arg(progress));
+    removeTransfer(state);
 }
 
-void client_widget::showFileTransferDialog(const QString& message)
+void client_widget::addTransferRow(FileTransferState* state, const QString& title)
 {
-    if (file_dialog)
+    if (!file_dialog)
     {
-        // 如果文件传输对话框已存在,销毁掉
-        hideFileTransferDialog();
+        file_dialog = new QWidget(this);
+        file_dialog->setWindowFlags(Qt::Dialog | Qt::WindowTitleHint);
+        file_dialog->setWindowTitle("文件传输");
+        file_dialog->resize(360, 120);
+        file_dialog_layout = new QVBoxLayout(file_dialog);
     }
 
-    file_dialog = new QWidget(this);
-    file_dialog->setWindowFlags(Qt::Dialog | Qt::WindowTitleHint);
-    file_dialog->setWindowTitle("文件传输");
-    file_dialog->resize(300, 120);
-
-    QVBoxLayout* layout = new QVBoxLayout(file_dialog);
+    state->row = new QWidget(file_dialog);
+    QVBoxLayout* layout = new QVBoxLayout(state->row);
+    layout->setContentsMargins(0, 0, 0, 0);
 
-    file_status = new QLabel(message);
-    layout->addWidget(file_status);
+    state->status_label = new QLabel(title);
+    layout->addWidget(state->status_label);
 
-    file_progress = new QProgressBar();
-    file_progress->setRange(0, 100);
-    file_progress->setValue(0);
-    layout->addWidget(file_progress);
+    QHBoxLayout* bar_layout = new QHBoxLayout();
+    state->progress_bar = new QProgressBar();
+    state->progress_bar->setRange(0, 100);
+    state->progress_bar->setValue(0);
+    bar_layout->addWidget(state->progress_bar);
 
-    file_cancel_btn = new QPushButton("取消");
-    connect(file_cancel_btn, &QPushButton::clicked, [this]()
+    QPushButton* cancel_btn = new QPushButton("取消");
+    connect(cancel_btn, &QPushButton::clicked, this, [this, state]()
     {
-        resetFileTransferState();
+        // 按钮属于该行,行在removeTransfer中延迟销毁,此时state一定有效
+        if (state->is_sending)
+            cancelFileUpload(state);
+        else
+            removeTransfer(state);
     });
-    layout->addWidget(file_cancel_btn);
+    bar_layout->addWidget(cancel_btn);
+    layout->addLayout(bar_layout);
 
+    file_dialog_layout->addWidget(state->row);
     file_dialog->show();
 }
 
-void client_widget::hideFileTransferDialog()
+void client_widget::updateFileProgress(FileTransferState* state)
 {
-    // 处理UI资源
-    if (file_dialog)
-    {
-        file_dialog->close();
-        delete file_dialog;
-        file_dialog = nullptr;
-        file_progress = nullptr;
-        file_status = nullptr;
-        file_cancel_btn = nullptr;
-    }
+    if (!state->progress_bar) return;
+
+    int progress = state->total_size == 0 ? 100 : (int)((double)state->transferred_bytes / state->total_size * 100);
+    state->progress_bar->setValue(progress);
+    state->progress_bar->setFormat(QString("%1/%2 字节 (%3%)")
+                                       .arg(state->transferred_bytes)
+                                       .arg(state->total_size)
+                                       .arg(progress));
+}
+
+void client_widget::removeTransfer(FileTransferState* state)
+{
+    if (state->is_sending)
+        outgoing_files.remove(state->stream_id);
+    else
+        incoming_files.remove(incomingKey(state->sender_name, state->stream_id));
+
+    // QTemporaryFile析构时自动删除未移走的临时文件
+    delete state->file;
+
+    // 可能正处于该行取消按钮的信号中,延迟销毁
+    if (state->row)
+        state->row->deleteLater();
+    delete state;
+
+    hideFileTransferDialogIfIdle();
+}
+
+void client_widget::hideFileTransferDialogIfIdle()
+{
+    if (!file_dialog || !outgoing_files.isEmpty() || !incoming_files.isEmpty())
+        return;
+
+    file_timeout_timer->stop();
+    file_dialog->close();
+    file_dialog->deleteLater();
+    file_dialog = nullptr;
+    file_dialog_layout = nullptr;
 }
 
 void client_widget::onFileTransferTimeout()
 {
-    if (file_state.is_receiving)
+    // 超时期间没有任何文件数据到达,放弃所有未完成的接收
+    const QList<FileTransferState*> states = incoming_files.values();
+    for (FileTransferState* state : states)
     {
-        QMessageBox::warning(this, tr("超时"), tr("文件接收超时"));
-        ui->textBrowser->append("文件接收超时");
+        if (state->finished)
+            continue;
+        ui->textBrowser->append(QString("文件接收超时: %1").arg(state->filename));
+        removeTransfer(state);
     }
-    resetFileTransferState();
 }
@@ -13,9 +13,13 @@
 #include <QMessageBox>
 #include <QProgressBar>
 #include <QLabel>
-
-#define MAX_NAME 64
-#define MAX_FILENAME 256
+#include <QMap>
+#include <QHash>
+#include <QVBoxLayout>
+#include <cstdint>
+#include "protocol/MessageSchema.hpp"
+#include "protocol/WireFormat.hpp"
+#include "protocol/XXHash64.hpp"
 
 QT_BEGIN_NAMESPACE
 namespace Ui
@@ -24,65 +28,35 @@ class client_widget;
 }
 QT_END_NAMESPACE
 
-enum MSG_type
-{
-    REGISTER,
-    REGISTER_success,
-    REGISTER_failed,
-    LOGIN,
-    LOGIN_success,
-    LOGIN_failed,
-
-    INITIAL,
-    JOIN,
-    EXIT,
-    GROUP_MSG,
-    FILE_MSG,
-    FILE_DATA,
-    FILE_END,
-};
-struct MSG_header
-{
-    char sender_name[MAX_NAME];
-    MSG_type Type;
-    size_t length;
-};
-
-struct FileInfo
-{
-    char filename[MAX_FILENAME];
-    size_t file_size;
-};
-
-enum class ReadState
-{
-    ReadingHeader,
-    ReadingBody
-};
-
 struct MessageBuffer
 {
-    ReadState state = ReadState::ReadingHeader;
-    MSG_header current_header;
-    QByteArray buffer; // 累积 socket 缓冲区数据
+    QByteArray buffer; // 累积 socket 缓冲区数据,由WireCodec按协商的线格式拆分消息
 };
 
+class WireCodec;
+
 
-// 文件传输状态
+// 单个文件流的传输状态(发送和接收共用),同一时刻可以有多个文件流并发
 struct FileTransferState
 {
-    bool is_receiving = false;
+    quint32 stream_id = 0;
     bool is_sending = false;
-    bool abort = false; // 新增：是否取消发送
-    QString filename;
+    bool awaiting_accept = false; // 发送:已发送FILE_MSG,等待服务器回复FILE_ACCEPT/FILE_EXISTS
+    bool declined = false;        // 接收:用户拒绝接收,后续数据直接丢弃
+    bool finished = false;        // 接收:已收到FILE_END,等待用户选择保存位置
+    QString filename;             // 发送:本地文件路径; 接收:对方给出的文件名
     QString sender_name;
+    QString save_path;            // 接收:保存路径,为空表示用户尚未决定
     size_t total_size = 0;
-    size_t received_bytes = 0;
-    size_t sent_bytes = 0;
-    QFile* file = nullptr;
+    size_t transferred_bytes = 0;
+    quint64 credit = 0;           // 发送:服务器授予的剩余可发送字节数
+    quint32 codec = 0;            // 分片压缩算法(FILE_FLAG_COMPRESS_*),0表示不压缩
+    quint64 content_hash = 0;     // 接收:发送方给出的整文件哈希,0表示未提供
+    XXHash64 hasher;              // 接收:对写入的数据增量计算哈希
+    QFile* file = nullptr;        // 发送:源文件; 接收:先写入的临时文件
+    QWidget* row = nullptr;       // 传输面板中该文件流的一行
     QProgressBar* progress_bar = nullptr;
     QLabel* status_label = nullptr;
-    size_t chunks_received = 0;
 };
 
 class client_widget : public QWidget
@@ -90,7 +64,7 @@ class client_widget : public QWidget
     Q_OBJECT
 
 public:
-    client_widget(QWidget* parent = nullptr, QTcpSocket* Tcpsocket = nullptr);
+    client_widget(QWidget* parent = nullptr, QTcpSocket* Tcpsocket = nullptr, WireCodec* codec = nullptr);
     ~client_widget();
     void paintEvent(QPaintEvent*) override;
     void initialize(const QString& username);
@@ -101,34 +75,53 @@ private slots:
     void sendMsg();
     void sendFile();
     void onFileTransferTimeout();
+    void pumpFileStreams();
 
 private:
     void readMsg();
-    void handleFileMsg(const MSG_header& header,const FileInfo& file_info);
-    void handleFileData(const MSG_header& header,const QByteArray& data);
-    void handleFileEnd(const MSG_header& header);
-    void chunkedFileTransfer(QFile& file, const QString& filename);
-    void resetFileTransferState();
-    void updateFileProgress();
-    void showFileTransferDialog(const QString& message);
-    void hideFileTransferDialog();
     void dispatchMessage(const MSG_header& header, const QByteArray& body);
+    void writeMessage(MSG_type type, const QByteArray& body);
+
+    // 发送方向
+    void startFileUpload(const QString& file_path);
+    void handleFileAccept(quint32 stream_id);
+    void handleFileExists(quint32 stream_id);
+    void handleFileCredit(quint32 stream_id, quint64 credit_bytes);
+    void cancelFileUpload(FileTransferState* state);
+    quint64 hashFile(QFile& file, QByteArray& digest); // 返回XXH64,digest为SHA-256
+
+    // 接收方向
+    void handleFileMsg(const MSG_header& header, const FileInfo& file_info);
+    void handleFileData(const MSG_header& header, const QByteArray& body);
+    void handleFileEnd(const MSG_header& header, const QByteArray& body);
+    void finishIncomingFile(FileTransferState* state);
+    static QString incomingKey(const QString& sender, quint32 stream_id);
+
+    // 传输面板
+    void addTransferRow(FileTransferState* state, const QString& title);
+    void updateFileProgress(FileTransferState* state);
+    void removeTransfer(FileTransferState* state);
+    void hideFileTransferDialogIfIdle();
 
     QString user_name;
     QTcpSocket* tcpsocket;
+    WireCodec* wire_codec; // 登录时协商好的线格式,由登录对话框持有
+    quint64 acked_sequence = 0; // 已向服务器确认的聊天室序号
     Ui::client_widget* ui;
     QDateTime logintime;
     QTimer* timer;
     QTimer* file_timeout_timer;
 
-    FileTransferState file_state;
     MessageBuffer msg_buffer;
 
-    // 文件传输UI组件
+    QMap<quint32, FileTransferState*> outgoing_files;  // 本端发出的文件流: stream_id -> 状态
+    QHash<QString, FileTransferState*> incoming_files; // 接收的文件流: "发送者#stream_id" -> 状态
+    quint32 next_stream_id = 1;
+    bool pump_scheduled = false;
+
+    // 文件传输UI组件:所有文件流共用一个面板,每个流一行
     QWidget* file_dialog = nullptr;
-    QProgressBar* file_progress = nullptr;
-    QLabel* file_status = nullptr;
-    QPushButton* file_cancel_btn = nullptr;
+    QVBoxLayout* file_dialog_layout = nullptr;
 };
 
 #endif // CLIENT_WIDGET_H
@@ -0,0 +1,120 @@
+#include "file_codec.h"
+#include "client_widget.h"
+#include <lz4.h>
+#include <zstd.h>
+#include <cstring>
+
+// 采样大小:足以估计文本/日志类文件的压缩率,又不会明显拖慢发送前的准备
+static const qint64 SAMPLE_SIZE = 256 * 1024;
+// 小于该大小的文件压缩收益可以忽略
+static const qint64 MIN_COMPRESS_SIZE = 4 * 1024;
+// 采样压缩率高于该值视为已压缩数据(图片、视频、压缩包等),不再压缩
+static const double MIN_GAIN_RATIO = 0.9;
+// 采样压缩率低于该值视为文本类数据,改用压缩率更高的zstd
+static const double TEXT_RATIO = 0.5;
+static const int ZSTD_LEVEL = 3;
+// 单个分片解压后的上限,防止损坏的分片头导致超大内存分配
+static const quint32 MAX_RAW_CHUNK_SIZE = 64 * 1024 * 1024;
+
+static int lz4Compress(const QByteArray& raw, char* out, int capacity)
+{
+    return LZ4_compress_default(raw.constData(), out, raw.size(), capacity);
+}
+
+quint32 FileCodec::chooseCodec(QFile& file)
+{
+    if (file.size() < MIN_COMPRESS_SIZE)
+    {
+        return 0;
+    }
+
+    QByteArray sample = file.read(SAMPLE_SIZE);
+    file.seek(0);
+    if (sample.isEmpty())
+    {
+        return 0;
+    }
+
+    QByteArray out(LZ4_compressBound(sample.size()), Qt::Uninitialized);
+    int compressed = lz4Compress(sample, out.data(), out.size());
+    if (compressed <= 0)
+    {
+        return 0;
+    }
+
+    double ratio = static_cast<double>(compressed) / sample.size();
+    if (ratio > MIN_GAIN_RATIO)
+    {
+        return 0;
+    }
+    return ratio < TEXT_RATIO ? FILE_FLAG_COMPRESS_ZSTD : FILE_FLAG_COMPRESS_LZ4;
+}
+
+QByteArray FileCodec::encodeChunk(quint32 codec, const QByteArray& raw)
+{
+    FileChunkHeader chunk_header{static_cast<uint32_t>(raw.size())};
+    const int header_size = sizeof(FileChunkHeader);
+
+    size_t bound = codec == FILE_FLAG_COMPRESS_ZSTD ? ZSTD_compressBound(raw.size())
+                                                    : static_cast<size_t>(LZ4_compressBound(raw.size()));
+    QByteArray out(header_size + static_cast<int>(bound), Qt::Uninitialized);
+    memcpy(out.data(), &chunk_header, header_size);
+
+    size_t compressed = 0;
+    if (codec == FILE_FLAG_COMPRESS_ZSTD)
+    {
+        size_t result = ZSTD_compress(out.data() + header_size, bound, raw.constData(), raw.size(), ZSTD_LEVEL);
+        compressed = ZSTD_isError(result) ? 0 : result;
+    }
+    else
+    {
+        int result = lz4Compress(raw, out.data() + header_size, static_cast<int>(bound));
+        compressed = result > 0 ? static_cast<size_t>(result) : 0;
+    }
+
+    // 压缩失败或没有收益时原样存放,接收方据长度相等识别
+    if (compressed == 0 || compressed >= static_cast<size_t>(raw.size()))
+    {
+        out.resize(header_size);
+        out.append(raw);
+        return out;
+    }
+
+    out.resize(header_size + static_cast<int>(compressed));
+    return out;
+}
+
+bool FileCodec::decodeChunk(quint32 codec, const char* data, qint64 size, QByteArray& raw)
+{
+    if (size < static_cast<qint64>(sizeof(FileChunkHeader)))
+    {
+        return false;
+    }
+
+    FileChunkHeader chunk_header;
+    memcpy(&chunk_header, data, sizeof(chunk_header));
+    const char* payload = data + sizeof(FileChunkHeader);
+    qint64 payload_size = size - sizeof(FileChunkHeader);
+
+    if (chunk_header.raw_length > MAX_RAW_CHUNK_SIZE)
+    {
+        return false;
+    }
+
+    // 未压缩的分片
+    if (payload_size == chunk_header.raw_length)
+    {
+        raw = QByteArray(payload, static_cast<int>(payload_size));
+        return true;
+    }
+
+    raw.resize(static_cast<int>(chunk_header.raw_length));
+    if (codec == FILE_FLAG_COMPRESS_ZSTD)
+    {
+        size_t result = ZSTD_decompress(raw.data(), raw.size(), payload, static_cast<size_t>(payload_size));
+        return !ZSTD_isError(result) && result == chunk_header.raw_length;
+    }
+
+    int result = LZ4_decompress_safe(payload, raw.data(), static_cast<int>(payload_size), raw.size());
+    return result >= 0 && static_cast<quint32>(result) == chunk_header.raw_length;
+}
@@ -0,0 +1,23 @@
+#ifndef FILE_CODEC_H
+#define FILE_CODEC_H
+
+#include <QByteArray>
+#include <QFile>
+
+// 文件分片压缩(LZ4/zstd)
+// 发送方在FILE_MSG的flags中声明压缩算法并逐个分片压缩,服务器原样转发,接收方逐个分片解压
+// 每个分片独立压缩,接收方中途加入或分片交错到达都不影响解压
+namespace FileCodec
+{
+// 采样文件开头的数据估计压缩率并选择算法,返回FILE_FLAG_COMPRESS_*,不值得压缩时返回0
+// 调用后文件读取位置回到开头
+quint32 chooseCodec(QFile& file);
+
+// 压缩一个分片,返回FileChunkHeader加压缩数据;压缩无收益时原样存放
+QByteArray encodeChunk(quint32 codec, const QByteArray& raw);
+
+// 解码一个分片(FileChunkHeader加数据),数据损坏时返回false
+bool decodeChunk(quint32 codec, const char* data, qint64 size, QByteArray& raw);
+}
+
+#endif // FILE_CODEC_H
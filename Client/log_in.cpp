@@ -2,6 +2,10 @@
 #include "ui_log_in.h"
 
 #include <QCryptographicHash>
+#include <QTimer>
+
+// 等待服务器回复HELLO的时间,超时视为旧版服务器
+static const int HELLO_TIMEOUT_MS = 1500;
 
 log_in::log_in(QDialog *parent)
     : QDialog(parent)
@@ -12,11 +16,48 @@ log_in::log_in(QDialog *parent)
 
     connect(ui->loginButton, &QPushButton::clicked, this, &log_in::onLoginClicked);
     connect(ui->registerButton, &QPushButton::clicked, this, &log_in::onRegisterClicked);
+    connect(socket, &QTcpSocket::connected, this, &log_in::onSocketConnected);
     connect(socket, &QTcpSocket::readyRead, this, &log_in::onSocketReadyRead);
 
     connect(socket, QOverload<QAbstractSocket::SocketError>::of(&QTcpSocket::errorOccurred),
             this, &log_in::onSocketError);
 
+    setAuthEnabled(false);
+    socket->connectToHost("127.0.0.1", 1234);
+}
+
+void log_in::setAuthEnabled(bool enabled)
+{
+    ui->loginButton->setEnabled(enabled);
+    ui->registerButton->setEnabled(enabled);
+}
+
+void log_in::onSocketConnected()
+{
+    // 只在第一次连接时尝试v2;回退重连后直接使用旧版格式
+    if (helloAttempted)
+    {
+        setAuthEnabled(true);
+        return;
+    }
+
+    helloAttempted = true;
+    negotiating = true;
+    socket->write(WireCodec::helloFrame());
+    QTimer::singleShot(HELLO_TIMEOUT_MS, this, &log_in::onHelloTimeout);
+}
+
+void log_in::onHelloTimeout()
+{
+    if (!negotiating)
+        return;
+
+    // 旧版服务器会把HELLO当作消息头的一部分,连接已不可用,重新连接并使用旧版格式
+    qWarning() << "服务器未回复HELLO,使用旧版线格式";
+    negotiating = false;
+    readBuffer.clear();
+    wireCodec.setVersion(WIRE_VERSION_LEGACY);
+    socket->abort();
     socket->connectToHost("127.0.0.1", 1234);
 }
 
@@ -180,22 +221,10 @@ void log_in::sendAuthRequest(bool isLogin)
     QByteArray payload = encryptedHash;
 
 
-    // --- 4. 构造 header ---
-    MSG_header header{};
-    QByteArray nameBytes = username.toUtf8();
-    int copyLen = fmin(nameBytes.size(), MAX_NAMEBUFFER - 1);
-    memcpy(header.sender_name, nameBytes.constData(), copyLen);
-    header.sender_name[copyLen] = '\0';
-    header.Type = isLogin ? LOGIN : REGISTER;
-    header.length = payload.size();
-    // qDebug() << payload.size();
-
-    // --- 5. 合成数据包 ---
-    QByteArray finalPacket;
-    finalPacket.append(reinterpret_cast<const char*>(&header), sizeof(MSG_header));
-    finalPacket.append(payload);
+    // --- 4. 按协商的线格式组包 ---
+    QByteArray finalPacket = wireCodec.encode(isLogin ? LOGIN : REGISTER, username, payload);
 
-    // --- 6. 发送 ---
+    // --- 5. 发送 ---
     if (socket && socket->state() == QAbstractSocket::ConnectedState)
     {
         socket->write(finalPacket);
@@ -211,16 +240,33 @@ void log_in::sendAuthRequest(bool isLogin)
 
 
 
- void log_in::onSocketReadyRead()
-    {
-        // qDebug() << "log_in::onSocketReadyRead triggered";
+void log_in::onSocketReadyRead()
+{
+    // qDebug() << "log_in::onSocketReadyRead triggered";
 
-        QByteArray reply = socket->readAll();
+    readBuffer.append(socket->readAll());
 
-        if (reply.size() < sizeof(MSG_header)) return;
-        MSG_header replyheader;
-        memcpy(&replyheader, reply.data(), sizeof(MSG_header));
+    if (negotiating)
+    {
+        quint8 version = WIRE_VERSION_LEGACY;
+        int hello = decodeWireHello(reinterpret_cast<const unsigned char*>(readBuffer.constData()),
+                                    readBuffer.size(), version);
+        if (hello == 0)
+            return; // 等待更多数据
+
+        negotiating = false;
+        if (hello > 0)
+        {
+            readBuffer.remove(0, WIRE_HELLO_SIZE);
+            wireCodec.setVersion(version);
+        }
+        setAuthEnabled(true);
+    }
 
+    MSG_header replyheader;
+    QByteArray body;
+    while (wireCodec.decode(readBuffer, replyheader, body))
+    {
         switch (replyheader.Type)
         {
         case REGISTER_success:
@@ -237,7 +283,7 @@ void log_in::sendAuthRequest(bool isLogin)
             disconnect(socket, &QTcpSocket::readyRead, this, &log_in::onSocketReadyRead);
 
             accept();  // 关闭登录窗口，返回 QDialog::Accepted
-            break;
+            return;
         case LOGIN_failed:
             showMessage("登录失败，用户名或密码错误");
             break;
@@ -246,6 +292,7 @@ void log_in::sendAuthRequest(bool isLogin)
             break;
         }
     }
+}
 
 void log_in::showMessage(const QString& msg)
 {
@@ -12,6 +12,7 @@
 #include <QRegularExpression>
 #include <QDebug>
 #include "client_widget.h"
+#include "wire_codec.h"
 
 #define MAX_NAMEBUFFER 64
 
@@ -30,20 +31,31 @@ public:
 
     QTcpSocket* getsocket() const { return socket; }
     QString getname() const { return currentUsername; }
+    WireCodec* getcodec() { return &wireCodec; }
 
 private slots:
     void onLoginClicked();
     void onRegisterClicked();
+    void onSocketConnected();
     void onSocketReadyRead();
+    void onHelloTimeout();
     void onSocketError(QAbstractSocket::SocketError socketError);
 
 private:
     void sendAuthRequest(bool isLogin);
     void showMessage(const QString& msg);
 
+    void setAuthEnabled(bool enabled);
+
     QString currentUsername;
     Ui::log_in *ui;
     QTcpSocket* socket;
+
+    // 线格式协商:连接后先发送HELLO,服务器不支持时超时回退到旧版格式重新连接
+    WireCodec wireCodec;
+    QByteArray readBuffer;
+    bool negotiating = false;
+    bool helloAttempted = false;
 };
 
 #endif // LOG_IN_H
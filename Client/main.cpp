@@ -28,7 +28,7 @@ int main(int argc, char *argv[])
 
     if (loginDialog.exec() == QDialog::Accepted)
     {
-        client_widget client(nullptr, loginDialog.getsocket());
+        client_widget client(nullptr, loginDialog.getsocket(), loginDialog.getcodec());
         client.initialize(loginDialog.getname());
         client.show();
         return ChatRoom.exec(); // 登录成功，进入主窗口事件循环
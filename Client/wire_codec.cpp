@@ -0,0 +1,244 @@
+#include "wire_codec.h"
+#include <cstring>
+#include <algorithm>
+#include <QDebug>
+
+void WireCodec::setVersion(quint8 version)
+{
+    version_ = version;
+    user_names_.clear();
+    roster_epoch_ = 0;
+}
+
+QByteArray WireCodec::helloFrame()
+{
+    QByteArray hello(WIRE_HELLO_SIZE, Qt::Uninitialized);
+    encodeWireHello(reinterpret_cast<unsigned char*>(hello.data()), WIRE_VERSION_V3);
+    return hello;
+}
+
+QByteArray WireCodec::encode(MSG_type type, const QString& sender_name, const QByteArray& body) const
+{
+    QByteArray packet;
+
+    if (version_ == WIRE_VERSION_LEGACY)
+    {
+        packet.resize(static_cast<int>(sizeof(MSG_header)) + body.size());
+        schema::encodeText(packet.data(), type, sender_name.toUtf8().constData(), body.constData(), body.size());
+        return packet;
+    }
+
+    // 尚未分配用户ID的消息在消息体开头携带用户名
+    QByteArray name_prefix;
+    if (type == LOGIN || type == REGISTER || type == JOIN)
+    {
+        QByteArray name = sender_name.toUtf8().left(WIRE_V2_MAX_NAME_SIZE);
+        name_prefix.append(static_cast<char>(name.size()));
+        name_prefix.append(name);
+    }
+    // JOIN的消息体为本地用户表的版本,服务器回复ROSTER
+    if (type == JOIN)
+    {
+        name_prefix.append(reinterpret_cast<const char*>(&roster_epoch_), sizeof(roster_epoch_));
+    }
+
+    // 发送者ID由服务器填写,客户端发出的帧置0
+    WireHeaderV2 header{};
+    header.type = static_cast<uint8_t>(type);
+    header.length = name_prefix.size() + body.size();
+
+    unsigned char header_bytes[WIRE_V2_MAX_HEADER_SIZE];
+    size_t header_size = encodeWireHeaderV2(header_bytes, header);
+
+    packet.reserve(static_cast<int>(header_size) + name_prefix.size() + body.size());
+    packet.append(reinterpret_cast<const char*>(header_bytes), static_cast<int>(header_size));
+    packet.append(name_prefix);
+    packet.append(body);
+    return packet;
+}
+
+bool WireCodec::decode(QByteArray& buffer, MSG_header& header, QByteArray& body)
+{
+    if (version_ == WIRE_VERSION_LEGACY)
+    {
+        if (buffer.size() < static_cast<int>(sizeof(MSG_header)))
+            return false; // 等待更多数据
+
+        schema::decodeHeader(buffer.constData(), header);
+        int body_len = static_cast<int>(header.length);
+        if (buffer.size() - static_cast<int>(sizeof(MSG_header)) < body_len)
+            return false;
+
+        body = buffer.mid(sizeof(MSG_header), body_len);
+        buffer.remove(0, sizeof(MSG_header) + body_len);
+        return true;
+    }
+
+    WireHeaderV2 v2;
+    int header_size = decodeWireHeaderV2(reinterpret_cast<const unsigned char*>(buffer.constData()), buffer.size(), v2);
+    if (header_size < 0)
+    {
+        qWarning() << "收到格式错误的消息头";
+        buffer.clear();
+        return false;
+    }
+    if (header_size == 0 || static_cast<quint64>(buffer.size() - header_size) < v2.length)
+        return false; // 等待更多数据
+
+    body = buffer.mid(header_size, static_cast<int>(v2.length));
+    buffer.remove(0, header_size + static_cast<int>(v2.length));
+
+    memset(&header, 0, sizeof(header));
+    header.Type = static_cast<MSG_type>(v2.type);
+    if (v2.flags & WIRE_FLAG_SEQUENCE)
+        noteSequence(v2.sequence);
+    translateV2(v2, header, body);
+    header.length = body.size();
+    return true;
+}
+
+void WireCodec::translateV2(const WireHeaderV2& v2, MSG_header& header, QByteArray& body)
+{
+    const quint32 sender_id = v2.sender_id;
+    QString sender_name;
+
+    switch (header.Type)
+    {
+    case INITIAL:
+    {
+        // "ID:用户名"列表还原为用户名列表
+        QStringList names;
+        const QStringList entries = QString::fromUtf8(body).split(',', Qt::SkipEmptyParts);
+        for (const QString& entry : entries)
+        {
+            int colon = entry.indexOf(':');
+            QString name = entry.mid(colon + 1);
+            if (colon > 0)
+                user_names_.insert(entry.left(colon).toUInt(), name);
+            names.append(name);
+        }
+        body = names.join(',').toUtf8();
+        sender_name = "SERVER";
+        break;
+    }
+    case ROSTER:
+        applyRoster(header, body);
+        return;
+    case ACK:
+    case RESUME:
+    {
+        // ACK:自己发出的消息分配到的序号; RESUME:服务器补发起点之前的序号,大于请求的序号时中间的消息已丢失
+        SequenceInfo info;
+        if (schema::decode<ACK>(body.constData(), body.size(), info))
+        {
+            if (header.Type == ACK)
+                noteSequence(info.sequence);
+            else
+            {
+                if (last_sequence_ != 0 && info.sequence > last_sequence_)
+                    qWarning() << "重连期间有" << info.sequence - last_sequence_ << "条聊天室消息无法补发";
+                last_sequence_ = info.sequence;
+            }
+        }
+        sender_name = "SERVER";
+        break;
+    }
+    case ROOM_JOIN:
+        // 切换了聊天室,新聊天室的序号与之前的无关,随后的RESUME给出新的起点
+        last_sequence_ = 0;
+        sender_name = "SERVER";
+        break;
+    case ROOM_LEAVE:
+    case ROOM_LIST:
+    case DIRECT_FAILED:
+    case JOIN_failed:
+        sender_name = "SERVER";
+        break;
+    case JOIN:
+        sender_name = QString::fromUtf8(body);
+        if (sender_id != 0)
+            user_names_.insert(sender_id, sender_name);
+        body.clear();
+        break;
+    case EXIT:
+        // 服务器在退出消息发出后才回收ID,帧头中的ID仍指向退出的用户;旧服务器发来的ID为0时按名称查找
+        sender_name = QString::fromUtf8(body);
+        if (sender_id != 0)
+        {
+            user_names_.remove(sender_id);
+            body.clear();
+            break;
+        }
+        for (auto it = user_names_.begin(); it != user_names_.end(); ++it)
+        {
+            if (it.value() == sender_name)
+            {
+                user_names_.erase(it);
+                break;
+            }
+        }
+        body.clear();
+        break;
+    default:
+        // 补发的历史消息和离线消息在帧头中直接携带用户名,发送者可能已下线,不查本地用户表
+        if (v2.flags & WIRE_FLAG_SENDER_NAME)
+            sender_name = QString::fromUtf8(v2.sender_name, v2.sender_name_size);
+        else
+            sender_name = sender_id == 0 ? QString() : user_names_.value(sender_id);
+        break;
+    }
+
+    std::strncpy(header.sender_name, sender_name.toUtf8().constData(), sizeof(header.sender_name) - 1);
+}
+
+void WireCodec::applyRoster(MSG_header& header, QByteArray& body)
+{
+    std::strncpy(header.sender_name, "SERVER", sizeof(header.sender_name) - 1);
+
+    // 快照的第一页先清空本地用户表,增量页直接按顺序合并
+    RosterHeader roster;
+    if (body.size() >= static_cast<int>(sizeof(roster)))
+    {
+        memcpy(&roster, body.constData(), sizeof(roster));
+        if (roster.flags & ROSTER_FLAG_RESET)
+            user_names_.clear();
+    }
+    bool ok = schema::forEachRosterEntry(body.constData(), static_cast<size_t>(body.size()), roster,
+                                         [this](quint32 user_id, quint8 op, const char* name, size_t name_length)
+                                         {
+                                             if (op == ROSTER_OP_JOIN)
+                                                 user_names_.insert(user_id, QString::fromUtf8(name, static_cast<int>(name_length)));
+                                             else
+                                                 user_names_.remove(user_id);
+                                         });
+    if (!ok)
+    {
+        // 无法确定本地用户表是否完整,下次JOIN时请求完整快照
+        qWarning() << "收到格式错误的ROSTER";
+        roster_epoch_ = 0;
+        body.clear();
+        return;
+    }
+    roster_epoch_ = roster.epoch;
+    if (roster.flags & ROSTER_FLAG_MORE)
+    {
+        body.clear();
+        return;
+    }
+
+    // 最后一页:按用户ID顺序生成完整的用户名列表
+    QList<quint32> ids = user_names_.keys();
+    std::sort(ids.begin(), ids.end());
+    QStringList names;
+    for (quint32 id : ids)
+        names.append(user_names_.value(id));
+    header.Type = INITIAL;
+    body = names.join(',').toUtf8();
+}
+
+void WireCodec::noteSequence(quint64 sequence)
+{
+    if (last_sequence_ != 0 && sequence != last_sequence_ + 1)
+        qWarning() << "聊天室序号不连续:" << last_sequence_ << "->" << sequence;
+    last_sequence_ = sequence;
+}
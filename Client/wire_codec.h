@@ -0,0 +1,45 @@
+#ifndef WIRE_CODEC_H
+#define WIRE_CODEC_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QString>
+#include "client_widget.h"
+
+// 客户端线格式编解码
+// 登录对话框完成版本协商后交给聊天窗口继续使用;v2下维护用户ID到用户名的映射,
+// 对上层统一提供带用户名的MSG_header,消息派发逻辑无需关心线格式版本
+class WireCodec
+{
+public:
+    quint8 version() const { return version_; }
+    void setVersion(quint8 version);
+
+    // 连接后发送的握手帧
+    static QByteArray helloFrame();
+
+    QByteArray encode(MSG_type type, const QString& sender_name, const QByteArray& body) const;
+
+    // 从buffer开头解析一条完整消息并将其移除;数据不足返回false
+    // 格式错误时清空buffer并返回false
+    bool decode(QByteArray& buffer, MSG_header& header, QByteArray& body);
+
+    // 已收到的最新聊天室序号(v2下JOIN之前发送RESUME后,服务器在帧头中携带序号),0表示尚未收到
+    quint64 lastSequence() const { return last_sequence_; }
+
+private:
+    // v2下JOIN/EXIT/INITIAL/ROSTER携带用户名,据此维护ID映射,并还原为旧版格式的消息体
+    // 其余消息的发送者取帧头携带的用户名,没有时按发送者ID查映射
+    void translateV2(const WireHeaderV2& v2, MSG_header& header, QByteArray& body);
+    // 合并ROSTER的一页;最后一页合并后转换为完整用户名列表的INITIAL
+    void applyRoster(MSG_header& header, QByteArray& body);
+    // 记录收到的聊天室序号,不连续时说明有消息丢失
+    void noteSequence(quint64 sequence);
+
+    quint8 version_ = WIRE_VERSION_LEGACY;
+    QHash<quint32, QString> user_names_;
+    quint64 roster_epoch_ = 0; // user_names_对应的用户表版本,JOIN时发给服务器以只接收增量
+    quint64 last_sequence_ = 0;
+};
+
+#endif // WIRE_CODEC_H